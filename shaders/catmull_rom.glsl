@@ -0,0 +1,41 @@
+// A Catmull-Rom filter, sharper than bilinear, done as nine bilinear
+// fetches rather than sixteen texel fetches: in each direction the middle
+// two of the four texels come from one fetch, placed between them by their
+// weights. For upscale.frag and temporal_resolve.comp.
+//
+// position is in texels. The fetches are kept between low and high, half
+// a texel inside the part of the image that's worth reading.
+
+vec3 catmullRomFetch(sampler2D image, vec2 position, vec2 low, vec2 high) {
+    return textureLod(image, clamp(position, low, high) / vec2(textureSize(image, 0)), 0.0).rgb;
+}
+
+vec3 catmullRom(sampler2D image, vec2 position, vec2 low, vec2 high) {
+
+    // The texel centre at or before position, and how far past it we are
+    vec2 center = floor(position - 0.5) + 0.5;
+    vec2 f = position - center;
+
+    // Catmull-Rom weights for the texels at center - 1 up to center + 2
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+    vec2 w12 = w1 + w2;
+    vec2 p0 = center - 1.0;
+    vec2 p12 = center + w2 / w12;
+    vec2 p3 = center + 2.0;
+
+    vec3 color = vec3(0.0);
+    vec2 ps[3] = vec2[](p0, p12, p3);
+    vec2 ws[3] = vec2[](w0, w12, w3);
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 3; x++) {
+            color += catmullRomFetch(image, vec2(ps[x].x, ps[y].y), low, high) * ws[x].x * ws[y].y;
+        }
+    }
+
+    // The negative lobes can overshoot below zero next to a hard edge
+    return max(color, vec3(0.0));
+}
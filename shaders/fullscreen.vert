@@ -0,0 +1,15 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// One triangle big enough to cover the whole viewport, for the passes that
+// draw an image rather than any geometry. No vertex buffer, the corners
+// come from gl_VertexIndex: (-1, -1), (3, -1) and (-1, 3).
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    vec2 corner = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,174 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// shader.frag with clustered lighting (--lights), see
+// src/clustered_lighting.h. Each pixel finds its cell in the froxel grid
+// and only loops over the lights light_bin.comp put in that cell.
+//
+// Built a second time with SHADOWS defined for --shadows, when spot lights
+// with a tile in the shadow atlas (see src/shadow_atlas.h) are shadowed.
+// Either way it's built again with TEMPORAL defined for --temporal-upscale,
+// when it passes shader.vert's motion vectors on like shader.frag does.
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in float viewDepth;
+
+layout(location = 0) out vec4 outColor;
+
+#ifdef TEMPORAL
+layout(location = 2) in vec2 motion;
+layout(location = 1) out vec2 outMotion;
+#endif
+
+struct Light {
+    vec4 positionRadius;
+    vec4 colorType;             // w is 0 for a point light, 1 for a spot
+    vec4 directionCosAngle;
+};
+
+layout(std430, binding = 0) readonly buffer Lights {
+    uint count;
+    Light lights[];
+} lights;
+
+layout(std430, binding = 1) readonly buffer ClusterCounts {
+    uint counts[];
+} clusters;
+
+layout(std430, binding = 2) readonly buffer ClusterLights {
+    uint indices[];
+} clusterLights;
+
+#ifdef SHADOWS
+struct Shadow {
+    mat4 viewProjection;
+    vec4 atlasRect;             // Offset and scale, in UV
+};
+
+layout(std430, binding = 3) readonly buffer Shadows {
+    Shadow shadows[];
+} shadows;
+
+// For each light, which of the shadows is its, or -1
+layout(std430, binding = 4) readonly buffer ShadowIndices {
+    int indices[];
+} shadowIndices;
+
+layout(binding = 5) uniform sampler2DShadow shadowAtlas;
+#endif
+
+layout(push_constant) uniform Screen {
+    vec2 size;
+} screen;
+
+// Keep these in step with clustered_lighting.h
+const uint CLUSTERS_X = 16;
+const uint CLUSTERS_Y = 9;
+const uint CLUSTERS_Z = 24;
+const uint MAX_LIGHTS_PER_CLUSTER = 128;
+const float NEAR_Z = 0.5;
+const float FAR_Z = 20.0;
+const float TAN_HALF_FOV_Y = 0.5;
+
+const vec3 AMBIENT = vec3(0.05);
+
+#ifdef SHADOWS
+// How much of the light gets to position, 0 in shadow and 1 out of it. The
+// sampler does the depth test, on the four nearest texels, and blends the
+// results so the shadow's edges are soft.
+float shadowFactor(uint lightIndex, vec3 position) {
+
+    int index = shadowIndices.indices[lightIndex];
+    if (index < 0) {
+        return 1.0;
+    }
+
+    Shadow shadow = shadows.shadows[index];
+
+    vec4 clip = shadow.viewProjection * vec4(position, 1.0);
+    if (clip.w <= 0.0) {
+        return 1.0;
+    }
+
+    vec3 ndc = clip.xyz / clip.w;
+    if (any(greaterThan(abs(ndc.xy), vec2(1.0))) || ndc.z > 1.0) {
+        return 1.0;
+    }
+
+    // Half a texel in from the tile's edges, so the filtering can't reach
+    // into the next tile over
+    vec2 halfTexel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+    vec2 uv = shadow.atlasRect.xy + (ndc.xy * 0.5 + 0.5) * shadow.atlasRect.zw;
+    uv = clamp(uv, shadow.atlasRect.xy + halfTexel, shadow.atlasRect.xy + shadow.atlasRect.zw - halfTexel);
+
+    return texture(shadowAtlas, vec3(uv, ndc.z));
+}
+#endif
+
+void main() {
+
+    // Where this pixel is in view space, it's on the ray through the
+    // pixel at the depth the vertex shader gave us
+    vec2 ndc = gl_FragCoord.xy / screen.size * 2.0 - 1.0;
+    vec2 tanHalfFov = vec2(TAN_HALF_FOV_Y * screen.size.x / screen.size.y, TAN_HALF_FOV_Y);
+    vec3 position = vec3(ndc * tanHalfFov * viewDepth, viewDepth);
+
+    // The triangle is flat, so its normal is the same all over. Take
+    // whichever side faces the camera.
+    vec3 normal = normalize(cross(dFdx(position), dFdy(position)));
+    if (dot(normal, position) > 0.0) {
+        normal = -normal;
+    }
+
+    uvec2 tile = uvec2(clamp(floor((ndc * 0.5 + 0.5) * vec2(CLUSTERS_X, CLUSTERS_Y)),
+                             vec2(0.0), vec2(CLUSTERS_X - 1, CLUSTERS_Y - 1)));
+    float slice = log(viewDepth / NEAR_Z) / log(FAR_Z / NEAR_Z) * float(CLUSTERS_Z);
+    uint z = uint(clamp(slice, 0.0, float(CLUSTERS_Z - 1)));
+
+    uint cluster = (z * CLUSTERS_Y + tile.y) * CLUSTERS_X + tile.x;
+    uint count = min(clusters.counts[cluster], MAX_LIGHTS_PER_CLUSTER);
+
+    vec3 lighting = AMBIENT;
+
+    for (uint i = 0; i < count; i++) {
+
+        uint lightIndex = clusterLights.indices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
+        Light light = lights.lights[lightIndex];
+
+        vec3 toLight = light.positionRadius.xyz - position;
+        float distanceSquared = dot(toLight, toLight);
+        float radius = light.positionRadius.w;
+
+        // The cell is bigger than the pixel, plenty of its lights won't
+        // reach this far
+        if (distanceSquared >= radius * radius) {
+            continue;
+        }
+
+        float distance = sqrt(distanceSquared);
+        vec3 direction = toLight / distance;
+
+        // Inverse square, windowed so it reaches exactly zero at the radius
+        float window = clamp(1.0 - pow(distance / radius, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (1.0 + distanceSquared);
+
+        if (light.colorType.w > 0.5) {
+            float cosOuter = light.directionCosAngle.w;
+            float cosInner = mix(cosOuter, 1.0, 0.2);
+            attenuation *= smoothstep(cosOuter, cosInner, dot(-direction, light.directionCosAngle.xyz));
+
+#ifdef SHADOWS
+            if (attenuation > 0.0) {
+                attenuation *= shadowFactor(lightIndex, position);
+            }
+#endif
+        }
+
+        lighting += light.colorType.rgb * attenuation * max(dot(normal, direction), 0.0);
+    }
+
+    outColor = vec4(fragColor * lighting, 1.0);
+#ifdef TEMPORAL
+    outMotion = motion;
+#endif
+}
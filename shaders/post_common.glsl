@@ -0,0 +1,68 @@
+// What the post processing kernels share, see src/post_process.h. Each of
+// them is a 16x16 workgroup writing the image at binding 2, and takes its
+// size (and the blur's direction) as push constants.
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(push_constant) uniform Pass {
+    ivec2 size;
+    ivec2 direction;
+} post;
+
+// Keep these in step with post_process.h
+const int TILE = 16;
+const int BLOOM_RADIUS = 4;
+const int FXAA_SEARCH_STEPS = 4;
+
+// A gaussian with a sigma of 2 texels, from the middle out
+const float BLOOM_WEIGHTS[BLOOM_RADIUS + 1] = float[](0.2042, 0.1802, 0.1238, 0.0663, 0.0276);
+
+// Anything brighter than this blooms, with a soft knee below it
+const float BLOOM_THRESHOLD = 1.0;
+const float BLOOM_KNEE = 0.5;
+const float BLOOM_STRENGTH = 0.3;
+
+bool outside(ivec2 p) {
+    return any(greaterThanEqual(p, post.size));
+}
+
+float luma(vec3 color) {
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+// The part of a colour bright enough to bloom
+vec3 brightPass(vec3 color) {
+    float brightness = max(color.r, max(color.g, color.b));
+    float soft = clamp(brightness - BLOOM_THRESHOLD + BLOOM_KNEE, 0.0, 2.0 * BLOOM_KNEE);
+    soft = soft * soft / (4.0 * BLOOM_KNEE + 1e-4);
+    return color * max(soft, brightness - BLOOM_THRESHOLD) / max(brightness, 1e-4);
+}
+
+// The bloom image's texel p: the 2x2 scene texels under it, averaged by a
+// single bilinear fetch between them, through the bright pass. Off the edge
+// of the bloom image it's the nearest texel on it.
+vec3 bloomSource(sampler2D scene, ivec2 p, ivec2 bloomSize) {
+    p = clamp(p, ivec2(0), bloomSize - 1);
+    vec2 uv = (vec2(p) * 2.0 + 1.0) / vec2(textureSize(scene, 0));
+    return brightPass(textureLod(scene, uv, 0.0).rgb);
+}
+
+// The scene with the bloom added back, still HDR. The bloom image is half
+// the size, so it's upsampled with a bilinear fetch.
+vec3 composite(sampler2D scene, sampler2D bloom, ivec2 p) {
+    vec2 uv = (vec2(p) + 0.5) / vec2(textureSize(scene, 0));
+    return texelFetch(scene, p, 0).rgb + BLOOM_STRENGTH * textureLod(bloom, uv, 0.0).rgb;
+}
+
+// The ACES filmic curve, as fitted by Krzysztof Narkowicz
+vec3 tonemap(vec3 color) {
+    return clamp(color * (2.51 * color + 0.03) / (color * (2.43 * color + 0.59) + 0.14), 0.0, 1.0);
+}
+
+// A gentle grade: a little more contrast and saturation, a little warmer.
+// The result carries its luma in alpha, which is what FXAA looks at.
+vec4 grade(vec3 color) {
+    color = clamp(mix(vec3(0.5), color, 1.1), 0.0, 1.0);
+    color = clamp(mix(vec3(luma(color)), color, 1.15) * vec3(1.03, 1.0, 0.96), 0.0, 1.0);
+    return vec4(color, luma(color));
+}
@@ -0,0 +1,95 @@
+// FXAA, after Timothy Lottes' FXAA 3.11. Whoever includes this defines
+// fxaaFetch(p), the graded colour at texel p with its luma in alpha, and
+// fxaa() never asks for anything more than FXAA_SEARCH_STEPS texels away.
+// That's what lets post_resolve.comp keep the whole neighbourhood in
+// shared memory.
+//
+// Unlike the original the edge search works in whole texels, averaging
+// each one with its neighbour across the edge, rather than bilinear fetches
+// halfway between them.
+
+const float FXAA_EDGE_THRESHOLD = 0.125;
+const float FXAA_EDGE_THRESHOLD_MIN = 0.0312;
+const float FXAA_SUBPIXEL = 0.75;
+
+vec3 fxaa(ivec2 p) {
+
+    vec4 center = fxaaFetch(p);
+    float lumaM = center.a;
+    float lumaN = fxaaFetch(p + ivec2(0, -1)).a;
+    float lumaS = fxaaFetch(p + ivec2(0, 1)).a;
+    float lumaW = fxaaFetch(p + ivec2(-1, 0)).a;
+    float lumaE = fxaaFetch(p + ivec2(1, 0)).a;
+
+    // Not enough contrast to be an edge worth smoothing
+    float lumaMax = max(lumaM, max(max(lumaN, lumaS), max(lumaW, lumaE)));
+    float lumaMin = min(lumaM, min(min(lumaN, lumaS), min(lumaW, lumaE)));
+    float range = lumaMax - lumaMin;
+    if (range < max(FXAA_EDGE_THRESHOLD_MIN, lumaMax * FXAA_EDGE_THRESHOLD)) {
+        return center.rgb;
+    }
+
+    float lumaNW = fxaaFetch(p + ivec2(-1, -1)).a;
+    float lumaNE = fxaaFetch(p + ivec2(1, -1)).a;
+    float lumaSW = fxaaFetch(p + ivec2(-1, 1)).a;
+    float lumaSE = fxaaFetch(p + ivec2(1, 1)).a;
+
+    // Does the edge run across the screen (the luma changes going down) or
+    // down it?
+    float horizontal = abs(lumaNW + lumaSW - 2.0 * lumaW) + 2.0 * abs(lumaN + lumaS - 2.0 * lumaM)
+                     + abs(lumaNE + lumaSE - 2.0 * lumaE);
+    float vertical = abs(lumaNW + lumaNE - 2.0 * lumaN) + 2.0 * abs(lumaW + lumaE - 2.0 * lumaM)
+                   + abs(lumaSW + lumaSE - 2.0 * lumaS);
+    bool isHorizontal = horizontal >= vertical;
+
+    // And which side of this texel is it on? The one that's most different.
+    float luma1 = isHorizontal ? lumaN : lumaW;
+    float luma2 = isHorizontal ? lumaS : lumaE;
+    bool towards1 = abs(luma1 - lumaM) >= abs(luma2 - lumaM);
+    float gradient = 0.25 * max(abs(luma1 - lumaM), abs(luma2 - lumaM));
+    float lumaEdge = 0.5 * ((towards1 ? luma1 : luma2) + lumaM);
+
+    ivec2 across = isHorizontal ? ivec2(0, towards1 ? -1 : 1) : ivec2(towards1 ? -1 : 1, 0);
+    ivec2 along = isHorizontal ? ivec2(1, 0) : ivec2(0, 1);
+
+    // Walk along the edge both ways until it stops looking like this edge
+    float end1 = 0.0;
+    float end2 = 0.0;
+    int distance1 = FXAA_SEARCH_STEPS;
+    int distance2 = FXAA_SEARCH_STEPS;
+    bool done1 = false;
+    bool done2 = false;
+
+    for (int i = 1; i <= FXAA_SEARCH_STEPS; i++) {
+        if (!done1) {
+            ivec2 q = p - along * i;
+            end1 = 0.5 * (fxaaFetch(q).a + fxaaFetch(q + across).a) - lumaEdge;
+            done1 = abs(end1) >= gradient;
+            distance1 = i;
+        }
+        if (!done2) {
+            ivec2 q = p + along * i;
+            end2 = 0.5 * (fxaaFetch(q).a + fxaaFetch(q + across).a) - lumaEdge;
+            done2 = abs(end2) >= gradient;
+            distance2 = i;
+        }
+    }
+
+    // The nearer end decides how much to blend. Texels near an end blend
+    // the most, those in the middle of a long edge hardly at all, and if
+    // the luma at the end goes the same way as ours we're on the wrong
+    // side of the edge and leave it be.
+    bool nearer1 = distance1 < distance2;
+    float end = nearer1 ? end1 : end2;
+    float edgeBlend = 0.5 - float(min(distance1, distance2)) / float(distance1 + distance2);
+    if ((lumaM - lumaEdge < 0.0) == (end < 0.0)) {
+        edgeBlend = 0.0;
+    }
+
+    // Features too small to have an edge, single bright texels and the like
+    float average = (2.0 * (lumaN + lumaS + lumaW + lumaE) + lumaNW + lumaNE + lumaSW + lumaSE) / 12.0;
+    float subpixel = smoothstep(0.0, 1.0, clamp(abs(average - lumaM) / range, 0.0, 1.0));
+    float subpixelBlend = subpixel * subpixel * FXAA_SUBPIXEL;
+
+    return mix(center.rgb, fxaaFetch(p + across).rgb, max(edgeBlend, subpixelBlend));
+}
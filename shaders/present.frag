@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Puts the finished post processed image (see src/post_process.h) on the
+// output, a texel for each pixel.
+
+layout(binding = 0) uniform sampler2D image;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = vec4(texelFetch(image, ivec2(gl_FragCoord.xy), 0).rgb, 1.0);
+}
@@ -4,6 +4,16 @@
 layout(location = 0) out vec4 outColor;
 layout(location = 0) in vec3 fragColor;
 
+// With TEMPORAL defined (see shader.vert), the motion vectors go into an
+// attachment of their own
+#ifdef TEMPORAL
+layout(location = 2) in vec2 motion;
+layout(location = 1) out vec2 outMotion;
+#endif
+
 void main () {
     outColor = vec4(fragColor, 1.0);
+#ifdef TEMPORAL
+    outMotion = motion;
+#endif
 }
@@ -1,18 +1,42 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Built a second time with TEMPORAL defined for --temporal-upscale (see
+// src/temporal_upscale.h), when the triangle moves and is jittered by a
+// fraction of a pixel every frame, and tells the fragment shader how far
+// it moved.
+
 out gl_PerVertex {
     vec4 gl_Position;
 };
 
 layout(location = 0) out vec3 fragColor;
 
+// How far the corner is from the camera, only lit.frag uses it. The
+// triangle leans back, its base is further away than its tip.
+layout(location = 1) out float viewDepth;
+
+#ifdef TEMPORAL
+// Keep in step with TemporalUpscale::VertexConstants, the start of the
+// block is lit.frag's
+layout(push_constant) uniform Frame {
+    layout(offset = 16) vec2 jitter;
+    vec2 offset;
+    vec2 previousOffset;
+} frame;
+
+// How far the corner moved since the last frame, in UV, without the jitter
+layout(location = 2) out vec2 motion;
+#endif
+
 vec2 positions[3] = vec2[](
     vec2(0.0, -0.5),
     vec2(0.5, 0.5),
     vec2(-0.5, 0.5)
 );
 
+float depths[3] = float[](3.0, 6.0, 6.0);
+
 vec3 colors[3] = vec3[](
     vec3(1.0, 0.0, 0.0),
     vec3(0.0, 1.0, 0.0),
@@ -20,6 +44,14 @@ vec3 colors[3] = vec3[](
 );
 
 void main() {
+#ifdef TEMPORAL
+    vec2 position = positions[gl_VertexIndex] + frame.offset;
+    vec2 previousPosition = positions[gl_VertexIndex] + frame.previousOffset;
+    motion = (position - previousPosition) * 0.5;
+    gl_Position = vec4(position + frame.jitter, 0.0, 1.0);
+#else
     gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+#endif
     fragColor = colors[gl_VertexIndex];
+    viewDepth = depths[gl_VertexIndex];
 }
@@ -0,0 +1,20 @@
+#version 450
+
+// Draws shadow casters into a tile of the shadow atlas, see
+// src/shadow_atlas.h. There's no vertex input: the casters are triangles in
+// view space, pulled out of a storage buffer by gl_VertexIndex (the draw's
+// first vertex picks out static or dynamic ones), and the push constant
+// takes them into the light's clip space. No fragment shader either, depth
+// is all we're after.
+
+layout(std430, binding = 0) readonly buffer Casters {
+    vec4 corners[];
+} casters;
+
+layout(push_constant) uniform Light {
+    mat4 viewProjection;
+} light;
+
+void main() {
+    gl_Position = light.viewProjection * vec4(casters.corners[gl_VertexIndex].xyz, 1.0);
+}
@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+// Dynamic resolution's upscale (see src/dynamic_resolution.h), which
+// stretches the part of the scene image drawn this frame over the whole
+// output with a Catmull-Rom filter.
+
+layout(binding = 0) uniform sampler2D scene;
+
+layout(push_constant) uniform Upscale {
+    vec2 sceneSize;             // The part of the scene image drawn, in texels
+    vec2 outputSize;
+} upscale;
+
+layout(location = 0) out vec4 outColor;
+
+#include "catmull_rom.glsl"
+
+void main() {
+
+    // Beyond the part that was drawn is whatever a bigger frame left there
+    vec2 position = gl_FragCoord.xy / upscale.outputSize * upscale.sceneSize;
+    outColor = vec4(catmullRom(scene, position, vec2(0.5), upscale.sceneSize - 0.5), 1.0);
+}
@@ -0,0 +1,302 @@
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+/*
+ * Counts every heap allocation the program makes, by replacing the global
+ * operator new and delete, along with the driver's allocations reported by
+ * HostAllocator. Each allocation is charged to the subsystem the allocating
+ * thread is working for at the time and to the frame it happened in.
+ *
+ * The point is to keep drawFrame() free of allocations once it has warmed
+ * up. In strict mode any heap allocation made inside drawFrame() after the
+ * first few frames is recorded as a violation, and the regression harness
+ * fails a scene that has any.
+ *
+ * NOTE: this header defines the replacement operator new and delete, so it
+ * must only be included in one translation unit (main.cpp).
+ */
+class AllocationTracker {
+    public:
+        enum class Subsystem { Other, Startup, Frame, Readback, Writer, Count };
+
+        // Where the memory came from. Vulkan allocations served by the
+        // HostAllocator's pools and arena aren't heap allocations, but the
+        // driver still asked for memory so they are worth seeing.
+        enum class Source { Heap, Vulkan, Count };
+
+        static const size_t SUBSYSTEM_COUNT = (size_t) Subsystem::Count;
+        static const size_t SOURCE_COUNT = (size_t) Source::Count;
+
+        // How many frames to let drawFrame() warm up (fill its vectors and
+        // so on) before strict mode starts complaining
+        static const uint64_t WARMUP_FRAMES = 10;
+
+        // We keep the first few violations, without allocating of course
+        static const size_t MAX_RECORDED_VIOLATIONS = 16;
+
+        struct Violation {
+            uint64_t frame;
+            size_t size;
+            Source source;
+        };
+
+        /*
+         * Charges everything allocated on this thread to subsystem until it
+         * goes out of scope.
+         */
+        class Scope {
+            public:
+                explicit Scope(Subsystem subsystem) : previous(currentSubsystem) {
+                    currentSubsystem = subsystem;
+                }
+
+                ~Scope() {
+                    currentSubsystem = previous;
+                }
+
+                Scope(const Scope&) = delete;
+                Scope& operator=(const Scope&) = delete;
+
+            private:
+                Subsystem previous;
+        };
+
+        /*
+         * Marks the code that must not allocate (in strict mode) while in
+         * scope, also the start and end of a frame for the per frame counts.
+         * Only this thread's allocations count towards the frame, the writer,
+         * encoder and logging threads carry on allocating all the while.
+         */
+        class Frame {
+            public:
+                Frame() : scope(Subsystem::Frame) {
+                    hotPathAllocations = 0;
+                    inHotPath = true;
+                }
+
+                ~Frame() {
+                    inHotPath = false;
+                    endFrame(hotPathAllocations);
+                }
+
+                Frame(const Frame&) = delete;
+                Frame& operator=(const Frame&) = delete;
+
+            private:
+                Scope scope;
+        };
+
+        static void setThreadSubsystem(Subsystem subsystem) {
+            currentSubsystem = subsystem;
+        }
+
+        static void setStrict(bool enabled) {
+            strict = enabled;
+        }
+
+        /*
+         * Start warming up again, e.g. for a new App with empty vectors
+         */
+        static void restartWarmup() {
+            warmupRemaining = WARMUP_FRAMES;
+        }
+
+        static void record(Source source, size_t size) {
+
+            size_t subsystem = (size_t) currentSubsystem;
+            allocations[subsystem][(size_t) source].fetch_add(1, std::memory_order_relaxed);
+            bytes[subsystem][(size_t) source].fetch_add(size, std::memory_order_relaxed);
+
+            if (inHotPath && source == Source::Heap) {
+                hotPathAllocations++;
+                if (strict && warmupRemaining == 0) {
+                    recordViolation(size, source);
+                }
+            }
+        }
+
+        static void recordFree() {
+            frees.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /*
+         * The driver asked HostAllocator for memory, heap is true if that
+         * went to malloc rather than a pool or the arena.
+         */
+        static void recordVulkan(size_t size, bool heap) {
+            record(Source::Vulkan, size);
+
+            if (heap && inHotPath && strict && warmupRemaining == 0) {
+                recordViolation(size, Source::Vulkan);
+            }
+        }
+
+        static uint64_t getViolations() {
+            return violations;
+        }
+
+        static void resetViolations() {
+            violations = 0;
+        }
+
+        static const char* subsystemName(size_t subsystem) {
+            static const char* names[SUBSYSTEM_COUNT] = {"other", "startup", "frame", "readback", "writer"};
+            return subsystem < SUBSYSTEM_COUNT ? names[subsystem] : "unknown";
+        }
+
+        static void print(std::ostream& out) {
+
+            out << "Allocations by subsystem (heap / vulkan):\n";
+
+            for (size_t i = 0; i < SUBSYSTEM_COUNT; i++) {
+                out << "  " << subsystemName(i) << ": "
+                    << allocations[i][(size_t) Source::Heap] << " (" << bytes[i][(size_t) Source::Heap] << " bytes) / "
+                    << allocations[i][(size_t) Source::Vulkan] << " (" << bytes[i][(size_t) Source::Vulkan]
+                    << " bytes)\n";
+            }
+
+            uint64_t frameCount = frames;
+            out << "  " << frees << " frees, " << frameCount << " frames, "
+                << framesWithAllocations << " of them allocated, at most "
+                << maxFrameAllocations << " heap allocations in one frame";
+
+            if (frameCount > 0) {
+                out << ", " << (double) frameAllocations.load() / frameCount << " per frame";
+            }
+            out << "\n";
+
+            if (strict) {
+                out << "  strict mode: " << violations << " allocations in drawFrame() after warming up\n";
+
+                size_t recorded = violations < MAX_RECORDED_VIOLATIONS ? (size_t) violations
+                                                                       : MAX_RECORDED_VIOLATIONS;
+                for (size_t i = 0; i < recorded; i++) {
+                    out << "    frame " << recordedViolations[i].frame << ": "
+                        << recordedViolations[i].size << " bytes from "
+                        << (recordedViolations[i].source == Source::Heap ? "operator new" : "the driver")
+                        << "\n";
+                }
+            }
+
+            out << std::flush;
+        }
+
+    private:
+        static inline thread_local Subsystem currentSubsystem = Subsystem::Other;
+        static inline thread_local bool inHotPath = false;
+        static inline thread_local uint64_t hotPathAllocations = 0;
+        static inline std::atomic<bool> strict{false};
+
+        static inline std::atomic<uint64_t> allocations[SUBSYSTEM_COUNT][SOURCE_COUNT] = {};
+        static inline std::atomic<uint64_t> bytes[SUBSYSTEM_COUNT][SOURCE_COUNT] = {};
+        static inline std::atomic<uint64_t> frees{0};
+
+        // Per frame counts, only ever updated from the thread calling
+        // drawFrame()
+        static inline std::atomic<uint64_t> frames{0};
+        static inline std::atomic<uint64_t> warmupRemaining{WARMUP_FRAMES};
+        static inline std::atomic<uint64_t> framesWithAllocations{0};
+        static inline std::atomic<uint64_t> maxFrameAllocations{0};
+        static inline std::atomic<uint64_t> frameAllocations{0};
+
+        static inline std::atomic<uint64_t> violations{0};
+        static inline Violation recordedViolations[MAX_RECORDED_VIOLATIONS];
+
+        /*
+         * Frames can end on several threads at once (one for each render
+         * worker), so everything here is atomic.
+         */
+        static void endFrame(uint64_t allocated) {
+
+            frameAllocations.fetch_add(allocated, std::memory_order_relaxed);
+            if (allocated > 0) {
+                framesWithAllocations.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            uint64_t maximum = maxFrameAllocations.load(std::memory_order_relaxed);
+            while (allocated > maximum &&
+                   !maxFrameAllocations.compare_exchange_weak(maximum, allocated, std::memory_order_relaxed)) {
+            }
+
+            frames.fetch_add(1, std::memory_order_relaxed);
+
+            uint64_t remaining = warmupRemaining.load(std::memory_order_relaxed);
+            while (remaining > 0 &&
+                   !warmupRemaining.compare_exchange_weak(remaining, remaining - 1, std::memory_order_relaxed)) {
+            }
+        }
+
+        static void recordViolation(size_t size, Source source) {
+
+            uint64_t index = violations.fetch_add(1);
+            if (index < MAX_RECORDED_VIOLATIONS) {
+                recordedViolations[index] = {frames.load(std::memory_order_relaxed), size, source};
+            }
+        }
+};
+
+/*
+ * The replacements themselves. Each just counts and hands over to malloc.
+ */
+inline void* trackedAllocate(size_t size) {
+
+    AllocationTracker::record(AllocationTracker::Source::Heap, size);
+
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+inline void* trackedAllocateAligned(size_t size, std::align_val_t alignment) {
+
+    AllocationTracker::record(AllocationTracker::Source::Heap, size);
+
+    // aligned_alloc wants the size to be a multiple of the alignment
+    size_t align = (size_t) alignment;
+    void* memory = std::aligned_alloc(align, (size + align - 1) / align * align);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+inline void trackedFree(void* memory) {
+    if (memory != nullptr) {
+        AllocationTracker::recordFree();
+        std::free(memory);
+    }
+}
+
+void* operator new(size_t size) { return trackedAllocate(size); }
+void* operator new[](size_t size) { return trackedAllocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return trackedAllocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return trackedAllocateAligned(size, alignment); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try { return trackedAllocate(size); } catch (...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try { return trackedAllocate(size); } catch (...) { return nullptr; }
+}
+
+void operator delete(void* memory) noexcept { trackedFree(memory); }
+void operator delete[](void* memory) noexcept { trackedFree(memory); }
+void operator delete(void* memory, size_t) noexcept { trackedFree(memory); }
+void operator delete[](void* memory, size_t) noexcept { trackedFree(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { trackedFree(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { trackedFree(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { trackedFree(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { trackedFree(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { trackedFree(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { trackedFree(memory); }
+
+#endif
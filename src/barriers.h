@@ -0,0 +1,319 @@
+#ifndef BARRIERS_H
+#define BARRIERS_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "dispatch.h"
+
+/*
+ * One side of a barrier: the pipeline stages that do (or will do) the
+ * accesses, and the accesses themselves. These use the synchronization2
+ * flags, which are precise enough to say "the copy" rather than "any
+ * transfer" and have a NONE for "nothing to wait for".
+ */
+struct BarrierScope {
+    VkPipelineStageFlags2KHR stages;
+    VkAccessFlags2KHR access;
+};
+
+/*
+ * The scopes we use, named for what the image or buffer is being (or has
+ * been) used for.
+ */
+namespace Usage {
+    // Nothing, e.g. an image whose old contents we're about to throw away,
+    // or one being handed to the presentation engine
+    const BarrierScope None = {VK_PIPELINE_STAGE_2_NONE_KHR, VK_ACCESS_2_NONE_KHR};
+
+    // The swap chain image becomes available at the colour output stage
+    // (that's where we wait on the acquire semaphore), so writing it has
+    // to wait for that stage and nothing earlier
+    const BarrierScope AcquiredImage = {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, VK_ACCESS_2_NONE_KHR};
+
+    const BarrierScope ColorAttachmentWrite = {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+                                               VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR
+                                             | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR};
+
+    const BarrierScope CopySource = {VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR};
+    const BarrierScope CopyDestination = {VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR};
+
+    // Capture mode's YUV conversion reads the image through a sampler and
+    // writes the result into a storage buffer
+    const BarrierScope ComputeSampledRead = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+                                             VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR};
+    const BarrierScope ComputeStorageWrite = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+                                              VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR};
+
+    // The compute subsystem's kernels, which read and write storage buffers
+    // that the dispatch before them wrote
+    const BarrierScope ComputeStorageReadWrite = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+                                                  VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR
+                                                | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR};
+
+    // vkCmdFillBuffer counts as a clear rather than a copy
+    const BarrierScope FillDestination = {VK_PIPELINE_STAGE_2_CLEAR_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR};
+
+    // Clustered lighting's fragment shader reads the lights and clusters
+    const BarrierScope FragmentStorageRead = {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+                                              VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR};
+
+    // The shadow atlas is drawn into as a depth attachment, then sampled by
+    // lit.frag
+    const BarrierScope DepthAttachmentWrite = {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR
+                                             | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR,
+                                               VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR
+                                             | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR};
+    const BarrierScope FragmentSampledRead = {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+                                              VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR};
+
+    // Post processing's images are sampled by the next compute pass, or
+    // the last one by the present pass's fragment shader
+    const BarrierScope SampledRead = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR
+                                    | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+                                      VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR};
+
+    const BarrierScope HostRead = {VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_READ_BIT_KHR};
+}
+
+/*
+ * Collects the barriers needed at one point in a command buffer and emits
+ * them all in a single call, rather than one vkCmdPipelineBarrier per
+ * image or buffer.
+ *
+ * With VK_KHR_synchronization2 that's one vkCmdPipelineBarrier2KHR, where
+ * every barrier carries its own stages, so the GPU only waits for what each
+ * one actually needs. Without it we fall back to a single legacy
+ * vkCmdPipelineBarrier with the stages of all the barriers combined, which
+ * is still far better than the ALL_COMMANDS barrier that stalls the whole
+ * pipeline.
+ *
+ * The arrays are cleared rather than freed after each flush, so once warmed
+ * up recording barriers doesn't allocate.
+ */
+class BarrierBatch {
+    public:
+
+        void init(const DeviceDispatch& dispatch, bool useSynchronization2) {
+            this->dispatch = &dispatch;
+            this->synchronization2 = useSynchronization2;
+        }
+
+        bool usesSynchronization2() const {
+            return synchronization2;
+        }
+
+        /*
+         * Move an image from one layout to another, making whatever src did
+         * to it visible to dst.
+         */
+        void image(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                   BarrierScope src, BarrierScope dst,
+                   VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}) {
+
+            VkImageMemoryBarrier2KHR barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+            barrier.srcStageMask = src.stages;
+            barrier.srcAccessMask = src.access;
+            barrier.dstStageMask = dst.stages;
+            barrier.dstAccessMask = dst.access;
+            barrier.oldLayout = oldLayout;
+            barrier.newLayout = newLayout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = image;
+            barrier.subresourceRange = range;
+
+            imageBarriers.push_back(barrier);
+        }
+
+        void buffer(VkBuffer buffer, BarrierScope src, BarrierScope dst,
+                    VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE) {
+
+            VkBufferMemoryBarrier2KHR barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+            barrier.srcStageMask = src.stages;
+            barrier.srcAccessMask = src.access;
+            barrier.dstStageMask = dst.stages;
+            barrier.dstAccessMask = dst.access;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = buffer;
+            barrier.offset = offset;
+            barrier.size = size;
+
+            bufferBarriers.push_back(barrier);
+        }
+
+        /*
+         * Whatever src wrote to any memory, made visible to dst. Cheaper to
+         * record than a barrier for every buffer when one dispatch reads
+         * what the one before it wrote, and drivers treat them the same.
+         */
+        void memory(BarrierScope src, BarrierScope dst) {
+
+            VkMemoryBarrier2KHR barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+            barrier.srcStageMask = src.stages;
+            barrier.srcAccessMask = src.access;
+            barrier.dstStageMask = dst.stages;
+            barrier.dstAccessMask = dst.access;
+
+            memoryBarriers.push_back(barrier);
+        }
+
+        bool empty() const {
+            return memoryBarriers.empty() && imageBarriers.empty() && bufferBarriers.empty();
+        }
+
+        /*
+         * Record everything collected so far into commandBuffer
+         */
+        void flush(VkCommandBuffer commandBuffer) {
+
+            if (empty()) {
+                return;
+            }
+
+            if (synchronization2) {
+                VkDependencyInfoKHR dependencyInfo = {};
+                dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+                dependencyInfo.memoryBarrierCount = (uint32_t) memoryBarriers.size();
+                dependencyInfo.pMemoryBarriers = memoryBarriers.data();
+                dependencyInfo.bufferMemoryBarrierCount = (uint32_t) bufferBarriers.size();
+                dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+                dependencyInfo.imageMemoryBarrierCount = (uint32_t) imageBarriers.size();
+                dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+
+                dispatch->vkCmdPipelineBarrier2KHR(commandBuffer, &dependencyInfo);
+            } else {
+                flushLegacy(commandBuffer);
+            }
+
+            memoryBarriers.clear();
+            imageBarriers.clear();
+            bufferBarriers.clear();
+        }
+
+    private:
+        const DeviceDispatch* dispatch = nullptr;
+        bool synchronization2 = false;
+
+        std::vector<VkMemoryBarrier2KHR> memoryBarriers;
+        std::vector<VkImageMemoryBarrier2KHR> imageBarriers;
+        std::vector<VkBufferMemoryBarrier2KHR> bufferBarriers;
+
+        // Only used without synchronization2
+        std::vector<VkMemoryBarrier> legacyMemoryBarriers;
+        std::vector<VkImageMemoryBarrier> legacyImageBarriers;
+        std::vector<VkBufferMemoryBarrier> legacyBufferBarriers;
+
+        /*
+         * The synchronization2 flags are a superset of the old ones, the
+         * bits they share have the same values. The new, finer grained bits
+         * map on to the old stage or access they were split out of.
+         */
+        static VkPipelineStageFlags legacyStages(VkPipelineStageFlags2KHR stages, bool source) {
+
+            VkPipelineStageFlags legacy = (VkPipelineStageFlags) (stages & 0xffffffffull);
+
+            if (stages & (VK_PIPELINE_STAGE_2_COPY_BIT_KHR | VK_PIPELINE_STAGE_2_RESOLVE_BIT_KHR |
+                          VK_PIPELINE_STAGE_2_BLIT_BIT_KHR | VK_PIPELINE_STAGE_2_CLEAR_BIT_KHR)) {
+                legacy |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+            }
+
+            if (stages & (VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT_KHR |
+                          VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT_KHR)) {
+                legacy |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+            }
+
+            // NONE isn't allowed in the old API, the nearest is "the very
+            // start" for a source and "the very end" for a destination
+            if (legacy == 0) {
+                legacy = source ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            }
+
+            return legacy;
+        }
+
+        static VkAccessFlags legacyAccess(VkAccessFlags2KHR access) {
+
+            VkAccessFlags legacy = (VkAccessFlags) (access & 0xffffffffull);
+
+            if (access & (VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR | VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR)) {
+                legacy |= VK_ACCESS_SHADER_READ_BIT;
+            }
+
+            if (access & VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR) {
+                legacy |= VK_ACCESS_SHADER_WRITE_BIT;
+            }
+
+            return legacy;
+        }
+
+        /*
+         * The old API has one pair of stage masks for the whole call, so
+         * every barrier waits for all the source stages of the batch.
+         */
+        void flushLegacy(VkCommandBuffer commandBuffer) {
+
+            VkPipelineStageFlags2KHR srcStages = 0;
+            VkPipelineStageFlags2KHR dstStages = 0;
+
+            legacyMemoryBarriers.clear();
+            for (const auto& barrier : memoryBarriers) {
+                VkMemoryBarrier legacy = {};
+                legacy.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                legacy.srcAccessMask = legacyAccess(barrier.srcAccessMask);
+                legacy.dstAccessMask = legacyAccess(barrier.dstAccessMask);
+                legacyMemoryBarriers.push_back(legacy);
+
+                srcStages |= barrier.srcStageMask;
+                dstStages |= barrier.dstStageMask;
+            }
+
+            legacyImageBarriers.clear();
+            for (const auto& barrier : imageBarriers) {
+                VkImageMemoryBarrier legacy = {};
+                legacy.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                legacy.srcAccessMask = legacyAccess(barrier.srcAccessMask);
+                legacy.dstAccessMask = legacyAccess(barrier.dstAccessMask);
+                legacy.oldLayout = barrier.oldLayout;
+                legacy.newLayout = barrier.newLayout;
+                legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+                legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+                legacy.image = barrier.image;
+                legacy.subresourceRange = barrier.subresourceRange;
+                legacyImageBarriers.push_back(legacy);
+
+                srcStages |= barrier.srcStageMask;
+                dstStages |= barrier.dstStageMask;
+            }
+
+            legacyBufferBarriers.clear();
+            for (const auto& barrier : bufferBarriers) {
+                VkBufferMemoryBarrier legacy = {};
+                legacy.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                legacy.srcAccessMask = legacyAccess(barrier.srcAccessMask);
+                legacy.dstAccessMask = legacyAccess(barrier.dstAccessMask);
+                legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+                legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+                legacy.buffer = barrier.buffer;
+                legacy.offset = barrier.offset;
+                legacy.size = barrier.size;
+                legacyBufferBarriers.push_back(legacy);
+
+                srcStages |= barrier.srcStageMask;
+                dstStages |= barrier.dstStageMask;
+            }
+
+            dispatch->vkCmdPipelineBarrier(commandBuffer, legacyStages(srcStages, true), legacyStages(dstStages, false), 0,
+                                           (uint32_t) legacyMemoryBarriers.size(), legacyMemoryBarriers.data(),
+                                           (uint32_t) legacyBufferBarriers.size(), legacyBufferBarriers.data(),
+                                           (uint32_t) legacyImageBarriers.size(), legacyImageBarriers.data());
+        }
+};
+
+#endif
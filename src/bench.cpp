@@ -0,0 +1,324 @@
+/*
+ * Microbenchmarks for the expensive (and the frequent) things App does.
+ *
+ * The benchmarks need to poke at App's individual setup steps, so rather
+ * than split the class out of main.cpp we build main.cpp straight into this
+ * binary, minus its main(). Everything runs headless so it works on a
+ * software implementation (e.g. lavapipe) with no display, see the bench
+ * target in the Makefile.
+ */
+#define APP_NO_MAIN
+#include "main.cpp"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+/*
+ * App keeps its steps private, this friend class lets the benchmarks call
+ * them one at a time.
+ */
+class AppBench {
+    public:
+        static std::unique_ptr<App> create() {
+            AppOptions options;
+            options.headless = true;
+            return std::unique_ptr<App>(new App(options));
+        }
+
+        // Everything up to (but not including) the logical device
+        static void initInstance(App& app) {
+            app.createInstance();
+            app.setupDebugCallback();
+            app.pickPhysicalDevice();
+        }
+
+        // Everything up to (but not including) the graphics pipeline
+        static void initRenderPass(App& app) {
+            initInstance(app);
+            app.createLogicalDevice();
+            app.createOffscreenTargets();
+            app.createImageViews();
+            app.createRenderPass();
+        }
+
+        static void createInstance(App& app) { app.createInstance(); }
+        static void createLogicalDevice(App& app) { app.createLogicalDevice(); }
+        static void createGraphicsPipeline(App& app) { app.createGraphicsPipeline(); }
+
+        static void initCommandBuffers(App& app) {
+            initRenderPass(app);
+            app.createGraphicsPipeline();
+            app.createFrameBuffers();
+            app.createCommandPool();
+            app.createCommandBuffers();
+            app.createSemaphores();
+        }
+
+        // Throw away the command buffers so they can be recorded again
+        static void freeCommandBuffers(App& app) {
+            std::vector<VkCommandBuffer>& commandBuffers = app.outputs[0]->commandBuffers;
+            vkFreeCommandBuffers(app.device, app.commandPool,
+                                 (uint32_t) commandBuffers.size(), commandBuffers.data());
+            commandBuffers.clear();
+        }
+
+        static void createCommandBuffers(App& app) { app.createCommandBuffers(); }
+
+        static void submit(App& app) {
+            app.graphicsSubmit.add(app.outputs[0]->commandBuffers[0]);
+            app.graphicsSubmit.flush();
+        }
+
+        static void waitIdle(App& app) {
+            app.graphicsTimeline.wait(app.graphicsTimeline.lastPoint().value);
+        }
+
+        static VkDevice device(App& app) { return app.device; }
+        static const DeviceDispatch& dispatch(App& app) { return app.dispatch; }
+        static VkCommandPool commandPool(App& app) { return app.commandPool; }
+        static VkPipeline graphicsPipeline(App& app) { return app.graphicsPipeline; }
+        static const VDeleter<VkDevice>& deviceDeleter(App& app) { return app.device; }
+};
+
+static void BM_CreateInstance(benchmark::State& state) {
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto app = AppBench::create();
+        state.ResumeTiming();
+
+        AppBench::createInstance(*app);
+
+        // Tearing down doesn't count
+        state.PauseTiming();
+        app.reset();
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_CreateInstance)->Unit(benchmark::kMillisecond);
+
+static void BM_CreateLogicalDevice(benchmark::State& state) {
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto app = AppBench::create();
+        AppBench::initInstance(*app);
+        state.ResumeTiming();
+
+        AppBench::createLogicalDevice(*app);
+
+        state.PauseTiming();
+        app.reset();
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_CreateLogicalDevice)->Unit(benchmark::kMillisecond);
+
+static void BM_CreateGraphicsPipeline(benchmark::State& state) {
+
+    auto app = AppBench::create();
+    AppBench::initRenderPass(*app);
+
+    // Each call replaces (and so destroys) the previous pipeline, so that's
+    // included in the time too. The shaders are only read from disk on the
+    // first call, like they would be at startup.
+    for (auto _ : state) {
+        AppBench::createGraphicsPipeline(*app);
+    }
+}
+BENCHMARK(BM_CreateGraphicsPipeline)->Unit(benchmark::kMicrosecond);
+
+static void BM_RecordCommandBuffers(benchmark::State& state) {
+
+    auto app = AppBench::create();
+    AppBench::initCommandBuffers(*app);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        AppBench::freeCommandBuffers(*app);
+        state.ResumeTiming();
+
+        AppBench::createCommandBuffers(*app);
+    }
+}
+BENCHMARK(BM_RecordCommandBuffers)->Unit(benchmark::kMicrosecond);
+
+static void BM_Submit(benchmark::State& state) {
+
+    auto app = AppBench::create();
+    AppBench::initCommandBuffers(*app);
+
+    // Only the submit itself is timed, waiting for the GPU isn't
+    for (auto _ : state) {
+        AppBench::submit(*app);
+
+        state.PauseTiming();
+        AppBench::waitIdle(*app);
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_Submit)->Unit(benchmark::kMicrosecond);
+
+static void BM_SubmitAndWait(benchmark::State& state) {
+
+    auto app = AppBench::create();
+    AppBench::initCommandBuffers(*app);
+
+    for (auto _ : state) {
+        AppBench::submit(*app);
+        AppBench::waitIdle(*app);
+    }
+}
+BENCHMARK(BM_SubmitAndWait)->Unit(benchmark::kMicrosecond);
+
+/*
+ * The VDeleter benchmarks need a device but nothing else
+ */
+static std::unique_ptr<App> createDeviceOnly() {
+    auto app = AppBench::create();
+    AppBench::initInstance(*app);
+    AppBench::createLogicalDevice(*app);
+    return app;
+}
+
+static void BM_VDeleterEmpty(benchmark::State& state) {
+
+    auto app = createDeviceOnly();
+
+    // Just the cost of building the std::function and throwing it away
+    for (auto _ : state) {
+        VDeleter<VkSemaphore> semaphore{AppBench::deviceDeleter(*app), vkDestroySemaphore};
+        benchmark::DoNotOptimize(&semaphore);
+    }
+}
+BENCHMARK(BM_VDeleterEmpty);
+
+static void BM_VDeleterSemaphore(benchmark::State& state) {
+
+    auto app = createDeviceOnly();
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (auto _ : state) {
+        VDeleter<VkSemaphore> semaphore{AppBench::deviceDeleter(*app), vkDestroySemaphore};
+        vkCreateSemaphore(AppBench::device(*app), &semaphoreInfo, nullptr, &semaphore);
+    }
+}
+BENCHMARK(BM_VDeleterSemaphore);
+
+// The same again without VDeleter, for comparison
+static void BM_RawSemaphore(benchmark::State& state) {
+
+    auto app = createDeviceOnly();
+    VkDevice device = AppBench::device(*app);
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (auto _ : state) {
+        VkSemaphore semaphore;
+        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+        vkDestroySemaphore(device, semaphore, nullptr);
+    }
+}
+BENCHMARK(BM_RawSemaphore);
+
+/*
+ * The cost of a single call through the loader's trampoline against the
+ * same call straight into the driver through our dispatch table (see
+ * dispatch.h). Either way we call through a function pointer, for the
+ * loader it's the trampoline it exports.
+ */
+static void fenceStatus(benchmark::State& state, bool direct) {
+
+    auto app = createDeviceOnly();
+    VkDevice device = AppBench::device(*app);
+    PFN_vkGetFenceStatus getFenceStatus = direct ? AppBench::dispatch(*app).vkGetFenceStatus
+                                                 : vkGetFenceStatus;
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    VkFence fence;
+    vkCreateFence(device, &fenceInfo, nullptr, &fence);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(getFenceStatus(device, fence));
+    }
+
+    vkDestroyFence(device, fence, nullptr);
+}
+
+static void BM_GetFenceStatusLoader(benchmark::State& state) {
+    fenceStatus(state, false);
+}
+BENCHMARK(BM_GetFenceStatusLoader);
+
+static void BM_GetFenceStatusDispatch(benchmark::State& state) {
+    fenceStatus(state, true);
+}
+BENCHMARK(BM_GetFenceStatusDispatch);
+
+/*
+ * The same for recording, which is where most of our calls are. Each
+ * iteration records a buffer of BINDS_PER_BUFFER pipeline binds.
+ */
+static const int BINDS_PER_BUFFER = 1024;
+
+static void recordBinds(benchmark::State& state, bool direct) {
+
+    auto app = AppBench::create();
+    AppBench::initCommandBuffers(*app);
+
+    VkDevice device = AppBench::device(*app);
+    VkPipeline pipeline = AppBench::graphicsPipeline(*app);
+    PFN_vkCmdBindPipeline bindPipeline = direct ? AppBench::dispatch(*app).vkCmdBindPipeline
+                                                : vkCmdBindPipeline;
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = AppBench::commandPool(*app);
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        vkFreeCommandBuffers(device, allocInfo.commandPool, 1, &commandBuffer);
+        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        state.ResumeTiming();
+
+        for (int i = 0; i < BINDS_PER_BUFFER; i++) {
+            bindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        }
+
+        state.PauseTiming();
+        vkEndCommandBuffer(commandBuffer);
+        state.ResumeTiming();
+    }
+
+    vkFreeCommandBuffers(device, allocInfo.commandPool, 1, &commandBuffer);
+    state.SetItemsProcessed(state.iterations() * BINDS_PER_BUFFER);
+}
+
+static void BM_BindPipelineLoader(benchmark::State& state) {
+    recordBinds(state, false);
+}
+BENCHMARK(BM_BindPipelineLoader)->Unit(benchmark::kMicrosecond);
+
+static void BM_BindPipelineDispatch(benchmark::State& state) {
+    recordBinds(state, true);
+}
+BENCHMARK(BM_BindPipelineDispatch)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,126 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/*
+ * The CPU's half of clustered forward lighting (--lights), the GPU's is in
+ * shaders/light_bin.comp and shaders/lit.frag.
+ *
+ * The view frustum is cut into a grid of cells ("froxels"), CLUSTERS_X by
+ * CLUSTERS_Y tiles across the screen and CLUSTERS_Z slices deep. Slices get
+ * thicker with distance, so far away cells aren't long thin slivers. Each
+ * frame a compute pass works out which cells every light's sphere touches
+ * and appends the light to those cells' lists. A pixel then only has to
+ * look at the lights in its own cell rather than all of them, so the cost
+ * of shading follows how many lights are near it, not how many there are.
+ *
+ * Everything is in view space: the camera sits at the origin looking down
+ * +z, with +x to the right and +y down the screen like Vulkan's NDC.
+ *
+ * These numbers are repeated in the shaders, change them together.
+ */
+namespace ClusteredLighting {
+
+    const uint32_t CLUSTERS_X = 16;
+    const uint32_t CLUSTERS_Y = 9;
+    const uint32_t CLUSTERS_Z = 24;
+    const uint32_t CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+    // A cell's list stops growing here, lights past it are left out
+    const uint32_t MAX_LIGHTS_PER_CLUSTER = 128;
+
+    // The slices run from NEAR_Z to FAR_Z, anything outside lands in the
+    // first or last one
+    const float NEAR_Z = 0.5f;
+    const float FAR_Z = 20.0f;
+
+    // tan(fov / 2) vertically, horizontally it's that times the aspect
+    const float TAN_HALF_FOV_Y = 0.5f;
+
+    // The binning pass's workgroup size, one invocation a light
+    const uint32_t BIN_WORKGROUP_SIZE = 64;
+
+    // The light benchmark goes up to this many
+    const uint32_t MAX_LIGHTS = 100000;
+
+    /*
+     * One light, laid out as std430 sees it (three vec4s)
+     */
+    struct Light {
+        float position[3];
+        float radius;           // Nothing is lit beyond this distance
+
+        float color[3];         // Already multiplied by the intensity
+        float spot;             // 1 for a spot light, 0 for a point light
+
+        float direction[3];     // Spot lights only, which way the cone points
+        float cosOuterAngle;    // And how wide it is
+    };
+
+    /*
+     * The storage buffer the lights live in: the count, padded out to 16
+     * bytes, then the lights
+     */
+    struct LightBufferHeader {
+        uint32_t count;
+        uint32_t padding[3];
+    };
+
+    inline size_t lightBufferSize(uint32_t capacity) {
+        return sizeof(LightBufferHeader) + (size_t) capacity * sizeof(Light);
+    }
+
+    /*
+     * count lights spread through the box in front of the triangle, the
+     * same ones for the same count every time. A quarter are spot lights.
+     *
+     * The more lights there are the smaller they get, keeping about the
+     * same number reaching any one point. That's what a scene with lots
+     * of lights looks like (most of them are small), and it keeps the
+     * per-cell lists from overflowing.
+     */
+    inline std::vector<Light> generateLights(uint32_t count) {
+
+        std::mt19937 random(count);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        float radius = std::min(3.0f, 1.5f * std::cbrt(1000.0f / std::max(count, 1u)));
+
+        std::vector<Light> lights(count);
+        for (Light& light : lights) {
+
+            light.position[0] = -4.0f + 8.0f * unit(random);
+            light.position[1] = -3.0f + 6.0f * unit(random);
+            light.position[2] = 1.0f + 8.0f * unit(random);
+            light.radius = radius * (0.5f + unit(random));
+
+            // Bright, saturated colours, so overlapping lights are easy to
+            // tell apart
+            float hue = 6.0f * unit(random);
+            for (int channel = 0; channel < 3; channel++) {
+                float h = std::fmod(hue + 2.0f * channel, 6.0f);
+                light.color[channel] = 2.0f * std::min(std::max(std::abs(h - 3.0f) - 1.0f, 0.0f), 1.0f);
+            }
+
+            light.spot = unit(random) < 0.25f ? 1.0f : 0.0f;
+
+            // Spots point (roughly) away from the camera, at the triangle
+            float x = unit(random) - 0.5f;
+            float y = unit(random) - 0.5f;
+            float length = std::sqrt(x * x + y * y + 1.0f);
+            light.direction[0] = x / length;
+            light.direction[1] = y / length;
+            light.direction[2] = 1.0f / length;
+            light.cosOuterAngle = std::cos(0.3f + 0.5f * unit(random));
+        }
+
+        return lights;
+    }
+}
+
+#endif
@@ -0,0 +1,701 @@
+#ifndef COMPUTE_H
+#define COMPUTE_H
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "barriers.h"
+#include "debug_names.h"
+#include "device_caps.h"
+#include "dispatch.h"
+
+/*
+ * Compute work on the device and queue the renderer already set up, for
+ * data parallel jobs that have nothing to do with drawing.
+ *
+ * ComputeEngine looks after the Vulkan side: storage buffers, compute
+ * pipelines ("kernels"), and one command buffer of dispatches which can
+ * be recorded once and run as many times as we like, timed on the GPU.
+ * ComputeKernels builds reduce, scan, radix sort and SAXPY out of the
+ * shaders in shaders/.
+ *
+ * Nothing here is per frame, so it sticks to creating things up front and
+ * waiting for each run to finish.
+ */
+
+/*
+ * A storage buffer. Device local ones are for the kernels to work in,
+ * host visible ones stay mapped for the CPU.
+ */
+class ComputeBuffer {
+    public:
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+
+        ComputeBuffer(VkDevice device, const VkAllocationCallbacks* allocator)
+            : device(device), allocator(allocator) {}
+
+        ComputeBuffer(const ComputeBuffer&) = delete;
+        ComputeBuffer& operator=(const ComputeBuffer&) = delete;
+
+        ~ComputeBuffer() {
+            vkDestroyBuffer(device, buffer, allocator);
+            vkFreeMemory(device, memory, allocator);
+        }
+
+    private:
+        VkDevice device;
+        const VkAllocationCallbacks* allocator;
+};
+
+/*
+ * A compute pipeline whose bindings are all storage buffers (binding 0, 1,
+ * ...) and whose push constants are at most pushConstantSize bytes
+ */
+class ComputeKernel {
+    public:
+        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        uint32_t bindingCount = 0;
+        uint32_t pushConstantSize = 0;
+
+        ComputeKernel(VkDevice device, const VkAllocationCallbacks* allocator)
+            : device(device), allocator(allocator) {}
+
+        ComputeKernel(const ComputeKernel&) = delete;
+        ComputeKernel& operator=(const ComputeKernel&) = delete;
+
+        ~ComputeKernel() {
+            vkDestroyPipeline(device, pipeline, allocator);
+            vkDestroyPipelineLayout(device, layout, allocator);
+            vkDestroyDescriptorSetLayout(device, setLayout, allocator);
+        }
+
+    private:
+        VkDevice device;
+        const VkAllocationCallbacks* allocator;
+};
+
+class ComputeEngine {
+    public:
+
+        // All our kernels use workgroups of this many invocations
+        static const uint32_t WORKGROUP_SIZE = 256;
+
+        // The most bindings a kernel can have, and dispatches one recording
+        static const uint32_t MAX_BINDINGS = 4;
+        static const uint32_t MAX_DISPATCHES = 1024;
+
+        ComputeEngine(VkDevice device, const DeviceCapabilities& capabilities, uint32_t queueFamily,
+                      VkQueue queue, const DeviceDispatch& dispatch, bool synchronization2,
+                      const DebugNames& debugNames, const VkAllocationCallbacks* allocator)
+            : device(device), capabilities(capabilities), queue(queue), dispatch(dispatch),
+              debugNames(debugNames), allocator(allocator) {
+
+            if (!(capabilities.queueFamilies[queueFamily].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+                throw std::runtime_error("The queue can't run compute work!!");
+            }
+
+            barriers.init(dispatch, synchronization2);
+
+            VkCommandPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.queueFamilyIndex = queueFamily;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+            if (vkCreateCommandPool(device, &poolInfo, allocator, &commandPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the compute command pool!!");
+            }
+
+            // One for the work we time, one for getting data on and off
+            VkCommandBuffer buffers[2];
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 2;
+
+            if (vkAllocateCommandBuffers(device, &allocInfo, buffers) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the compute command buffers!!");
+            }
+            commandBuffer = buffers[0];
+            transferCommandBuffer = buffers[1];
+            debugNames.name(commandBuffer, "compute command buffer");
+            debugNames.name(transferCommandBuffer, "compute transfer command buffer");
+
+            VkFenceCreateInfo fenceInfo = {};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+            if (dispatch.vkCreateFence(device, &fenceInfo, allocator, &fence) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the compute fence!!");
+            }
+
+            VkDescriptorPoolSize poolSize = {};
+            poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            poolSize.descriptorCount = MAX_DISPATCHES * MAX_BINDINGS;
+
+            VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+            descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            descriptorPoolInfo.maxSets = MAX_DISPATCHES;
+            descriptorPoolInfo.poolSizeCount = 1;
+            descriptorPoolInfo.pPoolSizes = &poolSize;
+
+            if (vkCreateDescriptorPool(device, &descriptorPoolInfo, allocator, &descriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the compute descriptor pool!!");
+            }
+
+            // Time runs on the GPU where the queue can, otherwise we have to
+            // make do with the CPU's clock around the submit
+            timestampBits = capabilities.queueFamilies[queueFamily].timestampValidBits;
+            if (timestampBits > 0) {
+                VkQueryPoolCreateInfo queryInfo = {};
+                queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                queryInfo.queryCount = 2;
+
+                if (dispatch.vkCreateQueryPool(device, &queryInfo, allocator, &queryPool) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create the compute query pool!!");
+                }
+            }
+        }
+
+        ComputeEngine(const ComputeEngine&) = delete;
+        ComputeEngine& operator=(const ComputeEngine&) = delete;
+
+        ~ComputeEngine() {
+            dispatch.vkDestroyQueryPool(device, queryPool, allocator);
+            vkDestroyDescriptorPool(device, descriptorPool, allocator);
+            dispatch.vkDestroyFence(device, fence, allocator);
+            vkDestroyCommandPool(device, commandPool, allocator);
+        }
+
+        bool timesOnGpu() const {
+            return queryPool != VK_NULL_HANDLE;
+        }
+
+        /*
+         * How many workgroups to dispatch for items spread perGroup to a
+         * group. Our kernels stride over the grid, so when that's more than
+         * the device allows each group just does more.
+         */
+        uint32_t groupsFor(uint64_t items, uint64_t perGroup = WORKGROUP_SIZE) const {
+            uint64_t groups = (items + perGroup - 1) / perGroup;
+            uint64_t limit = capabilities.properties.limits.maxComputeWorkGroupCount[0];
+            return (uint32_t) std::max<uint64_t>(1, std::min(groups, limit));
+        }
+
+        std::unique_ptr<ComputeBuffer> createBuffer(VkDeviceSize size, bool hostVisible, const char* name) {
+
+            std::unique_ptr<ComputeBuffer> buffer(new ComputeBuffer(device, allocator));
+            buffer->size = size;
+
+            VkBufferCreateInfo bufferInfo = {};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = size;
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                             | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateBuffer(device, &bufferInfo, allocator, &buffer->buffer) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create a compute buffer!!");
+            }
+
+            VkMemoryRequirements requirements;
+            vkGetBufferMemoryRequirements(device, buffer->buffer, &requirements);
+
+            // The CPU reads back what the kernels wrote, so cached memory is
+            // worth having for that
+            VkMemoryAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = requirements.size;
+            allocInfo.memoryTypeIndex = hostVisible
+                ? findMemoryType(requirements.memoryTypeBits,
+                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                 VK_MEMORY_PROPERTY_HOST_CACHED_BIT)
+                : findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+
+            if (vkAllocateMemory(device, &allocInfo, allocator, &buffer->memory) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate compute buffer memory!!");
+            }
+
+            vkBindBufferMemory(device, buffer->buffer, buffer->memory, 0);
+
+            if (hostVisible && vkMapMemory(device, buffer->memory, 0, size, 0, &buffer->mapped) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to map a compute buffer!!");
+            }
+
+            debugNames.name(buffer->buffer, name);
+            return buffer;
+        }
+
+        std::unique_ptr<ComputeKernel> createKernel(const char* name, const std::vector<char>& code,
+                                                    uint32_t bindingCount, uint32_t pushConstantSize) {
+
+            if (bindingCount > MAX_BINDINGS) {
+                throw std::runtime_error(std::string("Too many bindings for kernel ") + name + "!!");
+            }
+
+            std::unique_ptr<ComputeKernel> kernel(new ComputeKernel(device, allocator));
+            kernel->bindingCount = bindingCount;
+            kernel->pushConstantSize = pushConstantSize;
+
+            VkDescriptorSetLayoutBinding bindings[MAX_BINDINGS] = {};
+            for (uint32_t i = 0; i < bindingCount; i++) {
+                bindings[i].binding = i;
+                bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[i].descriptorCount = 1;
+                bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            }
+
+            VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.bindingCount = bindingCount;
+            setLayoutInfo.pBindings = bindings;
+
+            if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, allocator, &kernel->setLayout) != VK_SUCCESS) {
+                throw std::runtime_error(std::string("Unable to create the descriptor set layout for ") + name + "!!");
+            }
+
+            VkPushConstantRange pushConstants = {};
+            pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstants.offset = 0;
+            pushConstants.size = pushConstantSize;
+
+            VkPipelineLayoutCreateInfo layoutInfo = {};
+            layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            layoutInfo.setLayoutCount = 1;
+            layoutInfo.pSetLayouts = &kernel->setLayout;
+            layoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+            layoutInfo.pPushConstantRanges = &pushConstants;
+
+            if (vkCreatePipelineLayout(device, &layoutInfo, allocator, &kernel->layout) != VK_SUCCESS) {
+                throw std::runtime_error(std::string("Unable to create the pipeline layout for ") + name + "!!");
+            }
+
+            VkShaderModuleCreateInfo moduleInfo = {};
+            moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            moduleInfo.codeSize = code.size();
+            moduleInfo.pCode = (const uint32_t*) code.data();
+
+            VkShaderModule module;
+            if (vkCreateShaderModule(device, &moduleInfo, allocator, &module) != VK_SUCCESS) {
+                throw std::runtime_error(std::string("Unable to create the shader module for ") + name + "!!");
+            }
+
+            VkComputePipelineCreateInfo pipelineInfo = {};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = module;
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.layout = kernel->layout;
+
+            VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator,
+                                                       &kernel->pipeline);
+
+            // The pipeline has what it needs from the module
+            vkDestroyShaderModule(device, module, allocator);
+
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error(std::string("Unable to create the pipeline for ") + name + "!!");
+            }
+
+            debugNames.name(kernel->pipeline, name);
+            return kernel;
+        }
+
+        /*
+         * Copy data into a buffer, through a staging buffer if the CPU can't
+         * see it. Waits for the copy to finish.
+         */
+        void upload(ComputeBuffer& buffer, const void* data, VkDeviceSize size) {
+
+            if (buffer.mapped != nullptr) {
+                memcpy(buffer.mapped, data, size);
+                return;
+            }
+
+            std::unique_ptr<ComputeBuffer> staging = createBuffer(size, true, "compute upload staging");
+            memcpy(staging->mapped, data, size);
+
+            transfer([&](VkCommandBuffer commandBuffer) {
+                VkBufferCopy region = {0, 0, size};
+                dispatch.vkCmdCopyBuffer(commandBuffer, staging->buffer, buffer.buffer, 1, &region);
+            });
+        }
+
+        /*
+         * And the other way, the kernels have to have finished with the
+         * buffer (run() waits for them)
+         */
+        void download(const ComputeBuffer& buffer, void* data, VkDeviceSize size) {
+
+            if (buffer.mapped != nullptr) {
+                memcpy(data, buffer.mapped, size);
+                return;
+            }
+
+            std::unique_ptr<ComputeBuffer> staging = createBuffer(size, true, "compute download staging");
+
+            transfer([&](VkCommandBuffer commandBuffer) {
+                VkBufferCopy region = {0, 0, size};
+                dispatch.vkCmdCopyBuffer(commandBuffer, buffer.buffer, staging->buffer, 1, &region);
+            });
+
+            memcpy(data, staging->mapped, size);
+        }
+
+        /*
+         * Start recording dispatches, throwing away whatever was recorded
+         * before
+         */
+        void begin() {
+
+            vkResetDescriptorPool(device, descriptorPool, 0);
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            dispatch.vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+            if (queryPool != VK_NULL_HANDLE) {
+                dispatch.vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+                dispatch.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+            }
+        }
+
+        /*
+         * Run kernel over groups workgroups, with buffers at bindings 0, 1...
+         * and pushConstants (kernel.pushConstantSize bytes of them)
+         */
+        void dispatchKernel(const ComputeKernel& kernel, std::initializer_list<const ComputeBuffer*> buffers,
+                            const void* pushConstants, uint32_t groups) {
+
+            if (buffers.size() != kernel.bindingCount) {
+                throw std::runtime_error("Wrong number of buffers for a compute kernel!!");
+            }
+
+            VkDescriptorSetAllocateInfo setInfo = {};
+            setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setInfo.descriptorPool = descriptorPool;
+            setInfo.descriptorSetCount = 1;
+            setInfo.pSetLayouts = &kernel.setLayout;
+
+            VkDescriptorSet set;
+            if (vkAllocateDescriptorSets(device, &setInfo, &set) != VK_SUCCESS) {
+                throw std::runtime_error("Too many compute dispatches in one recording!!");
+            }
+
+            VkDescriptorBufferInfo bufferInfos[MAX_BINDINGS] = {};
+            VkWriteDescriptorSet writes[MAX_BINDINGS] = {};
+
+            uint32_t binding = 0;
+            for (const ComputeBuffer* buffer : buffers) {
+                bufferInfos[binding].buffer = buffer->buffer;
+                bufferInfos[binding].offset = 0;
+                bufferInfos[binding].range = VK_WHOLE_SIZE;
+
+                writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[binding].dstSet = set;
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[binding].pBufferInfo = &bufferInfos[binding];
+                binding++;
+            }
+
+            vkUpdateDescriptorSets(device, kernel.bindingCount, writes, 0, nullptr);
+
+            dispatch.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+            dispatch.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.layout,
+                                             0, 1, &set, 0, nullptr);
+            if (kernel.pushConstantSize > 0) {
+                dispatch.vkCmdPushConstants(commandBuffer, kernel.layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                                            0, kernel.pushConstantSize, pushConstants);
+            }
+            dispatch.vkCmdDispatch(commandBuffer, groups, 1, 1);
+        }
+
+        /*
+         * Everything dispatched so far finishes (and its writes are visible)
+         * before anything dispatched after
+         */
+        void barrier() {
+            barriers.memory(Usage::ComputeStorageWrite, Usage::ComputeStorageReadWrite);
+            barriers.flush(commandBuffer);
+        }
+
+        void end() {
+
+            if (queryPool != VK_NULL_HANDLE) {
+                dispatch.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+            }
+
+            if (dispatch.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to record the compute command buffer!!");
+            }
+        }
+
+        /*
+         * Run what was recorded and wait for it, returns how long it took
+         * in seconds
+         */
+        double run() {
+
+            auto start = std::chrono::steady_clock::now();
+            submitAndWait(commandBuffer);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            if (queryPool == VK_NULL_HANDLE) {
+                return elapsed.count();
+            }
+
+            uint64_t timestamps[2];
+            if (dispatch.vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps,
+                                               sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to read the compute timestamps!!");
+            }
+
+            uint64_t mask = timestampBits >= 64 ? ~0ull : (1ull << timestampBits) - 1;
+            uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+            return ticks * (double) capabilities.properties.limits.timestampPeriod * 1e-9;
+        }
+
+    private:
+        VkDevice device;
+        const DeviceCapabilities& capabilities;
+        VkQueue queue;
+        const DeviceDispatch& dispatch;
+        const DebugNames& debugNames;
+        const VkAllocationCallbacks* allocator;
+
+        BarrierBatch barriers;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        uint32_t timestampBits = 0;
+
+        // Try for the preferred properties as well, settle for without
+        uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags required,
+                                VkMemoryPropertyFlags preferred) const {
+
+            const VkPhysicalDeviceMemoryProperties& memory = capabilities.memoryProperties;
+
+            for (VkMemoryPropertyFlags wanted : {required | preferred, required}) {
+                for (uint32_t i = 0; i < memory.memoryTypeCount; i++) {
+                    if ((typeFilter & (1 << i)) && (memory.memoryTypes[i].propertyFlags & wanted) == wanted) {
+                        return i;
+                    }
+                }
+            }
+
+            throw std::runtime_error("Unable to find a suitable memory type!!");
+        }
+
+        void submitAndWait(VkCommandBuffer buffer) {
+
+            VkSubmitInfo submitInfo = {};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &buffer;
+
+            if (dispatch.vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to submit compute work!!");
+            }
+
+            // The buffers are read back next, they mustn't still be the
+            // GPU's if the wait gave up
+            if (dispatch.vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to wait for the compute work!!");
+            }
+            dispatch.vkResetFences(device, 1, &fence);
+        }
+
+        /*
+         * A one off copy, ordered after any kernels that wrote the source
+         * and before any that read the destination
+         */
+        template <typename Record>
+        void transfer(Record record) {
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            dispatch.vkBeginCommandBuffer(transferCommandBuffer, &beginInfo);
+
+            barriers.memory(Usage::ComputeStorageWrite, Usage::CopySource);
+            barriers.flush(transferCommandBuffer);
+
+            record(transferCommandBuffer);
+
+            barriers.memory(Usage::CopyDestination, Usage::ComputeStorageReadWrite);
+            barriers.memory(Usage::CopyDestination, Usage::HostRead);
+            barriers.flush(transferCommandBuffer);
+
+            if (dispatch.vkEndCommandBuffer(transferCommandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to record a compute transfer!!");
+            }
+
+            submitAndWait(transferCommandBuffer);
+        }
+};
+
+/*
+ * The algorithms, each recorded into the engine's current recording. They
+ * bring their own scratch buffers, which stay around for the next time.
+ */
+class ComputeKernels {
+    public:
+
+        // Loads (and checks) a shader's SPIR-V given its file name
+        using ShaderLoader = std::function<std::vector<char>(const std::string&)>;
+
+        ComputeKernels(ComputeEngine& engine, const ShaderLoader& load) : engine(engine) {
+            reduceKernel = engine.createKernel("reduce", load("reduce.spv"), 2, 4);
+            scanKernel = engine.createKernel("scan", load("scan.spv"), 3, 4);
+            scanAddKernel = engine.createKernel("scan add", load("scan_add.spv"), 2, 4);
+            radixCountKernel = engine.createKernel("radix count", load("radix_count.spv"), 2, 8);
+            radixScatterKernel = engine.createKernel("radix scatter", load("radix_scatter.spv"), 3, 8);
+            saxpyKernel = engine.createKernel("saxpy", load("saxpy.spv"), 2, 8);
+        }
+
+        /*
+         * result[0] = the sum of the first n uints of input
+         */
+        void reduce(const ComputeBuffer& input, uint32_t n, ComputeBuffer& result) {
+
+            // A few thousand values each for up to 1024 groups, then one
+            // group to add up their partial sums
+            uint32_t groups = std::min(engine.groupsFor(n, ComputeEngine::WORKGROUP_SIZE * 8), 1024u);
+            ComputeBuffer& partials = scratch(reducePartials, groups * sizeof(uint32_t), "reduce partials");
+
+            engine.dispatchKernel(*reduceKernel, {&input, &partials}, &n, groups);
+            engine.barrier();
+            engine.dispatchKernel(*reduceKernel, {&partials, &result}, &groups, 1);
+        }
+
+        /*
+         * output[i] = the sum of input[0] to input[i - 1]. input and output
+         * can be the same buffer.
+         */
+        void exclusiveScan(const ComputeBuffer& input, ComputeBuffer& output, uint32_t n) {
+            scanLevel(input, output, n, 0);
+        }
+
+        /*
+         * Sort the first n uints of keys, n has to be a multiple of 256
+         * (pad with UINT32_MAX). Eight passes of 4 bits each, least
+         * significant first.
+         */
+        void radixSort(ComputeBuffer& keys, uint32_t n) {
+
+            if (n % ComputeEngine::WORKGROUP_SIZE != 0) {
+                throw std::runtime_error("Radix sort needs a multiple of 256 keys!!");
+            }
+
+            uint32_t blockCount = n / ComputeEngine::WORKGROUP_SIZE;
+            uint32_t groups = engine.groupsFor(n);
+
+            ComputeBuffer& temp = scratch(sortKeys, (VkDeviceSize) n * sizeof(uint32_t), "radix sort keys");
+            ComputeBuffer& histogram = scratch(sortHistogram, (VkDeviceSize) blockCount * 16 * sizeof(uint32_t),
+                                               "radix sort histogram");
+
+            // An even number of passes, so the keys finish where they started
+            ComputeBuffer* from = &keys;
+            ComputeBuffer* to = &temp;
+
+            for (uint32_t shift = 0; shift < 32; shift += 4) {
+                uint32_t params[2] = {n, shift};
+
+                engine.dispatchKernel(*radixCountKernel, {from, &histogram}, params, groups);
+                engine.barrier();
+                exclusiveScan(histogram, histogram, blockCount * 16);
+                engine.barrier();
+                engine.dispatchKernel(*radixScatterKernel, {from, to, &histogram}, params, groups);
+                engine.barrier();
+
+                std::swap(from, to);
+            }
+        }
+
+        /*
+         * y = a * x + y over n floats
+         */
+        void saxpy(float a, const ComputeBuffer& x, ComputeBuffer& y, uint32_t n) {
+
+            struct {
+                uint32_t n;
+                float a;
+            } params = {n, a};
+
+            engine.dispatchKernel(*saxpyKernel, {&x, &y}, &params, engine.groupsFor(n));
+        }
+
+    private:
+        ComputeEngine& engine;
+
+        std::unique_ptr<ComputeKernel> reduceKernel;
+        std::unique_ptr<ComputeKernel> scanKernel;
+        std::unique_ptr<ComputeKernel> scanAddKernel;
+        std::unique_ptr<ComputeKernel> radixCountKernel;
+        std::unique_ptr<ComputeKernel> radixScatterKernel;
+        std::unique_ptr<ComputeKernel> saxpyKernel;
+
+        std::unique_ptr<ComputeBuffer> reducePartials;
+        std::vector<std::unique_ptr<ComputeBuffer>> scanSums;    // One for each level
+        std::unique_ptr<ComputeBuffer> sortKeys;
+        std::unique_ptr<ComputeBuffer> sortHistogram;
+
+        static const uint32_t SCAN_BLOCK = 512;
+
+        // A scratch buffer of at least size bytes, only reallocated when it
+        // has to grow (so don't grow one a recording still uses)
+        ComputeBuffer& scratch(std::unique_ptr<ComputeBuffer>& buffer, VkDeviceSize size, const char* name) {
+            if (!buffer || buffer->size < size) {
+                buffer = engine.createBuffer(size, false, name);
+            }
+            return *buffer;
+        }
+
+        /*
+         * Scan each block of 512, then (if there's more than one block)
+         * scan the blocks' totals the same way and add them back on
+         */
+        void scanLevel(const ComputeBuffer& input, ComputeBuffer& output, uint32_t n, size_t level) {
+
+            uint32_t blockCount = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
+
+            if (scanSums.size() <= level) {
+                scanSums.resize(level + 1);
+            }
+            ComputeBuffer& sums = scratch(scanSums[level], (VkDeviceSize) blockCount * sizeof(uint32_t),
+                                          "scan block sums");
+
+            engine.dispatchKernel(*scanKernel, {&input, &output, &sums}, &n, engine.groupsFor(blockCount, 1));
+
+            if (blockCount > 1) {
+                engine.barrier();
+                scanLevel(sums, sums, blockCount, level + 1);
+                engine.barrier();
+                engine.dispatchKernel(*scanAddKernel, {&output, &sums}, &n, engine.groupsFor(n));
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef DEBUG_LOG_H
+#define DEBUG_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Where the validation layers' messages go. The layers call us from
+ * whichever thread made the Vulkan call, often in the middle of a frame, so
+ * the callback must be quick and must never block. It copies the message
+ * into a fixed size ring buffer and returns, a background thread does the
+ * slow part: printing.
+ *
+ * The same message tends to fire every frame, so the background thread
+ * also keeps a count for each message (by its code) and only prints the
+ * first few of each per second. Everything else is summarised, either
+ * when the rate limit lifts or when the log is stopped.
+ *
+ * The ring buffer is the bounded queue by Dmitry Vyukov: each slot carries a
+ * sequence number which tells producers when it's free and the consumer
+ * when it's full, so there are no locks. If the buffer fills up messages
+ * are dropped (and counted) rather than making the driver wait.
+ */
+class DebugLog {
+    public:
+        enum class Severity { Verbose, Info, Warning, Error };
+
+        // Slots in the ring buffer, must be a power of two
+        static const size_t CAPACITY = 256;
+
+        // Longer messages are cut short
+        static const size_t MAX_MESSAGE = 1024;
+
+        // How many times a single message may be printed each second
+        static const uint32_t RATE_LIMIT = 5;
+
+        explicit DebugLog(std::ostream& out = std::cerr) : out(out) {
+
+            for (size_t i = 0; i < CAPACITY; i++) {
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+
+            drainThread = std::thread(&DebugLog::drain, this);
+        }
+
+        DebugLog(const DebugLog&) = delete;
+        DebugLog& operator=(const DebugLog&) = delete;
+
+        ~DebugLog() {
+            stop();
+        }
+
+        /*
+         * Queue a message, safe to call from any thread and never blocks.
+         * Returns false if the buffer was full and the message was dropped.
+         */
+        bool push(Severity severity, int32_t code, const char* layer, const char* message) noexcept {
+
+            size_t position = enqueuePosition.load(std::memory_order_relaxed);
+            Slot* slot;
+
+            while (true) {
+                slot = &slots[position & (CAPACITY - 1)];
+                size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+                if (difference == 0) {
+                    // The slot is free, try to claim it
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                              std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    // The consumer hasn't got this far yet, we're full
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                } else {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->severity = severity;
+            slot->code = code;
+            copy(slot->layer, sizeof(slot->layer), layer);
+            copy(slot->message, sizeof(slot->message), message);
+
+            // Hand the slot over to the consumer
+            slot->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*
+         * Print everything still queued along with a summary of repeated
+         * messages, then stop the background thread.
+         */
+        void stop() {
+
+            if (!drainThread.joinable()) {
+                return;
+            }
+
+            stopping = true;
+            drainThread.join();
+
+            summarise(true);
+        }
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence;
+            Severity severity;
+            int32_t code;
+            char layer[32];
+            char message[MAX_MESSAGE];
+        };
+
+        // Everything we know about one message, only touched by the
+        // background thread
+        struct MessageCount {
+            std::string example;
+            Severity severity;
+            uint64_t total = 0;
+            uint64_t suppressed = 0;
+            uint32_t printedThisWindow = 0;
+        };
+
+        std::ostream& out;
+
+        Slot slots[CAPACITY];
+        alignas(64) std::atomic<size_t> enqueuePosition{0};
+        alignas(64) size_t dequeuePosition = 0;
+
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> stopping{false};
+        std::thread drainThread;
+
+        std::unordered_map<uint64_t, MessageCount> counts;
+        std::chrono::steady_clock::time_point windowStart = std::chrono::steady_clock::now();
+
+        static void copy(char* destination, size_t size, const char* source) {
+
+            if (source == nullptr) {
+                destination[0] = '\0';
+                return;
+            }
+
+            size_t length = strnlen(source, size - 1);
+            memcpy(destination, source, length);
+            destination[length] = '\0';
+        }
+
+        static const char* severityName(Severity severity) {
+            switch (severity) {
+                case Severity::Verbose: return "verbose";
+                case Severity::Info: return "info";
+                case Severity::Warning: return "warning";
+                case Severity::Error: return "error";
+            }
+            return "unknown";
+        }
+
+        /*
+         * Messages are told apart by their code, some layers use 0 for
+         * everything so then the text has to do.
+         */
+        static uint64_t keyFor(int32_t code, const char* message) {
+
+            if (code != 0) {
+                return (uint64_t) (uint32_t) code;
+            }
+
+            // FNV-1a, with the top bit set so it can't clash with a code
+            uint64_t hash = 14695981039346656037ull;
+            for (const char* c = message; *c != '\0'; c++) {
+                hash = (hash ^ (uint8_t) *c) * 1099511628211ull;
+            }
+            return hash | (1ull << 63);
+        }
+
+        /*
+         * Take a message off the ring buffer, returns false if it's empty
+         */
+        bool pop(Severity& severity, int32_t& code, std::string& layer, std::string& message) {
+
+            Slot& slot = slots[dequeuePosition & (CAPACITY - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+            if (sequence != dequeuePosition + 1) {
+                return false;
+            }
+
+            severity = slot.severity;
+            code = slot.code;
+            layer.assign(slot.layer);
+            message.assign(slot.message);
+
+            // Free the slot for the producer one trip around the ring later
+            slot.sequence.store(dequeuePosition + CAPACITY, std::memory_order_release);
+            dequeuePosition++;
+
+            return true;
+        }
+
+        void drain() {
+
+            Severity severity;
+            int32_t code;
+            std::string layer;
+            std::string message;
+
+            while (true) {
+
+                bool printed = false;
+
+                while (pop(severity, code, layer, message)) {
+                    printed = handle(severity, code, layer, message) || printed;
+                }
+
+                // Once a second let each message print again, after saying
+                // how many times it was held back
+                auto now = std::chrono::steady_clock::now();
+                if (now - windowStart >= std::chrono::seconds(1)) {
+                    printed = summarise(false) || printed;
+                    windowStart = now;
+                }
+
+                if (printed) {
+                    out.flush();
+                }
+
+                if (stopping) {
+                    // One last look in case something arrived while we were
+                    // printing
+                    while (pop(severity, code, layer, message)) {
+                        handle(severity, code, layer, message);
+                    }
+                    return;
+                }
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+
+        bool handle(Severity severity, int32_t code, const std::string& layer, const std::string& message) {
+
+            MessageCount& count = counts[keyFor(code, message.c_str())];
+            count.total++;
+
+            if (count.example.empty()) {
+                count.example = message;
+                count.severity = severity;
+            }
+
+            if (count.printedThisWindow >= RATE_LIMIT) {
+                count.suppressed++;
+                return false;
+            }
+
+            count.printedThisWindow++;
+            out << "Validation layer";
+            if (!layer.empty()) {
+                out << " (" << layer << ")";
+            }
+            out << " " << severityName(severity) << " [" << code << "]: " << message << '\n';
+
+            return true;
+        }
+
+        /*
+         * Report the messages we've held back. At the end also list every
+         * message which fired more than once.
+         */
+        bool summarise(bool final) {
+
+            bool printed = false;
+
+            for (auto& entry : counts) {
+                MessageCount& count = entry.second;
+
+                if (count.suppressed > 0) {
+                    out << "Validation layer: previous " << severityName(count.severity)
+                        << " repeated " << count.suppressed << " more times: "
+                        << count.example.substr(0, 120) << '\n';
+                    printed = true;
+                }
+
+                count.suppressed = 0;
+                count.printedThisWindow = 0;
+            }
+
+            if (final) {
+
+                std::vector<const MessageCount*> repeated;
+                for (const auto& entry : counts) {
+                    if (entry.second.total > 1) {
+                        repeated.push_back(&entry.second);
+                    }
+                }
+
+                std::sort(repeated.begin(), repeated.end(), [](const MessageCount* a, const MessageCount* b) {
+                    return a->total > b->total;
+                });
+
+                if (!repeated.empty()) {
+                    out << "Validation messages seen more than once:\n";
+                    for (const MessageCount* count : repeated) {
+                        out << "  " << count->total << " x " << count->example.substr(0, 120) << '\n';
+                    }
+                }
+
+                if (dropped > 0) {
+                    out << "Validation layer: " << dropped << " messages dropped (log buffer full)\n";
+                }
+
+                out.flush();
+            }
+
+            return printed;
+        }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef DEBUG_NAMES_H
+#define DEBUG_NAMES_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+/*
+ * Which VkObjectType goes with which handle type, so callers don't have to
+ * spell it out every time they name something.
+ *
+ * NOTE: on 32 bit builds every non-dispatchable handle is a plain uint64_t,
+ * so this only tells them apart on 64 bit.
+ */
+template<typename T>
+struct DebugObjectType {
+    static const VkObjectType value = VK_OBJECT_TYPE_UNKNOWN;
+};
+
+#define DEBUG_OBJECT_TYPE(T, type)                  \
+    template<>                                      \
+    struct DebugObjectType<T> {                     \
+        static const VkObjectType value = type;     \
+    };
+
+DEBUG_OBJECT_TYPE(VkInstance, VK_OBJECT_TYPE_INSTANCE)
+DEBUG_OBJECT_TYPE(VkDevice, VK_OBJECT_TYPE_DEVICE)
+DEBUG_OBJECT_TYPE(VkQueue, VK_OBJECT_TYPE_QUEUE)
+DEBUG_OBJECT_TYPE(VkCommandBuffer, VK_OBJECT_TYPE_COMMAND_BUFFER)
+DEBUG_OBJECT_TYPE(VkSemaphore, VK_OBJECT_TYPE_SEMAPHORE)
+DEBUG_OBJECT_TYPE(VkFence, VK_OBJECT_TYPE_FENCE)
+DEBUG_OBJECT_TYPE(VkDeviceMemory, VK_OBJECT_TYPE_DEVICE_MEMORY)
+DEBUG_OBJECT_TYPE(VkBuffer, VK_OBJECT_TYPE_BUFFER)
+DEBUG_OBJECT_TYPE(VkImage, VK_OBJECT_TYPE_IMAGE)
+DEBUG_OBJECT_TYPE(VkImageView, VK_OBJECT_TYPE_IMAGE_VIEW)
+DEBUG_OBJECT_TYPE(VkShaderModule, VK_OBJECT_TYPE_SHADER_MODULE)
+DEBUG_OBJECT_TYPE(VkPipelineLayout, VK_OBJECT_TYPE_PIPELINE_LAYOUT)
+DEBUG_OBJECT_TYPE(VkDescriptorSetLayout, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT)
+DEBUG_OBJECT_TYPE(VkDescriptorPool, VK_OBJECT_TYPE_DESCRIPTOR_POOL)
+DEBUG_OBJECT_TYPE(VkDescriptorSet, VK_OBJECT_TYPE_DESCRIPTOR_SET)
+DEBUG_OBJECT_TYPE(VkSampler, VK_OBJECT_TYPE_SAMPLER)
+DEBUG_OBJECT_TYPE(VkRenderPass, VK_OBJECT_TYPE_RENDER_PASS)
+DEBUG_OBJECT_TYPE(VkPipeline, VK_OBJECT_TYPE_PIPELINE)
+DEBUG_OBJECT_TYPE(VkFramebuffer, VK_OBJECT_TYPE_FRAMEBUFFER)
+DEBUG_OBJECT_TYPE(VkCommandPool, VK_OBJECT_TYPE_COMMAND_POOL)
+DEBUG_OBJECT_TYPE(VkSurfaceKHR, VK_OBJECT_TYPE_SURFACE_KHR)
+DEBUG_OBJECT_TYPE(VkSwapchainKHR, VK_OBJECT_TYPE_SWAPCHAIN_KHR)
+
+#undef DEBUG_OBJECT_TYPE
+
+/*
+ * Gives our Vulkan objects names and marks out the passes in our command
+ * buffers, through VK_EXT_debug_utils. RenderDoc, the validation layers and
+ * the vendors' profilers all pick these up, so instead of "VkImage
+ * 0x55d0c3a1" we see "offscreen image 2".
+ *
+ * This is only for debugging, so in release (NDEBUG) builds every function
+ * here is empty and the compiler throws the calls away. In debug builds
+ * they do nothing until init() finds the extension's functions, which it
+ * only will when we enabled VK_EXT_debug_utils on the instance.
+ */
+class DebugNames {
+    public:
+
+        // Colours for command buffer labels, some tools draw them
+        static constexpr float PASS_COLOR[4] = {0.2f, 0.4f, 0.8f, 1.0f};
+        static constexpr float DRAW_COLOR[4] = {0.2f, 0.7f, 0.3f, 1.0f};
+        static constexpr float COPY_COLOR[4] = {0.8f, 0.5f, 0.2f, 1.0f};
+
+#ifndef NDEBUG
+        void init(VkInstance instance, VkDevice device) {
+
+            this->device = device;
+
+            setObjectName = (PFN_vkSetDebugUtilsObjectNameEXT)
+                vkGetInstanceProcAddr(instance, "vkSetDebugUtilsObjectNameEXT");
+            beginLabel = (PFN_vkCmdBeginDebugUtilsLabelEXT)
+                vkGetInstanceProcAddr(instance, "vkCmdBeginDebugUtilsLabelEXT");
+            endLabel = (PFN_vkCmdEndDebugUtilsLabelEXT)
+                vkGetInstanceProcAddr(instance, "vkCmdEndDebugUtilsLabelEXT");
+        }
+
+        template<typename T>
+        void name(T object, const char* name) const {
+
+            if (setObjectName == nullptr || object == VK_NULL_HANDLE) {
+                return;
+            }
+
+            VkDebugUtilsObjectNameInfoEXT nameInfo = {};
+            nameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+            nameInfo.objectType = DebugObjectType<T>::value;
+            nameInfo.objectHandle = toHandle(object);
+            nameInfo.pObjectName = name;
+
+            setObjectName(device, &nameInfo);
+        }
+
+        // For the objects we have lots of, e.g. "framebuffer 2"
+        template<typename T>
+        void name(T object, const char* name, size_t index) const {
+            if (setObjectName != nullptr) {
+                this->name(object, (std::string(name) + " " + std::to_string(index)).c_str());
+            }
+        }
+
+        void begin(VkCommandBuffer commandBuffer, const char* name, const float color[4]) const {
+
+            if (beginLabel == nullptr) {
+                return;
+            }
+
+            VkDebugUtilsLabelEXT label = {};
+            label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+            label.pLabelName = name;
+            for (int i = 0; i < 4; i++) {
+                label.color[i] = color[i];
+            }
+
+            beginLabel(commandBuffer, &label);
+        }
+
+        void end(VkCommandBuffer commandBuffer) const {
+            if (endLabel != nullptr) {
+                endLabel(commandBuffer);
+            }
+        }
+#else
+        void init(VkInstance, VkDevice) {}
+
+        template<typename T>
+        void name(T, const char*) const {}
+
+        template<typename T>
+        void name(T, const char*, size_t) const {}
+
+        void begin(VkCommandBuffer, const char*, const float[4]) const {}
+        void end(VkCommandBuffer) const {}
+#endif
+
+        /*
+         * Labels everything recorded into commandBuffer while in scope
+         */
+        class Label {
+            public:
+                Label(const DebugNames& names, VkCommandBuffer commandBuffer,
+                      const char* name, const float color[4])
+                    : names(names), commandBuffer(commandBuffer) {
+                    names.begin(commandBuffer, name, color);
+                }
+
+                ~Label() {
+                    names.end(commandBuffer);
+                }
+
+                Label(const Label&) = delete;
+                Label& operator=(const Label&) = delete;
+
+            private:
+                const DebugNames& names;
+                VkCommandBuffer commandBuffer;
+        };
+
+    private:
+#ifndef NDEBUG
+        VkDevice device = VK_NULL_HANDLE;
+        PFN_vkSetDebugUtilsObjectNameEXT setObjectName = nullptr;
+        PFN_vkCmdBeginDebugUtilsLabelEXT beginLabel = nullptr;
+        PFN_vkCmdEndDebugUtilsLabelEXT endLabel = nullptr;
+
+        // Dispatchable handles are pointers, non-dispatchable ones are
+        // pointers on 64 bit and uint64_t on 32 bit
+        template<typename T>
+        static uint64_t toHandle(T object) {
+            if constexpr (std::is_pointer<T>::value) {
+                return (uint64_t) (uintptr_t) object;
+            } else {
+                return (uint64_t) object;
+            }
+        }
+#endif
+};
+
+#endif
@@ -0,0 +1,462 @@
+#ifndef DEVICE_CAPS_H
+#define DEVICE_CAPS_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/*
+ * This struct will hold the capabilities of a particular
+ * device's swap chain support. We will need this to make sure
+ * the device we choose is compatible with our paricular window
+ * surface
+ */
+struct SwapChainSupportDetails {
+    VkSurfaceCapabilitiesKHR capabilities;
+    std::vector<VkSurfaceFormatKHR> formats;
+    std::vector<VkPresentModeKHR> presentModes;
+};
+
+/*
+ * Everything we want to know about a physical device which doesn't depend
+ * on a window, gathered in one go.
+ */
+struct DeviceCapabilities {
+    VkPhysicalDevice device = VK_NULL_HANDLE;
+
+    // The limits live in here too (properties.limits)
+    VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceFeatures features;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    std::vector<VkExtensionProperties> extensions;
+
+    // Optional features we can only ask about through
+    // VK_KHR_get_physical_device_properties2
+    bool timelineSemaphore = false;
+    bool dynamicRendering = false;
+    bool synchronization2 = false;
+
+    // Did this come from the file on disk rather than the driver?
+    bool fromDisk = false;
+
+    bool hasExtension(const char* extensionName) const {
+        for (const auto& extension : extensions) {
+            if (strcmp(extension.extensionName, extensionName) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/*
+ * Asks the driver about each physical device once per run and hands out
+ * the answers from then on, instead of every part of the app querying the
+ * driver again.
+ *
+ * Given a path it also keeps the window independent answers on disk, keyed
+ * by the device and its driver version, so the next launch only needs
+ * vkEnumeratePhysicalDevices and vkGetPhysicalDeviceProperties to find out
+ * whether what it has is still good. Updating the driver changes the key
+ * and everything gets queried afresh.
+ *
+ * Surface queries (present support, swap chain formats) depend on the
+ * window so they are only cached for the run.
+ */
+class CapabilityCache {
+    public:
+
+        /*
+         * getFeatures2 is vkGetPhysicalDeviceFeatures2KHR when
+         * VK_KHR_get_physical_device_properties2 is enabled, or nullptr.
+         * An empty path means don't touch the disk.
+         */
+        CapabilityCache(VkInstance instance, PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2,
+                        const std::string& path)
+            : getFeatures2(getFeatures2), path(path) {
+
+            uint32_t deviceCount = 0;
+            vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+            std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
+            vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data());
+
+            std::vector<DeviceCapabilities> stored;
+            if (!path.empty()) {
+                stored = load();
+            }
+
+            bool changed = false;
+
+            for (VkPhysicalDevice physicalDevice : physicalDevices) {
+
+                DeviceCapabilities capabilities;
+                capabilities.device = physicalDevice;
+                vkGetPhysicalDeviceProperties(physicalDevice, &capabilities.properties);
+
+                bool found = false;
+                for (const auto& entry : stored) {
+                    if (sameDriver(entry.properties, capabilities.properties)) {
+                        capabilities = entry;
+                        capabilities.device = physicalDevice;
+                        found = true;
+                        break;
+                    }
+                }
+
+                if (!found) {
+                    query(capabilities);
+                    changed = true;
+                }
+
+                devices.push_back(std::move(capabilities));
+            }
+
+            if (changed && !path.empty()) {
+                save();
+            }
+        }
+
+        const std::vector<DeviceCapabilities>& getDevices() const {
+            return devices;
+        }
+
+        const DeviceCapabilities& get(VkPhysicalDevice physicalDevice) const {
+
+            for (const auto& capabilities : devices) {
+                if (capabilities.device == physicalDevice) {
+                    return capabilities;
+                }
+            }
+
+            throw std::runtime_error("Asked for the capabilities of an unknown device!!");
+        }
+
+        /*
+         * Can this queue family present to the surface?
+         */
+        bool presentSupport(VkPhysicalDevice physicalDevice, uint32_t queueFamily, VkSurfaceKHR surface) {
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto key = std::make_tuple(physicalDevice, queueFamily, surface);
+            auto found = presentSupportCache.find(key);
+
+            if (found == presentSupportCache.end()) {
+                VkBool32 supported = VK_FALSE;
+                vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, queueFamily, surface, &supported);
+                found = presentSupportCache.emplace(key, supported == VK_TRUE).first;
+            }
+
+            return found->second;
+        }
+
+        /*
+         * The formats, present modes and limits for a swap chain on this
+         * surface.
+         */
+        const SwapChainSupportDetails& swapChainSupport(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto key = std::make_pair(physicalDevice, surface);
+            auto found = swapChainCache.find(key);
+
+            if (found != swapChainCache.end()) {
+                return found->second;
+            }
+
+            SwapChainSupportDetails& details = swapChainCache[key];
+
+            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &details.capabilities);
+
+            uint32_t formatCount;
+            vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
+
+            if (formatCount != 0) {
+                details.formats.resize(formatCount);
+                vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, details.formats.data());
+            }
+
+            uint32_t presentModeCount;
+            vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr);
+
+            if (presentModeCount != 0) {
+                details.presentModes.resize(presentModeCount);
+                vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount,
+                                                          details.presentModes.data());
+            }
+
+            return details;
+        }
+
+        /*
+         * Forget what we know about a surface, e.g. after the window has
+         * been resized and the current extent has changed.
+         */
+        void invalidateSurface(VkSurfaceKHR surface) {
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (auto it = swapChainCache.begin(); it != swapChainCache.end();) {
+                it = it->first.second == surface ? swapChainCache.erase(it) : std::next(it);
+            }
+
+            for (auto it = presentSupportCache.begin(); it != presentSupportCache.end();) {
+                it = std::get<2>(it->first) == surface ? presentSupportCache.erase(it) : std::next(it);
+            }
+        }
+
+        /*
+         * Capabilities of a single format on a device, e.g. whether it can
+         * be rendered to or used as a storage image.
+         */
+        VkFormatProperties formatProperties(VkPhysicalDevice physicalDevice, VkFormat format) {
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto key = std::make_pair(physicalDevice, format);
+            auto found = formatCache.find(key);
+
+            if (found == formatCache.end()) {
+                VkFormatProperties properties;
+                vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+                found = formatCache.emplace(key, properties).first;
+            }
+
+            return found->second;
+        }
+
+    private:
+
+        // Bump this whenever the file layout changes, the sizes of the
+        // structs we write out are also checked in case the headers change
+        static const uint32_t FILE_VERSION = 3;
+
+        PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2;
+        std::string path;
+        std::vector<DeviceCapabilities> devices;
+
+        std::mutex mutex;
+        std::map<std::tuple<VkPhysicalDevice, uint32_t, VkSurfaceKHR>, bool> presentSupportCache;
+        std::map<std::pair<VkPhysicalDevice, VkSurfaceKHR>, SwapChainSupportDetails> swapChainCache;
+        std::map<std::pair<VkPhysicalDevice, VkFormat>, VkFormatProperties> formatCache;
+
+        /*
+         * Is this the same device, on the same driver, as one we saw before?
+         */
+        static bool sameDriver(const VkPhysicalDeviceProperties& a, const VkPhysicalDeviceProperties& b) {
+            return a.vendorID == b.vendorID &&
+                   a.deviceID == b.deviceID &&
+                   a.driverVersion == b.driverVersion &&
+                   a.apiVersion == b.apiVersion &&
+                   memcmp(a.pipelineCacheUUID, b.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+        }
+
+        void query(DeviceCapabilities& capabilities) {
+
+            VkPhysicalDevice physicalDevice = capabilities.device;
+
+            vkGetPhysicalDeviceFeatures(physicalDevice, &capabilities.features);
+            vkGetPhysicalDeviceMemoryProperties(physicalDevice, &capabilities.memoryProperties);
+
+            uint32_t queueFamilyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+            capabilities.queueFamilies.resize(queueFamilyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                                     capabilities.queueFamilies.data());
+
+            uint32_t extensionCount = 0;
+            vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+            capabilities.extensions.resize(extensionCount);
+            vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount,
+                                                 capabilities.extensions.data());
+
+            if (getFeatures2 == nullptr) {
+                return;
+            }
+
+            // Only chain on the structs for extensions the device has, the
+            // driver might not know the others
+            VkPhysicalDeviceFeatures2KHR features = {};
+            features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+
+            VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+            timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+            if (capabilities.hasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+                timelineFeatures.pNext = features.pNext;
+                features.pNext = &timelineFeatures;
+            }
+
+            VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+            dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+            if (capabilities.hasExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+                dynamicRenderingFeatures.pNext = features.pNext;
+                features.pNext = &dynamicRenderingFeatures;
+            }
+
+            VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features = {};
+            synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+            if (capabilities.hasExtension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+                synchronization2Features.pNext = features.pNext;
+                features.pNext = &synchronization2Features;
+            }
+
+            if (features.pNext == nullptr) {
+                return;
+            }
+
+            getFeatures2(physicalDevice, &features);
+
+            capabilities.timelineSemaphore = timelineFeatures.timelineSemaphore == VK_TRUE;
+            capabilities.dynamicRendering = dynamicRenderingFeatures.dynamicRendering == VK_TRUE;
+            capabilities.synchronization2 = synchronization2Features.synchronization2 == VK_TRUE;
+        }
+
+        // The file is a small header followed by the raw structs for each
+        // device. It's only ever read back by the same build on the same
+        // machine so there's no need for anything more portable.
+        struct FileHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t structSizes[4];
+            uint32_t haveFeatures2;
+            uint32_t deviceCount;
+        };
+
+        FileHeader expectedHeader(uint32_t deviceCount) const {
+
+            FileHeader header = {};
+            memcpy(header.magic, "VKCAPS\0", sizeof(header.magic));
+            header.version = FILE_VERSION;
+            header.structSizes[0] = sizeof(VkPhysicalDeviceProperties);
+            header.structSizes[1] = sizeof(VkPhysicalDeviceFeatures);
+            header.structSizes[2] = sizeof(VkPhysicalDeviceMemoryProperties);
+            header.structSizes[3] = sizeof(VkExtensionProperties);
+
+            // What we know about optional features depends on whether we
+            // could ask
+            header.haveFeatures2 = getFeatures2 != nullptr;
+            header.deviceCount = deviceCount;
+
+            return header;
+        }
+
+        template <typename T>
+        static bool read(std::ifstream& file, T& value) {
+            return (bool) file.read((char*) &value, sizeof(T));
+        }
+
+        template <typename T>
+        static bool readVector(std::ifstream& file, std::vector<T>& values) {
+
+            uint32_t count;
+            if (!read(file, count) || count > 4096) {
+                return false;
+            }
+
+            values.resize(count);
+            return (bool) file.read((char*) values.data(), sizeof(T) * count);
+        }
+
+        template <typename T>
+        static void write(std::ofstream& file, const T& value) {
+            file.write((const char*) &value, sizeof(T));
+        }
+
+        template <typename T>
+        static void writeVector(std::ofstream& file, const std::vector<T>& values) {
+            write(file, (uint32_t) values.size());
+            file.write((const char*) values.data(), sizeof(T) * values.size());
+        }
+
+        /*
+         * Anything wrong with the file just means we query the driver, it's
+         * only a cache.
+         */
+        std::vector<DeviceCapabilities> load() const {
+
+            std::ifstream file(path, std::ios::binary);
+
+            FileHeader header;
+            if (!file.is_open() || !read(file, header)) {
+                return {};
+            }
+
+            FileHeader expected = expectedHeader(header.deviceCount);
+            if (memcmp(&header, &expected, sizeof(header)) != 0) {
+                return {};
+            }
+
+            std::vector<DeviceCapabilities> stored(header.deviceCount);
+
+            for (auto& capabilities : stored) {
+
+                uint32_t timelineSemaphore, dynamicRendering, synchronization2;
+                if (!read(file, capabilities.properties) ||
+                    !read(file, capabilities.features) ||
+                    !read(file, capabilities.memoryProperties) ||
+                    !readVector(file, capabilities.queueFamilies) ||
+                    !readVector(file, capabilities.extensions) ||
+                    !read(file, timelineSemaphore) ||
+                    !read(file, dynamicRendering) ||
+                    !read(file, synchronization2)) {
+                    return {};
+                }
+
+                capabilities.timelineSemaphore = timelineSemaphore != 0;
+                capabilities.dynamicRendering = dynamicRendering != 0;
+                capabilities.synchronization2 = synchronization2 != 0;
+                capabilities.fromDisk = true;
+            }
+
+            return stored;
+        }
+
+        void save() const {
+
+            // Write somewhere else first so a half written file is never
+            // mistaken for a good one
+            std::string temporary = path + ".tmp";
+            {
+                std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+                if (!file.is_open()) {
+                    return;
+                }
+
+                write(file, expectedHeader((uint32_t) devices.size()));
+
+                for (const auto& capabilities : devices) {
+                    write(file, capabilities.properties);
+                    write(file, capabilities.features);
+                    write(file, capabilities.memoryProperties);
+                    writeVector(file, capabilities.queueFamilies);
+                    writeVector(file, capabilities.extensions);
+                    write(file, (uint32_t) capabilities.timelineSemaphore);
+                    write(file, (uint32_t) capabilities.dynamicRendering);
+                    write(file, (uint32_t) capabilities.synchronization2);
+                }
+
+                if (!file) {
+                    return;
+                }
+            }
+
+            std::rename(temporary.c_str(), path.c_str());
+        }
+};
+
+#endif
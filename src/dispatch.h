@@ -0,0 +1,144 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <vulkan/vulkan.h>
+
+#include <stdexcept>
+#include <string>
+
+/*
+ * The functions we call through our own tables rather than the loader.
+ *
+ * Every vk* function the loader exports is a trampoline: it looks at the
+ * handle's dispatch table and jumps to whatever the layers or driver put
+ * there. Asking vkGetDeviceProcAddr for a device function instead gives us
+ * the driver's (or first layer's) entry point itself, so calling through
+ * it skips a jump and a memory load. That only matters for the calls we
+ * make many times a frame, so those are what's listed here. Creating and
+ * destroying things can keep going through the loader.
+ *
+ * Each list is an X macro, X(name) is expanded once per function to
+ * declare the table's members and again to load them. To use another
+ * function add it to the right list and call it as table.vkSomething(...).
+ */
+
+// Instance functions we always need
+#define DISPATCH_INSTANCE_FUNCTIONS(X)              \
+    X(vkGetDeviceProcAddr)
+
+// Instance functions from extensions which may not be enabled, these are
+// left null when they are missing
+#define DISPATCH_INSTANCE_OPTIONAL_FUNCTIONS(X)     \
+    X(vkCreateDebugReportCallbackEXT)               \
+    X(vkDestroyDebugReportCallbackEXT)              \
+    X(vkCreateDebugUtilsMessengerEXT)               \
+    X(vkDestroyDebugUtilsMessengerEXT)              \
+    X(vkEnumeratePhysicalDeviceGroupsKHR)
+
+// Device functions we use every frame (or close to it)
+#define DISPATCH_DEVICE_FUNCTIONS(X)                \
+    X(vkQueueSubmit)                                \
+    X(vkQueueWaitIdle)                              \
+    X(vkDeviceWaitIdle)                             \
+    X(vkCreateFence)                                \
+    X(vkDestroyFence)                               \
+    X(vkResetFences)                                \
+    X(vkGetFenceStatus)                             \
+    X(vkWaitForFences)                              \
+    X(vkCreateSemaphore)                            \
+    X(vkDestroySemaphore)                           \
+    X(vkBeginCommandBuffer)                         \
+    X(vkEndCommandBuffer)                           \
+    X(vkCmdBeginRenderPass)                         \
+    X(vkCmdEndRenderPass)                           \
+    X(vkCmdBindPipeline)                            \
+    X(vkCmdSetViewport)                             \
+    X(vkCmdSetScissor)                              \
+    X(vkCmdDraw)                                    \
+    X(vkCmdBindDescriptorSets)                      \
+    X(vkCmdPushConstants)                           \
+    X(vkCmdDispatch)                                \
+    X(vkCmdCopyImageToBuffer)                       \
+    X(vkCmdCopyBuffer)                              \
+    X(vkCmdCopyImage)                               \
+    X(vkCmdClearAttachments)                        \
+    X(vkCmdClearColorImage)                         \
+    X(vkCmdFillBuffer)                              \
+    X(vkCmdResetQueryPool)                          \
+    X(vkCreateQueryPool)                            \
+    X(vkDestroyQueryPool)                           \
+    X(vkGetQueryPoolResults)                        \
+    X(vkCmdWriteTimestamp)                          \
+    X(vkCmdPipelineBarrier)
+
+// Device functions from extensions which may not be enabled (there is no
+// swap chain when we run headless, dynamic rendering, synchronization2
+// and device groups are optional)
+#define DISPATCH_DEVICE_OPTIONAL_FUNCTIONS(X)       \
+    X(vkAcquireNextImageKHR)                        \
+    X(vkQueuePresentKHR)                            \
+    X(vkCmdBeginRenderingKHR)                       \
+    X(vkCmdEndRenderingKHR)                         \
+    X(vkCmdPipelineBarrier2KHR)                     \
+    X(vkCmdSetDeviceMaskKHR)                        \
+    X(vkWaitSemaphoresKHR)                          \
+    X(vkGetSemaphoreCounterValueKHR)
+
+/*
+ * The instance's table, load() once the instance exists
+ */
+struct InstanceDispatch {
+
+    #define DISPATCH_MEMBER(name) PFN_##name name = nullptr;
+    DISPATCH_INSTANCE_FUNCTIONS(DISPATCH_MEMBER)
+    DISPATCH_INSTANCE_OPTIONAL_FUNCTIONS(DISPATCH_MEMBER)
+    #undef DISPATCH_MEMBER
+
+    void load(VkInstance instance) {
+
+        #define DISPATCH_LOAD(name) \
+            name = (PFN_##name) vkGetInstanceProcAddr(instance, #name);
+        #define DISPATCH_LOAD_REQUIRED(name) \
+            DISPATCH_LOAD(name) \
+            if (name == nullptr) { \
+                throw std::runtime_error(std::string("Unable to load ") + #name + "!!"); \
+            }
+
+        DISPATCH_INSTANCE_FUNCTIONS(DISPATCH_LOAD_REQUIRED)
+        DISPATCH_INSTANCE_OPTIONAL_FUNCTIONS(DISPATCH_LOAD)
+
+        #undef DISPATCH_LOAD_REQUIRED
+        #undef DISPATCH_LOAD
+    }
+};
+
+/*
+ * The device's table, load() once the device exists. The pointers are only
+ * good for that one device.
+ */
+struct DeviceDispatch {
+
+    #define DISPATCH_MEMBER(name) PFN_##name name = nullptr;
+    DISPATCH_DEVICE_FUNCTIONS(DISPATCH_MEMBER)
+    DISPATCH_DEVICE_OPTIONAL_FUNCTIONS(DISPATCH_MEMBER)
+    #undef DISPATCH_MEMBER
+
+    void load(const InstanceDispatch& instance, VkDevice device) {
+
+        #define DISPATCH_LOAD(name) \
+            name = (PFN_##name) instance.vkGetDeviceProcAddr(device, #name);
+        #define DISPATCH_LOAD_REQUIRED(name) \
+            DISPATCH_LOAD(name) \
+            if (name == nullptr) { \
+                throw std::runtime_error(std::string("Unable to load ") + #name + "!!"); \
+            }
+
+        DISPATCH_DEVICE_FUNCTIONS(DISPATCH_LOAD_REQUIRED)
+        DISPATCH_DEVICE_OPTIONAL_FUNCTIONS(DISPATCH_LOAD)
+
+        #undef DISPATCH_LOAD_REQUIRED
+        #undef DISPATCH_LOAD
+    }
+};
+
+#endif
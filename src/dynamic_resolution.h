@@ -0,0 +1,104 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/*
+ * Dynamic resolution (--dynamic-resolution MS): the scene is drawn into an
+ * image of its own at some fraction of the output's size, and upscaled
+ * onto the output (shaders/upscale.frag). Every frame the GPU's time for
+ * the last frame it finished goes into a PID controller, which picks the
+ * fraction for the next one so as to hold the frame time at the target.
+ *
+ * The command buffers are recorded once and reused, so rather than any
+ * fraction there are LEVELS of them, evenly spaced from MIN_SCALE up to
+ * the full size, and a set of command buffers for each. The scene image is
+ * full size and the smaller levels only draw into its top left corner.
+ */
+namespace DynamicResolution {
+
+    const uint32_t LEVELS = 11;
+    const float MIN_SCALE = 0.5f;
+
+    // The resolution benchmark holds frames to this unless told otherwise
+    const double BENCH_TARGET_MS = 8.0;
+
+    // How much of each side of the output a level draws
+    inline float levelScale(uint32_t level) {
+        return MIN_SCALE + (1.0f - MIN_SCALE) * level / (LEVELS - 1);
+    }
+
+    // And how many pixels that comes to, never less than one
+    inline uint32_t scaledSize(uint32_t size, uint32_t level) {
+        return std::max(1u, (uint32_t) std::lround(size * levelScale(level)));
+    }
+
+    /*
+     * What upscale.frag takes as push constants: how much of the scene
+     * image was drawn, and the size of the output it's stretched over
+     */
+    struct PushConstants {
+        float sceneSize[2];
+        float outputSize[2];
+    };
+
+    /*
+     * The PID controller. What it steers is the fraction of the output's
+     * pixels that get drawn, the square of the scale, since that's what
+     * the frame time goes with. It's in velocity form, each update nudges
+     * the last output rather than working it out from scratch, so clamping
+     * the output between the smallest and biggest level is all the
+     * anti-windup it needs.
+     *
+     * The frame time it hears about is a few frames old (however many the
+     * CPU lets the GPU get ahead by), so the gains are on the gentle side.
+     */
+    class Controller {
+        public:
+
+            static constexpr double KP = 0.3;
+            static constexpr double KI = 0.08;
+            static constexpr double KD = 0.05;
+
+            explicit Controller(double targetMs) : targetMs(targetMs) {}
+
+            /*
+             * Take a frame's GPU time and return the level to draw the
+             * next one at
+             */
+            uint32_t update(double frameMs) {
+
+                // Relative, so the gains don't depend on the target. It's
+                // positive when there's time to spare.
+                double error = (targetMs - frameMs) / targetMs;
+
+                area += KP * (error - lastError) + KI * error + KD * (error - 2.0 * lastError + errorBefore);
+                area = std::min(std::max(area, (double) MIN_SCALE * MIN_SCALE), 1.0);
+
+                errorBefore = lastError;
+                lastError = error;
+
+                return level();
+            }
+
+            // The level nearest the scale the controller wants
+            uint32_t level() const {
+                double position = (std::sqrt(area) - MIN_SCALE) / (1.0 - MIN_SCALE) * (LEVELS - 1);
+                return (uint32_t) std::lround(std::min(std::max(position, 0.0), (double) (LEVELS - 1)));
+            }
+
+            double getTargetMs() const {
+                return targetMs;
+            }
+
+        private:
+            double targetMs;
+            double area = 1.0;
+            double lastError = 0.0;
+            double errorBefore = 0.0;
+    };
+}
+
+#endif
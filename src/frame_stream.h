@@ -0,0 +1,639 @@
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Hands rendered frames to another process on the same machine, e.g. a
+ * compositor, so it doesn't have to screen capture our window.
+ *
+ * The fast way is a ring of frame slots in POSIX shared memory. We copy
+ * each frame out of its readback buffer into the next slot (the same copy
+ * batch mode makes for the image writers) and the consumer reads it where
+ * it lies, no copies on its side at all. A futex on the count of published
+ * frames wakes the consumer when there's a new one, without either side
+ * polling.
+ *
+ * We never wait for the consumer: if it falls behind it gets the newest
+ * frame and the ones in between are dropped, which is what a compositor
+ * wants. Each slot has a sequence number (a seqlock) so the consumer can
+ * tell when we lapped it and overwrote a frame while it was reading.
+ *
+ * The slow way is a local TCP socket, for tests and for setups where the
+ * two can't share memory. Every frame is sent whole, so there the consumer
+ * does hold us up.
+ *
+ * Both sides stamp frames with the steady clock, which on Linux is
+ * CLOCK_MONOTONIC and so the same in every process, so the consumer can
+ * measure how long frames took to reach it.
+ *
+ * This is Linux only (futexes), like the rest of the Makefile.
+ */
+
+/*
+ * Where frames go: "shm:NAME" for a shared memory ring, "tcp:PORT" for a
+ * socket on the loopback interface
+ */
+struct StreamEndpoint {
+
+    enum class Transport { SharedMemory, Tcp };
+
+    Transport transport = Transport::SharedMemory;
+    std::string name;
+    uint16_t port = 0;
+
+    static StreamEndpoint parse(const std::string& text) {
+
+        StreamEndpoint endpoint;
+
+        if (text.compare(0, 4, "shm:") == 0 && text.size() > 4) {
+            endpoint.transport = Transport::SharedMemory;
+            endpoint.name = text.substr(4);
+
+            // shm_open wants names like "/frames"
+            if (endpoint.name[0] != '/') {
+                endpoint.name = "/" + endpoint.name;
+            }
+        } else if (text.compare(0, 4, "tcp:") == 0) {
+            endpoint.transport = Transport::Tcp;
+            unsigned long port = std::stoul(text.substr(4));
+            if (port == 0 || port > 65535) {
+                throw std::runtime_error("Expected a port between 1 and 65535, got " + text + "!!");
+            }
+            endpoint.port = (uint16_t) port;
+        } else {
+            throw std::runtime_error("Expected shm:NAME or tcp:PORT, got " + text + "!!");
+        }
+
+        return endpoint;
+    }
+
+    std::string toString() const {
+        return transport == Transport::SharedMemory ? "shm:" + name : "tcp:" + std::to_string(port);
+    }
+};
+
+/*
+ * Nanoseconds on the clock both processes share
+ */
+inline int64_t streamClockNs(std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now()) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+/*
+ * The shared memory layout. A header, then the slots' headers, then the
+ * slots' pixels, each starting on its own page.
+ */
+namespace FrameRing {
+
+    const uint32_t MAGIC = 0x52464b56;      // "VKFR"
+    const uint32_t VERSION = 1;
+
+    // Triple buffered: one being written, one being read and one spare,
+    // so a consumer that keeps up never sees a frame overwritten
+    const uint32_t SLOT_COUNT = 3;
+
+    struct Header {
+        // Set last, once everything else is, so a consumer never sees a
+        // half built ring
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;                    // VkFormat of the pixels
+        uint32_t slotCount;
+        uint64_t frameSize;
+        uint64_t slotStride;
+        uint64_t dataOffset;
+
+        // How many frames have been published, this is the futex word
+        std::atomic<uint32_t> published;
+
+        // How many consumers are (about to be) asleep on published, so we
+        // only make the wake system call when someone is waiting
+        std::atomic<uint32_t> waiters;
+
+        // Set once the last frame is out
+        std::atomic<uint32_t> closed;
+    };
+
+    struct Slot {
+        // Odd while we're writing the slot, bumped again when it's done
+        std::atomic<uint64_t> sequence;
+        uint64_t frameIndex;
+        int64_t submitTimeNs;               // When the frame went to the GPU
+        int64_t publishTimeNs;              // When it landed in the slot
+    };
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+                  "Futexes need a plain 32 bit word");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "The slot sequence is shared between processes, so it can't use a lock");
+
+    inline size_t pageAlign(size_t size) {
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        return (size + page - 1) / page * page;
+    }
+
+    // Shared futexes (no FUTEX_PRIVATE_FLAG), the other side is another
+    // process
+    inline void wait(std::atomic<uint32_t>& word, uint32_t expected, int64_t timeoutNs) {
+        timespec timeout = {(time_t) (timeoutNs / 1000000000), (long) (timeoutNs % 1000000000)};
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    }
+
+    inline void wakeAll(std::atomic<uint32_t>& word) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+}
+
+/*
+ * What goes down the socket ahead of each frame's pixels
+ */
+struct FrameMessage {
+    uint64_t frameIndex;
+    int64_t submitTimeNs;
+    int64_t publishTimeNs;
+    uint32_t width;
+    uint32_t height;
+    uint64_t size;
+};
+
+/*
+ * A frame as the consumer sees it
+ */
+struct StreamedFrame {
+    uint64_t frameIndex;
+    int64_t submitTimeNs;
+    int64_t publishTimeNs;
+    uint32_t width;
+    uint32_t height;
+    size_t size;
+    const uint8_t* pixels;
+};
+
+namespace StreamSocket {
+
+    inline void sendAll(int fd, const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*) data;
+        while (size > 0) {
+            ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                throw std::runtime_error("Lost the frame stream's consumer!!");
+            }
+            bytes += sent;
+            size -= (size_t) sent;
+        }
+    }
+
+    // False if the other end hung up before anything arrived
+    inline bool receiveAll(int fd, void* data, size_t size) {
+        uint8_t* bytes = (uint8_t*) data;
+        size_t total = size;
+        while (size > 0) {
+            ssize_t received = recv(fd, bytes, size, 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received == 0 && size == total) {
+                return false;
+            }
+            if (received <= 0) {
+                throw std::runtime_error("The frame stream was cut off mid frame!!");
+            }
+            bytes += received;
+            size -= (size_t) received;
+        }
+        return true;
+    }
+
+    inline sockaddr_in loopback(uint16_t port) {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return address;
+    }
+}
+
+/*
+ * The renderer's side
+ */
+class FramePublisher {
+    public:
+
+        FramePublisher(const StreamEndpoint& endpoint, uint32_t width, uint32_t height, uint32_t format,
+                       size_t frameSize)
+            : endpoint(endpoint), width(width), height(height), frameSize(frameSize) {
+
+            if (endpoint.transport == StreamEndpoint::Transport::SharedMemory) {
+                createRing(format);
+            } else {
+                acceptConsumer();
+            }
+        }
+
+        FramePublisher(const FramePublisher&) = delete;
+        FramePublisher& operator=(const FramePublisher&) = delete;
+
+        ~FramePublisher() {
+            close();
+        }
+
+        /*
+         * Send a frame, pixels is frameSize bytes. In shared memory this
+         * never waits for the consumer.
+         */
+        void publish(uint64_t frameIndex, int64_t submitTimeNs, const uint8_t* pixels) {
+
+            if (header != nullptr) {
+
+                FrameRing::Slot& slot = slots[published % header->slotCount];
+                uint8_t* data = (uint8_t*) mapping + header->dataOffset
+                              + (published % header->slotCount) * header->slotStride;
+
+                // Mark the slot as being written before touching it
+                uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+                slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+
+                memcpy(data, pixels, frameSize);
+                slot.frameIndex = frameIndex;
+                slot.submitTimeNs = submitTimeNs;
+                slot.publishTimeNs = streamClockNs();
+
+                slot.sequence.store(sequence + 2, std::memory_order_release);
+
+                // Both of these are sequentially consistent, so either we
+                // see the consumer waiting or its futex wait sees the new
+                // count and doesn't sleep
+                header->published.store(++published);
+                if (header->waiters.load() > 0) {
+                    FrameRing::wakeAll(header->published);
+                }
+            } else {
+                FrameMessage message = {frameIndex, submitTimeNs, streamClockNs(), width, height, frameSize};
+                StreamSocket::sendAll(clientFd, &message, sizeof(message));
+                StreamSocket::sendAll(clientFd, pixels, frameSize);
+                published++;
+            }
+
+            bytesPublished += frameSize;
+        }
+
+        /*
+         * Tell the consumer there are no more frames and tear everything
+         * down
+         */
+        void close() {
+
+            if (header != nullptr) {
+                header->closed.store(1);
+                FrameRing::wakeAll(header->published);
+                header = nullptr;
+            }
+
+            if (mapping != nullptr) {
+                munmap(mapping, mappingSize);
+                mapping = nullptr;
+            }
+
+            // A consumer that still has it mapped keeps it until it lets go
+            if (shmFd >= 0) {
+                ::close(shmFd);
+                shm_unlink(endpoint.name.c_str());
+                shmFd = -1;
+            }
+
+            if (clientFd >= 0) {
+                ::close(clientFd);
+                clientFd = -1;
+            }
+        }
+
+        uint64_t getBytesPublished() const {
+            return bytesPublished;
+        }
+
+    private:
+        StreamEndpoint endpoint;
+        uint32_t width;
+        uint32_t height;
+        size_t frameSize;
+        uint32_t published = 0;
+        uint64_t bytesPublished = 0;
+
+        // Shared memory
+        int shmFd = -1;
+        void* mapping = nullptr;
+        size_t mappingSize = 0;
+        FrameRing::Header* header = nullptr;
+        FrameRing::Slot* slots = nullptr;
+
+        // TCP
+        int clientFd = -1;
+
+        void createRing(uint32_t format) {
+
+            // Whatever a crashed run left behind is no use to anyone
+            shm_unlink(endpoint.name.c_str());
+
+            shmFd = shm_open(endpoint.name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (shmFd < 0) {
+                throw std::runtime_error("Unable to create shared memory " + endpoint.name + "!!");
+            }
+
+            size_t headerSize = sizeof(FrameRing::Header) + FrameRing::SLOT_COUNT * sizeof(FrameRing::Slot);
+            size_t dataOffset = FrameRing::pageAlign(headerSize);
+            size_t slotStride = FrameRing::pageAlign(frameSize);
+            mappingSize = dataOffset + FrameRing::SLOT_COUNT * slotStride;
+
+            if (ftruncate(shmFd, (off_t) mappingSize) != 0) {
+                throw std::runtime_error("Unable to size shared memory " + endpoint.name + "!!");
+            }
+
+            mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                throw std::runtime_error("Unable to map shared memory " + endpoint.name + "!!");
+            }
+
+            // ftruncate zeroed it, so the atomics start out at zero too
+            FrameRing::Header* ring = (FrameRing::Header*) mapping;
+            ring->version = FrameRing::VERSION;
+            ring->width = width;
+            ring->height = height;
+            ring->format = format;
+            ring->slotCount = FrameRing::SLOT_COUNT;
+            ring->frameSize = frameSize;
+            ring->slotStride = slotStride;
+            ring->dataOffset = dataOffset;
+            ring->magic.store(FrameRing::MAGIC, std::memory_order_release);
+
+            header = ring;
+            slots = (FrameRing::Slot*) (ring + 1);
+        }
+
+        void acceptConsumer() {
+
+            int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+            if (listenFd < 0) {
+                throw std::runtime_error("Unable to create a socket!!");
+            }
+
+            int reuse = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+            sockaddr_in address = StreamSocket::loopback(endpoint.port);
+            if (bind(listenFd, (sockaddr*) &address, sizeof(address)) != 0 || listen(listenFd, 1) != 0) {
+                ::close(listenFd);
+                throw std::runtime_error("Unable to listen on " + endpoint.toString() + "!!");
+            }
+
+            std::cout << "Waiting for a consumer on " << endpoint.toString() << std::endl;
+            clientFd = accept(listenFd, nullptr, nullptr);
+            ::close(listenFd);
+
+            if (clientFd < 0) {
+                throw std::runtime_error("Unable to accept a consumer on " + endpoint.toString() + "!!");
+            }
+
+            // Frames are big enough to fill packets on their own, but the
+            // small message in front of each shouldn't sit waiting
+            int noDelay = 1;
+            setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        }
+};
+
+/*
+ * The other process's side
+ */
+class FrameConsumer {
+    public:
+
+        // How long to wait for the renderer to turn up
+        static constexpr std::chrono::seconds CONNECT_TIMEOUT{30};
+
+        explicit FrameConsumer(const StreamEndpoint& endpoint) : endpoint(endpoint) {
+            if (endpoint.transport == StreamEndpoint::Transport::SharedMemory) {
+                openRing();
+            } else {
+                connectToPublisher();
+            }
+        }
+
+        FrameConsumer(const FrameConsumer&) = delete;
+        FrameConsumer& operator=(const FrameConsumer&) = delete;
+
+        ~FrameConsumer() {
+            if (mapping != nullptr) {
+                munmap(mapping, mappingSize);
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        /*
+         * Wait for the newest frame and hand it to onFrame, returns false
+         * once the stream has ended. In shared memory the pixels are read
+         * straight out of the ring, so they're only good until onFrame
+         * returns.
+         */
+        template <typename FrameCallback>
+        bool next(FrameCallback onFrame) {
+            return header != nullptr ? nextFromRing(onFrame) : nextFromSocket(onFrame);
+        }
+
+        // Frames we overwrote while onFrame was reading them, only
+        // possible in shared memory when onFrame is slower than a frame
+        uint64_t getTornFrames() const {
+            return tornFrames;
+        }
+
+    private:
+        StreamEndpoint endpoint;
+        int fd = -1;
+
+        void* mapping = nullptr;
+        size_t mappingSize = 0;
+        FrameRing::Header* header = nullptr;
+        FrameRing::Slot* slots = nullptr;
+        uint32_t seen = 0;
+        uint64_t tornFrames = 0;
+
+        // Only for TCP, where the frames have to land somewhere
+        std::vector<uint8_t> buffer;
+
+        template <typename FrameCallback>
+        bool nextFromRing(FrameCallback& onFrame) {
+
+            while (true) {
+
+                uint32_t published = header->published.load(std::memory_order_acquire);
+
+                if (published != seen) {
+
+                    uint32_t slotIndex = (published - 1) % header->slotCount;
+                    FrameRing::Slot& slot = slots[slotIndex];
+
+                    // Odd means it's being rewritten already. The count
+                    // moves on once that's done, so sleep until it does
+                    // rather than spinning through a whole frame's copy,
+                    // then try again with whatever is newest
+                    uint64_t before = slot.sequence.load(std::memory_order_acquire);
+                    if (before % 2 != 0) {
+                        waitForPublish(published);
+                        continue;
+                    }
+
+                    StreamedFrame frame;
+                    frame.frameIndex = slot.frameIndex;
+                    frame.submitTimeNs = slot.submitTimeNs;
+                    frame.publishTimeNs = slot.publishTimeNs;
+                    frame.width = header->width;
+                    frame.height = header->height;
+                    frame.size = header->frameSize;
+                    frame.pixels = (const uint8_t*) mapping + header->dataOffset + slotIndex * header->slotStride;
+
+                    onFrame(frame);
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (slot.sequence.load(std::memory_order_relaxed) != before) {
+                        tornFrames++;
+                    }
+
+                    seen = published;
+                    return true;
+                }
+
+                if (header->closed.load() != 0) {
+                    return false;
+                }
+
+                waitForPublish(published);
+            }
+        }
+
+        // Sleep until the count moves on from published. The timeout is
+        // only there in case the renderer dies without closing the ring.
+        void waitForPublish(uint32_t published) {
+            header->waiters.fetch_add(1);
+            FrameRing::wait(header->published, published, 100000000);
+            header->waiters.fetch_sub(1);
+        }
+
+        template <typename FrameCallback>
+        bool nextFromSocket(FrameCallback& onFrame) {
+
+            FrameMessage message;
+            if (!StreamSocket::receiveAll(fd, &message, sizeof(message))) {
+                return false;
+            }
+
+            buffer.resize(message.size);
+            if (!StreamSocket::receiveAll(fd, buffer.data(), buffer.size())) {
+                throw std::runtime_error("The frame stream was cut off mid frame!!");
+            }
+
+            StreamedFrame frame = {message.frameIndex, message.submitTimeNs, message.publishTimeNs,
+                                   message.width, message.height, (size_t) message.size, buffer.data()};
+            onFrame(frame);
+            return true;
+        }
+
+        void openRing() {
+
+            auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+            auto tooLate = [&] { return std::chrono::steady_clock::now() > deadline; };
+
+            // The renderer may not have started yet
+            while ((fd = shm_open(endpoint.name.c_str(), O_RDWR, 0)) < 0) {
+                if (tooLate()) {
+                    throw std::runtime_error("Nobody published frames on " + endpoint.toString() + "!!");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            struct stat info;
+            while (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(FrameRing::Header)) {
+                if (tooLate()) {
+                    throw std::runtime_error("The ring on " + endpoint.toString() + " was never set up!!");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            mappingSize = (size_t) info.st_size;
+            mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                throw std::runtime_error("Unable to map shared memory " + endpoint.name + "!!");
+            }
+
+            FrameRing::Header* ring = (FrameRing::Header*) mapping;
+            while (ring->magic.load(std::memory_order_acquire) != FrameRing::MAGIC) {
+                if (tooLate()) {
+                    throw std::runtime_error("The ring on " + endpoint.toString() + " was never set up!!");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            if (ring->version != FrameRing::VERSION) {
+                throw std::runtime_error("The ring on " + endpoint.toString() + " is a different version!!");
+            }
+
+            header = ring;
+            slots = (FrameRing::Slot*) (ring + 1);
+        }
+
+        void connectToPublisher() {
+
+            auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+            sockaddr_in address = StreamSocket::loopback(endpoint.port);
+
+            while (true) {
+
+                fd = socket(AF_INET, SOCK_STREAM, 0);
+                if (fd < 0) {
+                    throw std::runtime_error("Unable to create a socket!!");
+                }
+
+                if (connect(fd, (sockaddr*) &address, sizeof(address)) == 0) {
+                    return;
+                }
+
+                close(fd);
+                fd = -1;
+
+                if (std::chrono::steady_clock::now() > deadline) {
+                    throw std::runtime_error("Nobody published frames on " + endpoint.toString() + "!!");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+};
+
+#endif
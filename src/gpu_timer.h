@@ -0,0 +1,186 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dispatch.h"
+
+/*
+ * Times the passes of a frame on the GPU with timestamp queries.
+ *
+ * A frame is split into regions (say "light binning" then "shading"), and
+ * each recorded command buffer gets a slot of its own: begin() at the start
+ * of the slot's command buffer, then mark() at the end of each region.
+ * Command buffers are recorded once and submitted over and over, so the
+ * queries are reset at the start of every run of them rather than by us.
+ *
+ * Once the GPU has finished a submit, collect() adds its times to the
+ * running totals. Nothing here waits, a slot whose results aren't there
+ * yet is just skipped.
+ *
+ * Queues without timestamps (timestampValidBits of zero) leave the timer
+ * disabled, and everything but enabled() does nothing.
+ */
+class GpuTimer {
+    public:
+
+        GpuTimer() = default;
+        GpuTimer(const GpuTimer&) = delete;
+        GpuTimer& operator=(const GpuTimer&) = delete;
+
+        ~GpuTimer() {
+            if (queryPool != VK_NULL_HANDLE) {
+                dispatch->vkDestroyQueryPool(device, queryPool, allocator);
+            }
+        }
+
+        void init(VkDevice device, const DeviceDispatch& dispatch, const VkPhysicalDeviceLimits& limits,
+                  uint32_t timestampValidBits, uint32_t slots, const std::vector<std::string>& regions,
+                  const VkAllocationCallbacks* allocator) {
+
+            this->device = device;
+            this->dispatch = &dispatch;
+            this->allocator = allocator;
+            this->regions = regions;
+            this->slots = slots;
+
+            totals.assign(regions.size(), 0.0);
+            last.assign(regions.size(), 0.0);
+            results.resize(regions.size() + 1);
+
+            if (timestampValidBits == 0) {
+                return;
+            }
+
+            period = limits.timestampPeriod;
+            mask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+            VkQueryPoolCreateInfo queryInfo = {};
+            queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryInfo.queryCount = slots * marksPerSlot();
+
+            if (dispatch.vkCreateQueryPool(device, &queryInfo, allocator, &queryPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the timestamp query pool!!");
+            }
+        }
+
+        bool enabled() const {
+            return queryPool != VK_NULL_HANDLE;
+        }
+
+        /*
+         * Start of the frame, outside any render pass
+         */
+        void begin(VkCommandBuffer commandBuffer, uint32_t slot) {
+
+            if (!enabled()) {
+                return;
+            }
+
+            dispatch->vkCmdResetQueryPool(commandBuffer, queryPool, slot * marksPerSlot(), marksPerSlot());
+            dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool,
+                                          slot * marksPerSlot());
+        }
+
+        /*
+         * End of region, once everything recorded before it has finished
+         */
+        void mark(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t region) {
+
+            if (!enabled()) {
+                return;
+            }
+
+            dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool,
+                                          slot * marksPerSlot() + region + 1);
+        }
+
+        /*
+         * Add the times from the slot's last submit, which has to have
+         * finished. Returns false if they weren't there.
+         */
+        bool collect(uint32_t slot) {
+
+            if (!enabled()) {
+                return false;
+            }
+
+            VkResult result = dispatch->vkGetQueryPoolResults(device, queryPool, slot * marksPerSlot(),
+                                                              marksPerSlot(), results.size() * sizeof(uint64_t),
+                                                              results.data(), sizeof(uint64_t),
+                                                              VK_QUERY_RESULT_64_BIT);
+            if (result != VK_SUCCESS) {
+                return false;
+            }
+
+            for (size_t region = 0; region < regions.size(); region++) {
+                last[region] = ((results[region + 1] - results[region]) & mask) * period * 1e-6;
+                totals[region] += last[region];
+            }
+            frames++;
+
+            return true;
+        }
+
+        void clear() {
+            totals.assign(regions.size(), 0.0);
+            frames = 0;
+        }
+
+        const std::vector<std::string>& getRegions() const {
+            return regions;
+        }
+
+        uint64_t getFrames() const {
+            return frames;
+        }
+
+        // Milliseconds, over every frame collected since clear()
+        double averageMs(size_t region) const {
+            return frames == 0 ? 0.0 : totals[region] / frames;
+        }
+
+        // And for just the frame collected last
+        double lastMs(size_t region) const {
+            return last[region];
+        }
+
+        // The whole of the frame collected last, every region together
+        double lastFrameMs() const {
+            double ms = 0.0;
+            for (double regionMs : last) {
+                ms += regionMs;
+            }
+            return ms;
+        }
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        const DeviceDispatch* dispatch = nullptr;
+        const VkAllocationCallbacks* allocator = nullptr;
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+
+        std::vector<std::string> regions;
+        uint32_t slots = 0;
+
+        // Nanoseconds a tick, and the bits of a timestamp that count
+        double period = 1.0;
+        uint64_t mask = ~0ull;
+
+        std::vector<uint64_t> results;
+        std::vector<double> totals;
+        std::vector<double> last;
+        uint64_t frames = 0;
+
+        uint32_t marksPerSlot() const {
+            return (uint32_t) regions.size() + 1;
+        }
+};
+
+#endif
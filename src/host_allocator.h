@@ -0,0 +1,508 @@
+#ifndef HOST_ALLOCATOR_H
+#define HOST_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Our answer to the pAllocator argument every vkCreate and vkDestroy call
+ * takes. Left as nullptr the driver's host memory comes straight from
+ * malloc, which shows up in the frame loop as a steady trickle of small
+ * allocations. Instead we route each allocation by its scope:
+ *
+ *   - COMMAND: memory that only lives for the duration of a single Vulkan
+ *     call. This comes out of an arena which is simply rewound once a frame.
+ *
+ *   - OBJECT: memory that lives as long as a Vulkan object. Small blocks
+ *     come from pools of fixed size blocks which are recycled rather than
+ *     returned to the system.
+ *
+ *   - everything else (cache, device, instance) lives for a long time and
+ *     is rarely allocated, so it goes to the system allocator.
+ *
+ * Each scope also keeps counters of allocations, bytes and peak bytes so we
+ * can see what the driver is doing behind our back.
+ */
+class HostAllocator {
+    public:
+        enum class Mode {
+            Driver,         // Pass nullptr, let the driver use malloc
+            Tracking,       // Our callbacks, but everything goes to malloc
+            Pooled          // Our callbacks with the arena and pools
+        };
+
+        static const size_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+        struct ScopeStats {
+            uint64_t allocations = 0;
+            uint64_t frees = 0;
+            uint64_t reallocations = 0;
+            uint64_t bytes = 0;             // Currently allocated
+            uint64_t peakBytes = 0;
+            uint64_t totalBytes = 0;        // Ever allocated
+        };
+
+        struct Stats {
+            ScopeStats scopes[SCOPE_COUNT];
+
+            // How many allocations actually reached malloc, and how many we
+            // served ourselves
+            uint64_t systemAllocations = 0;
+            uint64_t pooledAllocations = 0;
+            uint64_t arenaAllocations = 0;
+        };
+
+        explicit HostAllocator(Mode mode) : mode(mode) {
+            callbackTable.pUserData = this;
+            callbackTable.pfnAllocation = &HostAllocator::allocationCallback;
+            callbackTable.pfnReallocation = &HostAllocator::reallocationCallback;
+            callbackTable.pfnFree = &HostAllocator::freeCallback;
+            callbackTable.pfnInternalAllocation = &HostAllocator::internalAllocationCallback;
+            callbackTable.pfnInternalFree = &HostAllocator::internalFreeCallback;
+        }
+
+        HostAllocator(const HostAllocator&) = delete;
+        HostAllocator& operator=(const HostAllocator&) = delete;
+
+        ~HostAllocator() {
+            for (void* slab : slabs) {
+                std::free(slab);
+            }
+            for (auto& block : arenaBlocks) {
+                std::free(block.memory);
+            }
+        }
+
+        /*
+         * Called after every allocation we make for the driver, heap is
+         * true if it had to go to malloc. Used to feed AllocationTracker.
+         */
+        using AllocationHook = void (*)(size_t size, bool heap);
+
+        void setAllocationHook(AllocationHook hook) {
+            allocationHook = hook;
+        }
+
+        /*
+         * What to pass as pAllocator, nullptr when the driver should do its
+         * own thing.
+         */
+        const VkAllocationCallbacks* callbacks() const {
+            return mode == Mode::Driver ? nullptr : &callbackTable;
+        }
+
+        /*
+         * Call once a frame, when no Vulkan call is in progress. Rewinds the
+         * arena if everything allocated from it has been freed, which it
+         * should have been as command scope memory can't outlive the call
+         * it was allocated in.
+         */
+        void endFrame() {
+
+            std::lock_guard<std::mutex> lock(arenaMutex);
+
+            if (arenaLive == 0) {
+                arenaBlock = 0;
+                for (auto& block : arenaBlocks) {
+                    block.used = 0;
+                }
+            }
+        }
+
+        Stats getStats() const {
+
+            Stats stats;
+
+            for (size_t i = 0; i < SCOPE_COUNT; i++) {
+                const Counters& counters = scopeCounters[i];
+                stats.scopes[i].allocations = counters.allocations;
+                stats.scopes[i].frees = counters.frees;
+                stats.scopes[i].reallocations = counters.reallocations;
+                stats.scopes[i].bytes = counters.bytes;
+                stats.scopes[i].peakBytes = counters.peakBytes;
+                stats.scopes[i].totalBytes = counters.totalBytes;
+            }
+
+            stats.systemAllocations = systemAllocations;
+            stats.pooledAllocations = pooledAllocations;
+            stats.arenaAllocations = arenaAllocations;
+
+            return stats;
+        }
+
+        /*
+         * The allocations made between two snapshots, e.g. just the frame
+         * loop. Live and peak bytes are taken from the later one.
+         */
+        static Stats difference(const Stats& later, const Stats& earlier) {
+
+            Stats stats = later;
+
+            for (size_t i = 0; i < SCOPE_COUNT; i++) {
+                stats.scopes[i].allocations -= earlier.scopes[i].allocations;
+                stats.scopes[i].frees -= earlier.scopes[i].frees;
+                stats.scopes[i].reallocations -= earlier.scopes[i].reallocations;
+                stats.scopes[i].totalBytes -= earlier.scopes[i].totalBytes;
+            }
+
+            stats.systemAllocations -= earlier.systemAllocations;
+            stats.pooledAllocations -= earlier.pooledAllocations;
+            stats.arenaAllocations -= earlier.arenaAllocations;
+
+            return stats;
+        }
+
+        static const char* scopeName(size_t scope) {
+            static const char* names[SCOPE_COUNT] = {"command", "object", "cache", "device", "instance"};
+            return scope < SCOPE_COUNT ? names[scope] : "unknown";
+        }
+
+        /*
+         * Print the counters, along with how many allocations per frame
+         * went to malloc compared with how many the driver made.
+         */
+        static void printStats(std::ostream& out, const Stats& stats, uint64_t frames) {
+
+            out << "Host allocations by scope:\n";
+
+            uint64_t total = 0;
+            for (size_t i = 0; i < SCOPE_COUNT; i++) {
+                const ScopeStats& scope = stats.scopes[i];
+                out << "  " << scopeName(i) << ": " << scope.allocations << " allocations ("
+                    << scope.reallocations << " reallocations), " << scope.totalBytes << " bytes, "
+                    << scope.bytes << " bytes live, peak " << scope.peakBytes << " bytes\n";
+                total += scope.allocations;
+            }
+
+            out << "  " << total << " driver allocations, " << stats.systemAllocations << " from malloc, "
+                << stats.pooledAllocations << " from pools, " << stats.arenaAllocations << " from the arena";
+
+            if (frames > 0) {
+                out << " (" << (double) total / frames << " driver allocations/frame)";
+            }
+
+            out << std::endl;
+        }
+
+    private:
+
+        // Each block we hand out is preceded by one of these, so free and
+        // realloc know where it came from
+        enum class Source : uint32_t { System, Pool, Arena };
+
+        struct Header {
+            Source source;
+            uint32_t scope;
+            uint32_t sizeClass;
+            uint32_t offset;        // From the start of the real allocation
+            size_t size;            // What was asked for
+        };
+
+        // Big enough for the header and matching malloc's alignment, so
+        // anything asking for this or less can use the pools as they are
+        static const size_t HEADER_SPACE = 32;
+        static_assert(sizeof(Header) <= HEADER_SPACE, "Header doesn't fit");
+
+        // The pools hold blocks of 64 bytes up to 4KiB (header included),
+        // each pool grows a slab at a time
+        static const size_t SIZE_CLASS_COUNT = 7;
+        static const size_t SMALLEST_CLASS = 64;
+        static const size_t SLAB_SIZE = 64 * 1024;
+
+        static const size_t ARENA_BLOCK_SIZE = 256 * 1024;
+
+        struct Counters {
+            std::atomic<uint64_t> allocations{0};
+            std::atomic<uint64_t> frees{0};
+            std::atomic<uint64_t> reallocations{0};
+            std::atomic<uint64_t> bytes{0};
+            std::atomic<uint64_t> peakBytes{0};
+            std::atomic<uint64_t> totalBytes{0};
+        };
+
+        struct ArenaBlock {
+            uint8_t* memory;
+            size_t size;
+            size_t used;
+        };
+
+        const Mode mode;
+        VkAllocationCallbacks callbackTable = {};
+        AllocationHook allocationHook = nullptr;
+
+        Counters scopeCounters[SCOPE_COUNT];
+        std::atomic<uint64_t> systemAllocations{0};
+        std::atomic<uint64_t> pooledAllocations{0};
+        std::atomic<uint64_t> arenaAllocations{0};
+
+        // Pools, a free list for each size class
+        std::mutex poolMutex;
+        void* freeLists[SIZE_CLASS_COUNT] = {};
+        std::vector<void*> slabs;
+
+        // The arena
+        std::mutex arenaMutex;
+        std::vector<ArenaBlock> arenaBlocks;
+        size_t arenaBlock = 0;
+        uint64_t arenaLive = 0;
+
+        static size_t alignUp(size_t value, size_t alignment) {
+            return (value + alignment - 1) & ~(alignment - 1);
+        }
+
+        static Header* headerOf(void* memory) {
+            return (Header*) ((uint8_t*) memory - sizeof(Header));
+        }
+
+        void countAllocation(size_t scope, size_t size) {
+
+            Counters& counters = scopeCounters[scope];
+            counters.allocations++;
+            counters.totalBytes += size;
+
+            uint64_t bytes = counters.bytes += size;
+            uint64_t peak = counters.peakBytes;
+            while (bytes > peak && !counters.peakBytes.compare_exchange_weak(peak, bytes)) {}
+        }
+
+        void countFree(size_t scope, size_t size) {
+            scopeCounters[scope].frees++;
+            scopeCounters[scope].bytes -= size;
+        }
+
+        /*
+         * Put the header just before the aligned address we hand out
+         */
+        static void* place(void* base, size_t offset, Source source, size_t scope, uint32_t sizeClass,
+                           size_t size) {
+
+            void* memory = (uint8_t*) base + offset;
+
+            Header* header = headerOf(memory);
+            header->source = source;
+            header->scope = (uint32_t) scope;
+            header->sizeClass = sizeClass;
+            header->offset = (uint32_t) offset;
+            header->size = size;
+
+            return memory;
+        }
+
+        void* allocate(size_t size, size_t alignment, size_t scope) {
+
+            alignment = std::max(alignment, (size_t) 16);
+            size_t offset = alignUp(HEADER_SPACE, alignment);
+
+            void* memory = nullptr;
+            bool heap = false;
+
+            if (mode == Mode::Pooled && scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+                memory = allocateArena(size, alignment, offset, scope);
+            } else if (mode == Mode::Pooled && scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT &&
+                       offset == HEADER_SPACE) {
+                memory = allocatePool(size, scope);
+            }
+
+            if (memory == nullptr) {
+                memory = allocateSystem(size, alignment, offset, scope);
+                heap = true;
+            }
+
+            if (memory != nullptr) {
+                countAllocation(scope, size);
+
+                if (allocationHook != nullptr) {
+                    allocationHook(size, heap);
+                }
+            }
+
+            return memory;
+        }
+
+        void* allocateSystem(size_t size, size_t alignment, size_t offset, size_t scope) {
+
+            // aligned_alloc wants the size to be a multiple of the alignment
+            void* base = std::aligned_alloc(alignment, alignUp(offset + size, alignment));
+
+            if (base == nullptr) {
+                return nullptr;
+            }
+
+            systemAllocations++;
+            return place(base, offset, Source::System, scope, 0, size);
+        }
+
+        void* allocatePool(size_t size, size_t scope) {
+
+            size_t sizeClass = 0;
+            size_t classSize = SMALLEST_CLASS;
+            while (classSize < HEADER_SPACE + size) {
+                sizeClass++;
+                classSize *= 2;
+            }
+
+            if (sizeClass >= SIZE_CLASS_COUNT) {
+                return nullptr;
+            }
+
+            void* base;
+            {
+                std::lock_guard<std::mutex> lock(poolMutex);
+
+                if (freeLists[sizeClass] == nullptr) {
+
+                    // Carve a new slab up into blocks of this class
+                    uint8_t* slab = (uint8_t*) std::aligned_alloc(HEADER_SPACE, SLAB_SIZE);
+                    if (slab == nullptr) {
+                        return nullptr;
+                    }
+                    slabs.push_back(slab);
+
+                    for (size_t i = 0; i + classSize <= SLAB_SIZE; i += classSize) {
+                        *(void**) (slab + i) = freeLists[sizeClass];
+                        freeLists[sizeClass] = slab + i;
+                    }
+                }
+
+                base = freeLists[sizeClass];
+                freeLists[sizeClass] = *(void**) base;
+            }
+
+            pooledAllocations++;
+            return place(base, HEADER_SPACE, Source::Pool, scope, (uint32_t) sizeClass, size);
+        }
+
+        void* allocateArena(size_t size, size_t alignment, size_t offset, size_t scope) {
+
+            std::lock_guard<std::mutex> lock(arenaMutex);
+
+            size_t needed = offset + size;
+
+            while (true) {
+
+                if (arenaBlock == arenaBlocks.size()) {
+
+                    size_t blockSize = std::max(ARENA_BLOCK_SIZE, alignUp(needed + alignment, alignment));
+                    uint8_t* memory = (uint8_t*) std::aligned_alloc(HEADER_SPACE,
+                                                                     alignUp(blockSize, HEADER_SPACE));
+                    if (memory == nullptr) {
+                        return nullptr;
+                    }
+                    arenaBlocks.push_back({memory, blockSize, 0});
+                }
+
+                ArenaBlock& block = arenaBlocks[arenaBlock];
+
+                // Align the address we hand out, not just the offset into
+                // the block
+                uintptr_t start = (uintptr_t) block.memory + block.used;
+                size_t padding = alignUp(start + offset, alignment) - (start + offset);
+
+                if (block.used + padding + needed <= block.size) {
+                    void* base = block.memory + block.used + padding;
+                    block.used += padding + needed;
+                    arenaLive++;
+                    arenaAllocations++;
+                    return place(base, offset, Source::Arena, scope, 0, size);
+                }
+
+                // Doesn't fit, move on to the next block (or a new one)
+                arenaBlock++;
+            }
+        }
+
+        void release(void* memory) {
+
+            if (memory == nullptr) {
+                return;
+            }
+
+            Header* header = headerOf(memory);
+            countFree(header->scope, header->size);
+
+            switch (header->source) {
+                case Source::System:
+                    std::free((uint8_t*) memory - header->offset);
+                    break;
+
+                case Source::Pool: {
+                    void* base = (uint8_t*) memory - header->offset;
+                    std::lock_guard<std::mutex> lock(poolMutex);
+                    *(void**) base = freeLists[header->sizeClass];
+                    freeLists[header->sizeClass] = base;
+                    break;
+                }
+
+                case Source::Arena: {
+                    // Nothing to give back until the whole arena is rewound
+                    std::lock_guard<std::mutex> lock(arenaMutex);
+                    arenaLive--;
+                    break;
+                }
+            }
+        }
+
+        void* reallocate(void* original, size_t size, size_t alignment, size_t scope) {
+
+            if (original == nullptr) {
+                return allocate(size, alignment, scope);
+            }
+
+            if (size == 0) {
+                release(original);
+                return nullptr;
+            }
+
+            void* memory = allocate(size, alignment, scope);
+            if (memory == nullptr) {
+                return nullptr;
+            }
+
+            scopeCounters[scope].reallocations++;
+
+            memcpy(memory, original, std::min(size, headerOf(original)->size));
+            release(original);
+
+            return memory;
+        }
+
+        static VKAPI_ATTR void* VKAPI_CALL allocationCallback(void* userData, size_t size, size_t alignment,
+                                                              VkSystemAllocationScope scope) {
+            return ((HostAllocator*) userData)->allocate(size, alignment, scope);
+        }
+
+        static VKAPI_ATTR void* VKAPI_CALL reallocationCallback(void* userData, void* original, size_t size,
+                                                                size_t alignment, VkSystemAllocationScope scope) {
+            return ((HostAllocator*) userData)->reallocate(original, size, alignment, scope);
+        }
+
+        static VKAPI_ATTR void VKAPI_CALL freeCallback(void* userData, void* memory) {
+            ((HostAllocator*) userData)->release(memory);
+        }
+
+        // The driver tells us about memory it allocates itself (e.g. for
+        // executable code) so we can count it
+        static VKAPI_ATTR void VKAPI_CALL internalAllocationCallback(void* userData, size_t size,
+                                                                     VkInternalAllocationType type,
+                                                                     VkSystemAllocationScope scope) {
+            ((HostAllocator*) userData)->countAllocation(scope, size);
+        }
+
+        static VKAPI_ATTR void VKAPI_CALL internalFreeCallback(void* userData, size_t size,
+                                                               VkInternalAllocationType type,
+                                                               VkSystemAllocationScope scope) {
+            ((HostAllocator*) userData)->countFree(scope, size);
+        }
+};
+
+#endif
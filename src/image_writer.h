@@ -0,0 +1,243 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc_tracker.h"
+
+/*
+ * Writes rendered frames to disk on a pool of background threads, so the
+ * render loop only has to copy the pixels out of the readback buffer before
+ * moving on to the next frame.
+ *
+ * Frames come in as tightly packed BGRA rows (the layout of our
+ * B8G8R8A8_UNORM images) and go out as either
+ *
+ *   - PPM: a binary (P6) RGB image any image viewer can open
+ *   - RAW: the BGRA bytes exactly as the GPU produced them
+ */
+class ImageWriter {
+    public:
+        enum class Format { PPM, RAW };
+
+        ImageWriter(const std::string& directory, Format format, unsigned int threadCount)
+            : directory(directory), format(format) {
+
+            if (threadCount == 0) {
+                threadCount = 1;
+            }
+
+            // Don't let the renderer get too far ahead of the disk, each
+            // queued frame is a full copy of the image
+            maxQueued = threadCount * 2;
+
+            for (unsigned int i = 0; i < threadCount; i++) {
+                workers.emplace_back(&ImageWriter::work, this);
+            }
+        }
+
+        ImageWriter(const ImageWriter&) = delete;
+        ImageWriter& operator=(const ImageWriter&) = delete;
+
+        ~ImageWriter() {
+            stop();
+        }
+
+        /*
+         * Get a buffer to copy a frame into, buffers are recycled once a
+         * frame has been written so we aren't allocating one every frame.
+         */
+        std::vector<uint8_t> acquireBuffer(size_t size) {
+
+            std::vector<uint8_t> buffer;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!freeBuffers.empty()) {
+                    buffer = std::move(freeBuffers.back());
+                    freeBuffers.pop_back();
+                }
+            }
+
+            buffer.resize(size);
+            return buffer;
+        }
+
+        /*
+         * Queue a frame to be written, this blocks if the writers have fallen
+         * too far behind.
+         */
+        void write(uint32_t frameIndex, uint32_t width, uint32_t height, std::vector<uint8_t> pixels) {
+
+            std::unique_lock<std::mutex> lock(mutex);
+            spaceAvailable.wait(lock, [this] { return jobs.size() < maxQueued || error; });
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+
+            jobs.push_back({frameIndex, width, height, std::move(pixels)});
+            workAvailable.notify_one();
+        }
+
+        /*
+         * Wait for every queued frame to hit the disk.
+         */
+        void finish() {
+
+            std::unique_lock<std::mutex> lock(mutex);
+            allDone.wait(lock, [this] { return (jobs.empty() && busy == 0) || error; });
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        uint64_t getBytesWritten() const {
+            return bytesWritten;
+        }
+
+    private:
+        struct Job {
+            uint32_t frameIndex;
+            uint32_t width;
+            uint32_t height;
+            std::vector<uint8_t> pixels;
+        };
+
+        std::string directory;
+        Format format;
+        size_t maxQueued;
+
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable spaceAvailable;
+        std::condition_variable allDone;
+
+        std::deque<Job> jobs;
+        std::vector<std::vector<uint8_t>> freeBuffers;
+        std::vector<std::thread> workers;
+        unsigned int busy = 0;
+        bool stopping = false;
+        std::exception_ptr error;
+        uint64_t bytesWritten = 0;
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+
+            workAvailable.notify_all();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            workers.clear();
+        }
+
+        void work() {
+
+            AllocationTracker::setThreadSubsystem(AllocationTracker::Subsystem::Writer);
+
+            // Each thread keeps its own scratch space for the converted rows
+            std::vector<uint8_t> scratch;
+
+            while (true) {
+
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    workAvailable.wait(lock, [this] { return !jobs.empty() || stopping; });
+
+                    if (jobs.empty()) {
+                        return;
+                    }
+
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                    busy++;
+                }
+                spaceAvailable.notify_one();
+
+                size_t written = 0;
+                try {
+                    written = save(job, scratch);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    busy--;
+                    bytesWritten += written;
+                    freeBuffers.push_back(std::move(job.pixels));
+                }
+                spaceAvailable.notify_all();
+                allDone.notify_all();
+            }
+        }
+
+        size_t save(const Job& job, std::vector<uint8_t>& scratch) {
+
+            char filename[32];
+            snprintf(filename, sizeof(filename), "frame_%06u.%s", job.frameIndex,
+                     format == Format::PPM ? "ppm" : "raw");
+
+            std::string path = directory + "/" + filename;
+            FILE* file = fopen(path.c_str(), "wb");
+
+            if (file == nullptr) {
+                throw std::runtime_error("Unable to open " + path + " for writing!!");
+            }
+
+            size_t written = 0;
+            bool ok = false;
+
+            if (format == Format::PPM) {
+
+                // PPM wants RGB, so drop the alpha and swap the red and blue
+                // channels around
+                size_t pixelCount = (size_t) job.width * job.height;
+                scratch.resize(pixelCount * 3);
+
+                const uint8_t* src = job.pixels.data();
+                uint8_t* dst = scratch.data();
+                for (size_t i = 0; i < pixelCount; i++, src += 4, dst += 3) {
+                    dst[0] = src[2];
+                    dst[1] = src[1];
+                    dst[2] = src[0];
+                }
+
+                int header = fprintf(file, "P6\n%u %u\n255\n", job.width, job.height);
+                size_t pixels = fwrite(scratch.data(), 1, scratch.size(), file);
+
+                ok = header > 0 && pixels == scratch.size();
+                written = (header > 0 ? (size_t) header : 0) + pixels;
+
+            } else {
+                written = fwrite(job.pixels.data(), 1, job.pixels.size(), file);
+                ok = written == job.pixels.size();
+            }
+
+            // A short write means the disk is full (or worse), and the
+            // frame on disk is cut off
+            if (fclose(file) != 0 || !ok) {
+                throw std::runtime_error("Unable to write " + path + "!!");
+            }
+
+            return written;
+        }
+};
+
+#endif
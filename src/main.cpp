@@ -1,15 +1,48 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
 #include <set>
 #include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "alloc_tracker.h"
+#include "barriers.h"
+#include "clustered_lighting.h"
+#include "shadow_atlas.h"
+#include "compute.h"
+#include "debug_log.h"
+#include "debug_names.h"
+#include "device_caps.h"
+#include "dispatch.h"
+#include "dynamic_resolution.h"
+#include "temporal_upscale.h"
+#include "frame_stream.h"
+#include "gpu_timer.h"
+#include "host_allocator.h"
+#include "image_writer.h"
+#include "multi_gpu.h"
+#include "post_process.h"
+#include "regress.h"
+#include "startup.h"
+#include "submit.h"
+#include "timeline.h"
+#include "video_encoder.h"
+
 /*
  * This struct will tell us which index? a certain
  * queue family can be found. -1 denotes the family
@@ -26,54 +59,360 @@ struct QueueFamilyIndices {
 };
 
 /*
- * This struct will hold the capabilities of a particular
- * device's swap chain support. We will need this to make sure
- * the device we choose is compatible with our paricular window
- * surface
+ * How much checking the validation layer does for us. Each step up catches
+ * more and costs more, GPU assisted validation in particular can make
+ * frames many times slower.
  */
-struct SwapChainSupportDetails {
-    VkSurfaceCapabilitiesKHR capabilities;
-    std::vector<VkSurfaceFormatKHR> formats;
-    std::vector<VkPresentModeKHR> presentModes;
+enum class ValidationProfile {
+    Off,                // No layer at all, nothing between us and the driver
+    Core,               // The usual API usage checks
+    Synchronization,    // Plus hazards between commands and submissions
+    GpuAssisted,        // Plus checks done by instrumenting our shaders
+    BestPractices       // Plus warnings about things that are legal but slow
 };
 
 /*
- * This function looks up the debug callback function
- * destructor and loads it for us
+ * Everything that can be set from the command line
  */
-void DestroyDebugReportCallbackEXT(VkInstance instance,
-                                   VkDebugReportCallbackEXT callback,
-                                   const VkAllocationCallbacks* pAllocator) {
-
-    // Lookup the function
-    auto func = (PFN_vkDestroyDebugReportCallbackEXT)
-                  vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
-
-    // Did it work?
-    if (func != nullptr) {
-        func(instance, callback, pAllocator);
-    }
-}
+struct AppOptions {
+
+    // Size of the window (or the images in batch mode)
+    uint32_t width = 800;
+    uint32_t height = 600;
+
+    // How many windows to open, e.g. one for each monitor. They all share
+    // the one device and are presented together.
+    uint32_t windows = 1;
+
+    // Debug builds validate by default, release builds don't but can
+    // still ask for it with --validation
+    #ifdef NDEBUG
+        ValidationProfile validation = ValidationProfile::Off;
+    #else
+        ValidationProfile validation = ValidationProfile::Core;
+    #endif
+
+    // Use VK_KHR_timeline_semaphore when the device supports it, pass
+    // --fences to force the fence backend for comparison
+    bool preferTimelineSemaphores = true;
+
+    // Draw with VK_KHR_dynamic_rendering when the device supports it, pass
+    // --render-pass to use a render pass and framebuffers regardless
+    bool preferDynamicRendering = true;
+
+    // Record barriers with VK_KHR_synchronization2 when the device supports
+    // it, pass --legacy-barriers to use vkCmdPipelineBarrier regardless
+    bool preferSynchronization2 = true;
+
+    // Run the independent startup steps on worker threads, pass
+    // --serial-init to run them one after another for comparison
+    bool parallelInit = true;
+
+    // Print how long each startup step took once the first frame is out
+    bool profileStartup = false;
+
+    // Keep what we learn about the physical devices in this file between
+    // runs, empty means ask the driver every time
+    std::string capabilityCachePath;
+
+    // Where the driver's host memory comes from, see host_allocator.h
+    HostAllocator::Mode hostAllocator = HostAllocator::Mode::Pooled;
+
+    // Treat any heap allocation in drawFrame() (once it has warmed up) as
+    // an error, the regression harness always does
+    bool strictAllocations = false;
+
+    // Render into images of our own instead of a window. Batch and
+    // regression mode imply this.
+    bool headless = false;
+
+    // Batch mode: render this many frames without a window and write them
+    // to disk. Zero means open a window as normal.
+    uint32_t batchFrames = 0;
+    std::string outputDirectory = ".";
+    ImageWriter::Format outputFormat = ImageWriter::Format::PPM;
+    unsigned int writerThreads = 0;
+
+    // Capture mode: turn the batch's frames into a video instead of
+    // separate images. A .y4m file is written directly, anything else
+    // goes through ffmpeg.
+    std::string captureFile;
+    uint32_t captureRate = 60;
+
+    // Streaming: hand the batch's frames to another process as they're
+    // drawn ("shm:NAME" or "tcp:PORT", see frame_stream.h), or be that
+    // other process and report how long the frames took to arrive
+    std::string streamTo;
+    std::string consumeFrom;
+
+    // Compute mode: draw nothing, run the kernels in compute.h over this
+    // many elements and report how fast they went
+    bool computeBench = false;
+    uint32_t computeElements = 1 << 24;
+
+    // How many copies of the triangle to draw, more than one is only
+    // useful as a stress test
+    uint32_t instances = 1;
+
+    // Light the triangle with this many point and spot lights, binned into
+    // clusters on the GPU (see clustered_lighting.h). Zero leaves it unlit.
+    // The light benchmark times the lighting with 10 up to 100000 of them.
+    uint32_t lights = 0;
+    bool lightBench = false;
+
+    // Give this many of the spot lights shadows, from a cached atlas (see
+    // shadow_atlas.h), with shadowCasters triangles moving through the
+    // scene. The shadow benchmark times the atlas updates with and without
+    // the cache.
+    uint32_t shadows = 0;
+    uint32_t shadowCasters = 4;
+    bool shadowBench = false;
+
+    // Draw the scene into an HDR image and take it through bloom,
+    // tonemapping, colour grading and FXAA on the way to the output (see
+    // post_process.h). The passes are fused into two dispatches unless
+    // postUnfused. The post benchmark times them both ways.
+    bool post = false;
+    bool postUnfused = false;
+    bool postBench = false;
+
+    // Hold the GPU's frame time at this many milliseconds by drawing the
+    // scene at a lower resolution and upscaling it (see
+    // dynamic_resolution.h), zero always draws it at full resolution. The
+    // resolution benchmark changes the load underneath and reports how
+    // well the frame time held.
+    double targetFrameMs = 0.0;
+    bool resolutionBench = false;
+
+    // Draw the scene at this fraction of the output's size and build the
+    // full size image up over several frames (see temporal_upscale.h),
+    // zero doesn't. The temporal benchmark compares the cost with drawing
+    // at full resolution.
+    float temporalScale = 0.0f;
+    bool temporalBench = false;
+
+    // Spread batch rendering over several GPUs, see multi_gpu.h. gpus caps
+    // how many we use, zero means all of them.
+    MultiGpuMode multiGpu = MultiGpuMode::Off;
+    uint32_t gpus = 0;
+
+    // Render on this physical device rather than the first suitable one,
+    // -1 means pick
+    int deviceIndex = -1;
+
+    // Which of the batch's frames are ours to draw: firstFrame,
+    // firstFrame + frameStride and so on. Only the render workers change
+    // these, each takes every Nth frame.
+    uint32_t firstFrame = 0;
+    uint32_t frameStride = 1;
+
+    // Regression mode: render the reference scenes headlessly and compare
+    // them against the golden images and performance baselines
+    bool regress = false;
+    std::string goldenDirectory = "golden";
+    bool updateGolden = false;
+    uint32_t imageTolerance = 2;            // Per channel, out of 255
+    double maxDifferentPixels = 0.001;      // Fraction of the image
+    double perfThreshold = 0.25;            // Fraction slower than baseline
+};
 
 /*
- * This function looks up the debug callback creator function
- * and loads it for us
+ * Turn the command line into an AppOptions
  */
-VkResult CreateDebugReportCallbackEXT(VkInstance instance,
-                                      const VkDebugReportCallbackCreateInfoEXT* pCreateInfo,
-                                      const VkAllocationCallbacks* pAllocator,
-                                      VkDebugReportCallbackEXT* pCallback) {
-
-    // Lookup the address of the function we want
-    auto func = (PFN_vkCreateDebugReportCallbackEXT)
-                  vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
-
-    // Did it work?
-    if (func != nullptr) {
-        return func(instance, pCreateInfo, pAllocator, pCallback);
-    } else {
-        return VK_ERROR_EXTENSION_NOT_PRESENT;
+AppOptions parseOptions(int argc, char* argv[]) {
+
+    AppOptions options;
+
+    for (int i = 1; i < argc; i++) {
+
+        std::string arg = argv[i];
+
+        // All of our options bar the flags take a single value
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for " + arg + "!!");
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--size") {
+            std::string size = value();
+            if (sscanf(size.c_str(), "%ux%u", &options.width, &options.height) != 2 ||
+                options.width == 0 || options.height == 0) {
+                throw std::runtime_error("Expected --size WIDTHxHEIGHT, got " + size + "!!");
+            }
+        } else if (arg == "--windows") {
+            options.windows = (uint32_t) std::stoul(value());
+            if (options.windows == 0) {
+                throw std::runtime_error("Expected at least one window!!");
+            }
+        } else if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--validation") {
+            std::string profile = value();
+            if (profile == "off") {
+                options.validation = ValidationProfile::Off;
+            } else if (profile == "core") {
+                options.validation = ValidationProfile::Core;
+            } else if (profile == "sync") {
+                options.validation = ValidationProfile::Synchronization;
+            } else if (profile == "gpu") {
+                options.validation = ValidationProfile::GpuAssisted;
+            } else if (profile == "best-practices") {
+                options.validation = ValidationProfile::BestPractices;
+            } else {
+                throw std::runtime_error("Unknown validation profile " + profile +
+                                         " (off, core, sync, gpu or best-practices)!!");
+            }
+        } else if (arg == "--fences") {
+            options.preferTimelineSemaphores = false;
+        } else if (arg == "--render-pass") {
+            options.preferDynamicRendering = false;
+        } else if (arg == "--legacy-barriers") {
+            options.preferSynchronization2 = false;
+        } else if (arg == "--serial-init") {
+            options.parallelInit = false;
+        } else if (arg == "--profile-startup") {
+            options.profileStartup = true;
+        } else if (arg == "--caps-cache") {
+            options.capabilityCachePath = value();
+        } else if (arg == "--strict-allocations") {
+            options.strictAllocations = true;
+        } else if (arg == "--host-allocator") {
+            std::string mode = value();
+            if (mode == "driver") {
+                options.hostAllocator = HostAllocator::Mode::Driver;
+            } else if (mode == "tracking") {
+                options.hostAllocator = HostAllocator::Mode::Tracking;
+            } else if (mode == "pooled") {
+                options.hostAllocator = HostAllocator::Mode::Pooled;
+            } else {
+                throw std::runtime_error("Unknown host allocator " + mode + " (driver, tracking or pooled)!!");
+            }
+        } else if (arg == "--batch") {
+            options.batchFrames = (uint32_t) std::stoul(value());
+        } else if (arg == "--output") {
+            options.outputDirectory = value();
+        } else if (arg == "--format") {
+            std::string format = value();
+            if (format == "ppm") {
+                options.outputFormat = ImageWriter::Format::PPM;
+            } else if (format == "raw") {
+                options.outputFormat = ImageWriter::Format::RAW;
+            } else {
+                throw std::runtime_error("Unknown output format " + format + " (ppm or raw)!!");
+            }
+        } else if (arg == "--capture") {
+            options.captureFile = value();
+        } else if (arg == "--capture-fps") {
+            options.captureRate = (uint32_t) std::stoul(value());
+            if (options.captureRate == 0) {
+                throw std::runtime_error("Expected a capture frame rate above zero!!");
+            }
+        } else if (arg == "--stream") {
+            options.streamTo = value();
+        } else if (arg == "--consume") {
+            options.consumeFrom = value();
+        } else if (arg == "--compute-bench") {
+            options.computeBench = true;
+        } else if (arg == "--compute-elements") {
+            options.computeElements = (uint32_t) std::stoul(value());
+            if (options.computeElements == 0 || options.computeElements > (1u << 30)) {
+                throw std::runtime_error("Expected between 1 and 2^30 compute elements!!");
+            }
+        } else if (arg == "--writer-threads") {
+            options.writerThreads = (unsigned int) std::stoul(value());
+        } else if (arg == "--instances") {
+            options.instances = (uint32_t) std::stoul(value());
+        } else if (arg == "--lights") {
+            options.lights = (uint32_t) std::stoul(value());
+            if (options.lights > ClusteredLighting::MAX_LIGHTS) {
+                throw std::runtime_error("Expected at most " + std::to_string(ClusteredLighting::MAX_LIGHTS) +
+                                         " lights!!");
+            }
+        } else if (arg == "--light-bench") {
+            options.lightBench = true;
+            options.lights = ClusteredLighting::MAX_LIGHTS;
+        } else if (arg == "--shadows") {
+            options.shadows = (uint32_t) std::stoul(value());
+            if (options.shadows > ShadowAtlas::MAX_SHADOWS) {
+                throw std::runtime_error("Expected at most " + std::to_string(ShadowAtlas::MAX_SHADOWS) +
+                                         " shadowed lights!!");
+            }
+        } else if (arg == "--shadow-casters") {
+            options.shadowCasters = (uint32_t) std::stoul(value());
+            if (options.shadowCasters > ShadowAtlas::MAX_DYNAMIC_CASTERS) {
+                throw std::runtime_error("Expected at most " + std::to_string(ShadowAtlas::MAX_DYNAMIC_CASTERS) +
+                                         " shadow casters!!");
+            }
+        } else if (arg == "--shadow-bench") {
+            options.shadowBench = true;
+            options.lights = ShadowAtlas::BENCH_LIGHTS;
+            options.shadows = ShadowAtlas::MAX_SHADOWS;
+        } else if (arg == "--post") {
+            options.post = true;
+        } else if (arg == "--post-unfused") {
+            options.post = true;
+            options.postUnfused = true;
+        } else if (arg == "--post-bench") {
+            options.post = true;
+            options.postBench = true;
+        } else if (arg == "--dynamic-resolution") {
+            options.targetFrameMs = std::stod(value());
+            if (options.targetFrameMs <= 0.0) {
+                throw std::runtime_error("Expected a target frame time above zero!!");
+            }
+        } else if (arg == "--resolution-bench") {
+            options.resolutionBench = true;
+            options.lights = ClusteredLighting::MAX_LIGHTS;
+            if (options.targetFrameMs == 0.0) {
+                options.targetFrameMs = DynamicResolution::BENCH_TARGET_MS;
+            }
+        } else if (arg == "--temporal-upscale") {
+            options.temporalScale = std::stof(value());
+            if (options.temporalScale <= 0.0f || options.temporalScale > 1.0f) {
+                throw std::runtime_error("Expected a temporal upscaling scale above 0 and at most 1!!");
+            }
+        } else if (arg == "--temporal-bench") {
+            options.temporalBench = true;
+            if (options.temporalScale == 0.0f) {
+                options.temporalScale = TemporalUpscale::BENCH_SCALES[0];
+            }
+        } else if (arg == "--multi-gpu") {
+            std::string mode = value();
+            if (mode == "off") {
+                options.multiGpu = MultiGpuMode::Off;
+            } else if (mode == "afr") {
+                options.multiGpu = MultiGpuMode::AlternateFrame;
+            } else if (mode == "sfr") {
+                options.multiGpu = MultiGpuMode::SplitFrame;
+            } else if (mode == "workers") {
+                options.multiGpu = MultiGpuMode::Workers;
+            } else {
+                throw std::runtime_error("Unknown multi-GPU mode " + mode + " (off, afr, sfr or workers)!!");
+            }
+        } else if (arg == "--gpus") {
+            options.gpus = (uint32_t) std::stoul(value());
+        } else if (arg == "--device") {
+            options.deviceIndex = std::stoi(value());
+        } else if (arg == "--regress") {
+            options.regress = true;
+        } else if (arg == "--golden") {
+            options.goldenDirectory = value();
+        } else if (arg == "--update-golden") {
+            options.updateGolden = true;
+        } else if (arg == "--image-tolerance") {
+            options.imageTolerance = (uint32_t) std::stoul(value());
+        } else if (arg == "--max-different-pixels") {
+            options.maxDifferentPixels = std::stod(value());
+        } else if (arg == "--perf-threshold") {
+            options.perfThreshold = std::stod(value());
+        } else {
+            throw std::runtime_error("Unknown option " + arg + "!!");
+        }
     }
+
+    return options;
 }
 
 /*
@@ -88,23 +427,29 @@ class VDeleter {
     public:
 
         // Wut..
-        VDeleter() : VDeleter([](T, VkAllocationCallbacks*) {}) {}
+        VDeleter() : VDeleter([](T, const VkAllocationCallbacks*) {}) {}
 
         // Wut...
-        VDeleter(std::function<void(T, VkAllocationCallbacks*)> deletef) {
-            this->deleter = [=](T obj) {deletef(obj, nullptr); };
+        //
+        // The allocator has to be the same one the object was created
+        // with, so whoever creates it passes theirs in here too.
+        VDeleter(std::function<void(T, const VkAllocationCallbacks*)> deletef,
+                 const VkAllocationCallbacks* allocator = nullptr) {
+            this->deleter = [=](T obj) {deletef(obj, allocator); };
         }
 
         // Wut..
         VDeleter(const VDeleter<VkInstance>& instance,
-                 std::function<void(VkInstance, T, VkAllocationCallbacks*)> deletef) {
-            this->deleter = [&instance, deletef](T obj) {deletef(instance, obj, nullptr); };
+                 std::function<void(VkInstance, T, const VkAllocationCallbacks*)> deletef,
+                 const VkAllocationCallbacks* allocator = nullptr) {
+            this->deleter = [&instance, deletef, allocator](T obj) {deletef(instance, obj, allocator); };
         }
 
         // Wut..
         VDeleter(const VDeleter<VkDevice>& device,
-                 std::function<void(VkDevice, T, VkAllocationCallbacks*)> deletef) {
-            this->deleter = [&device, deletef](T obj) {deletef(device, obj, nullptr); };
+                 std::function<void(VkDevice, T, const VkAllocationCallbacks*)> deletef,
+                 const VkAllocationCallbacks* allocator = nullptr) {
+            this->deleter = [&device, deletef, allocator](T obj) {deletef(device, obj, allocator); };
         }
 
         ~VDeleter() {
@@ -120,6 +465,12 @@ class VDeleter {
             return object;
         }
 
+        // For pointing a create info at the object, unlike & this leaves
+        // it alone
+        const T* get() const {
+            return &object;
+        }
+
     private:
         T object{VK_NULL_HANDLE};
         std::function<void(T)> deleter;
@@ -141,21 +492,143 @@ class VDeleter {
 class App {
 
     public:
+        explicit App(const AppOptions& options) : options(options) {
+
+            // Share the driver's allocations with the global allocation
+            // counts
+            hostAllocator.setAllocationHook(&AllocationTracker::recordVulkan);
+
+            // One output for each window, or just the one for our own
+            // images when there are no windows
+            size_t outputCount = headless ? 1 : options.windows;
+            for (size_t i = 0; i < outputCount; i++) {
+                outputs.emplace_back(new Output(instance, device, allocator));
+            }
+        }
+
         void run () {
-            initWindow();
+
+            // Creating the window is part of initVulkan's startup steps, so
+            // it can overlap creating the instance
+            initVulkan();
+
+            if (options.computeBench) {
+                computeBenchLoop();
+            } else if (headless) {
+                batchLoop();
+            } else {
+                mainLoop();
+            }
+        }
+
+        /*
+         * Used by the regression harness, render frames headlessly and
+         * return the last one along with the best time per frame over a few
+         * runs.
+         */
+        struct SceneResult {
+            RgbImage image;
+            double frameMs;
+
+            // Heap allocations drawFrame() made once it had warmed up
+            uint64_t frameAllocations;
+        };
+
+        SceneResult renderScene(uint32_t frames) {
+
             initVulkan();
-            mainLoop();
+
+            // Everything from here on should be allocation free, bar the
+            // first few frames
+            AllocationTracker::restartWarmup();
+            AllocationTracker::resetViolations();
+
+            // Let everything settle (caches, clocks, lazy driver setup)
+            // before we start timing
+            renderFrames(10, [](uint32_t, const uint8_t*) {});
+
+            SceneResult result;
+            result.frameMs = std::numeric_limits<double>::max();
+
+            const VkExtent2D& extent = outputs[0]->extent;
+            size_t frameSize = (size_t) extent.width * extent.height * 4;
+            std::vector<uint8_t> lastFrame(frameSize);
+
+            for (int run = 0; run < 3; run++) {
+
+                uint32_t lastFrameIndex = framesDrawn + frames - 1;
+
+                auto start = std::chrono::steady_clock::now();
+
+                renderFrames(frames, [&](uint32_t frameIndex, const uint8_t* pixels) {
+                    if (frameIndex == lastFrameIndex) {
+                        memcpy(lastFrame.data(), pixels, frameSize);
+                    }
+                });
+
+                std::chrono::duration<double, std::milli> elapsed =
+                    std::chrono::steady_clock::now() - start;
+                result.frameMs = std::min(result.frameMs, elapsed.count() / frames);
+            }
+
+            result.frameAllocations = AllocationTracker::getViolations();
+            result.image = rgbFromBgra(extent.width, extent.height, lastFrame.data());
+
+            dispatch.vkDeviceWaitIdle(device);
+            retireQueue.flush();
+
+            return result;
         }
 
     private:
 
-        // Some constants
-        const int WIDTH = 800;
-        const int HEIGHT = 600;
+        // The benchmarks in bench.cpp time individual setup steps
+        friend class AppBench;
+
+        const AppOptions options;
+
+        // In batch and regression mode we render into images of our own
+        // rather than a window's swap chain. Compute mode has no images at
+        // all, but no window either.
+        const bool headless = options.headless || options.batchFrames > 0 || options.regress ||
+                              options.computeBench || options.lightBench || options.shadowBench ||
+                              options.postBench || options.resolutionBench || options.temporalBench;
+
+        // Capturing to video, the frames are converted to YUV on the GPU
+        // and read back in that form rather than as BGRA
+        const bool capture = !options.captureFile.empty();
 
-        // Validation Layers
+        // Lighting the triangle, see clustered_lighting.h
+        const bool lighting = options.lights > 0;
+
+        // Shadows for some of the lights, see shadow_atlas.h
+        const bool shadowing = options.shadows > 0;
+
+        // Post processing the scene on its way to the output, see
+        // post_process.h
+        const bool postProcessing = options.post;
+
+        // Scaling the scene's resolution to hold the frame time, see
+        // dynamic_resolution.h
+        const bool dynamicResolution = options.targetFrameMs > 0.0;
+
+        // Drawing the scene smaller and building it up to full size over
+        // several frames, see temporal_upscale.h
+        const bool temporalUpscaling = options.temporalScale > 0.0f;
+
+        // All of them draw the scene into an image of their own rather than
+        // the output, and finish the frame by drawing the result onto it
+        const bool sceneTarget = postProcessing || dynamicResolution || temporalUpscaling;
+
+        // Time each frame's passes on the GPU, for the benchmarks that
+        // report them and dynamic resolution's controller
+        const bool timePasses = options.lightBench || options.shadowBench || options.postBench ||
+                                dynamicResolution || options.temporalBench;
+
+        // Validation Layers, the Khronos layer replaced the LunarG
+        // standard_validation meta layer (and everything it loaded)
         const std::vector<const char*> validationLayers = {
-            "VK_LAYER_LUNARG_standard_validation"
+            "VK_LAYER_KHRONOS_validation"
         };
 
         // Extensions
@@ -163,62 +636,404 @@ class App {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME
         };
 
-        // Do we enable these layers?
-        #ifdef NDEBUG
-            const bool enableValidationLayers = false;
-        #else
-            const bool enableValidationLayers = true;
-        #endif
+        // VK_KHR_dynamic_rendering and the extensions it depends on
+        const std::vector<const char*> dynamicRenderingExtensions = {
+            VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+            VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+            VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+            VK_KHR_MULTIVIEW_EXTENSION_NAME,
+            VK_KHR_MAINTENANCE_2_EXTENSION_NAME
+        };
+
+        // How many frames can be queued up on the GPU before we make the
+        // CPU wait for it to catch up
+        static const int MAX_FRAMES_IN_FLIGHT = 2;
+
+
+        // Do we enable these layers? When we don't, the layer is never
+        // loaded and our calls go straight to the driver, so leaving it off
+        // costs nothing.
+        const bool enableValidationLayers = options.validation != ValidationProfile::Off;
+
+        // The extra checks the profile asks for, the storage has to live
+        // until vkCreateInstance
+        std::vector<VkValidationFeatureEnableEXT> validationFeatures;
 
-        // The GLFW window object
-        GLFWwindow* window;
+        // Host memory for the driver, this has to outlive every Vulkan
+        // object so it comes first. allocator is what we pass as
+        // pAllocator (nullptr if the driver should use malloc).
+        HostAllocator hostAllocator{options.hostAllocator};
+        const VkAllocationCallbacks* allocator = hostAllocator.callbacks();
+
+        // Where the validation layers' messages go, only created when the
+        // layers are on. It has to outlive the instance.
+        std::unique_ptr<DebugLog> debugLog;
 
         // The Vulkan instnce object
-        VDeleter<VkInstance> instance {vkDestroyInstance};
+        VDeleter<VkInstance> instance {vkDestroyInstance, allocator};
 
-        // Debug Callback Function
-        VDeleter<VkDebugReportCallbackEXT>
-            callback {instance, DestroyDebugReportCallbackEXT};
+        // The instance functions we call through our own table (see
+        // dispatch.h), it has to outlive everything destroyed through it
+        InstanceDispatch instanceDispatch;
 
-        // Window surface
-        VDeleter<VkSurfaceKHR> surface{instance, vkDestroySurfaceKHR};
+        // Debug Callback Function
+        VDeleter<VkDebugReportCallbackEXT> callback {instance,
+            [this](VkInstance instance, VkDebugReportCallbackEXT callback, const VkAllocationCallbacks* allocator) {
+                instanceDispatch.vkDestroyDebugReportCallbackEXT(instance, callback, allocator);
+            }, allocator};
+
+        // Or its replacement, if VK_EXT_debug_utils is available
+        VDeleter<VkDebugUtilsMessengerEXT> messenger {instance,
+            [this](VkInstance instance, VkDebugUtilsMessengerEXT messenger, const VkAllocationCallbacks* allocator) {
+                instanceDispatch.vkDestroyDebugUtilsMessengerEXT(instance, messenger, allocator);
+            }, allocator};
+        bool debugUtilsEnabled = false;
+
+        // Names for our objects and command buffer passes, for RenderDoc
+        // and friends. Does nothing in release builds.
+        DebugNames debugNames;
 
         // Reference to the hardware we will run on
         VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 
+        // Everything the driver has told us about the physical devices, ask
+        // this rather than the driver
+        std::unique_ptr<CapabilityCache> capabilities;
+
         // Reference to the logical device we will use
-        VDeleter<VkDevice> device{vkDestroyDevice};
+        VDeleter<VkDevice> device{vkDestroyDevice, allocator};
+
+        // The device functions we call every frame, straight into the
+        // driver rather than via the loader
+        DeviceDispatch dispatch;
+
+        // Where our queues came from, the command pool is created from
+        // these while the swap chain is still using the surface
+        QueueFamilyIndices queueFamilies;
 
         // References to our queues
         VkQueue graphicsQueue;
         VkQueue presentQueue;
 
-        // Refernece to the swap chain
-        VDeleter<VkSwapchainKHR> swapChain{device, vkDestroySwapchainKHR};
+        // In batch mode these stand in for the swap chain's images, along
+        // with a host visible buffer for each to copy the result into
+        std::vector<VDeleter<VkDeviceMemory>> offscreenMemory;
+        std::vector<VDeleter<VkImage>> offscreenImages;
+        std::vector<VDeleter<VkDeviceMemory>> readbackMemory;
+        std::vector<VDeleter<VkBuffer>> readbackBuffers;
+        std::vector<void*> readbackMappings;
+        uint32_t nextOffscreenImage = 0;
 
-        // Reference to the image queue in the swap chain along the image
-        // properties
-        std::vector<VkImage> swapChainImages;
-        VkFormat swapChainImageFormat;
-        VkExtent2D swapChainExtent;
-
-        // The views into our images
-        std::vector<VDeleter<VkImageView>> swapChainImageViews;
+        // The SPIR-V for our shaders, loaded while the device is being
+        // created
+        std::vector<char> vertShaderCode;
+        std::vector<char> fragShaderCode;
 
         // Pipeline layout
-        VDeleter<VkPipelineLayout> pipelineLayout{device, vkDestroyPipelineLayout};
-        VDeleter<VkRenderPass> renderPass{device, vkDestroyRenderPass};
-        VDeleter<VkPipeline> graphicsPipeline{device, vkDestroyPipeline};
-
-        std::vector<VDeleter<VkFramebuffer>> swapChainFramebuffers;
+        VDeleter<VkPipelineLayout> pipelineLayout{device, vkDestroyPipelineLayout, allocator};
+        VDeleter<VkRenderPass> renderPass{device, vkDestroyRenderPass, allocator};
+        VDeleter<VkPipeline> graphicsPipeline{device, vkDestroyPipeline, allocator};
+
+        // Capture mode's colour conversion, a compute pipeline that reads
+        // each finished image through a sampler and writes YUV into that
+        // image's readback buffer. There's a descriptor set for each image.
+        std::vector<char> yuvShaderCode;
+        VDeleter<VkDescriptorSetLayout> yuvSetLayout{device, vkDestroyDescriptorSetLayout, allocator};
+        VDeleter<VkPipelineLayout> yuvPipelineLayout{device, vkDestroyPipelineLayout, allocator};
+        VDeleter<VkPipeline> yuvPipeline{device, vkDestroyPipeline, allocator};
+        VDeleter<VkSampler> yuvSampler{device, vkDestroySampler, allocator};
+        VDeleter<VkDescriptorPool> yuvDescriptorPool{device, vkDestroyDescriptorPool, allocator};
+        std::vector<VkDescriptorSet> yuvDescriptorSets;
+
+        // Clustered lighting. The lights live in host memory (the light
+        // benchmark rewrites them between runs), the clusters' lists are
+        // rebuilt on the GPU at the start of every frame. One descriptor set
+        // holds all three buffers, for both the binning pass and lit.frag.
+        std::vector<char> litFragShaderCode;
+        std::vector<char> lightBinShaderCode;
+        VDeleter<VkBuffer> lightBuffer{device, vkDestroyBuffer, allocator};
+        VDeleter<VkDeviceMemory> lightMemory{device, vkFreeMemory, allocator};
+        void* lightMapping = nullptr;
+        VDeleter<VkBuffer> clusterCountBuffer{device, vkDestroyBuffer, allocator};
+        VDeleter<VkDeviceMemory> clusterCountMemory{device, vkFreeMemory, allocator};
+        VDeleter<VkBuffer> clusterLightBuffer{device, vkDestroyBuffer, allocator};
+        VDeleter<VkDeviceMemory> clusterLightMemory{device, vkFreeMemory, allocator};
+        VDeleter<VkDescriptorSetLayout> lightingSetLayout{device, vkDestroyDescriptorSetLayout, allocator};
+        VDeleter<VkDescriptorPool> lightingDescriptorPool{device, vkDestroyDescriptorPool, allocator};
+        VkDescriptorSet lightingDescriptorSet = VK_NULL_HANDLE;
+        VDeleter<VkPipelineLayout> lightBinPipelineLayout{device, vkDestroyPipelineLayout, allocator};
+        VDeleter<VkPipeline> lightBinPipeline{device, vkDestroyPipeline, allocator};
+        std::vector<ClusteredLighting::Light> sceneLights;
+
+        // Shadowed lights. Atlas 0 is the cache of static casters, atlas 1
+        // the live one lit.frag samples, with their current layouts. Each
+        // frame in flight has a command buffer the atlas updates are
+        // recorded into, and its own stretch of the caster buffer for the
+        // dynamic casters. The tiles are ours to change once the GPU is
+        // idle, lit.frag finds them through the shadow record and index
+        // buffers (bindings 3 and 4 of the lighting set, the atlas is 5).
+        static const uint32_t SHADOW_CACHE = 0;
+        static const uint32_t SHADOW_LIVE = 1;
+        static const VkFormat SHADOW_FORMAT = VK_FORMAT_D16_UNORM;
+        std::vector<char> shadowVertShaderCode;
+        std::vector<VDeleter<VkDeviceMemory>> shadowAtlasMemory;
+        std::vector<VDeleter<VkImage>> shadowAtlasImages;
+        std::vector<VDeleter<VkImageView>> shadowAtlasViews;
+        std::vector<VDeleter<VkFramebuffer>> shadowFramebuffers;
+        VkImageLayout shadowAtlasLayouts[2] = {VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED};
+        VDeleter<VkRenderPass> shadowRenderPass{device, vkDestroyRenderPass, allocator};
+        VDeleter<VkSampler> shadowSampler{device, vkDestroySampler, allocator};
+        VDeleter<VkBuffer> casterBuffer{device, vkDestroyBuffer, allocator};
+        VDeleter<VkDeviceMemory> casterMemory{device, vkFreeMemory, allocator};
+        void* casterMapping = nullptr;
+        VDeleter<VkBuffer> shadowRecordBuffer{device, vkDestroyBuffer, allocator};
+        VDeleter<VkDeviceMemory> shadowRecordMemory{device, vkFreeMemory, allocator};
+        void* shadowRecordMapping = nullptr;
+        VDeleter<VkBuffer> shadowIndexBuffer{device, vkDestroyBuffer, allocator};
+        VDeleter<VkDeviceMemory> shadowIndexMemory{device, vkFreeMemory, allocator};
+        void* shadowIndexMapping = nullptr;
+        VDeleter<VkDescriptorSetLayout> casterSetLayout{device, vkDestroyDescriptorSetLayout, allocator};
+        VDeleter<VkDescriptorPool> casterDescriptorPool{device, vkDestroyDescriptorPool, allocator};
+        VkDescriptorSet casterDescriptorSet = VK_NULL_HANDLE;
+        VDeleter<VkPipelineLayout> shadowPipelineLayout{device, vkDestroyPipelineLayout, allocator};
+        VDeleter<VkPipeline> shadowPipeline{device, vkDestroyPipeline, allocator};
+        VDeleter<VkCommandPool> shadowCommandPool{device, vkDestroyCommandPool, allocator};
+        std::vector<VkCommandBuffer> shadowCommandBuffers;
+        std::vector<ShadowAtlas::Tile> shadowTiles;
+        std::vector<ShadowAtlas::Sphere> shadowCasterBounds;
+        std::vector<uint32_t> shadowCacheUpdates;
+        std::vector<uint32_t> shadowLiveUpdates;
+        std::vector<VkImageCopy> shadowCopies;
+        uint32_t shadowCount = options.shadows;
+        uint32_t shadowCasters = options.shadowCasters;
+        bool cacheShadows = true;
+        uint64_t shadowFrame = 0;
+        uint64_t shadowTilesDrawn = 0;
+
+        // The scene's own image, when sceneTarget. It's HDR and as big as
+        // the output, and the present pipeline draws it (or what post
+        // processing made of it) onto the output, upscaling it with
+        // dynamic resolution. One image serves every frame in flight, the
+        // barriers keep the frames from treading on each other.
+        static const VkFormat SCENE_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+        std::vector<char> fullscreenVertShaderCode;
+        std::vector<char> presentFragShaderCode;
+        VDeleter<VkDeviceMemory> sceneMemory{device, vkFreeMemory, allocator};
+        VDeleter<VkImage> sceneImage{device, vkDestroyImage, allocator};
+        VDeleter<VkImageView> sceneView{device, vkDestroyImageView, allocator};
+        VkExtent2D sceneExtent = {};
+        VDeleter<VkRenderPass> sceneRenderPass{device, vkDestroyRenderPass, allocator};
+        VDeleter<VkFramebuffer> sceneFramebuffer{device, vkDestroyFramebuffer, allocator};
+        VDeleter<VkSampler> sceneSampler{device, vkDestroySampler, allocator};
+        VDeleter<VkDescriptorSetLayout> presentSetLayout{device, vkDestroyDescriptorSetLayout, allocator};
+        VDeleter<VkPipelineLayout> presentPipelineLayout{device, vkDestroyPipelineLayout, allocator};
+        VDeleter<VkPipeline> presentPipeline{device, vkDestroyPipeline, allocator};
+        VDeleter<VkDescriptorPool> presentDescriptorPool{device, vkDestroyDescriptorPool, allocator};
+        VkDescriptorSet presentDescriptorSet = VK_NULL_HANDLE;
+
+        // Post processing. The compute passes take the scene image (which
+        // stands in for postImages[SCENE], left empty) to postImages[LDR_A]
+        // for the present pipeline. Each pass in post_process.h's table has
+        // its own pipeline and descriptor set, and fusePost picks which
+        // version of the chain gets recorded.
+        static const VkFormat LDR_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+        std::vector<std::vector<char>> postShaderCode;
+        std::vector<VDeleter<VkDeviceMemory>> postMemory;
+        std::vector<VDeleter<VkImage>> postImages;
+        std::vector<VDeleter<VkImageView>> postViews;
+        std::vector<VkExtent2D> postExtents;
+        VDeleter<VkDescriptorSetLayout> postSetLayout{device, vkDestroyDescriptorSetLayout, allocator};
+        VDeleter<VkPipelineLayout> postPipelineLayout{device, vkDestroyPipelineLayout, allocator};
+        std::vector<VDeleter<VkPipeline>> postPipelines;
+        VDeleter<VkDescriptorPool> postDescriptorPool{device, vkDestroyDescriptorPool, allocator};
+        std::vector<VkDescriptorSet> postDescriptorSets;
+        bool fusePost = !options.postUnfused;
+
+        // Temporal upscaling. With it the scene also writes its motion
+        // vectors, into an image as big as the scene's. The resolve writes
+        // the history images in turns, historyImages[phase % 2], reading
+        // the other, and the present pass draws the one just written. Both
+        // stay in GENERAL once historyCleared, the first frame's submit
+        // clears them. The benchmark can draw at other scales, or without
+        // the resolve (temporalResolve) at full size to compare with.
+        static const VkFormat MOTION_FORMAT = VK_FORMAT_R16G16_SFLOAT;
+        std::vector<char> temporalResolveShaderCode;
+        VDeleter<VkDeviceMemory> motionMemory{device, vkFreeMemory, allocator};
+        VDeleter<VkImage> motionImage{device, vkDestroyImage, allocator};
+        VDeleter<VkImageView> motionView{device, vkDestroyImageView, allocator};
+        std::vector<VDeleter<VkDeviceMemory>> historyMemory;
+        std::vector<VDeleter<VkImage>> historyImages;
+        std::vector<VDeleter<VkImageView>> historyViews;
+        VDeleter<VkDescriptorSetLayout> temporalSetLayout{device, vkDestroyDescriptorSetLayout, allocator};
+        VDeleter<VkPipelineLayout> temporalPipelineLayout{device, vkDestroyPipelineLayout, allocator};
+        VDeleter<VkPipeline> temporalPipeline{device, vkDestroyPipeline, allocator};
+        VDeleter<VkDescriptorPool> temporalDescriptorPool{device, vkDestroyDescriptorPool, allocator};
+        std::vector<VkDescriptorSet> temporalDescriptorSets;
+        std::vector<VkDescriptorSet> historyPresentSets;
+        VkCommandBuffer historyClearCommandBuffer = VK_NULL_HANDLE;
+        bool historyCleared = false;
+        float temporalScale = options.temporalScale;
+        bool temporalResolve = true;
+
+        // Dynamic resolution. Each level has its own command buffers (see
+        // Output), resolutionLevel is the one being drawn. Once a frame is
+        // done the controller gets its GPU time, from the timer slot noted
+        // in frameResolutions along with the level it was drawn at. The
+        // resolution benchmark can hold the level at full size, and
+        // collects resolutionStats as it goes.
+        struct FrameResolution {
+            uint32_t timerSlot;
+            uint32_t level;
+        };
+        struct ResolutionStats {
+            uint64_t frames;
+            double frameMs;
+            double scale;
+            uint64_t overTarget;
+        };
+        DynamicResolution::Controller resolutionController{options.targetFrameMs};
+        uint32_t resolutionLevel = DynamicResolution::LEVELS - 1;
+        bool holdResolution = false;
+        std::vector<FrameResolution> frameResolutions;
+        ResolutionStats resolutionStats = {};
+
+        // GPU times for each pass, a slot for each of our images. Only
+        // created when timePasses. The post processing passes' regions
+        // start after the shading's, then there's the temporal resolve and
+        // the present pass.
+        static const uint32_t SHADOW_REGION = 0;
+        static const uint32_t BINNING_REGION = 1;
+        static const uint32_t SHADING_REGION = 2;
+        static const uint32_t FIRST_POST_REGION = 3;
+        const uint32_t TEMPORAL_REGION = FIRST_POST_REGION + (postProcessing ? PostProcess::PASS_COUNT : 0);
+        const uint32_t PRESENT_REGION = TEMPORAL_REGION + (temporalUpscaling ? 1 : 0);
+        GpuTimer passTimer;
 
         // Command Pool
-        VDeleter<VkCommandPool> commandPool{device, vkDestroyCommandPool};
-        std::vector<VkCommandBuffer> commandBuffers;
+        VDeleter<VkCommandPool> commandPool{device, vkDestroyCommandPool, allocator};
+
+        /*
+         * Everything that belongs to one window: its surface and swap chain,
+         * the views and framebuffers for the swap chain's images, the command
+         * buffers which draw into them and the semaphores which pass them to
+         * and from the presentation engine. The device, queues, pipeline and
+         * command pool are shared by every window.
+         *
+         * In batch mode there is one output with no window, whose images are
+         * the offscreen ones.
+         */
+        struct Output {
+            Output(const VDeleter<VkInstance>& instance, const VDeleter<VkDevice>& device,
+                   const VkAllocationCallbacks* allocator)
+                : surface{instance, vkDestroySurfaceKHR, allocator},
+                  swapChain{device, vkDestroySwapchainKHR, allocator} {}
+
+            // The GLFW window object
+            GLFWwindow* window = nullptr;
+
+            // Window surface, and the swap chain presenting to it
+            VDeleter<VkSurfaceKHR> surface;
+            VDeleter<VkSwapchainKHR> swapChain;
+
+            // Reference to the image queue in the swap chain along the image
+            // properties
+            std::vector<VkImage> images;
+            VkFormat imageFormat;
+            VkExtent2D extent;
+
+            // The views into our images, and the framebuffers around them
+            std::vector<VDeleter<VkImageView>> imageViews;
+            std::vector<VDeleter<VkFramebuffer>> framebuffers;
+
+            // One for each image, and with dynamic resolution one for each
+            // image at each level: level * images.size() + image. Temporal
+            // upscaling has one for each phase in place of the levels.
+            std::vector<VkCommandBuffer> commandBuffers;
+
+            // Semaphores, one pair for each frame in flight
+            std::vector<VDeleter<VkSemaphore>> imageAvailableSemaphores;
+            std::vector<VDeleter<VkSemaphore>> renderFinishedSemaphores;
+
+            // The image we're drawing into this frame
+            uint32_t imageIndex = 0;
+        };
+
+        // The VDeleters can't be moved, so the outputs live behind pointers
+        std::vector<std::unique_ptr<Output>> outputs;
+
+        // What drawFrame() hands to vkQueuePresentKHR, an entry for each
+        // window. Kept here so presenting doesn't allocate.
+        std::vector<VkSwapchainKHR> presentSwapChains;
+        std::vector<uint32_t> presentImageIndices;
+        std::vector<VkSemaphore> presentWaitSemaphores;
+
+        // Is VK_KHR_get_physical_device_properties2 enabled on the instance?
+        bool physicalDeviceProperties2Enabled = false;
+
+        // Is VK_KHR_timeline_semaphore enabled on the device?
+        bool timelineSemaphoresEnabled = false;
+
+        // Is VK_KHR_dynamic_rendering? If so we have no render pass or
+        // framebuffers
+        bool dynamicRenderingEnabled = false;
+
+        // Is VK_KHR_synchronization2? The barrier batch needs to know
+        bool synchronization2Enabled = false;
+
+        // With --multi-gpu afr or sfr we try for a device group. If we get
+        // one (the instance and device extensions are both enabled) these
+        // are its GPUs, otherwise it's just physicalDevice.
+        const bool wantDeviceGroup = options.multiGpu == MultiGpuMode::AlternateFrame ||
+                                     options.multiGpu == MultiGpuMode::SplitFrame;
+        bool deviceGroupCreationEnabled = false;
+        bool deviceGroupEnabled = false;
+        std::vector<VkPhysicalDevice> deviceGroup;
+
+        // Frames the CPU lets the GPU get ahead by. Alternate frame rendering
+        // needs at least one for each GPU or some of them sit idle.
+        size_t framesInFlight = MAX_FRAMES_IN_FLIGHT;
+
+        // Collects the barriers at each sync point in a command buffer,
+        // see barriers.h
+        BarrierBatch barriers;
+
+        // One timeline for each queue we submit work to, along with the
+        // value each frame in flight will signal on it when it's done
+        QueueTimeline graphicsTimeline;
+        std::vector<uint64_t> frameTimelineValues;
+
+        // Collects everything headed for the graphics queue during a frame
+        SubmitBatcher graphicsSubmit{graphicsTimeline};
+        size_t currentFrame = 0;
+
+        // Things waiting for the GPU to finish with them
+        RetireQueue retireQueue;
+
+        // Compute mode's engine and kernels, see compute.h. Declared after
+        // the device so they're destroyed before it.
+        std::unique_ptr<ComputeEngine> computeEngine;
+        std::unique_ptr<ComputeKernels> computeKernels;
+
+        // Frames rendered in batch mode that still need copying out of
+        // their readback buffer
+        struct PendingReadback {
+            uint32_t frameIndex;
+            uint32_t imageIndex;
+            uint64_t timelineValue;
+            std::chrono::steady_clock::time_point submitted;
+        };
+        std::vector<PendingReadback> pendingReadbacks;
+
+        // When the frame being read back went to the GPU, for streaming's
+        // latency measurements
+        std::chrono::steady_clock::time_point readbackSubmitted;
+        uint32_t framesDrawn = 0;
+
+        // When each startup step ran, up to the first frame
+        StartupProfiler startupProfiler;
 
-        // Semaphores
-        VDeleter<VkSemaphore> imageAvailableSemaphore{device, vkDestroySemaphore};
-        VDeleter<VkSemaphore> renderFinishedSemaphore{device, vkDestroySemaphore};
+        // The host allocation counters as they stood when startup finished
+        HostAllocator::Stats startupAllocations;
 
         /*
          * This function invokes GLFW and will create a window for us to
@@ -226,17 +1041,19 @@ class App {
          */
         void initWindow() {
 
-            // Initialize GLFW
-            glfwInit();
-
             // Tell GLFW that we don't need an OpenGL context..
             glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
             // Prevent the window from being resized for now
             glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
-            // Create the window
-            window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+            // Create the windows, numbered when there's more than one so
+            // they can be told apart
+            for (size_t i = 0; i < outputs.size(); i++) {
+                std::string title = outputs.size() == 1 ? "Vulkan" : "Vulkan " + std::to_string(i + 1);
+                outputs[i]->window = glfwCreateWindow(options.width, options.height, title.c_str(),
+                                                      nullptr, nullptr);
+            }
         }
 
         // ------------------------ INITIALIZING VULKAN -----------------------
@@ -244,47 +1061,132 @@ class App {
         /*
          * This function performs all the actions necessary to get vulkan to
          * a state to draw something on screen.
+         *
+         * There are quite a few steps, but they don't all depend on each
+         * other. Loading the shaders for instance only needs the disk, and
+         * the command pool only needs the device. So rather than run them
+         * one after another each step lists the steps it needs and
+         * InitGraph starts it as soon as they're done, on another thread
+         * if it can. Anything touching the window stays on the main thread.
          */
         void initVulkan() {
 
+            using Thread = InitGraph::Thread;
+            InitGraph steps;
+
+            // Whichever thread a step runs on, what it allocates is startup's
+            AllocationTracker::Scope allocationScope(AllocationTracker::Subsystem::Startup);
+            steps.setThreadInit([] {
+                AllocationTracker::setThreadSubsystem(AllocationTracker::Subsystem::Startup);
+            });
+
+            // Step 0: Initialise GLFW and open the windows (unless there are
+            // no windows). GLFW needs initialising before it can tell us which
+            // instance extensions it wants.
+            if (!headless) {
+                steps.add("glfw", {}, Thread::Main, [this] { glfwInit(); });
+                steps.add("window", {"glfw"}, Thread::Main, [this] { initWindow(); });
+            }
+
             // Step 1: Create an instance
-            createInstance();
+            steps.add("instance", headless ? std::vector<std::string>{} : std::vector<std::string>{"glfw"},
+                      Thread::Any, [this] { createInstance(); });
 
             // Step 2: Setup debug callbacks
-            setupDebugCallback();
+            steps.add("debug callback", {"instance"}, Thread::Any, [this] { setupDebugCallback(); });
 
-            // Step 3: Creating a surface
-            createSurface();
+            // Step 3: Creating a surface for each window (unless there are none)
+            if (!headless) {
+                steps.add("surface", {"instance", "window"}, Thread::Main, [this] { createSurface(); });
+            }
 
             // Step 4: Choosing a hardware device
-            pickPhysicalDevice();
+            steps.add("physical device", {headless ? "instance" : "surface"}, Thread::Any,
+                      [this] { pickPhysicalDevice(); });
 
             // Step 5: Creating a logical device
-            createLogicalDevice();
+            steps.add("logical device", {"physical device"}, Thread::Any, [this] { createLogicalDevice(); });
+
+            // Compute mode only needs the device and queue, the rest is all
+            // for drawing
+            if (options.computeBench) {
+                steps.add("compute", {"logical device"}, Thread::Any, [this] { createCompute(); });
+                steps.run(startupProfiler, options.parallelInit);
+                return;
+            }
 
-            // Step 6: Create the Swap Chain (render queue)
-            createSwapChain();
+            // Meanwhile load our shaders off the disk and make sure they're
+            // valid, so the pipeline doesn't have to wait for them
+            steps.add("load shaders", {}, Thread::Any, [this] { loadShaders(); });
+
+            // Step 6: Create the Swap Chain (render queue), or in batch mode
+            // some images of our own to render into
+            steps.add("swap chain", {"logical device"}, Thread::Any, [this] {
+                if (headless) {
+                    createOffscreenTargets();
+                } else {
+                    createSwapChain();
+                }
+            });
 
             // Step 7: Create Views into our images
-            createImageViews();
+            steps.add("image views", {"swap chain"}, Thread::Any, [this] { createImageViews(); });
 
-            // Step 8: Create Render Passes
-            createRenderPass();
+            // Step 8: Create Render Passes, this only needs the image format
+            steps.add("render pass", {"swap chain"}, Thread::Any, [this] { createRenderPass(); });
+
+            // Step 8b: With --lights, the buffers and binning pipeline for
+            // clustered lighting (the graphics pipeline needs their layout)
+            steps.add("lighting", {"logical device", "load shaders"}, Thread::Any, [this] { createLighting(); });
+
+            // Step 8c: With --shadows, the shadow atlas and its casters (the
+            // graphics pipeline makes the depth only pipeline for them)
+            steps.add("shadows", {"lighting"}, Thread::Any, [this] { createShadows(); });
+
+            // Step 8d: With --post, --dynamic-resolution or
+            // --temporal-upscale, the image the scene is drawn into and what
+            // the present pipeline needs
+            steps.add("scene target", {"swap chain"}, Thread::Any, [this] { createSceneTarget(); });
+
+            // Step 8e: With --post, the images the post processing passes
+            // draw into, and the passes' pipelines
+            steps.add("post processing", {"scene target", "load shaders"}, Thread::Any,
+                      [this] { createPostProcessing(); });
+
+            // Step 8f: With --temporal-upscale, the history images and the
+            // resolve's pipeline
+            steps.add("temporal upscale", {"scene target", "load shaders"}, Thread::Any,
+                      [this] { createTemporalUpscale(); });
 
             // Step 9: Build the graphics pipeline
-            createGraphicsPipeline();
+            steps.add("graphics pipeline", {"render pass", "load shaders", "shadows", "post processing"},
+                      Thread::Any, [this] { createGraphicsPipeline(); });
 
             // Step 10: Create the framebuffers
-            createFrameBuffers();
+            steps.add("framebuffers", {"image views", "render pass"}, Thread::Any,
+                      [this] { createFrameBuffers(); });
 
             // Step 11: Create the command pool
-            createCommandPool();
+            steps.add("command pool", {"logical device"}, Thread::Any, [this] { createCommandPool(); });
+
+            // Step 11b: In capture mode, the pipeline which converts the
+            // frames to YUV (it reads the images through their views)
+            steps.add("capture pipeline", {"image views", "load shaders"}, Thread::Any,
+                      [this] { createCapturePipeline(); });
+
+            // Step 11c: The timestamp queries the benchmarks time passes with,
+            // a set for each image
+            steps.add("pass timer", {"swap chain"}, Thread::Any, [this] { createPassTimer(); });
 
             // Step 12: Create the command buffers
-            createCommandBuffers();
+            steps.add("command buffers", {"command pool", "framebuffers", "graphics pipeline", "capture pipeline",
+                                          "pass timer", "temporal upscale"},
+                      Thread::Any, [this] { createCommandBuffers(); });
 
             // Step 13: Create the Semaphores
-            createSemaphores();
+            steps.add("semaphores", {"logical device"}, Thread::Any, [this] { createSemaphores(); });
+
+            steps.run(startupProfiler, options.parallelInit);
         }
 
         /*
@@ -320,10 +1222,20 @@ class App {
             createInfo.ppEnabledExtensionNames = extensions.data();
 
             // Only enable validation layers if needed
+            VkValidationFeaturesEXT validationFeaturesInfo = {};
             if (enableValidationLayers) {
                 createInfo.enabledLayerCount = validationLayers.size();
                 createInfo.ppEnabledLayerNames = validationLayers.data();
 
+                // Anything beyond the core checks is switched on through
+                // VkValidationFeaturesEXT
+                if (!validationFeatures.empty()) {
+                    validationFeaturesInfo.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+                    validationFeaturesInfo.enabledValidationFeatureCount = validationFeatures.size();
+                    validationFeaturesInfo.pEnabledValidationFeatures = validationFeatures.data();
+                    createInfo.pNext = &validationFeaturesInfo;
+                }
+
             } else {
                 createInfo.enabledLayerCount = 0;
             }
@@ -331,10 +1243,14 @@ class App {
 
             // Finally we have everything in place, time to tell Vulkan to make
             // an instance for us
-            if(vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+            if(vkCreateInstance(&createInfo, allocator, &instance) != VK_SUCCESS) {
 
                 throw std::runtime_error("Failed to create instance!!");
             }
+
+            // Look up the functions we'll call ourselves, once, rather than
+            // every time we call them
+            instanceDispatch.load(instance);
         }
 
         /*
@@ -387,7 +1303,35 @@ class App {
                                                             const char* layerPrefix,
                                                             const char* msg,
                                                             void* userData) {
-            std::cerr << "Validation layer: " << msg << std::endl;
+
+            // This can be called from any thread in the middle of anything,
+            // so just queue the message up and get out of the way
+            DebugLog::Severity severity = (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT) ? DebugLog::Severity::Error
+                                                                                  : DebugLog::Severity::Warning;
+            ((DebugLog*) userData)->push(severity, code, layerPrefix, msg);
+
+            return VK_FALSE;
+        }
+
+        /*
+         * The debug utils version of the above
+         */
+        static VKAPI_ATTR VkBool32 VKAPI_CALL debugUtilsCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+                                                                 VkDebugUtilsMessageTypeFlagsEXT messageTypes,
+                                                                 const VkDebugUtilsMessengerCallbackDataEXT* callbackData,
+                                                                 void* userData) {
+
+            DebugLog::Severity severity = DebugLog::Severity::Verbose;
+            if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+                severity = DebugLog::Severity::Error;
+            } else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+                severity = DebugLog::Severity::Warning;
+            } else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
+                severity = DebugLog::Severity::Info;
+            }
+
+            ((DebugLog*) userData)->push(severity, callbackData->messageIdNumber,
+                                         callbackData->pMessageIdName, callbackData->pMessage);
 
             return VK_FALSE;
         }
@@ -395,6 +1339,30 @@ class App {
         void setupDebugCallback() {
             if(!enableValidationLayers) return;
 
+            debugLog.reset(new DebugLog());
+
+            // Prefer debug utils, it tells us more and debug report is
+            // deprecated
+            if (debugUtilsEnabled) {
+
+                VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+                createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+                createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
+                                           | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+                createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
+                                       | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
+                                       | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+                createInfo.pfnUserCallback = debugUtilsCallback;
+                createInfo.pUserData = debugLog.get();
+
+                if (instanceDispatch.vkCreateDebugUtilsMessengerEXT == nullptr ||
+                    instanceDispatch.vkCreateDebugUtilsMessengerEXT(instance, &createInfo, allocator, &messenger)
+                        != VK_SUCCESS) {
+                    throw std::runtime_error("Failed to setup the debug messenger!!");
+                }
+                return;
+            }
+
             // We need to tell Vulkan about our function
             VkDebugReportCallbackCreateInfoEXT createInfo = {};
             createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
@@ -402,14 +1370,57 @@ class App {
             // Which events do we want to handle?
             createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
             createInfo.pfnCallback = debugCallback;
+            createInfo.pUserData = debugLog.get();
 
             // Try and setup the callback
-            if (CreateDebugReportCallbackEXT(instance, &createInfo, nullptr, &callback)
+            if (instanceDispatch.vkCreateDebugReportCallbackEXT == nullptr ||
+                instanceDispatch.vkCreateDebugReportCallbackEXT(instance, &createInfo, allocator, &callback)
                     != VK_SUCCESS) {
                 throw std::runtime_error("Failed to setup the debug callback!!");
             }
         }
 
+        /*
+         * Work out which of the validation layer's optional checks the
+         * profile needs. They're enabled through VK_EXT_validation_features,
+         * which the layer itself provides, so if it's an old layer without
+         * it we warn and carry on with the core checks.
+         */
+        void chooseValidationFeatures(std::vector<const char*>& extensions) {
+
+            validationFeatures.clear();
+
+            switch (options.validation) {
+                case ValidationProfile::Off:
+                case ValidationProfile::Core:
+                    return;
+
+                case ValidationProfile::Synchronization:
+                    validationFeatures.push_back(VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT);
+                    break;
+
+                case ValidationProfile::GpuAssisted:
+                    // The layer needs a descriptor set binding of its own
+                    // to talk to the instrumented shaders
+                    validationFeatures.push_back(VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_EXT);
+                    validationFeatures.push_back(VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_RESERVE_BINDING_SLOT_EXT);
+                    break;
+
+                case ValidationProfile::BestPractices:
+                    validationFeatures.push_back(VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT);
+                    break;
+            }
+
+            if (!checkInstanceExtensionSupport(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME, validationLayers[0])) {
+                std::cerr << "The validation layer doesn't support " << VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME
+                          << ", using the core checks only" << std::endl;
+                validationFeatures.clear();
+                return;
+            }
+
+            extensions.push_back(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+        }
+
         /*
          * This function will return a list of all the extensions we require
          */
@@ -422,30 +1433,76 @@ class App {
             const char** glfwExtensions;
 
             // Ask GLFW for the extensions it needs to get vulkan ta;lking to
-            // the windowing system
-            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            // the windowing system, if we have one
+            if (!headless) {
+                glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-            // Add the GLFW extensions to the list
-            for (unsigned int i = 0; i < glfwExtensionCount; i++) {
-                extensions.push_back(glfwExtensions[i]);
+                // Add the GLFW extensions to the list
+                for (unsigned int i = 0; i < glfwExtensionCount; i++) {
+                    extensions.push_back(glfwExtensions[i]);
+                }
             }
 
             // Finally if we are using validation layers, we also need to add the
-            // debug extension
+            // debug extension. Debug utils if we can, debug report if not.
             if (enableValidationLayers) {
-                extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+                if (checkInstanceExtensionSupport(VK_EXT_DEBUG_UTILS_EXTENSION_NAME) ||
+                    checkInstanceExtensionSupport(VK_EXT_DEBUG_UTILS_EXTENSION_NAME, validationLayers[0])) {
+                    extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+                    debugUtilsEnabled = true;
+                } else {
+                    extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+                }
+
+                chooseValidationFeatures(extensions);
+            }
+
+            // We need this one to ask a device about optional features
+            // (e.g. timeline semaphores) but we can live without it
+            if (checkInstanceExtensionSupport(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+                extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+                physicalDeviceProperties2Enabled = true;
+            }
+
+            // And this one to find and create device groups
+            if (wantDeviceGroup && checkInstanceExtensionSupport(VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME)) {
+                extensions.push_back(VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME);
+                deviceGroupCreationEnabled = true;
             }
 
             return extensions;
         }
 
         /*
-         * This function will create the surface that will allow us to draw
-         * stuff
+         * This function checks to see if an optional instance extension is
+         * available
+         */
+        bool checkInstanceExtensionSupport(const char* extensionName, const char* layerName = nullptr) {
+
+            uint32_t extensionCount = 0;
+            vkEnumerateInstanceExtensionProperties(layerName, &extensionCount, nullptr);
+
+            std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+            vkEnumerateInstanceExtensionProperties(layerName, &extensionCount, availableExtensions.data());
+
+            for (const auto& extension : availableExtensions) {
+                if (strcmp(extension.extensionName, extensionName) == 0) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /*
+         * This function will create the surfaces that will allow us to draw
+         * stuff, one for each window
          */
         void createSurface() {
-            if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
-                throw std::runtime_error("Unable to create the window surafce!!");
+            for (auto& output : outputs) {
+                if (glfwCreateWindowSurface(instance, output->window, allocator, &output->surface) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create the window surafce!!");
+                }
             }
         }
 
@@ -454,25 +1511,41 @@ class App {
          */
         void pickPhysicalDevice() {
 
-            // We will choose the device from a list of available hardware
-            // but first off we need to count them all.
-            uint32_t deviceCount = 0;
-            vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+            // Ask the driver (or the cache on disk) about every device once,
+            // everything after this asks the cache instead
+            PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = nullptr;
+            if (physicalDeviceProperties2Enabled) {
+                getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)
+                    vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+            }
+
+            capabilities.reset(new CapabilityCache(instance, getFeatures2, options.capabilityCachePath));
 
             // If no devices are found then we won't be able to do anything!!
-            if (deviceCount == 0) {
+            if (capabilities->getDevices().empty()) {
                 throw std::runtime_error("Unable to find Vulkan compatible hardware!!");
             }
 
-            // Put all the available devices in a list
-            std::vector<VkPhysicalDevice> devices(deviceCount);
-            vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+            // Unless we've been told which one to use (each render worker
+            // gets its own) we will pick the first device that matches our
+            // needs
+            if (options.deviceIndex >= 0) {
 
-            // We will pick the first device that matches our needs
-            for (const auto& device : devices) {
-                if (isDeviceSuitable(device)) {
-                    physicalDevice = device;
-                    break;
+                const auto& devices = capabilities->getDevices();
+                if ((size_t) options.deviceIndex >= devices.size() ||
+                    !isDeviceSuitable(devices[options.deviceIndex].device)) {
+                    throw std::runtime_error("Device " + std::to_string(options.deviceIndex) +
+                                             " doesn't exist or isn't suitable!!");
+                }
+
+                physicalDevice = devices[options.deviceIndex].device;
+
+            } else {
+                for (const auto& device : capabilities->getDevices()) {
+                    if (isDeviceSuitable(device.device)) {
+                        physicalDevice = device.device;
+                        break;
+                    }
                 }
             }
 
@@ -481,6 +1554,52 @@ class App {
                 throw std::runtime_error("Unable to find a suitable device!!");
             }
 
+            deviceGroup = {physicalDevice};
+            if (wantDeviceGroup) {
+                pickDeviceGroup();
+            }
+        }
+
+        /*
+         * For --multi-gpu afr and sfr, find the biggest device group with a
+         * suitable GPU at its head and take as many of its GPUs as we're
+         * allowed. The GPUs in a group are all the same model, so the first
+         * one becomes physicalDevice and answers for all of them.
+         */
+        void pickDeviceGroup() {
+
+            if (!deviceGroupCreationEnabled || instanceDispatch.vkEnumeratePhysicalDeviceGroupsKHR == nullptr) {
+                return;
+            }
+
+            uint32_t groupCount = 0;
+            instanceDispatch.vkEnumeratePhysicalDeviceGroupsKHR(instance, &groupCount, nullptr);
+
+            std::vector<VkPhysicalDeviceGroupPropertiesKHR> groups(groupCount);
+            for (auto& group : groups) {
+                group.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES_KHR;
+            }
+            instanceDispatch.vkEnumeratePhysicalDeviceGroupsKHR(instance, &groupCount, groups.data());
+
+            const VkPhysicalDeviceGroupPropertiesKHR* best = nullptr;
+            for (const auto& group : groups) {
+                if ((best == nullptr || group.physicalDeviceCount > best->physicalDeviceCount) &&
+                    isDeviceSuitable(group.physicalDevices[0])) {
+                    best = &group;
+                }
+            }
+
+            if (best == nullptr) {
+                return;
+            }
+
+            uint32_t count = best->physicalDeviceCount;
+            if (options.gpus > 0) {
+                count = std::min(count, options.gpus);
+            }
+
+            physicalDevice = best->physicalDevices[0];
+            deviceGroup.assign(best->physicalDevices, best->physicalDevices + count);
         }
 
         /*
@@ -490,25 +1609,34 @@ class App {
             QueueFamilyIndices indices;
 
             // Get all of the queue type supported on this device
-            uint32_t queueFamilyCount = 0;
-            vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-            std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-            vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+            const auto& queueFamilies = capabilities->get(device).queueFamilies;
 
             int i = 0;
 
             for (const auto& queueFamily : queueFamilies) {
 
-                // Check for graphics queue support
-                if (queueFamily.queueCount > 0 &&
+                // Check for graphics queue support, in compute mode the same
+                // queue runs the kernels (there's always a family with both)
+                bool computeSupport = !options.computeBench || (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
+                if (queueFamily.queueCount > 0 && computeSupport &&
                         queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
                     indices.graphicsFamily = i;
                 }
 
-                // Check for 'present support'
-                VkBool32 presentSupport = false;
-                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                // Check for 'present support', without a window there is
+                // nothing to present to so any graphics queue will do. With
+                // several windows the one queue presents to all of them, so
+                // it needs to support every surface.
+                bool presentSupport;
+                if (headless) {
+                    presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+                } else {
+                    presentSupport = true;
+                    for (const auto& output : outputs) {
+                        presentSupport = presentSupport &&
+                                         capabilities->presentSupport(device, i, output->surface);
+                    }
+                }
 
                 if (queueFamily.queueCount > 0 && presentSupport) {
                     indices.presentFamily = i;
@@ -526,35 +1654,10 @@ class App {
 
         /*
          * This will get the details of the particular swap chain we can create
+         * for a surface
          */
-        SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
-
-            SwapChainSupportDetails details;
-
-            // First query the capabilities
-            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
-
-            // Next we will count the number of formats
-            uint32_t formatCount;
-            vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
-
-            // Then actually pull them out
-            if (formatCount != 0) {
-                details.formats.resize(formatCount);
-                vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
-            }
-
-            // Similarly for the present modes
-            uint32_t presentModeCount;
-            vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
-
-            if(presentModeCount != 0) {
-                details.presentModes.resize(presentModeCount);
-                vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
-            }
-
-            return details;
-
+        const SwapChainSupportDetails& querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface) {
+            return capabilities->swapChainSupport(device, surface);
         }
 
         /*
@@ -638,7 +1741,7 @@ class App {
                 return capabilities.currentExtent;
             } else {
 
-                VkExtent2D actualExtent = {WIDTH, HEIGHT};
+                VkExtent2D actualExtent = {options.width, options.height};
 
                 actualExtent.width = std::max(capabilities.minImageExtent.width,
                                               std::min(capabilities.maxImageExtent.width,
@@ -655,16 +1758,35 @@ class App {
         /*
          * After we choose the format for our surface, the presentation
          * mode and the image resolution we can finally build the swap
-         * chain.
+         * chain. Or rather chains, each window gets its own.
          */
-        void createSwapChain () {
+        void createSwapChain() {
+            for (size_t i = 0; i < outputs.size(); i++) {
+                createSwapChain(*outputs[i], i);
+            }
+        }
+
+        void createSwapChain(Output& output, size_t outputIndex) {
 
             // Query the capabilities of the system
-            SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+            const SwapChainSupportDetails& swapChainSupport = querySwapChainSupport(physicalDevice, output.surface);
 
             // Now pick the surface format...
             VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
 
+            // ... which has to be the same for every window, they all share
+            // one render pass and pipeline ...
+            if (outputIndex > 0 && surfaceFormat.format != outputs[0]->imageFormat) {
+                auto sameFormat = std::find_if(swapChainSupport.formats.begin(), swapChainSupport.formats.end(),
+                                               [&](const VkSurfaceFormatKHR& format) {
+                                                   return format.format == outputs[0]->imageFormat;
+                                               });
+                if (sameFormat == swapChainSupport.formats.end()) {
+                    throw std::runtime_error("Unable to find an image format every window supports!!");
+                }
+                surfaceFormat = *sameFormat;
+            }
+
             // ... the presenation mode ...
             VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 
@@ -686,7 +1808,7 @@ class App {
             // swap chain we want created for us. Be Warned though! It's a biggie
             VkSwapchainCreateInfoKHR createInfo = {};
             createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-            createInfo.surface = surface;
+            createInfo.surface = output.surface;
 
             // Image details
             createInfo.minImageCount = imageCount;
@@ -702,7 +1824,7 @@ class App {
              * images to be drawn on screen). So we need to check for it and configure
              * the swap chain to cope with this accordingly
              */
-            QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+            const QueueFamilyIndices& indices = queueFamilies;
             uint32_t queueFamilyIndices[] = {(uint32_t) indices.graphicsFamily,
                                              (uint32_t) indices.presentFamily};
 
@@ -756,7 +1878,7 @@ class App {
             createInfo.oldSwapchain = VK_NULL_HANDLE;
 
             // Finally!! Try and create the Swap Chain
-            if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
+            if (vkCreateSwapchainKHR(device, &createInfo, allocator, &output.swapChain) != VK_SUCCESS) {
                 throw std::runtime_error("Unable to create the swap chain!!");
             }
 
@@ -765,14 +1887,19 @@ class App {
              * so we need to check to see how many it actually created for us, along with
              * getting the reference to the image queue created by the swap chain.
              */
-            vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-            swapChainImages.resize(imageCount);
-            vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+            vkGetSwapchainImagesKHR(device, output.swapChain, &imageCount, nullptr);
+            output.images.resize(imageCount);
+            vkGetSwapchainImagesKHR(device, output.swapChain, &imageCount, output.images.data());
+
+            setDebugName(output.swapChain, "swap chain", outputIndex);
+            for (size_t i = 0; i < output.images.size(); i++) {
+                debugNames.name(output.images[i], "swap chain image", i);
+            }
 
             // Also don't forget to make a note of the extent and image format we chose
             // as we'll need those later.
-            swapChainImageFormat = surfaceFormat.format;
-            swapChainExtent = extent;
+            output.imageFormat = surfaceFormat.format;
+            output.extent = extent;
 
         }
 
@@ -780,22 +1907,28 @@ class App {
          * This function is responsible for creating the views into our images
          */
         void createImageViews() {
+            for (auto& output : outputs) {
+                createImageViews(*output);
+            }
+        }
+
+        void createImageViews(Output& output) {
 
             // Resize our views to match the number of images in the swap chain
-            swapChainImageViews.resize(swapChainImages.size(),
-                                       VDeleter<VkImageView>{device, vkDestroyImageView});
+            output.imageViews.resize(output.images.size(),
+                                     VDeleter<VkImageView>{device, vkDestroyImageView, allocator});
 
             // Next for each image in the chain
-            for (uint32_t i = 0; i < swapChainImages.size(); i++) {
+            for (uint32_t i = 0; i < output.images.size(); i++) {
 
                 // We will make a view for it
                 VkImageViewCreateInfo createInfo = {};
                 createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-                createInfo.image = swapChainImages[i];
+                createInfo.image = output.images[i];
 
                 // What will the image represent
                 createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-                createInfo.format = swapChainImageFormat;
+                createInfo.format = output.imageFormat;
 
                 // Swizzle the components...?
                 createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -811,64 +1944,327 @@ class App {
                 createInfo.subresourceRange.layerCount = 1;
 
                 // Create the image view
-                if (vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i])
+                if (vkCreateImageView(device, &createInfo, allocator, &output.imageViews[i])
                         != VK_SUCCESS) {
                     throw std::runtime_error("Unable to create image views!!");
                 }
+                setDebugName(output.imageViews[i], "swap chain image view", i);
             }
         }
 
         /*
-         * This function checks to see of the Vulkan extensions we require are
-         * supported
+         * This will find a type of memory on the device which is allowed by
+         * typeFilter (a bit for each memory type) and has all the properties
+         * we ask for.
          */
-        bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
-
-            // So first we count the number of available extensions
-            uint32_t extensionCount;
-            vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+        uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
 
-            // Grab all of the available extensions
-            std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-            vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
-
-            // We create a set of all the extensions we require
-            std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+            const VkPhysicalDeviceMemoryProperties& memoryProperties =
+                capabilities->get(physicalDevice).memoryProperties;
 
-            // And remove the ones we find in the available extensions
-            for (const auto& extension : availableExtensions) {
-                requiredExtensions.erase(extension.extensionName);
+            for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+                if ((typeFilter & (1 << i)) &&
+                    (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                    return i;
+                }
             }
 
-            // If all extensions are supported then the set will be empty
-            return requiredExtensions.empty();
+            throw std::runtime_error("Unable to find a suitable memory type!!");
         }
 
         /*
-         * This function will look at a physical device and decide if it is
-         * "suitable"
-         *
-         * In our case a device is suitable if:
-         *   - it supports a graphics queue
-         *   - it has present support
-         *   - there is a present mode and image format available which is
-         *     compitable with our window's surface.
+         * Create a buffer along with some memory of its own for it
          */
-        bool isDeviceSuitable(VkPhysicalDevice device) {
+        void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                          VDeleter<VkBuffer>& buffer, VDeleter<VkDeviceMemory>& memory, const char* name) {
 
-            QueueFamilyIndices indices = findQueueFamilies(device);
+            VkBufferCreateInfo bufferInfo = {};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = size;
+            bufferInfo.usage = usage;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-            bool extensionsSupported = checkDeviceExtensionSupport(device);
+            if (vkCreateBuffer(device, &bufferInfo, allocator, &buffer) != VK_SUCCESS) {
+                throw std::runtime_error(std::string("Unable to create the ") + name + "!!");
+            }
 
-            bool swapChainAdequate = false;
+            VkMemoryRequirements requirements;
+            vkGetBufferMemoryRequirements(device, buffer, &requirements);
 
-            if (extensionsSupported) {
-                SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
-                swapChainAdequate = !swapChainSupport.formats.empty() &&
-                                    !swapChainSupport.presentModes.empty();
+            VkMemoryAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = requirements.size;
+            allocInfo.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+
+            if (vkAllocateMemory(device, &allocInfo, allocator, &memory) != VK_SUCCESS) {
+                throw std::runtime_error(std::string("Unable to allocate memory for the ") + name + "!!");
             }
 
-            return indices.isComplete() &&
+            vkBindBufferMemory(device, buffer, memory, 0);
+            setDebugName(buffer, name);
+        }
+
+        /*
+         * And a 2D image, in device local memory
+         */
+        void createImage(VkExtent2D extent, VkFormat format, VkImageUsageFlags usage,
+                         VDeleter<VkImage>& image, VDeleter<VkDeviceMemory>& memory, const char* name) {
+
+            VkImageCreateInfo imageInfo = {};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = format;
+            imageInfo.extent = {extent.width, extent.height, 1};
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = usage;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            if (vkCreateImage(device, &imageInfo, allocator, &image) != VK_SUCCESS) {
+                throw std::runtime_error(std::string("Unable to create the ") + name + "!!");
+            }
+
+            VkMemoryRequirements requirements;
+            vkGetImageMemoryRequirements(device, image, &requirements);
+
+            VkMemoryAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = requirements.size;
+            allocInfo.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits,
+                                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+            if (vkAllocateMemory(device, &allocInfo, allocator, &memory) != VK_SUCCESS) {
+                throw std::runtime_error(std::string("Unable to allocate memory for the ") + name + "!!");
+            }
+
+            vkBindImageMemory(device, image, memory, 0);
+            setDebugName(image, name);
+        }
+
+        /*
+         * In batch mode there is no swap chain to hand us images, so we make
+         * our own. Everything after this point only cares that there are
+         * some images in the output, so the rest of the setup doesn't need
+         * to know the difference.
+         *
+         * Each image also gets a buffer the CPU can read, which the command
+         * buffers copy the finished frame into.
+         */
+        void createOffscreenTargets() {
+
+            // One more image than frames in flight, just like the swap chain,
+            // so the CPU can be reading one back while the GPU draws the others
+            uint32_t imageCount = (uint32_t) framesInFlight + 1;
+
+            Output& output = *outputs[0];
+            output.imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+            output.extent = {options.width, options.height};
+
+            offscreenMemory.resize(imageCount, VDeleter<VkDeviceMemory>{device, vkFreeMemory, allocator});
+            offscreenImages.resize(imageCount, VDeleter<VkImage>{device, vkDestroyImage, allocator});
+            readbackMemory.resize(imageCount, VDeleter<VkDeviceMemory>{device, vkFreeMemory, allocator});
+            readbackBuffers.resize(imageCount, VDeleter<VkBuffer>{device, vkDestroyBuffer, allocator});
+            readbackMappings.resize(imageCount, nullptr);
+            output.images.resize(imageCount);
+
+            // A capture reads back the YUV version of the frame, which the
+            // compute shader writes into the buffer itself
+            VkDeviceSize frameSize = capture ? VideoEncoder::frameSize(output.extent.width, output.extent.height)
+                                             : (VkDeviceSize) output.extent.width * output.extent.height * 4;
+
+            for (uint32_t i = 0; i < imageCount; i++) {
+
+                // The image we will render into
+                VkImageCreateInfo imageInfo = {};
+                imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+                imageInfo.imageType = VK_IMAGE_TYPE_2D;
+                imageInfo.format = output.imageFormat;
+                imageInfo.extent = {output.extent.width, output.extent.height, 1};
+                imageInfo.mipLevels = 1;
+                imageInfo.arrayLayers = 1;
+                imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+                imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+                imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                  (capture ? VK_IMAGE_USAGE_SAMPLED_BIT : VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+                imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+                imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+                if (vkCreateImage(device, &imageInfo, allocator, &offscreenImages[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create an offscreen image!!");
+                }
+
+                VkMemoryRequirements imageRequirements;
+                vkGetImageMemoryRequirements(device, offscreenImages[i], &imageRequirements);
+
+                VkMemoryAllocateInfo imageAllocInfo = {};
+                imageAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+                imageAllocInfo.allocationSize = imageRequirements.size;
+                imageAllocInfo.memoryTypeIndex = findMemoryType(imageRequirements.memoryTypeBits,
+                                                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+                if (vkAllocateMemory(device, &imageAllocInfo, allocator, &offscreenMemory[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to allocate offscreen image memory!!");
+                }
+
+                vkBindImageMemory(device, offscreenImages[i], offscreenMemory[i], 0);
+                setDebugName(offscreenImages[i], "offscreen image", i);
+                setDebugName(offscreenMemory[i], "offscreen image memory", i);
+                output.images[i] = offscreenImages[i];
+
+                // And the buffer we will read it back from
+                VkBufferCreateInfo bufferInfo = {};
+                bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+                bufferInfo.size = frameSize;
+                bufferInfo.usage = capture ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+                bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+                if (vkCreateBuffer(device, &bufferInfo, allocator, &readbackBuffers[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create a readback buffer!!");
+                }
+
+                VkMemoryRequirements bufferRequirements;
+                vkGetBufferMemoryRequirements(device, readbackBuffers[i], &bufferRequirements);
+
+                // Cached memory is much faster for the CPU to read from, but
+                // we'll take whatever we can get
+                VkMemoryAllocateInfo bufferAllocInfo = {};
+                bufferAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+                bufferAllocInfo.allocationSize = bufferRequirements.size;
+
+                try {
+                    bufferAllocInfo.memoryTypeIndex = findMemoryType(bufferRequirements.memoryTypeBits,
+                                                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                                                   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                                                                   | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+                } catch (const std::runtime_error&) {
+                    bufferAllocInfo.memoryTypeIndex = findMemoryType(bufferRequirements.memoryTypeBits,
+                                                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                                                   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                }
+
+                if (vkAllocateMemory(device, &bufferAllocInfo, allocator, &readbackMemory[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to allocate readback memory!!");
+                }
+
+                vkBindBufferMemory(device, readbackBuffers[i], readbackMemory[i], 0);
+                setDebugName(readbackBuffers[i], "readback buffer", i);
+                setDebugName(readbackMemory[i], "readback memory", i);
+
+                // We leave the buffer mapped for as long as it lives
+                if (vkMapMemory(device, readbackMemory[i], 0, frameSize, 0, &readbackMappings[i])
+                        != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to map a readback buffer!!");
+                }
+            }
+        }
+
+        /*
+         * This function checks to see of the Vulkan extensions we require are
+         * supported
+         */
+        bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
+
+            // Grab all of the available extensions
+            const auto& availableExtensions = capabilities->get(device).extensions;
+
+            // We create a set of all the extensions we require
+            auto deviceExtensions = getRequiredDeviceExtensions();
+            std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+
+            // And remove the ones we find in the available extensions
+            for (const auto& extension : availableExtensions) {
+                requiredExtensions.erase(extension.extensionName);
+            }
+
+            // If all extensions are supported then the set will be empty
+            return requiredExtensions.empty();
+        }
+
+        /*
+         * The device extensions we can't do without, we only need the swap
+         * chain when there is a window to present to.
+         */
+        std::vector<const char*> getRequiredDeviceExtensions() {
+
+            if (headless) {
+                return {};
+            }
+
+            return deviceExtensions;
+        }
+
+        /*
+         * Unlike the extensions above, this checks for a single extension we
+         * would like to use but can do without.
+         */
+        bool checkOptionalDeviceExtension(VkPhysicalDevice device, const char* extensionName) {
+            return capabilities->get(device).hasExtension(extensionName);
+        }
+
+        /*
+         * Timeline semaphores need both the extension and the feature bit,
+         * and we can only ask about the feature through
+         * VK_KHR_get_physical_device_properties2.
+         */
+        bool checkTimelineSemaphoreSupport(VkPhysicalDevice device) {
+
+            // The cache has already asked, if it could
+            return capabilities->get(device).timelineSemaphore;
+        }
+
+        /*
+         * Can we draw without render pass and framebuffer objects? We need
+         * the feature and everything the extension depends on.
+         */
+        bool checkDynamicRenderingSupport(VkPhysicalDevice device) {
+
+            const DeviceCapabilities& deviceCapabilities = capabilities->get(device);
+
+            if (!deviceCapabilities.dynamicRendering) {
+                return false;
+            }
+
+            for (const char* extension : dynamicRenderingExtensions) {
+                if (!deviceCapabilities.hasExtension(extension)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        /*
+         * This function will look at a physical device and decide if it is
+         * "suitable"
+         *
+         * In our case a device is suitable if:
+         *   - it supports a graphics queue
+         *   - it has present support
+         *   - there is a present mode and image format available which is
+         *     compitable with each of our windows' surfaces.
+         */
+        bool isDeviceSuitable(VkPhysicalDevice device) {
+
+            QueueFamilyIndices indices = findQueueFamilies(device);
+
+            bool extensionsSupported = checkDeviceExtensionSupport(device);
+
+            bool swapChainAdequate = headless;
+
+            if (extensionsSupported && !headless) {
+                swapChainAdequate = true;
+                for (const auto& output : outputs) {
+                    const SwapChainSupportDetails& swapChainSupport = querySwapChainSupport(device, output->surface);
+                    swapChainAdequate = swapChainAdequate &&
+                                        !swapChainSupport.formats.empty() &&
+                                        !swapChainSupport.presentModes.empty();
+                }
+            }
+
+            return indices.isComplete() &&
                    extensionsSupported  &&
                    swapChainAdequate;
         }
@@ -884,6 +2280,7 @@ class App {
             // First we need to specify the queues we want created
             // For now a single graphics queue will suffice
             QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+            queueFamilies = indices;
 
             std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
             std::set<int> uniqueQueueFamilies =
@@ -914,10 +2311,75 @@ class App {
             createInfo.queueCreateInfoCount = (uint32_t) queueCreateInfos.size();
             createInfo.pEnabledFeatures = &deviceFeatures;
 
+            // On top of the extensions we need, switch on the optional ones
+            // the device happens to support
+            std::vector<const char*> enabledExtensions = getRequiredDeviceExtensions();
+
+            // One device driving every GPU in the group
+            VkDeviceGroupDeviceCreateInfoKHR deviceGroupInfo = {};
+            deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_DEVICE_CREATE_INFO_KHR;
+
+            deviceGroupEnabled = wantDeviceGroup && deviceGroupCreationEnabled &&
+                                 checkOptionalDeviceExtension(physicalDevice, VK_KHR_DEVICE_GROUP_EXTENSION_NAME);
+
+            if (deviceGroupEnabled) {
+                enabledExtensions.push_back(VK_KHR_DEVICE_GROUP_EXTENSION_NAME);
+                deviceGroupInfo.physicalDeviceCount = (uint32_t) deviceGroup.size();
+                deviceGroupInfo.pPhysicalDevices = deviceGroup.data();
+                deviceGroupInfo.pNext = createInfo.pNext;
+                createInfo.pNext = &deviceGroupInfo;
+            } else {
+                deviceGroup = {physicalDevice};
+            }
+
+            VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+            timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+            // A timeline's value may only ever go up, but the GPUs of a group
+            // finish their frames in any order. Fences don't mind.
+            timelineSemaphoresEnabled = options.preferTimelineSemaphores && !deviceGroupEnabled &&
+                                        checkTimelineSemaphoreSupport(physicalDevice);
+
+            if (timelineSemaphoresEnabled) {
+                enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+                timelineFeatures.timelineSemaphore = VK_TRUE;
+                timelineFeatures.pNext = (void*) createInfo.pNext;
+                createInfo.pNext = &timelineFeatures;
+            }
+
+            VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+            dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+            dynamicRenderingEnabled = options.preferDynamicRendering &&
+                                      checkDynamicRenderingSupport(physicalDevice);
+
+            if (dynamicRenderingEnabled) {
+                // On a 1.0 device it needs these too (they're core in 1.2)
+                for (const char* extension : dynamicRenderingExtensions) {
+                    enabledExtensions.push_back(extension);
+                }
+                dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+                dynamicRenderingFeatures.pNext = (void*) createInfo.pNext;
+                createInfo.pNext = &dynamicRenderingFeatures;
+            }
+
+            VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features = {};
+            synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+
+            synchronization2Enabled = options.preferSynchronization2 &&
+                                      capabilities->get(physicalDevice).synchronization2;
+
+            if (synchronization2Enabled) {
+                enabledExtensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+                synchronization2Features.synchronization2 = VK_TRUE;
+                synchronization2Features.pNext = (void*) createInfo.pNext;
+                createInfo.pNext = &synchronization2Features;
+            }
+
             // As with the instance we need to specify any validation
             // layers or extensions we want applied to the device
-            createInfo.enabledExtensionCount = deviceExtensions.size();
-            createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+            createInfo.enabledExtensionCount = enabledExtensions.size();
+            createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
             if (enableValidationLayers) {
                 createInfo.enabledLayerCount = validationLayers.size();
@@ -927,15 +2389,76 @@ class App {
             }
 
             // So we can now actually create the device
-            if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device)
+            if (vkCreateDevice(physicalDevice, &createInfo, allocator, &device)
                     != VK_SUCCESS) {
                 throw std::runtime_error("Unable to create the logical device!!");
             }
 
+            // From here on the calls we make every frame skip the loader
+            dispatch.load(instanceDispatch, device);
+
+            if (dynamicRenderingEnabled && (dispatch.vkCmdBeginRenderingKHR == nullptr ||
+                                            dispatch.vkCmdEndRenderingKHR == nullptr)) {
+                throw std::runtime_error("Unable to load the dynamic rendering functions!!");
+            }
+
+            if (synchronization2Enabled && dispatch.vkCmdPipelineBarrier2KHR == nullptr) {
+                throw std::runtime_error("Unable to load the synchronization2 functions!!");
+            }
+
+            if (deviceGroupEnabled && dispatch.vkCmdSetDeviceMaskKHR == nullptr) {
+                throw std::runtime_error("Unable to load the device group functions!!");
+            }
+            barriers.init(dispatch, synchronization2Enabled);
+
             // With our logical device created the queues we asked for will also
             // have been created, Time to find out where they live...
             vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
             vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
+
+            // Object names go through the device, so this is the first
+            // chance we get to hand them out
+            if (debugUtilsEnabled) {
+                debugNames.init(instance, device);
+            }
+            setDebugName(device, "device");
+            debugNames.name(graphicsQueue, "graphics queue");
+            if (presentQueue != graphicsQueue) {
+                debugNames.name(presentQueue, "present queue");
+            }
+
+            // Now that we have a queue to submit to, give it a timeline.
+            // (We never submit to the present queue, only present on it)
+            graphicsTimeline.init(dispatch, device, graphicsQueue, timelineSemaphoresEnabled, allocator);
+
+            if (deviceGroupEnabled) {
+                graphicsSubmit.useDeviceGroup(allDevicesMask((uint32_t) deviceGroup.size()));
+
+                if (options.multiGpu == MultiGpuMode::AlternateFrame) {
+                    framesInFlight = std::max(framesInFlight, deviceGroup.size());
+                }
+
+                std::cout << "Rendering on a device group of " << deviceGroup.size() << " GPUs ("
+                          << (options.multiGpu == MultiGpuMode::AlternateFrame ? "alternate" : "split")
+                          << " frame)" << std::endl;
+            }
+        }
+
+        /*
+         * Compute mode's replacement for everything after the logical
+         * device, the engine shares its graphics queue
+         */
+        void createCompute() {
+
+            computeEngine.reset(new ComputeEngine(device, capabilities->get(physicalDevice),
+                                                  queueFamilies.graphicsFamily, graphicsQueue, dispatch,
+                                                  synchronization2Enabled, debugNames, allocator));
+
+            computeKernels.reset(new ComputeKernels(*computeEngine, [](const std::string& filename) {
+                std::vector<char> code = readFile(filename);
+                validateSpirv(filename, code);
+                return code;
+            }));
         }
 
         /*
@@ -948,7 +2471,7 @@ class App {
             std::ifstream file (filename, std::ios::ate | std::ios::binary);
 
             if (!file.is_open()) {
-                throw ("Unable to open file!!");
+                throw std::runtime_error("Unable to open " + filename + "!!");
             }
 
             // By reading the file from the end we have an easy way to determine
@@ -964,20 +2487,133 @@ class App {
             return buffer;
         }
 
+        /*
+         * Make sure some SPIR-V at least looks like SPIR-V before we hand it
+         * to the driver, a bad shader is much easier to diagnose here than
+         * as a crash inside vkCreateShaderModule.
+         */
+        static void validateSpirv(const std::string& filename, const std::vector<char>& code) {
+
+            // SPIR-V is a stream of 32 bit words, starting with a five word
+            // header: magic number, version, generator, bound and a zero
+            const uint32_t spirvMagic = 0x07230203;
+
+            if (code.size() < 5 * sizeof(uint32_t) || code.size() % sizeof(uint32_t) != 0) {
+                throw std::runtime_error(filename + " is not a whole number of SPIR-V words!!");
+            }
+
+            uint32_t header[5];
+            memcpy(header, code.data(), sizeof(header));
+
+            if (header[0] != spirvMagic) {
+                throw std::runtime_error(filename + " is not SPIR-V (bad magic number)!!");
+            }
+
+            // We ask for Vulkan 1.0, which only understands SPIR-V 1.0
+            uint32_t major = (header[1] >> 16) & 0xff;
+            uint32_t minor = (header[1] >> 8) & 0xff;
+            if (major != 1 || minor != 0) {
+                throw std::runtime_error(filename + " is SPIR-V " + std::to_string(major) + "."
+                                         + std::to_string(minor) + ", we need 1.0!!");
+            }
+
+            if (header[3] == 0 || header[4] != 0) {
+                throw std::runtime_error(filename + " has a malformed SPIR-V header!!");
+            }
+        }
+
+        /*
+         * Read in (and check) the shader code, this doesn't need the device
+         * so it happens while the device is created.
+         */
+        void loadShaders() {
+
+            // Temporal upscaling has its own versions of the triangle's
+            // shaders, built with TEMPORAL defined
+            const char* vertFile = temporalUpscaling ? "vert_temporal.spv" : "vert.spv";
+            vertShaderCode = readFile(vertFile);
+            validateSpirv(vertFile, vertShaderCode);
+
+            const char* fragFile = temporalUpscaling ? "frag_temporal.spv" : "frag.spv";
+            fragShaderCode = readFile(fragFile);
+            validateSpirv(fragFile, fragShaderCode);
+
+            if (capture) {
+                yuvShaderCode = readFile("yuv.spv");
+                validateSpirv("yuv.spv", yuvShaderCode);
+            }
+
+            // Shadows are lit.frag built with SHADOWS defined
+            if (lighting) {
+                const char* litFile = shadowing ? (temporalUpscaling ? "lit_shadows_temporal.spv" : "lit_shadows.spv")
+                                                : (temporalUpscaling ? "lit_temporal.spv" : "lit.spv");
+                litFragShaderCode = readFile(litFile);
+                validateSpirv(litFile, litFragShaderCode);
+
+                lightBinShaderCode = readFile("light_bin.spv");
+                validateSpirv("light_bin.spv", lightBinShaderCode);
+            }
+
+            if (shadowing) {
+                shadowVertShaderCode = readFile("shadow.spv");
+                validateSpirv("shadow.spv", shadowVertShaderCode);
+            }
+
+            if (postProcessing) {
+                postShaderCode.resize(PostProcess::PASS_COUNT);
+                for (uint32_t i = 0; i < PostProcess::PASS_COUNT; i++) {
+                    postShaderCode[i] = readFile(PostProcess::PASSES[i].shader);
+                    validateSpirv(PostProcess::PASSES[i].shader, postShaderCode[i]);
+                }
+            }
+
+            if (temporalUpscaling) {
+                temporalResolveShaderCode = readFile("temporal_resolve.spv");
+                validateSpirv("temporal_resolve.spv", temporalResolveShaderCode);
+            }
+
+            // With dynamic resolution the present pass upscales
+            if (sceneTarget) {
+                const char* presentFile = dynamicResolution ? "upscale.spv" : "present.spv";
+
+                fullscreenVertShaderCode = readFile("fullscreen.spv");
+                validateSpirv("fullscreen.spv", fullscreenVertShaderCode);
+
+                presentFragShaderCode = readFile(presentFile);
+                validateSpirv(presentFile, presentFragShaderCode);
+            }
+        }
+
+        /*
+         * Name one of our objects for the debugging tools, the index is for
+         * the ones we have a vector of
+         */
+        template<typename T>
+        void setDebugName(const VDeleter<T>& object, const char* name) const {
+            debugNames.name((T) object, name);
+        }
+
+        template<typename T>
+        void setDebugName(const VDeleter<T>& object, const char* name, size_t index) const {
+            debugNames.name((T) object, name, index);
+        }
+
         /*
          * This function sets about making the shader modules.
          */
-        void createShaderModule(const std::vector<char>& code, VDeleter<VkShaderModule>& shaderModule) {
+        void createShaderModule(const std::vector<char>& code, VDeleter<VkShaderModule>& shaderModule,
+                                const char* name) {
 
             VkShaderModuleCreateInfo createInfo = {};
             createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
             createInfo.codeSize = code.size();
             createInfo.pCode = (uint32_t*) code.data();
 
-            if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule)
+            if (vkCreateShaderModule(device, &createInfo, allocator, &shaderModule)
                     != VK_SUCCESS) {
                 throw std::runtime_error("Unable to create shader module!!");
             }
+            setDebugName(shaderModule, name);
         }
 
         /*
@@ -985,15 +2621,26 @@ class App {
          */
         void createRenderPass() {
 
+            // With dynamic rendering the attachments are given to
+            // vkCmdBeginRenderingKHR as we record instead
+            if (dynamicRenderingEnabled) {
+                return;
+            }
+
             VkAttachmentDescription colorAttachment = {};
-            colorAttachment.format = swapChainImageFormat;
+            colorAttachment.format = outputs[0]->imageFormat;
             colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
             colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
             colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
             colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
             colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
             colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+            // In batch mode the image is copied out rather than presented,
+            // or read by the YUV conversion when capturing
+            colorAttachment.finalLayout = !headless ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+                                        : capture ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                                  : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
             VkAttachmentReference colorAttachmentRef = {};
             colorAttachmentRef.attachment = 0;
@@ -1015,22 +2662,37 @@ class App {
             // Some stuff about subpass dependencies I don't quite get right now
             // Apparently there are implicit dependenices and the default syncronisation
             // cues are wrong. So this will fix that
-            VkSubpassDependency dependency = {};
-            dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-            dependency.dstSubpass = 0;
-            dependency.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-            dependency.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-            dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
-                                     | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-            renderPassInfo.dependencyCount = 1;
-            renderPassInfo.pDependencies = &dependency;
-
-            if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass)
+            //
+            // The first waits for the image to be acquired, which happens
+            // at the colour output stage (where we wait on the semaphore)
+            // so there's no need to wait for the whole pipeline.
+            VkSubpassDependency dependencies[2] = {};
+            dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+            dependencies[0].dstSubpass = 0;
+            dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            dependencies[0].srcAccessMask = 0;
+            dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+                                          | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+            // In batch mode the copy (or conversion) after the render pass
+            // has to wait for the colours to be written
+            dependencies[1].srcSubpass = 0;
+            dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+            dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            dependencies[1].dstStageMask = capture ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                                   : VK_PIPELINE_STAGE_TRANSFER_BIT;
+            dependencies[1].dstAccessMask = capture ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_TRANSFER_READ_BIT;
+
+            renderPassInfo.dependencyCount = headless ? 2 : 1;
+            renderPassInfo.pDependencies = dependencies;
+
+            if (vkCreateRenderPass(device, &renderPassInfo, allocator, &renderPass)
                 != VK_SUCCESS) {
                 throw std::runtime_error("Unable to create render pass!!");
             }
+            setDebugName(renderPass, "render pass");
         }
 
         /*
@@ -1038,16 +2700,19 @@ class App {
          */
         void createGraphicsPipeline () {
 
-            // Read in the shader code
-            auto vertShaderCode = readFile("vert.spv");
-            auto fragShaderCode = readFile("frag.spv");
+            // The shader code should already have been read in, but just in
+            // case we're called on our own
+            if (vertShaderCode.empty() || fragShaderCode.empty()) {
+                loadShaders();
+            }
 
             // Now we need to wrap the code in a shader module
-            VDeleter<VkShaderModule> vertShaderModule{device, vkDestroyShaderModule};
-            VDeleter<VkShaderModule> fragShaderModule{device, vkDestroyShaderModule};
+            VDeleter<VkShaderModule> vertShaderModule{device, vkDestroyShaderModule, allocator};
+            VDeleter<VkShaderModule> fragShaderModule{device, vkDestroyShaderModule, allocator};
 
-            createShaderModule(vertShaderCode, vertShaderModule);
-            createShaderModule(fragShaderCode, fragShaderModule);
+            // A lit triangle has a fragment shader of its own
+            createShaderModule(vertShaderCode, vertShaderModule, "vertex shader");
+            createShaderModule(lighting ? litFragShaderCode : fragShaderCode, fragShaderModule, "fragment shader");
 
             // Then we need to assemble the modules into stages
             // telling Vulkand their purpose
@@ -1092,29 +2757,17 @@ class App {
 
             /*
              * With the pipeline input taken care of, it's time to specify the viewport
-             * which is the region of the frambuffer we will render to.
+             * which is the region of the frambuffer we will render to, and the
+             * 'scissors' which can be used to restrict regions of the viewport.
+             *
+             * Every window can be a different size but they all share this
+             * pipeline, so both are set as the command buffers are recorded
+             * (see Dynamic State below). Here we only say how many there are.
              */
-            VkViewport viewport = {};
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = (float) swapChainExtent.width;
-            viewport.height = (float) swapChainExtent.height;
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
-
-            // And we can define 'scissors' which can be used to restrict
-            // regions of the viewport
-            VkRect2D scissor = {};
-            scissor.offset = {0, 0};
-            scissor.extent = swapChainExtent;
-
-            // Combining these two will give us the Viewport State
             VkPipelineViewportStateCreateInfo viewportState = {};
             viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
             viewportState.viewportCount = 1;
-            viewportState.pViewports = &viewport;
             viewportState.scissorCount = 1;
-            viewportState.pScissors = &scissor;
 
             // Next we configure the rasterizer
             VkPipelineRasterizationStateCreateInfo rasterizer = {};
@@ -1175,12 +2828,32 @@ class App {
             colorBlending.attachmentCount = 1;
             colorBlending.pAttachments = &colorBlendAttachment;
 
+            // Upscaling temporally there's a second attachment, the motion
+            // vectors, which are written as they are
+            VkPipelineColorBlendAttachmentState blendAttachments[2] = {colorBlendAttachment, {}};
+            blendAttachments[1].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT;
+            blendAttachments[1].blendEnable = VK_FALSE;
+
+            if (temporalUpscaling) {
+                colorBlending.attachmentCount = 2;
+                colorBlending.pAttachments = blendAttachments;
+            }
+
             /*
              * Dynamic State.
              *
-             * There is a small number of options which CAN be defined at run time
-             * however we won't be doing this for now
+             * There is a small number of options which CAN be defined at run time,
+             * we leave the viewport and scissors until then
              */
+            VkDynamicState dynamicStates[] = {
+                VK_DYNAMIC_STATE_VIEWPORT,
+                VK_DYNAMIC_STATE_SCISSOR
+            };
+
+            VkPipelineDynamicStateCreateInfo dynamicState = {};
+            dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+            dynamicState.dynamicStateCount = 2;
+            dynamicState.pDynamicStates = dynamicStates;
 
             /*
              * There are things called UNIFORM values that we can use in our shaders
@@ -1193,10 +2866,37 @@ class App {
             VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
             pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 
-            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout)
+            // Lit, the fragment shader reads the lights and their clusters
+            // and needs the size of the window to find its cluster
+            VkPushConstantRange screenSize = {};
+            screenSize.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+            screenSize.offset = 0;
+            screenSize.size = 2 * sizeof(float);
+
+            // Upscaling temporally, the vertex shader takes the jitter and
+            // how the triangle moved, clear of the screen size
+            VkPushConstantRange pushConstants[2] = {screenSize, {}};
+            pushConstants[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+            pushConstants[1].offset = TemporalUpscale::VERTEX_CONSTANTS_OFFSET;
+            pushConstants[1].size = sizeof(TemporalUpscale::VertexConstants);
+
+            if (lighting) {
+                pipelineLayoutInfo.setLayoutCount = 1;
+                pipelineLayoutInfo.pSetLayouts = lightingSetLayout.get();
+                pipelineLayoutInfo.pushConstantRangeCount = 1;
+                pipelineLayoutInfo.pPushConstantRanges = &screenSize;
+            }
+
+            if (temporalUpscaling) {
+                pipelineLayoutInfo.pushConstantRangeCount = lighting ? 2 : 1;
+                pipelineLayoutInfo.pPushConstantRanges = lighting ? pushConstants : &pushConstants[1];
+            }
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &pipelineLayout)
                     != VK_SUCCESS) {
                 throw std::runtime_error("Unable to create the pipeline layout!!");
             }
+            setDebugName(pipelineLayout, "pipeline layout");
 
             /*
              * We can now bring it together now and build the pipeline
@@ -1211,278 +2911,3717 @@ class App {
             pipelineInfo.pRasterizationState = &rasterizer;
             pipelineInfo.pMultisampleState = &multisampling;
             pipelineInfo.pColorBlendState = &colorBlending;
+            pipelineInfo.pDynamicState = &dynamicState;
             pipelineInfo.layout = pipelineLayout;
-            pipelineInfo.renderPass = renderPass;
             pipelineInfo.subpass = 0;
             pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
+            // With a scene target, the triangle goes into the HDR scene
+            // image rather than straight to the output
+            pipelineInfo.renderPass = sceneTarget ? sceneRenderPass : renderPass;
+            VkFormat colorFormats[2] = {sceneTarget ? SCENE_FORMAT : outputs[0]->imageFormat, MOTION_FORMAT};
+
+            // Without a render pass the pipeline needs telling what it will
+            // draw into
+            VkPipelineRenderingCreateInfoKHR renderingInfo = {};
+            if (dynamicRenderingEnabled) {
+                renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+                renderingInfo.colorAttachmentCount = temporalUpscaling ? 2 : 1;
+                renderingInfo.pColorAttachmentFormats = colorFormats;
+                renderingInfo.depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+                renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+
+                pipelineInfo.pNext = &renderingInfo;
+                pipelineInfo.renderPass = VK_NULL_HANDLE;
+            }
+
+            // The shadow casters are drawn with a depth only variation on
+            // this pipeline, which we let the driver build as a derivative
+            if (shadowing) {
+                pipelineInfo.flags |= VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+            }
+
             if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                        nullptr, &graphicsPipeline) != VK_SUCCESS) {
+                        allocator, &graphicsPipeline) != VK_SUCCESS) {
                 throw std::runtime_error("Unable to create the graphics pipeline!!");
             }
+            setDebugName(graphicsPipeline, "triangle pipeline");
+
+            if (shadowing) {
+                createShadowPipeline(pipelineInfo);
+            }
 
+            if (sceneTarget) {
+                createPresentPipeline(pipelineInfo);
+            }
         }
 
         /*
-         * This function creates our framebuffers for us
+         * The shadow casters' pipeline: the triangle's, as it was handed to
+         * vkCreateGraphicsPipelines, with only what differs changed. There's
+         * no fragment shader or colour attachment, just depth, the casters
+         * are seen from both sides and their depth is pushed back a little
+         * so the edges of a shadow don't flicker.
          */
-        void createFrameBuffers() {
-
-            // We need a framebuffer for each image in the swap chain
-            swapChainFramebuffers.resize(swapChainImageViews.size(),
-                                         VDeleter<VkFramebuffer>{device, vkDestroyFramebuffer});
-
-            for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+        void createShadowPipeline(const VkGraphicsPipelineCreateInfo& trianglePipelineInfo) {
 
-                VkImageView attachments [] = {
-                    swapChainImageViews[i]
-                };
+            if (shadowVertShaderCode.empty()) {
+                loadShaders();
+            }
 
-                VkFramebufferCreateInfo framebufferInfo = {};
-                framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-                framebufferInfo.renderPass = renderPass;
-                framebufferInfo.attachmentCount = 1;
-                framebufferInfo.pAttachments = attachments;
-                framebufferInfo.width = swapChainExtent.width;
-                framebufferInfo.height = swapChainExtent.height;
-                framebufferInfo.layers = 1;
+            VDeleter<VkShaderModule> shadowShaderModule{device, vkDestroyShaderModule, allocator};
+            createShaderModule(shadowVertShaderCode, shadowShaderModule, "shadow vertex shader");
+
+            VkPipelineShaderStageCreateInfo shaderStage = {};
+            shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            shaderStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+            shaderStage.module = shadowShaderModule;
+            shaderStage.pName = "main";
+
+            VkPipelineRasterizationStateCreateInfo rasterizer = *trianglePipelineInfo.pRasterizationState;
+            rasterizer.cullMode = VK_CULL_MODE_NONE;
+            rasterizer.depthBiasEnable = VK_TRUE;
+            rasterizer.depthBiasConstantFactor = 1.25f;
+            rasterizer.depthBiasSlopeFactor = 1.75f;
+            rasterizer.depthBiasClamp = 0.0f;
+
+            VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+            depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+            depthStencil.depthTestEnable = VK_TRUE;
+            depthStencil.depthWriteEnable = VK_TRUE;
+            depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+            VkPipelineColorBlendStateCreateInfo colorBlending = *trianglePipelineInfo.pColorBlendState;
+            colorBlending.attachmentCount = 0;
+            colorBlending.pAttachments = nullptr;
+
+            VkGraphicsPipelineCreateInfo pipelineInfo = trianglePipelineInfo;
+            pipelineInfo.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+            pipelineInfo.stageCount = 1;
+            pipelineInfo.pStages = &shaderStage;
+            pipelineInfo.pRasterizationState = &rasterizer;
+            pipelineInfo.pDepthStencilState = &depthStencil;
+            pipelineInfo.pColorBlendState = &colorBlending;
+            pipelineInfo.layout = shadowPipelineLayout;
+            pipelineInfo.basePipelineHandle = graphicsPipeline;
+            pipelineInfo.basePipelineIndex = -1;
+
+            VkPipelineRenderingCreateInfoKHR renderingInfo = {};
+            if (dynamicRenderingEnabled) {
+                renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+                renderingInfo.colorAttachmentCount = 0;
+                renderingInfo.depthAttachmentFormat = SHADOW_FORMAT;
+                renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+                pipelineInfo.pNext = &renderingInfo;
+            } else {
+                pipelineInfo.renderPass = shadowRenderPass;
+            }
 
-                if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i])
-                        != VK_SUCCESS) {
-                    std::runtime_error("Unable to create framebuffer!!");
-                }
+            if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &shadowPipeline)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the shadow pipeline!!");
             }
+            setDebugName(shadowPipeline, "shadow pipeline");
         }
 
         /*
-         * This function will create the command buffer for us
+         * The present pipeline, which draws the finished scene onto the
+         * output: the triangle's pipeline again, with fullscreen.vert and
+         * present.frag (or upscale.frag) for shaders, drawing into the
+         * output's render pass rather than the scene's, and nothing to cull
+         * or blend.
          */
-        void createCommandPool () {
+        void createPresentPipeline(const VkGraphicsPipelineCreateInfo& trianglePipelineInfo) {
 
-            /*
-             * Command Pools allocate and manage comamnd buffers. They
-             * only managed buffers that can be submitted to a single
-             * type of queue and since we want to draw something, then
-             * we need to create buffers that will be submitted to the
-             * graphics queue.
-             */
-            QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+            if (fullscreenVertShaderCode.empty() || presentFragShaderCode.empty()) {
+                loadShaders();
+            }
 
-            VkCommandPoolCreateInfo poolInfo = {};
-            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-            poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+            VDeleter<VkShaderModule> vertShaderModule{device, vkDestroyShaderModule, allocator};
+            VDeleter<VkShaderModule> fragShaderModule{device, vkDestroyShaderModule, allocator};
+            createShaderModule(fullscreenVertShaderCode, vertShaderModule, "fullscreen vertex shader");
+            createShaderModule(presentFragShaderCode, fragShaderModule, "present fragment shader");
+
+            VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+            shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+            shaderStages[0].module = vertShaderModule;
+            shaderStages[0].pName = "main";
+            shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+            shaderStages[1].module = fragShaderModule;
+            shaderStages[1].pName = "main";
+
+            VkPipelineRasterizationStateCreateInfo rasterizer = *trianglePipelineInfo.pRasterizationState;
+            rasterizer.cullMode = VK_CULL_MODE_NONE;
+
+            VkPipelineColorBlendAttachmentState colorBlendAttachment =
+                trianglePipelineInfo.pColorBlendState->pAttachments[0];
+            colorBlendAttachment.blendEnable = VK_FALSE;
+
+            VkPipelineColorBlendStateCreateInfo colorBlending = *trianglePipelineInfo.pColorBlendState;
+            colorBlending.attachmentCount = 1;
+            colorBlending.pAttachments = &colorBlendAttachment;
+
+            VkGraphicsPipelineCreateInfo pipelineInfo = trianglePipelineInfo;
+            pipelineInfo.flags = 0;
+            pipelineInfo.stageCount = 2;
+            pipelineInfo.pStages = shaderStages;
+            pipelineInfo.pRasterizationState = &rasterizer;
+            pipelineInfo.pColorBlendState = &colorBlending;
+            pipelineInfo.layout = presentPipelineLayout;
+            pipelineInfo.renderPass = renderPass;
+            pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-            if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool)
+            VkPipelineRenderingCreateInfoKHR renderingInfo = {};
+            if (dynamicRenderingEnabled) {
+                renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+                renderingInfo.colorAttachmentCount = 1;
+                renderingInfo.pColorAttachmentFormats = &outputs[0]->imageFormat;
+                renderingInfo.depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+                renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+                pipelineInfo.pNext = &renderingInfo;
+                pipelineInfo.renderPass = VK_NULL_HANDLE;
+            }
+
+            if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &presentPipeline)
                     != VK_SUCCESS) {
-                throw std::runtime_error("Unable to create the command pool!!");
+                throw std::runtime_error("Unable to create the present pipeline!!");
             }
+            setDebugName(presentPipeline, "present pipeline");
         }
 
         /*
-         * This function will create and 'record' our command
+         * Capture mode's compute pipeline, see shaders/yuv.comp. It takes
+         * two things: the image to read (binding 0) and the buffer to write
+         * the YUV planes into (binding 1), and the frame size as a push
+         * constant.
+         */
+        void createCapturePipeline() {
+
+            if (!capture) {
+                return;
+            }
+
+            const Output& output = *outputs[0];
+
+            // The shader does 8x2 pixel blocks
+            if (output.extent.width % 8 != 0 || output.extent.height % 2 != 0) {
+                throw std::runtime_error("Capturing needs a width that's a multiple of 8 and an even height!!");
+            }
+
+            VkDescriptorSetLayoutBinding bindings[2] = {};
+            bindings[0].binding = 0;
+            bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            bindings[0].descriptorCount = 1;
+            bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[1].binding = 1;
+            bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[1].descriptorCount = 1;
+            bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+            VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.bindingCount = 2;
+            setLayoutInfo.pBindings = bindings;
+
+            if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, allocator, &yuvSetLayout) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the capture descriptor set layout!!");
+            }
+            setDebugName(yuvSetLayout, "capture descriptor set layout");
+
+            VkPushConstantRange pushConstants = {};
+            pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstants.offset = 0;
+            pushConstants.size = 2 * sizeof(uint32_t);
+
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = yuvSetLayout.get();
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &yuvPipelineLayout)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the capture pipeline layout!!");
+            }
+            setDebugName(yuvPipelineLayout, "capture pipeline layout");
+
+            if (yuvShaderCode.empty()) {
+                loadShaders();
+            }
+
+            VDeleter<VkShaderModule> yuvShaderModule{device, vkDestroyShaderModule, allocator};
+            createShaderModule(yuvShaderCode, yuvShaderModule, "yuv shader");
+
+            VkComputePipelineCreateInfo pipelineInfo = {};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = yuvShaderModule;
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.layout = yuvPipelineLayout;
+
+            if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &yuvPipeline)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the capture pipeline!!");
+            }
+            setDebugName(yuvPipeline, "yuv pipeline");
+
+            // texelFetch ignores the filtering, but a sampled image has to
+            // come with a sampler all the same
+            VkSamplerCreateInfo samplerInfo = {};
+            samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+            samplerInfo.magFilter = VK_FILTER_NEAREST;
+            samplerInfo.minFilter = VK_FILTER_NEAREST;
+            samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+            samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+            if (vkCreateSampler(device, &samplerInfo, allocator, &yuvSampler) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the capture sampler!!");
+            }
+            setDebugName(yuvSampler, "capture sampler");
+
+            // One set for each of our images, pointing at it and its buffer
+            uint32_t imageCount = (uint32_t) output.images.size();
+
+            VkDescriptorPoolSize poolSizes[2] = {};
+            poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            poolSizes[0].descriptorCount = imageCount;
+            poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            poolSizes[1].descriptorCount = imageCount;
+
+            VkDescriptorPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = imageCount;
+            poolInfo.poolSizeCount = 2;
+            poolInfo.pPoolSizes = poolSizes;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, allocator, &yuvDescriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the capture descriptor pool!!");
+            }
+            setDebugName(yuvDescriptorPool, "capture descriptor pool");
+
+            std::vector<VkDescriptorSetLayout> setLayouts(imageCount, yuvSetLayout);
+            yuvDescriptorSets.resize(imageCount);
+
+            VkDescriptorSetAllocateInfo setInfo = {};
+            setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setInfo.descriptorPool = yuvDescriptorPool;
+            setInfo.descriptorSetCount = imageCount;
+            setInfo.pSetLayouts = setLayouts.data();
+
+            if (vkAllocateDescriptorSets(device, &setInfo, yuvDescriptorSets.data()) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the capture descriptor sets!!");
+            }
+
+            for (uint32_t i = 0; i < imageCount; i++) {
+
+                VkDescriptorImageInfo imageInfo = {};
+                imageInfo.sampler = yuvSampler;
+                imageInfo.imageView = output.imageViews[i];
+                imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+                VkDescriptorBufferInfo bufferInfo = {};
+                bufferInfo.buffer = readbackBuffers[i];
+                bufferInfo.offset = 0;
+                bufferInfo.range = VK_WHOLE_SIZE;
+
+                VkWriteDescriptorSet writes[2] = {};
+                writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[0].dstSet = yuvDescriptorSets[i];
+                writes[0].dstBinding = 0;
+                writes[0].descriptorCount = 1;
+                writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                writes[0].pImageInfo = &imageInfo;
+                writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[1].dstSet = yuvDescriptorSets[i];
+                writes[1].dstBinding = 1;
+                writes[1].descriptorCount = 1;
+                writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[1].pBufferInfo = &bufferInfo;
+
+                vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+                debugNames.name(yuvDescriptorSets[i], "capture descriptor set", i);
+            }
+        }
+
+        /*
+         * Clustered lighting's buffers, its descriptor set and the compute
+         * pipeline which bins the lights (see shaders/light_bin.comp).
+         * Bindings 0 to 2 are the lights, each cluster's light count and
+         * each cluster's list of lights.
+         */
+        void createLighting() {
+
+            if (!lighting) {
+                return;
+            }
+
+            createBuffer(ClusteredLighting::lightBufferSize(options.lights), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         lightBuffer, lightMemory, "light buffer");
+
+            if (vkMapMemory(device, lightMemory, 0, VK_WHOLE_SIZE, 0, &lightMapping) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to map the light buffer!!");
+            }
+            writeLights(options.lights);
+
+            // The counts are cleared every frame, with vkCmdFillBuffer
+            createBuffer(ClusteredLighting::CLUSTER_COUNT * sizeof(uint32_t),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, clusterCountBuffer, clusterCountMemory,
+                         "cluster count buffer");
+
+            createBuffer((VkDeviceSize) ClusteredLighting::CLUSTER_COUNT * ClusteredLighting::MAX_LIGHTS_PER_CLUSTER
+                             * sizeof(uint32_t),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                         clusterLightBuffer, clusterLightMemory, "cluster light buffer");
+
+            VkBuffer buffers[3] = {lightBuffer, clusterCountBuffer, clusterLightBuffer};
+
+            // With shadows lit.frag also reads the shadow records, which
+            // record each light has and the atlas, which createShadows
+            // fills in
+            uint32_t bindingCount = shadowing ? 6 : 3;
+
+            VkDescriptorSetLayoutBinding bindings[6] = {};
+            for (uint32_t i = 0; i < bindingCount; i++) {
+                bindings[i].binding = i;
+                bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[i].descriptorCount = 1;
+                bindings[i].stageFlags = i < 3 ? VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
+                                               : VK_SHADER_STAGE_FRAGMENT_BIT;
+            }
+            bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+            VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.bindingCount = bindingCount;
+            setLayoutInfo.pBindings = bindings;
+
+            if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, allocator, &lightingSetLayout) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the lighting descriptor set layout!!");
+            }
+            setDebugName(lightingSetLayout, "lighting descriptor set layout");
+
+            VkDescriptorPoolSize poolSizes[2] = {};
+            poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            poolSizes[0].descriptorCount = shadowing ? 5 : 3;
+            poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            poolSizes[1].descriptorCount = 1;
+
+            VkDescriptorPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = 1;
+            poolInfo.poolSizeCount = shadowing ? 2 : 1;
+            poolInfo.pPoolSizes = poolSizes;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, allocator, &lightingDescriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the lighting descriptor pool!!");
+            }
+            setDebugName(lightingDescriptorPool, "lighting descriptor pool");
+
+            VkDescriptorSetAllocateInfo setInfo = {};
+            setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setInfo.descriptorPool = lightingDescriptorPool;
+            setInfo.descriptorSetCount = 1;
+            setInfo.pSetLayouts = lightingSetLayout.get();
+
+            if (vkAllocateDescriptorSets(device, &setInfo, &lightingDescriptorSet) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the lighting descriptor set!!");
+            }
+            debugNames.name(lightingDescriptorSet, "lighting descriptor set");
+
+            VkDescriptorBufferInfo bufferInfos[3] = {};
+            VkWriteDescriptorSet writes[3] = {};
+            for (uint32_t i = 0; i < 3; i++) {
+                bufferInfos[i].buffer = buffers[i];
+                bufferInfos[i].offset = 0;
+                bufferInfos[i].range = VK_WHOLE_SIZE;
+
+                writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[i].dstSet = lightingDescriptorSet;
+                writes[i].dstBinding = i;
+                writes[i].descriptorCount = 1;
+                writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[i].pBufferInfo = &bufferInfos[i];
+            }
+
+            vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+
+            // The binning pass needs the window's aspect ratio, which it gets
+            // from the same screen size push constant as lit.frag
+            VkPushConstantRange pushConstants = {};
+            pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstants.offset = 0;
+            pushConstants.size = 2 * sizeof(float);
+
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = lightingSetLayout.get();
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &lightBinPipelineLayout)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the light binning pipeline layout!!");
+            }
+            setDebugName(lightBinPipelineLayout, "light binning pipeline layout");
+
+            if (lightBinShaderCode.empty()) {
+                loadShaders();
+            }
+
+            VDeleter<VkShaderModule> lightBinShaderModule{device, vkDestroyShaderModule, allocator};
+            createShaderModule(lightBinShaderCode, lightBinShaderModule, "light binning shader");
+
+            VkComputePipelineCreateInfo pipelineInfo = {};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = lightBinShaderModule;
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.layout = lightBinPipelineLayout;
+
+            if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &lightBinPipeline)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the light binning pipeline!!");
+            }
+            setDebugName(lightBinPipeline, "light binning pipeline");
+        }
+
+        /*
+         * Fill the light buffer with count lights (at most options.lights),
+         * the GPU mustn't be using it. New lights need new shadows.
+         */
+        void writeLights(uint32_t count) {
+
+            sceneLights = ClusteredLighting::generateLights(count);
+
+            ClusteredLighting::LightBufferHeader header = {};
+            header.count = count;
+
+            memcpy(lightMapping, &header, sizeof(header));
+            memcpy((uint8_t*) lightMapping + sizeof(header), sceneLights.data(),
+                   sceneLights.size() * sizeof(ClusteredLighting::Light));
+
+            if (shadowIndexMapping != nullptr) {
+                allocateShadows(shadowCount);
+            }
+        }
+
+        /*
+         * Shadowed spot lights (see shadow_atlas.h): the two atlases and the
+         * render pass that draws into them, the casters, the buffers lit.frag
+         * finds each light's tile through, and the command buffers the
+         * atlas is brought up to date with each frame. The pipeline is made
+         * along with the triangle's, in createGraphicsPipeline.
+         */
+        void createShadows() {
+
+            if (!shadowing) {
+                return;
+            }
+
+            // D16 is the one depth format every implementation has to be
+            // able to both draw into and sample
+            static const char* ATLAS_NAMES[2] = {"shadow cache atlas", "shadow atlas"};
+            static const char* VIEW_NAMES[2] = {"shadow cache atlas view", "shadow atlas view"};
+
+            shadowAtlasMemory.resize(2, VDeleter<VkDeviceMemory>{device, vkFreeMemory, allocator});
+            shadowAtlasImages.resize(2, VDeleter<VkImage>{device, vkDestroyImage, allocator});
+            shadowAtlasViews.resize(2, VDeleter<VkImageView>{device, vkDestroyImageView, allocator});
+
+            for (uint32_t i = 0; i < 2; i++) {
+
+                // The cache is only ever copied from, the live atlas copied
+                // to and sampled
+                VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                          (i == SHADOW_CACHE ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+                                                             : VK_IMAGE_USAGE_TRANSFER_DST_BIT
+                                                             | VK_IMAGE_USAGE_SAMPLED_BIT);
+
+                createImage({ShadowAtlas::ATLAS_SIZE, ShadowAtlas::ATLAS_SIZE}, SHADOW_FORMAT, usage,
+                            shadowAtlasImages[i], shadowAtlasMemory[i], ATLAS_NAMES[i]);
+
+                VkImageViewCreateInfo viewInfo = {};
+                viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                viewInfo.image = shadowAtlasImages[i];
+                viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+                viewInfo.format = SHADOW_FORMAT;
+                viewInfo.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+
+                if (vkCreateImageView(device, &viewInfo, allocator, &shadowAtlasViews[i]) != VK_SUCCESS) {
+                    throw std::runtime_error(std::string("Unable to create the ") + VIEW_NAMES[i] + "!!");
+                }
+                setDebugName(shadowAtlasViews[i], VIEW_NAMES[i]);
+            }
+
+            // Without dynamic rendering, a render pass with nothing but a
+            // depth attachment. It keeps what's there (we only draw some of
+            // the tiles) and leaves the layouts to our barriers.
+            if (!dynamicRenderingEnabled) {
+
+                VkAttachmentDescription depthAttachment = {};
+                depthAttachment.format = SHADOW_FORMAT;
+                depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+                depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+                depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+                VkAttachmentReference depthReference = {0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+                VkSubpassDescription subpass = {};
+                subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+                subpass.colorAttachmentCount = 0;
+                subpass.pDepthStencilAttachment = &depthReference;
+
+                VkRenderPassCreateInfo renderPassInfo = {};
+                renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+                renderPassInfo.attachmentCount = 1;
+                renderPassInfo.pAttachments = &depthAttachment;
+                renderPassInfo.subpassCount = 1;
+                renderPassInfo.pSubpasses = &subpass;
+
+                if (vkCreateRenderPass(device, &renderPassInfo, allocator, &shadowRenderPass) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create the shadow render pass!!");
+                }
+                setDebugName(shadowRenderPass, "shadow render pass");
+
+                shadowFramebuffers.resize(2, VDeleter<VkFramebuffer>{device, vkDestroyFramebuffer, allocator});
+
+                for (uint32_t i = 0; i < 2; i++) {
+
+                    VkImageView attachment = shadowAtlasViews[i];
+
+                    VkFramebufferCreateInfo framebufferInfo = {};
+                    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+                    framebufferInfo.renderPass = shadowRenderPass;
+                    framebufferInfo.attachmentCount = 1;
+                    framebufferInfo.pAttachments = &attachment;
+                    framebufferInfo.width = ShadowAtlas::ATLAS_SIZE;
+                    framebufferInfo.height = ShadowAtlas::ATLAS_SIZE;
+                    framebufferInfo.layers = 1;
+
+                    if (vkCreateFramebuffer(device, &framebufferInfo, allocator, &shadowFramebuffers[i])
+                            != VK_SUCCESS) {
+                        throw std::runtime_error("Unable to create a shadow framebuffer!!");
+                    }
+                    setDebugName(shadowFramebuffers[i], "shadow framebuffer", i);
+                }
+            }
+
+            // Filtered and compared in the sampler, so each lookup is four
+            // depth tests blended together
+            VkSamplerCreateInfo samplerInfo = {};
+            samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+            samplerInfo.magFilter = VK_FILTER_LINEAR;
+            samplerInfo.minFilter = VK_FILTER_LINEAR;
+            samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+            samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.compareEnable = VK_TRUE;
+            samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+            samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+            if (vkCreateSampler(device, &samplerInfo, allocator, &shadowSampler) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the shadow sampler!!");
+            }
+            setDebugName(shadowSampler, "shadow sampler");
+
+            // The static casters, then room for every frame in flight's
+            // dynamic ones
+            VkDeviceSize casterCount = ShadowAtlas::STATIC_CASTERS + framesInFlight * ShadowAtlas::MAX_DYNAMIC_CASTERS;
+            createBuffer(casterCount * sizeof(ShadowAtlas::Caster), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         casterBuffer, casterMemory, "shadow caster buffer");
+
+            if (vkMapMemory(device, casterMemory, 0, VK_WHOLE_SIZE, 0, &casterMapping) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to map the shadow caster buffer!!");
+            }
+
+            std::vector<ShadowAtlas::Caster> staticCasters = ShadowAtlas::generateStaticCasters();
+            memcpy(casterMapping, staticCasters.data(), staticCasters.size() * sizeof(ShadowAtlas::Caster));
+            shadowCasterBounds.resize(ShadowAtlas::MAX_DYNAMIC_CASTERS);
+
+            createBuffer(options.shadows * sizeof(ShadowAtlas::ShadowRecord), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         shadowRecordBuffer, shadowRecordMemory, "shadow record buffer");
+
+            if (vkMapMemory(device, shadowRecordMemory, 0, VK_WHOLE_SIZE, 0, &shadowRecordMapping) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to map the shadow record buffer!!");
+            }
+
+            createBuffer(options.lights * sizeof(int32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         shadowIndexBuffer, shadowIndexMemory, "shadow index buffer");
+
+            if (vkMapMemory(device, shadowIndexMemory, 0, VK_WHOLE_SIZE, 0, &shadowIndexMapping) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to map the shadow index buffer!!");
+            }
+
+            allocateShadows(shadowCount);
+
+            // The rest of lit.frag's descriptors
+            VkDescriptorBufferInfo bufferInfos[2] = {};
+            bufferInfos[0].buffer = shadowRecordBuffer;
+            bufferInfos[0].range = VK_WHOLE_SIZE;
+            bufferInfos[1].buffer = shadowIndexBuffer;
+            bufferInfos[1].range = VK_WHOLE_SIZE;
+
+            VkDescriptorImageInfo imageInfo = {};
+            imageInfo.sampler = shadowSampler;
+            imageInfo.imageView = shadowAtlasViews[SHADOW_LIVE];
+            imageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+            VkWriteDescriptorSet writes[3] = {};
+            for (uint32_t i = 0; i < 3; i++) {
+                writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[i].dstSet = lightingDescriptorSet;
+                writes[i].dstBinding = 3 + i;
+                writes[i].descriptorCount = 1;
+                writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[i].pBufferInfo = &bufferInfos[i];
+            }
+            writes[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writes[2].pBufferInfo = nullptr;
+            writes[2].pImageInfo = &imageInfo;
+
+            vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+
+            // shadow.vert pulls the casters' corners out of a storage buffer,
+            // and takes the light's matrix as a push constant
+            VkDescriptorSetLayoutBinding binding = {};
+            binding.binding = 0;
+            binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            binding.descriptorCount = 1;
+            binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+            VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.bindingCount = 1;
+            setLayoutInfo.pBindings = &binding;
+
+            if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, allocator, &casterSetLayout) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the shadow caster descriptor set layout!!");
+            }
+            setDebugName(casterSetLayout, "shadow caster descriptor set layout");
+
+            VkDescriptorPoolSize poolSize = {};
+            poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            poolSize.descriptorCount = 1;
+
+            VkDescriptorPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = 1;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = &poolSize;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, allocator, &casterDescriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the shadow caster descriptor pool!!");
+            }
+            setDebugName(casterDescriptorPool, "shadow caster descriptor pool");
+
+            VkDescriptorSetAllocateInfo setInfo = {};
+            setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setInfo.descriptorPool = casterDescriptorPool;
+            setInfo.descriptorSetCount = 1;
+            setInfo.pSetLayouts = casterSetLayout.get();
+
+            if (vkAllocateDescriptorSets(device, &setInfo, &casterDescriptorSet) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the shadow caster descriptor set!!");
+            }
+            debugNames.name(casterDescriptorSet, "shadow caster descriptor set");
+
+            VkDescriptorBufferInfo casterInfo = {};
+            casterInfo.buffer = casterBuffer;
+            casterInfo.range = VK_WHOLE_SIZE;
+
+            VkWriteDescriptorSet casterWrite = {};
+            casterWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            casterWrite.dstSet = casterDescriptorSet;
+            casterWrite.dstBinding = 0;
+            casterWrite.descriptorCount = 1;
+            casterWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            casterWrite.pBufferInfo = &casterInfo;
+
+            vkUpdateDescriptorSets(device, 1, &casterWrite, 0, nullptr);
+
+            VkPushConstantRange pushConstants = {};
+            pushConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+            pushConstants.offset = 0;
+            pushConstants.size = 16 * sizeof(float);
+
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = casterSetLayout.get();
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &shadowPipelineLayout)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the shadow pipeline layout!!");
+            }
+            setDebugName(shadowPipelineLayout, "shadow pipeline layout");
+
+            // The updates are recorded afresh every frame, so each command
+            // buffer has to be resettable on its own
+            VkCommandPoolCreateInfo commandPoolInfo = {};
+            commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            commandPoolInfo.queueFamilyIndex = queueFamilies.graphicsFamily;
+
+            if (vkCreateCommandPool(device, &commandPoolInfo, allocator, &shadowCommandPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the shadow command pool!!");
+            }
+            setDebugName(shadowCommandPool, "shadow command pool");
+
+            shadowCommandBuffers.resize(framesInFlight);
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = shadowCommandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = (uint32_t) shadowCommandBuffers.size();
+
+            if (vkAllocateCommandBuffers(device, &allocInfo, shadowCommandBuffers.data()) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the shadow command buffers!!");
+            }
+            for (size_t i = 0; i < shadowCommandBuffers.size(); i++) {
+                debugNames.name(shadowCommandBuffers[i], "shadow command buffer", i);
+            }
+        }
+
+        /*
+         * Hand the atlas's tiles out to the count most important spot
+         * lights, and tell lit.frag where they are. Every tile starts out
+         * empty, so the next frame draws them all. The GPU mustn't be using
+         * the shadows.
+         */
+        void allocateShadows(uint32_t count) {
+
+            shadowCount = count;
+            shadowTiles = ShadowAtlas::allocateTiles(sceneLights, count);
+
+            int32_t* indices = (int32_t*) shadowIndexMapping;
+            std::fill(indices, indices + options.lights, -1);
+
+            ShadowAtlas::ShadowRecord* records = (ShadowAtlas::ShadowRecord*) shadowRecordMapping;
+            for (size_t i = 0; i < shadowTiles.size(); i++) {
+                records[i] = shadowTiles[i].record;
+                indices[shadowTiles[i].light] = (int32_t) i;
+            }
+
+            // Reserved now so recording the updates doesn't allocate
+            shadowCacheUpdates.reserve(shadowTiles.size());
+            shadowLiveUpdates.reserve(shadowTiles.size());
+            shadowCopies.reserve(shadowTiles.size());
+        }
+
+        /*
+         * Bring the live shadow atlas up to date, in this frame's shadow
+         * command buffer. It goes in the same submit as the image's own,
+         * just before it.
+         *
+         * Tiles that are new get their static casters drawn into the cache.
+         * Then any tile a dynamic caster is near, or has just left, is
+         * copied back from the cache and has the dynamic casters drawn over
+         * it. Tiles nothing moved near are left as they are. Without
+         * cacheShadows every tile is cleared and drawn from scratch, every
+         * frame, which is what the benchmark compares against.
+         *
+         * The timer's slot starts here rather than in the image's command
+         * buffer, its first region is the shadows.
+         */
+        VkCommandBuffer recordShadowUpdates(uint32_t timerSlot) {
+
+            VkCommandBuffer commandBuffer = shadowCommandBuffers[currentFrame];
+
+            // This frame's dynamic casters have a stretch of the buffer to
+            // themselves, the other frames in flight may still be drawing
+            // theirs
+            uint32_t firstDynamic = ShadowAtlas::STATIC_CASTERS
+                                  + (uint32_t) currentFrame * ShadowAtlas::MAX_DYNAMIC_CASTERS;
+            ShadowAtlas::dynamicCasters(shadowFrame++, shadowCasters,
+                                        (ShadowAtlas::Caster*) casterMapping + firstDynamic,
+                                        shadowCasterBounds.data());
+
+            shadowCacheUpdates.clear();
+            shadowLiveUpdates.clear();
+
+            for (uint32_t i = 0; i < shadowTiles.size(); i++) {
+
+                ShadowAtlas::Tile& tile = shadowTiles[i];
+
+                bool dynamic = false;
+                for (uint32_t caster = 0; caster < shadowCasters && !dynamic; caster++) {
+                    dynamic = ShadowAtlas::touches(shadowCasterBounds[caster], sceneLights[tile.light]);
+                }
+
+                bool fresh = cacheShadows && !tile.cached;
+                if (fresh) {
+                    shadowCacheUpdates.push_back(i);
+                    tile.cached = true;
+                }
+
+                if (!cacheShadows || fresh || dynamic || tile.dynamic) {
+                    shadowLiveUpdates.push_back(i);
+                }
+                tile.dynamic = dynamic;
+            }
+            shadowTilesDrawn += shadowLiveUpdates.size();
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            dispatch.vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            passTimer.begin(commandBuffer, timerSlot);
+
+            VkImageSubresourceRange depthRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+            VkImage cache = shadowAtlasImages[SHADOW_CACHE];
+            VkImage live = shadowAtlasImages[SHADOW_LIVE];
+
+            {
+                DebugNames::Label shadowLabel(debugNames, commandBuffer, "shadows", DebugNames::PASS_COLOR);
+
+                if (!shadowCacheUpdates.empty()) {
+
+                    barriers.image(cache, shadowAtlasLayouts[SHADOW_CACHE],
+                                   VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                                   Usage::CopySource, Usage::DepthAttachmentWrite, depthRange);
+                    barriers.flush(commandBuffer);
+
+                    beginShadowRendering(commandBuffer, SHADOW_CACHE);
+                    for (uint32_t i : shadowCacheUpdates) {
+                        drawShadowTile(commandBuffer, shadowTiles[i], true, false, 0);
+                    }
+                    endShadowRendering(commandBuffer);
+
+                    barriers.image(cache, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                   Usage::DepthAttachmentWrite, Usage::CopySource, depthRange);
+                    shadowAtlasLayouts[SHADOW_CACHE] = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+                }
+
+                // lit.frag expects the live atlas to be readable even if
+                // there's nothing in it, so the first frame always comes in
+                // here
+                if (!shadowLiveUpdates.empty() || shadowAtlasLayouts[SHADOW_LIVE] == VK_IMAGE_LAYOUT_UNDEFINED) {
+
+                    if (cacheShadows) {
+                        barriers.image(live, shadowAtlasLayouts[SHADOW_LIVE], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                       Usage::FragmentSampledRead, Usage::CopyDestination, depthRange);
+                        barriers.flush(commandBuffer);
+
+                        shadowCopies.clear();
+                        for (uint32_t i : shadowLiveUpdates) {
+                            const ShadowAtlas::Tile& tile = shadowTiles[i];
+
+                            VkImageCopy copy = {};
+                            copy.srcSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1};
+                            copy.srcOffset = {(int32_t) tile.x, (int32_t) tile.y, 0};
+                            copy.dstSubresource = copy.srcSubresource;
+                            copy.dstOffset = copy.srcOffset;
+                            copy.extent = {tile.size, tile.size, 1};
+                            shadowCopies.push_back(copy);
+                        }
+
+                        if (!shadowCopies.empty()) {
+                            dispatch.vkCmdCopyImage(commandBuffer, cache, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                    live, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                    (uint32_t) shadowCopies.size(), shadowCopies.data());
+                        }
+
+                        barriers.image(live, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                       VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                                       Usage::CopyDestination, Usage::DepthAttachmentWrite, depthRange);
+                    } else {
+                        barriers.image(live, shadowAtlasLayouts[SHADOW_LIVE],
+                                       VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                                       Usage::FragmentSampledRead, Usage::DepthAttachmentWrite, depthRange);
+                    }
+                    barriers.flush(commandBuffer);
+
+                    beginShadowRendering(commandBuffer, SHADOW_LIVE);
+                    for (uint32_t i : shadowLiveUpdates) {
+                        drawShadowTile(commandBuffer, shadowTiles[i], !cacheShadows, true, firstDynamic);
+                    }
+                    endShadowRendering(commandBuffer);
+
+                    barriers.image(live, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                                   VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                                   Usage::DepthAttachmentWrite, Usage::FragmentSampledRead, depthRange);
+                    shadowAtlasLayouts[SHADOW_LIVE] = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+                }
+
+                barriers.flush(commandBuffer);
+            }
+
+            passTimer.mark(commandBuffer, timerSlot, SHADOW_REGION);
+
+            if (dispatch.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to record the shadow command buffer!!");
+            }
+
+            return commandBuffer;
+        }
+
+        /*
+         * Start drawing into one of the atlases, which has to be in the
+         * depth attachment layout already, with the shadow pipeline bound
+         */
+        void beginShadowRendering(VkCommandBuffer commandBuffer, uint32_t atlas) {
+
+            VkRect2D renderArea = {{0, 0}, {ShadowAtlas::ATLAS_SIZE, ShadowAtlas::ATLAS_SIZE}};
+
+            if (dynamicRenderingEnabled) {
+                VkRenderingAttachmentInfoKHR depthAttachment = {};
+                depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+                depthAttachment.imageView = shadowAtlasViews[atlas];
+                depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+                depthAttachment.resolveMode = VK_RESOLVE_MODE_NONE;
+                depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+                VkRenderingInfoKHR renderingInfo = {};
+                renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+                renderingInfo.renderArea = renderArea;
+                renderingInfo.layerCount = 1;
+                renderingInfo.pDepthAttachment = &depthAttachment;
+
+                dispatch.vkCmdBeginRenderingKHR(commandBuffer, &renderingInfo);
+            } else {
+                VkRenderPassBeginInfo renderPassInfo = {};
+                renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                renderPassInfo.renderPass = shadowRenderPass;
+                renderPassInfo.framebuffer = shadowFramebuffers[atlas];
+                renderPassInfo.renderArea = renderArea;
+
+                dispatch.vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            }
+
+            dispatch.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline);
+            dispatch.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout,
+                                             0, 1, &casterDescriptorSet, 0, nullptr);
+        }
+
+        void endShadowRendering(VkCommandBuffer commandBuffer) {
+
+            if (dynamicRenderingEnabled) {
+                dispatch.vkCmdEndRenderingKHR(commandBuffer);
+            } else {
+                dispatch.vkCmdEndRenderPass(commandBuffer);
+            }
+        }
+
+        /*
+         * Draw one tile from the light's point of view. From scratch it's
+         * cleared and gets the static casters, the dynamic ones (starting
+         * at firstDynamic in the caster buffer) go on top of whatever is
+         * there.
+         */
+        void drawShadowTile(VkCommandBuffer commandBuffer, const ShadowAtlas::Tile& tile, bool fromScratch,
+                            bool drawDynamic, uint32_t firstDynamic) {
+
+            VkViewport viewport = {(float) tile.x, (float) tile.y, (float) tile.size, (float) tile.size, 0.0f, 1.0f};
+            VkRect2D scissor = {{(int32_t) tile.x, (int32_t) tile.y}, {tile.size, tile.size}};
+            dispatch.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            dispatch.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+            dispatch.vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                                        0, sizeof(tile.record.viewProjection), tile.record.viewProjection);
+
+            if (fromScratch) {
+                VkClearAttachment clear = {};
+                clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+                clear.clearValue.depthStencil = {1.0f, 0};
+
+                VkClearRect clearRect = {scissor, 0, 1};
+                dispatch.vkCmdClearAttachments(commandBuffer, 1, &clear, 1, &clearRect);
+
+                dispatch.vkCmdDraw(commandBuffer, 3 * ShadowAtlas::STATIC_CASTERS, 1, 0, 0);
+            }
+
+            if (drawDynamic && shadowCasters > 0) {
+                dispatch.vkCmdDraw(commandBuffer, 3 * shadowCasters, 1, 3 * firstDynamic, 0);
+            }
+        }
+
+        /*
+         * With post processing or dynamic resolution, the HDR image the
+         * scene is drawn into, the render pass it's drawn with, and the
+         * present pass's layouts and descriptor set. The image is as big as
+         * the output, dynamic resolution only draws into its top left
+         * corner when it's drawing smaller.
+         */
+        void createSceneTarget() {
+
+            if (!sceneTarget) {
+                return;
+            }
+
+            sceneExtent = outputs[0]->extent;
+
+            createImage(sceneExtent, SCENE_FORMAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                        sceneImage, sceneMemory, "scene image");
+
+            VkImageViewCreateInfo viewInfo = {};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = sceneImage;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = SCENE_FORMAT;
+            viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+            if (vkCreateImageView(device, &viewInfo, allocator, &sceneView) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the view of the scene image!!");
+            }
+            setDebugName(sceneView, "scene image");
+
+            // Upscaling temporally, the motion vectors go alongside
+            if (temporalUpscaling) {
+                createImage(sceneExtent, MOTION_FORMAT,
+                            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                            motionImage, motionMemory, "motion image");
+
+                viewInfo.image = motionImage;
+                viewInfo.format = MOTION_FORMAT;
+
+                if (vkCreateImageView(device, &viewInfo, allocator, &motionView) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create the view of the motion image!!");
+                }
+                setDebugName(motionView, "motion image");
+            }
+
+            const uint32_t attachmentCount = temporalUpscaling ? 2 : 1;
+
+            // Without dynamic rendering, the scene's render pass. The images
+            // are cleared, and our barriers see to their layouts.
+            if (!dynamicRenderingEnabled) {
+
+                VkAttachmentDescription colorAttachment = {};
+                colorAttachment.format = SCENE_FORMAT;
+                colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+                colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+                colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+                VkAttachmentDescription attachments[2] = {colorAttachment, colorAttachment};
+                attachments[1].format = MOTION_FORMAT;
+
+                VkAttachmentReference colorReferences[2] = {
+                    {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+                    {1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}
+                };
+
+                VkSubpassDescription subpass = {};
+                subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+                subpass.colorAttachmentCount = attachmentCount;
+                subpass.pColorAttachments = colorReferences;
+
+                VkRenderPassCreateInfo renderPassInfo = {};
+                renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+                renderPassInfo.attachmentCount = attachmentCount;
+                renderPassInfo.pAttachments = attachments;
+                renderPassInfo.subpassCount = 1;
+                renderPassInfo.pSubpasses = &subpass;
+
+                if (vkCreateRenderPass(device, &renderPassInfo, allocator, &sceneRenderPass) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create the scene render pass!!");
+                }
+                setDebugName(sceneRenderPass, "scene render pass");
+
+                VkImageView views[2] = {sceneView, motionView};
+
+                VkFramebufferCreateInfo framebufferInfo = {};
+                framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+                framebufferInfo.renderPass = sceneRenderPass;
+                framebufferInfo.attachmentCount = attachmentCount;
+                framebufferInfo.pAttachments = views;
+                framebufferInfo.width = sceneExtent.width;
+                framebufferInfo.height = sceneExtent.height;
+                framebufferInfo.layers = 1;
+
+                if (vkCreateFramebuffer(device, &framebufferInfo, allocator, &sceneFramebuffer) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create the scene framebuffer!!");
+                }
+                setDebugName(sceneFramebuffer, "scene framebuffer");
+            }
+
+            // Bilinear, for the bloom's downsampling and upsampling and the
+            // upscales. The other reads are texelFetches, which ignore it.
+            VkSamplerCreateInfo samplerInfo = {};
+            samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+            samplerInfo.magFilter = VK_FILTER_LINEAR;
+            samplerInfo.minFilter = VK_FILTER_LINEAR;
+            samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+            samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+            if (vkCreateSampler(device, &samplerInfo, allocator, &sceneSampler) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the scene sampler!!");
+            }
+            setDebugName(sceneSampler, "scene sampler");
+
+            // The present pass only reads the finished image. With dynamic
+            // resolution it also needs to know how much of the scene image
+            // was drawn, and how big the output is.
+            VkDescriptorSetLayoutBinding presentBinding = {};
+            presentBinding.binding = 0;
+            presentBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            presentBinding.descriptorCount = 1;
+            presentBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+            VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.bindingCount = 1;
+            setLayoutInfo.pBindings = &presentBinding;
+
+            if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, allocator, &presentSetLayout) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the present descriptor set layout!!");
+            }
+            setDebugName(presentSetLayout, "present descriptor set layout");
+
+            VkPushConstantRange pushConstants = {};
+            pushConstants.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+            pushConstants.offset = 0;
+            pushConstants.size = sizeof(DynamicResolution::PushConstants);
+
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = presentSetLayout.get();
+            if (dynamicResolution) {
+                pipelineLayoutInfo.pushConstantRangeCount = 1;
+                pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+            }
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &presentPipelineLayout)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the present pipeline layout!!");
+            }
+            setDebugName(presentPipelineLayout, "present pipeline layout");
+
+            VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1};
+
+            VkDescriptorPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = 1;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = &poolSize;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, allocator, &presentDescriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the present descriptor pool!!");
+            }
+            setDebugName(presentDescriptorPool, "present descriptor pool");
+
+            VkDescriptorSetAllocateInfo setInfo = {};
+            setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setInfo.descriptorPool = presentDescriptorPool;
+            setInfo.descriptorSetCount = 1;
+            setInfo.pSetLayouts = presentSetLayout.get();
+
+            if (vkAllocateDescriptorSets(device, &setInfo, &presentDescriptorSet) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the present descriptor set!!");
+            }
+
+            // Post processing points it at its own output once it's made it
+            writePresentDescriptorSet(sceneView);
+        }
+
+        void writePresentDescriptorSet(VkImageView view) {
+
+            VkDescriptorImageInfo presentInfo = {sceneSampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+
+            VkWriteDescriptorSet write = {};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = presentDescriptorSet;
+            write.dstBinding = 0;
+            write.descriptorCount = 1;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            write.pImageInfo = &presentInfo;
+
+            vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+            debugNames.name(presentDescriptorSet, "present descriptor set");
+        }
+
+        /*
+         * Post processing's images, and a compute pipeline and descriptor
+         * set for each of the passes in post_process.h. The passes' sets
+         * share a layout: the pass's input at binding 0, the bloom for
+         * those that add it at binding 1 and the image it writes at
+         * binding 2.
+         */
+        void createPostProcessing() {
+
+            if (!postProcessing) {
+                return;
+            }
+
+            static const char* IMAGE_NAMES[PostProcess::IMAGE_COUNT] = {
+                "scene image", "bloom image A", "bloom image B", "LDR image A", "LDR image B"
+            };
+
+            const VkExtent2D extent = sceneExtent;
+
+            postMemory.resize(PostProcess::IMAGE_COUNT, VDeleter<VkDeviceMemory>{device, vkFreeMemory, allocator});
+            postImages.resize(PostProcess::IMAGE_COUNT, VDeleter<VkImage>{device, vkDestroyImage, allocator});
+            postViews.resize(PostProcess::IMAGE_COUNT, VDeleter<VkImageView>{device, vkDestroyImageView, allocator});
+            postExtents.resize(PostProcess::IMAGE_COUNT);
+
+            postExtents[PostProcess::SCENE] = sceneExtent;
+
+            for (uint32_t i = 0; i < PostProcess::IMAGE_COUNT; i++) {
+
+                PostProcess::Image image = (PostProcess::Image) i;
+
+                // createSceneTarget() made that one
+                if (image == PostProcess::SCENE) {
+                    continue;
+                }
+
+                // The bloom is HDR like the scene, everything after the
+                // tonemapping fits in 8 bits. Both formats have to support
+                // storage on every implementation.
+                VkFormat format = PostProcess::halfSize(image) ? SCENE_FORMAT : LDR_FORMAT;
+                VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+
+                postExtents[i] = PostProcess::halfSize(image)
+                               ? VkExtent2D{(extent.width + 1) / 2, (extent.height + 1) / 2} : extent;
+
+                createImage(postExtents[i], format, usage, postImages[i], postMemory[i], IMAGE_NAMES[i]);
+
+                VkImageViewCreateInfo viewInfo = {};
+                viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                viewInfo.image = postImages[i];
+                viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+                viewInfo.format = format;
+                viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+                if (vkCreateImageView(device, &viewInfo, allocator, &postViews[i]) != VK_SUCCESS) {
+                    throw std::runtime_error(std::string("Unable to create the view of the ") + IMAGE_NAMES[i] + "!!");
+                }
+                setDebugName(postViews[i], IMAGE_NAMES[i]);
+            }
+
+            VkDescriptorSetLayoutBinding bindings[3] = {};
+            for (uint32_t i = 0; i < 3; i++) {
+                bindings[i].binding = i;
+                bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                bindings[i].descriptorCount = 1;
+                bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            }
+            bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+            VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.bindingCount = 3;
+            setLayoutInfo.pBindings = bindings;
+
+            if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, allocator, &postSetLayout) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the post processing descriptor set layout!!");
+            }
+            setDebugName(postSetLayout, "post processing descriptor set layout");
+
+            VkPushConstantRange pushConstants = {};
+            pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstants.offset = 0;
+            pushConstants.size = sizeof(PostProcess::PushConstants);
+
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = postSetLayout.get();
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &postPipelineLayout) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the post processing pipeline layout!!");
+            }
+            setDebugName(postPipelineLayout, "post processing pipeline layout");
+
+            if (postShaderCode.empty()) {
+                loadShaders();
+            }
+
+            postPipelines.resize(PostProcess::PASS_COUNT, VDeleter<VkPipeline>{device, vkDestroyPipeline, allocator});
+
+            for (uint32_t i = 0; i < PostProcess::PASS_COUNT; i++) {
+
+                VDeleter<VkShaderModule> shaderModule{device, vkDestroyShaderModule, allocator};
+                createShaderModule(postShaderCode[i], shaderModule, PostProcess::PASSES[i].shader);
+
+                VkComputePipelineCreateInfo pipelineInfo = {};
+                pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+                pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+                pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+                pipelineInfo.stage.module = shaderModule;
+                pipelineInfo.stage.pName = "main";
+                pipelineInfo.layout = postPipelineLayout;
+
+                if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &postPipelines[i])
+                        != VK_SUCCESS) {
+                    throw std::runtime_error(std::string("Unable to create the ") + PostProcess::PASSES[i].name +
+                                             " pipeline!!");
+                }
+                setDebugName(postPipelines[i], PostProcess::PASSES[i].name);
+            }
+
+            // A set for each pass
+            VkDescriptorPoolSize poolSizes[2] = {};
+            poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            poolSizes[0].descriptorCount = 2 * PostProcess::PASS_COUNT;
+            poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            poolSizes[1].descriptorCount = PostProcess::PASS_COUNT;
+
+            VkDescriptorPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = PostProcess::PASS_COUNT;
+            poolInfo.poolSizeCount = 2;
+            poolInfo.pPoolSizes = poolSizes;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, allocator, &postDescriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the post processing descriptor pool!!");
+            }
+            setDebugName(postDescriptorPool, "post processing descriptor pool");
+
+            std::vector<VkDescriptorSetLayout> setLayouts(PostProcess::PASS_COUNT, postSetLayout);
+            postDescriptorSets.resize(PostProcess::PASS_COUNT);
+
+            VkDescriptorSetAllocateInfo setInfo = {};
+            setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setInfo.descriptorPool = postDescriptorPool;
+            setInfo.descriptorSetCount = PostProcess::PASS_COUNT;
+            setInfo.pSetLayouts = setLayouts.data();
+
+            if (vkAllocateDescriptorSets(device, &setInfo, postDescriptorSets.data()) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the post processing descriptor sets!!");
+            }
+
+            // The inputs are read in the layout each pass leaves its output
+            // in, the outputs written in GENERAL (storage images have to be)
+            for (uint32_t i = 0; i < PostProcess::PASS_COUNT; i++) {
+
+                const PostProcess::Pass& pass = PostProcess::PASSES[i];
+
+                VkDescriptorImageInfo imageInfos[3] = {};
+                imageInfos[0] = {sceneSampler, postView(pass.input), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+                imageInfos[2] = {VK_NULL_HANDLE, postView(pass.output), VK_IMAGE_LAYOUT_GENERAL};
+                if (pass.secondInput != PostProcess::NO_IMAGE) {
+                    imageInfos[1] = {sceneSampler, postView(pass.secondInput),
+                                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+                }
+
+                VkWriteDescriptorSet writes[3] = {};
+                uint32_t writeCount = 0;
+                for (uint32_t binding = 0; binding < 3; binding++) {
+
+                    // Only the passes that add the bloom have a second input
+                    if (binding == 1 && pass.secondInput == PostProcess::NO_IMAGE) {
+                        continue;
+                    }
+
+                    VkWriteDescriptorSet& write = writes[writeCount++];
+                    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                    write.dstSet = postDescriptorSets[i];
+                    write.dstBinding = binding;
+                    write.descriptorCount = 1;
+                    write.descriptorType = bindings[binding].descriptorType;
+                    write.pImageInfo = &imageInfos[binding];
+                }
+
+                vkUpdateDescriptorSets(device, writeCount, writes, 0, nullptr);
+                debugNames.name(postDescriptorSets[i], pass.name);
+            }
+
+            // The present pass takes the finished image rather than the
+            // scene
+            writePresentDescriptorSet(postViews[PostProcess::LDR_A]);
+        }
+
+        // The scene image stands in for post processing's SCENE image
+        VkImageView postView(PostProcess::Image image) const {
+            return image == PostProcess::SCENE ? (VkImageView) sceneView : (VkImageView) postViews[image];
+        }
+
+        /*
+         * Temporal upscaling's history images, as big as the output, and the
+         * resolve's pipeline. The resolve has a descriptor set for each
+         * history image it writes: the scene and motion vectors at bindings
+         * 0 and 1, the other history image at 2 and the one it writes at 3.
+         * The present pass has a set for each history image too.
+         */
+        void createTemporalUpscale() {
+
+            if (!temporalUpscaling) {
+                return;
+            }
+
+            static const char* HISTORY_NAMES[2] = {"history image A", "history image B"};
+
+            historyMemory.resize(2, VDeleter<VkDeviceMemory>{device, vkFreeMemory, allocator});
+            historyImages.resize(2, VDeleter<VkImage>{device, vkDestroyImage, allocator});
+            historyViews.resize(2, VDeleter<VkImageView>{device, vkDestroyImageView, allocator});
+
+            for (uint32_t i = 0; i < 2; i++) {
+
+                createImage(outputs[0]->extent, SCENE_FORMAT,
+                            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                            historyImages[i], historyMemory[i], HISTORY_NAMES[i]);
+
+                VkImageViewCreateInfo viewInfo = {};
+                viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                viewInfo.image = historyImages[i];
+                viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+                viewInfo.format = SCENE_FORMAT;
+                viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+                if (vkCreateImageView(device, &viewInfo, allocator, &historyViews[i]) != VK_SUCCESS) {
+                    throw std::runtime_error(std::string("Unable to create the view of the ") + HISTORY_NAMES[i] +
+                                             "!!");
+                }
+                setDebugName(historyViews[i], HISTORY_NAMES[i]);
+            }
+
+            VkDescriptorSetLayoutBinding bindings[4] = {};
+            for (uint32_t i = 0; i < 4; i++) {
+                bindings[i].binding = i;
+                bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                bindings[i].descriptorCount = 1;
+                bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            }
+            bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+            VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+            setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutInfo.bindingCount = 4;
+            setLayoutInfo.pBindings = bindings;
+
+            if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, allocator, &temporalSetLayout) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the temporal resolve descriptor set layout!!");
+            }
+            setDebugName(temporalSetLayout, "temporal resolve descriptor set layout");
+
+            VkPushConstantRange pushConstants = {};
+            pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstants.offset = 0;
+            pushConstants.size = sizeof(TemporalUpscale::ResolveConstants);
+
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = temporalSetLayout.get();
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstants;
+
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, &temporalPipelineLayout)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the temporal resolve pipeline layout!!");
+            }
+            setDebugName(temporalPipelineLayout, "temporal resolve pipeline layout");
+
+            if (temporalResolveShaderCode.empty()) {
+                loadShaders();
+            }
+
+            VDeleter<VkShaderModule> shaderModule{device, vkDestroyShaderModule, allocator};
+            createShaderModule(temporalResolveShaderCode, shaderModule, "temporal resolve shader");
+
+            VkComputePipelineCreateInfo pipelineInfo = {};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = shaderModule;
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.layout = temporalPipelineLayout;
+
+            if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocator, &temporalPipeline)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the temporal resolve pipeline!!");
+            }
+            setDebugName(temporalPipeline, "temporal resolve pipeline");
+
+            // Two sets for the resolve and two for the present pass
+            VkDescriptorPoolSize poolSizes[2] = {};
+            poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            poolSizes[0].descriptorCount = 2 * 3 + 2;
+            poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            poolSizes[1].descriptorCount = 2;
+
+            VkDescriptorPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = 4;
+            poolInfo.poolSizeCount = 2;
+            poolInfo.pPoolSizes = poolSizes;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, allocator, &temporalDescriptorPool) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the temporal resolve descriptor pool!!");
+            }
+            setDebugName(temporalDescriptorPool, "temporal resolve descriptor pool");
+
+            VkDescriptorSetLayout setLayouts[2] = {temporalSetLayout, temporalSetLayout};
+            VkDescriptorSetLayout presentLayouts[2] = {presentSetLayout, presentSetLayout};
+            temporalDescriptorSets.resize(2);
+            historyPresentSets.resize(2);
+
+            VkDescriptorSetAllocateInfo setInfo = {};
+            setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setInfo.descriptorPool = temporalDescriptorPool;
+            setInfo.descriptorSetCount = 2;
+            setInfo.pSetLayouts = setLayouts;
+
+            if (vkAllocateDescriptorSets(device, &setInfo, temporalDescriptorSets.data()) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the temporal resolve descriptor sets!!");
+            }
+
+            setInfo.pSetLayouts = presentLayouts;
+
+            if (vkAllocateDescriptorSets(device, &setInfo, historyPresentSets.data()) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the history's present descriptor sets!!");
+            }
+
+            // The history images never leave GENERAL, the scene and motion
+            // vectors are left ready to sample like the scene always is
+            for (uint32_t i = 0; i < 2; i++) {
+
+                VkDescriptorImageInfo imageInfos[4] = {
+                    {sceneSampler, sceneView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                    {sceneSampler, motionView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                    {sceneSampler, historyViews[1 - i], VK_IMAGE_LAYOUT_GENERAL},
+                    {VK_NULL_HANDLE, historyViews[i], VK_IMAGE_LAYOUT_GENERAL}
+                };
+                VkDescriptorImageInfo presentInfo = {sceneSampler, historyViews[i], VK_IMAGE_LAYOUT_GENERAL};
+
+                VkWriteDescriptorSet writes[5] = {};
+                for (uint32_t binding = 0; binding < 4; binding++) {
+                    writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                    writes[binding].dstSet = temporalDescriptorSets[i];
+                    writes[binding].dstBinding = binding;
+                    writes[binding].descriptorCount = 1;
+                    writes[binding].descriptorType = bindings[binding].descriptorType;
+                    writes[binding].pImageInfo = &imageInfos[binding];
+                }
+
+                writes[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[4].dstSet = historyPresentSets[i];
+                writes[4].dstBinding = 0;
+                writes[4].descriptorCount = 1;
+                writes[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                writes[4].pImageInfo = &presentInfo;
+
+                vkUpdateDescriptorSets(device, 5, writes, 0, nullptr);
+                debugNames.name(temporalDescriptorSets[i], "temporal resolve descriptor set", i);
+                debugNames.name(historyPresentSets[i], "history present descriptor set", i);
+            }
+        }
+
+        /*
+         * Start drawing the scene into its HDR image, the top left extent
+         * of it. Its old contents are about to be cleared, all it has to
+         * wait for is the last frame's passes (or present pass) to be done
+         * reading them.
+         */
+        void beginSceneRendering(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+
+            const uint32_t attachmentCount = temporalUpscaling ? 2 : 1;
+
+            barriers.image(sceneImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                           Usage::SampledRead, Usage::ColorAttachmentWrite);
+            if (temporalUpscaling) {
+                barriers.image(motionImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                               Usage::SampledRead, Usage::ColorAttachmentWrite);
+            }
+            barriers.flush(commandBuffer);
+
+            // Nothing moved where nothing was drawn
+            VkRect2D renderArea = {{0, 0}, extent};
+            VkClearValue clearValues[2] = {};
+            clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+            clearValues[1].color = {{0.0f, 0.0f, 0.0f, 0.0f}};
+
+            if (dynamicRenderingEnabled) {
+                VkRenderingAttachmentInfoKHR colorAttachments[2] = {};
+                VkImageView views[2] = {sceneView, motionView};
+                for (uint32_t i = 0; i < attachmentCount; i++) {
+                    colorAttachments[i].sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+                    colorAttachments[i].imageView = views[i];
+                    colorAttachments[i].imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+                    colorAttachments[i].resolveMode = VK_RESOLVE_MODE_NONE;
+                    colorAttachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                    colorAttachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                    colorAttachments[i].clearValue = clearValues[i];
+                }
+
+                VkRenderingInfoKHR renderingInfo = {};
+                renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+                renderingInfo.renderArea = renderArea;
+                renderingInfo.layerCount = 1;
+                renderingInfo.colorAttachmentCount = attachmentCount;
+                renderingInfo.pColorAttachments = colorAttachments;
+
+                dispatch.vkCmdBeginRenderingKHR(commandBuffer, &renderingInfo);
+            } else {
+                VkRenderPassBeginInfo renderPassInfo = {};
+                renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                renderPassInfo.renderPass = sceneRenderPass;
+                renderPassInfo.framebuffer = sceneFramebuffer;
+                renderPassInfo.renderArea = renderArea;
+                renderPassInfo.clearValueCount = attachmentCount;
+                renderPassInfo.pClearValues = clearValues;
+
+                dispatch.vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            }
+        }
+
+        void endSceneRendering(VkCommandBuffer commandBuffer) {
+
+            if (dynamicRenderingEnabled) {
+                dispatch.vkCmdEndRenderingKHR(commandBuffer);
+            } else {
+                dispatch.vkCmdEndRenderPass(commandBuffer);
+            }
+
+            // Left for the first post processing pass (or the resolve, or
+            // the present pass) to flush
+            barriers.image(sceneImage,
+                           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                           Usage::ColorAttachmentWrite, Usage::SampledRead);
+            if (temporalUpscaling) {
+                barriers.image(motionImage,
+                               VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                               Usage::ColorAttachmentWrite, Usage::SampledRead);
+            }
+        }
+
+        /*
+         * The post processing passes, the separate ones or the fused ones
+         * as fusePost says, with a timer region each (the other version's
+         * take no time). Each pass's output is thrown away and rewritten,
+         * once whatever read it last is done, which might be the last
+         * frame's present pass. Afterwards it's left ready to sample.
+         */
+        void recordPostProcessing(VkCommandBuffer commandBuffer, uint32_t timerSlot) {
+
+            for (uint32_t i = 0; i < PostProcess::PASS_COUNT; i++) {
+
+                const PostProcess::Pass& pass = PostProcess::PASSES[i];
+
+                if (pass.fused == fusePost) {
+                    DebugNames::Label passLabel(debugNames, commandBuffer, pass.name, DebugNames::PASS_COLOR);
+
+                    VkImage output = postImages[pass.output];
+                    const VkExtent2D& extent = postExtents[pass.output];
+
+                    barriers.image(output, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                   Usage::SampledRead, Usage::ComputeStorageWrite);
+                    barriers.flush(commandBuffer);
+
+                    PostProcess::PushConstants pushConstants = {
+                        {(int32_t) extent.width, (int32_t) extent.height},
+                        {pass.direction[0], pass.direction[1]}
+                    };
+
+                    dispatch.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postPipelines[i]);
+                    dispatch.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                                     postPipelineLayout, 0, 1, &postDescriptorSets[i], 0, nullptr);
+                    dispatch.vkCmdPushConstants(commandBuffer, postPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                                                0, sizeof(pushConstants), &pushConstants);
+                    dispatch.vkCmdDispatch(commandBuffer,
+                                           (extent.width + PostProcess::TILE - 1) / PostProcess::TILE,
+                                           (extent.height + PostProcess::TILE - 1) / PostProcess::TILE, 1);
+
+                    // Left for the next pass (or the present pass) to flush
+                    barriers.image(output, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                   Usage::ComputeStorageWrite, Usage::SampledRead);
+                }
+
+                passTimer.mark(commandBuffer, timerSlot, FIRST_POST_REGION + i);
+            }
+        }
+
+        /*
+         * The phase's push constants for shader.vert: the jitter, turned
+         * from pixels of what's drawn into normalized device coordinates,
+         * and where the triangle is this frame and was in the last
+         */
+        void recordTemporalConstants(VkCommandBuffer commandBuffer, uint32_t phase, VkExtent2D sceneSize) {
+
+            TemporalUpscale::VertexConstants constants = {};
+
+            if (temporalResolve) {
+                TemporalUpscale::jitter(phase, constants.jitter);
+                constants.jitter[0] *= 2.0f / sceneSize.width;
+                constants.jitter[1] *= 2.0f / sceneSize.height;
+            }
+
+            TemporalUpscale::triangleOffset(phase, constants.offset);
+            TemporalUpscale::triangleOffset(phase + TemporalUpscale::PHASES - 1, constants.previousOffset);
+
+            dispatch.vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                                        TemporalUpscale::VERTEX_CONSTANTS_OFFSET, sizeof(constants), &constants);
+        }
+
+        /*
+         * Temporal upscaling's resolve, for the phase's frame: this frame's
+         * sceneSize of the scene image and the history image the last frame
+         * wrote go into the other one. What it writes was last read by the
+         * present pass, or the resolve, of the frame before last. It's left
+         * ready for both of them.
+         */
+        void recordTemporalResolve(VkCommandBuffer commandBuffer, uint32_t phase, VkExtent2D sceneSize,
+                                   VkExtent2D outputSize) {
+
+            DebugNames::Label resolveLabel(debugNames, commandBuffer, "temporal resolve", DebugNames::PASS_COLOR);
+
+            VkImage history = historyImages[phase % 2];
+
+            barriers.image(history, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                           Usage::SampledRead, Usage::ComputeStorageWrite);
+            barriers.flush(commandBuffer);
+
+            TemporalUpscale::ResolveConstants pushConstants = {
+                {(float) sceneSize.width, (float) sceneSize.height},
+                {(float) outputSize.width, (float) outputSize.height},
+                {}
+            };
+            TemporalUpscale::jitter(phase, pushConstants.jitter);
+
+            dispatch.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, temporalPipeline);
+            dispatch.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, temporalPipelineLayout,
+                                             0, 1, &temporalDescriptorSets[phase % 2], 0, nullptr);
+            dispatch.vkCmdPushConstants(commandBuffer, temporalPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                                        0, sizeof(pushConstants), &pushConstants);
+            dispatch.vkCmdDispatch(commandBuffer,
+                                   (outputSize.width + TemporalUpscale::TILE - 1) / TemporalUpscale::TILE,
+                                   (outputSize.height + TemporalUpscale::TILE - 1) / TemporalUpscale::TILE, 1);
+
+            // Left for the present pass to flush
+            barriers.image(history, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                           Usage::ComputeStorageWrite, Usage::SampledRead);
+        }
+
+        /*
+         * The history images start out in no layout at all, and the first
+         * frame's resolve would read one of them. This goes in the first
+         * frame's submit, before anything else, and clears them both to
+         * black in GENERAL. The neighbourhood clamp means the black never
+         * shows.
+         */
+        VkCommandBuffer recordHistoryClear() {
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+
+            if (vkAllocateCommandBuffers(device, &allocInfo, &historyClearCommandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate the history clear command buffer!!");
+            }
+            debugNames.name(historyClearCommandBuffer, "history clear command buffer");
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            dispatch.vkBeginCommandBuffer(historyClearCommandBuffer, &beginInfo);
+
+            for (VkImage history : historyImages) {
+                barriers.image(history, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                               Usage::None, Usage::FillDestination);
+            }
+            barriers.flush(historyClearCommandBuffer);
+
+            VkClearColorValue black = {{0.0f, 0.0f, 0.0f, 1.0f}};
+            VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            for (VkImage history : historyImages) {
+                dispatch.vkCmdClearColorImage(historyClearCommandBuffer, history, VK_IMAGE_LAYOUT_GENERAL,
+                                              &black, 1, &range);
+            }
+
+            for (VkImage history : historyImages) {
+                barriers.image(history, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                               Usage::FillDestination, Usage::SampledRead);
+            }
+            barriers.flush(historyClearCommandBuffer);
+
+            if (dispatch.vkEndCommandBuffer(historyClearCommandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to record the history clear command buffer!!");
+            }
+
+            return historyClearCommandBuffer;
+        }
+
+        /*
+         * Draw the finished image onto the output, in the output's own
+         * render pass (which leaves it ready to present or read back).
+         * With dynamic resolution only sceneSize of the scene image was
+         * drawn, and upscale.frag stretches that over the output. The
+         * image is the one presentSet has.
+         */
+        void recordPresent(VkCommandBuffer commandBuffer, const Output& output, size_t imageIndex,
+                           VkExtent2D sceneSize, VkDescriptorSet presentSet, const void* next) {
+
+            DebugNames::Label presentLabel(debugNames, commandBuffer, "present", DebugNames::PASS_COLOR);
+
+            barriers.flush(commandBuffer);
+            beginOutputRendering(commandBuffer, output, imageIndex, next);
+
+            VkViewport viewport = {0.0f, 0.0f, (float) output.extent.width, (float) output.extent.height, 0.0f, 1.0f};
+            VkRect2D scissor = {{0, 0}, output.extent};
+
+            dispatch.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, presentPipeline);
+            dispatch.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            dispatch.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+            dispatch.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, presentPipelineLayout,
+                                             0, 1, &presentSet, 0, nullptr);
+
+            if (dynamicResolution) {
+                DynamicResolution::PushConstants pushConstants = {
+                    {(float) sceneSize.width, (float) sceneSize.height},
+                    {(float) output.extent.width, (float) output.extent.height}
+                };
+                dispatch.vkCmdPushConstants(commandBuffer, presentPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT,
+                                            0, sizeof(pushConstants), &pushConstants);
+            }
+
+            dispatch.vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+            endOutputRendering(commandBuffer, output, imageIndex);
+        }
+
+        /*
+         * The queries for timing each frame's passes. The regions are the
+         * passes in the order the command buffers record them.
+         */
+        void createPassTimer() {
+
+            if (!timePasses) {
+                return;
+            }
+
+            const DeviceCapabilities& deviceCapabilities = capabilities->get(physicalDevice);
+
+            std::vector<std::string> regions = {"shadows", "light binning", "shading"};
+            if (postProcessing) {
+                for (const PostProcess::Pass& pass : PostProcess::PASSES) {
+                    regions.push_back(pass.name);
+                }
+            }
+            if (temporalUpscaling) {
+                regions.push_back("temporal resolve");
+            }
+            if (sceneTarget) {
+                regions.push_back(dynamicResolution ? "upscale" : "present");
+            }
+
+            passTimer.init(device, dispatch, deviceCapabilities.properties.limits,
+                           deviceCapabilities.queueFamilies[queueFamilies.graphicsFamily].timestampValidBits,
+                           (uint32_t) outputs[0]->images.size(), regions, allocator);
+        }
+
+        /*
+         * This function creates our framebuffers for us
+         */
+        void createFrameBuffers() {
+
+            // Dynamic rendering draws straight into the image views
+            if (dynamicRenderingEnabled) {
+                return;
+            }
+
+            for (auto& output : outputs) {
+                createFrameBuffers(*output);
+            }
+        }
+
+        void createFrameBuffers(Output& output) {
+
+            // We need a framebuffer for each image in the swap chain
+            output.framebuffers.resize(output.imageViews.size(),
+                                       VDeleter<VkFramebuffer>{device, vkDestroyFramebuffer, allocator});
+
+            for (size_t i = 0; i < output.imageViews.size(); i++) {
+
+                VkImageView attachments [] = {
+                    output.imageViews[i]
+                };
+
+                VkFramebufferCreateInfo framebufferInfo = {};
+                framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+                framebufferInfo.renderPass = renderPass;
+                framebufferInfo.attachmentCount = 1;
+                framebufferInfo.pAttachments = attachments;
+                framebufferInfo.width = output.extent.width;
+                framebufferInfo.height = output.extent.height;
+                framebufferInfo.layers = 1;
+
+                if (vkCreateFramebuffer(device, &framebufferInfo, allocator, &output.framebuffers[i])
+                        != VK_SUCCESS) {
+                    std::runtime_error("Unable to create framebuffer!!");
+                }
+                setDebugName(output.framebuffers[i], "framebuffer", i);
+            }
+        }
+
+        /*
+         * This function will create the command buffer for us
+         */
+        void createCommandPool () {
+
+            /*
+             * Command Pools allocate and manage comamnd buffers. They
+             * only managed buffers that can be submitted to a single
+             * type of queue and since we want to draw something, then
+             * we need to create buffers that will be submitted to the
+             * graphics queue.
+             */
+            VkCommandPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.queueFamilyIndex = queueFamilies.graphicsFamily;
+
+            if (vkCreateCommandPool(device, &poolInfo, allocator, &commandPool)
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to create the command pool!!");
+            }
+            setDebugName(commandPool, "command pool");
+        }
+
+        /*
+         * This function will create and 'record' our command
          * buffers for us
          */
-        void createCommandBuffers() {
+        void createCommandBuffers() {
+            for (auto& output : outputs) {
+                createCommandBuffers(*output);
+            }
+        }
+
+        void createCommandBuffers(Output& output) {
+
+            /*
+             * So... we need a command buffer for each framebuffer
+             * in the swapchain... for reasons. (Or each image view when
+             * there are no framebuffers.) With dynamic resolution there's
+             * a set of them for every level the scene can be drawn at, and
+             * with temporal upscaling for every phase of the jitter.
+             */
+            std::vector<VkCommandBuffer>& commandBuffers = output.commandBuffers;
+            const size_t images = output.imageViews.size();
+            const uint32_t variants = dynamicResolution ? DynamicResolution::LEVELS
+                                    : temporalUpscaling ? TemporalUpscale::PHASES : 1;
+            commandBuffers.resize(images * variants);
+
+            /*
+             * For our case we will be using "Primary" command buffers.
+             * We can submit them directly to a queue, but we can't use them
+             * from other buffers.
+             *
+             * There are "Secondary" buffers, which we can't submit directly
+             * to a queue, but they can be called from a number of different
+             * queues.
+             */
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+
+            if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data())
+                    != VK_SUCCESS) {
+                throw std::runtime_error("Unable to allocate command buffers!!");
+            }
+
+            /*
+             * With split frame rendering each GPU in the group only draws
+             * (and reads back) its own strip of the image. This goes on the
+             * start of the render pass.
+             */
+            std::vector<VkRect2D> deviceRenderAreas;
+            VkDeviceGroupRenderPassBeginInfoKHR deviceGroupInfo = {};
+            const void* renderPassNext = nullptr;
+
+            if (deviceGroupEnabled && options.multiGpu == MultiGpuMode::SplitFrame) {
+                deviceRenderAreas = splitFrameAreas(output.extent, (uint32_t) deviceGroup.size());
+
+                deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_RENDER_PASS_BEGIN_INFO_KHR;
+                deviceGroupInfo.deviceMask = allDevicesMask((uint32_t) deviceGroup.size());
+                deviceGroupInfo.deviceRenderAreaCount = (uint32_t) deviceRenderAreas.size();
+                deviceGroupInfo.pDeviceRenderAreas = deviceRenderAreas.data();
+                renderPassNext = &deviceGroupInfo;
+            }
+
+            /*
+             * With the command buffers allocated, we can start "recording"
+             * commands to then, after of course giving some info about
+             * how they will be used
+             */
+            for (size_t i = 0; i < commandBuffers.size(); i++) {
+
+                // Which image this one draws, and at which level (or phase)
+                size_t imageIndex = i % images;
+                uint32_t variant = (uint32_t) (i / images);
+                uint32_t timerSlot = (uint32_t) imageIndex;
+
+                // The whole of this window, or with dynamic resolution or
+                // temporal upscaling the part of the scene image drawn
+                VkExtent2D extent = output.extent;
+                if (dynamicResolution) {
+                    extent = {DynamicResolution::scaledSize(output.extent.width, variant),
+                              DynamicResolution::scaledSize(output.extent.height, variant)};
+                }
+                if (temporalUpscaling) {
+                    extent = {TemporalUpscale::scaledSize(output.extent.width, temporalScale),
+                              TemporalUpscale::scaledSize(output.extent.height, temporalScale)};
+                }
+
+                VkCommandBufferBeginInfo beginInfo = {};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+                dispatch.vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+                debugNames.name(commandBuffers[i], "command buffer", i);
+
+                // Everything in here shows up as one "frame" pass in a capture
+                debugNames.begin(commandBuffers[i], "frame", DebugNames::PASS_COLOR);
+
+                // With shadows the timer's slot was started by the shadow
+                // command buffer before us, otherwise they take no time
+                if (!shadowing) {
+                    passTimer.begin(commandBuffers[i], timerSlot);
+                    passTimer.mark(commandBuffers[i], timerSlot, SHADOW_REGION);
+                }
+
+                // The lights have to be sorted into clusters before anything
+                // can be lit
+                if (lighting) {
+                    DebugNames::Label binningLabel(debugNames, commandBuffers[i], "light binning",
+                                                   DebugNames::PASS_COLOR);
+                    recordLightBinning(commandBuffers[i], extent);
+                }
+                passTimer.mark(commandBuffers[i], timerSlot, BINNING_REGION);
+
+                // Now that the buffer is "open", ready to receive commands
+                // in this case 'execute the render pass we defined earlier'.
+                // Post processed or scaled, the scene goes into an image of
+                // its own.
+                debugNames.begin(commandBuffers[i], "render pass", DebugNames::PASS_COLOR);
+                if (sceneTarget) {
+                    beginSceneRendering(commandBuffers[i], extent);
+                } else {
+                    beginOutputRendering(commandBuffers[i], output, imageIndex, renderPassNext);
+                }
+
+                // Now we need to tell the command buffer which pipeline it should use
+                dispatch.vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+                // The pipeline leaves the viewport to us
+                VkViewport viewport = {0.0f, 0.0f, (float) extent.width, (float) extent.height, 0.0f, 1.0f};
+                VkRect2D scissor = {{0, 0}, extent};
+                dispatch.vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
+                dispatch.vkCmdSetScissor(commandBuffers[i], 0, 1, &scissor);
+
+                if (lighting) {
+                    float screenSize[2] = {(float) extent.width, (float) extent.height};
+                    dispatch.vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+                                                     0, 1, &lightingDescriptorSet, 0, nullptr);
+                    dispatch.vkCmdPushConstants(commandBuffers[i], pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT,
+                                                0, sizeof(screenSize), screenSize);
+                }
+
+                // Upscaling temporally the triangle moves, and is jittered
+                // by a fraction of a pixel unless we're drawing at full size
+                // to compare with
+                if (temporalUpscaling) {
+                    recordTemporalConstants(commandBuffers[i], variant, extent);
+                }
+
+                /*
+                 * What are we drawing?
+                 *
+                 * 3 vertices, starting from index 0 of the vertex buffer.
+                 * (This will set the value of gl_VertexIndex in the vertex shader)
+                 *
+                 * The one and the second zero in the arguments are used when we do
+                 * instance rendering. Normally we only want the one triangle but
+                 * drawing the same one over and over is a handy stress test.
+                 */
+                debugNames.begin(commandBuffers[i], "triangles", DebugNames::DRAW_COLOR);
+                dispatch.vkCmdDraw(commandBuffers[i], 3, options.instances, 0, 0);
+                debugNames.end(commandBuffers[i]);
+
+                // Tell vulkan to end the render pass
+                if (sceneTarget) {
+                    endSceneRendering(commandBuffers[i]);
+                } else {
+                    endOutputRendering(commandBuffers[i], output, imageIndex);
+                }
+                debugNames.end(commandBuffers[i]);
+                passTimer.mark(commandBuffers[i], timerSlot, SHADING_REGION);
+
+                // Then the post processing passes or the temporal resolve,
+                // and the result (upscaled with dynamic resolution) onto the
+                // output
+                if (postProcessing) {
+                    recordPostProcessing(commandBuffers[i], timerSlot);
+                }
+
+                VkDescriptorSet presentSet = presentDescriptorSet;
+                if (temporalUpscaling) {
+                    if (temporalResolve) {
+                        recordTemporalResolve(commandBuffers[i], variant, extent, output.extent);
+                        presentSet = historyPresentSets[variant % 2];
+                    }
+                    passTimer.mark(commandBuffers[i], timerSlot, TEMPORAL_REGION);
+                }
+
+                if (sceneTarget) {
+                    recordPresent(commandBuffers[i], output, imageIndex, extent, presentSet, renderPassNext);
+                    passTimer.mark(commandBuffers[i], timerSlot, PRESENT_REGION);
+                }
+
+                // In batch mode we also copy the image somewhere the CPU can
+                // read it
+                if (headless) {
+                    DebugNames::Label readbackLabel(debugNames, commandBuffers[i], "readback",
+                                                    DebugNames::COPY_COLOR);
+                    recordReadback(commandBuffers[i], output, imageIndex, deviceRenderAreas);
+                }
+
+                // End recording to the buffer and check for errors, labels
+                // have to be closed before the buffer is
+                barriers.flush(commandBuffers[i]);
+                debugNames.end(commandBuffers[i]);
+                if (dispatch.vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to record the command buffer!!");
+                }
+
+            }
+
+        }
+
+        /*
+         * Record the command buffers again, after changing something that
+         * goes into them. The GPU has to be done with the old ones.
+         */
+        void rerecordCommandBuffers() {
+            for (auto& output : outputs) {
+                vkFreeCommandBuffers(device, commandPool, (uint32_t) output->commandBuffers.size(),
+                                     output->commandBuffers.data());
+            }
+            createCommandBuffers();
+        }
+
+        /*
+         * Start drawing into the output's image, with its render pass or
+         * dynamic rendering, clearing it first
+         */
+        void beginOutputRendering(VkCommandBuffer commandBuffer, const Output& output, size_t imageIndex,
+                                  const void* next) {
+
+            if (dynamicRenderingEnabled) {
+                beginDynamicRendering(commandBuffer, output, imageIndex, next);
+                return;
+            }
+
+            VkRenderPassBeginInfo renderPassInfo = {};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.pNext = next;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = output.framebuffers[imageIndex];
+            renderPassInfo.renderArea.offset = {0, 0};
+            renderPassInfo.renderArea.extent = output.extent;
+
+            VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
+            renderPassInfo.clearValueCount = 1;
+            renderPassInfo.pClearValues = &clearColor;
+
+            // Submit the command (Do the render)
+            dispatch.vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        }
+
+        void endOutputRendering(VkCommandBuffer commandBuffer, const Output& output, size_t imageIndex) {
+
+            if (dynamicRenderingEnabled) {
+                endDynamicRendering(commandBuffer, output, imageIndex);
+            } else {
+                dispatch.vkCmdEndRenderPass(commandBuffer);
+            }
+        }
+
+        /*
+         * Clustered lighting's first pass: clear the clusters' counts, then
+         * let shaders/light_bin.comp put every light in the clusters it
+         * reaches. One invocation for each light the buffer can hold, the
+         * ones past the current count do nothing.
+         */
+        void recordLightBinning(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+
+            // The last frame's shading has to be done with the lists before
+            // we start on them again
+            barriers.memory(Usage::FragmentStorageRead, Usage::FillDestination);
+            barriers.flush(commandBuffer);
+
+            dispatch.vkCmdFillBuffer(commandBuffer, clusterCountBuffer, 0, VK_WHOLE_SIZE, 0);
+
+            barriers.memory(Usage::FillDestination, Usage::ComputeStorageReadWrite);
+            barriers.flush(commandBuffer);
+
+            float screenSize[2] = {(float) extent.width, (float) extent.height};
+
+            dispatch.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightBinPipeline);
+            dispatch.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightBinPipelineLayout,
+                                             0, 1, &lightingDescriptorSet, 0, nullptr);
+            dispatch.vkCmdPushConstants(commandBuffer, lightBinPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                                        0, sizeof(screenSize), screenSize);
+            dispatch.vkCmdDispatch(commandBuffer, (options.lights + ClusteredLighting::BIN_WORKGROUP_SIZE - 1)
+                                                      / ClusteredLighting::BIN_WORKGROUP_SIZE, 1, 1);
+
+            barriers.memory(Usage::ComputeStorageWrite, Usage::FragmentStorageRead);
+            barriers.flush(commandBuffer);
+        }
+
+        /*
+         * The dynamic rendering version of vkCmdBeginRenderPass. There's no
+         * render pass to move the image into the right layout for us, or to
+         * hold the dependency on whoever used it last, so we do both with a
+         * barrier first.
+         */
+        void beginDynamicRendering(VkCommandBuffer commandBuffer, const Output& output, size_t imageIndex,
+                                   const void* next) {
+
+            // The image's old contents are about to be cleared so its old
+            // layout doesn't matter. The acquire semaphore is waited on at
+            // the colour output stage, so that's what we wait for here too.
+            barriers.image(output.images[imageIndex],
+                           VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                           Usage::AcquiredImage, Usage::ColorAttachmentWrite);
+            barriers.flush(commandBuffer);
+
+            VkRenderingAttachmentInfoKHR colorAttachment = {};
+            colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+            colorAttachment.imageView = output.imageViews[imageIndex];
+            colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            colorAttachment.resolveMode = VK_RESOLVE_MODE_NONE;
+            colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            colorAttachment.clearValue = {0.0f, 0.0f, 0.0f, 1.0f};
+
+            VkRenderingInfoKHR renderingInfo = {};
+            renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+            renderingInfo.pNext = next;
+            renderingInfo.renderArea.offset = {0, 0};
+            renderingInfo.renderArea.extent = output.extent;
+            renderingInfo.layerCount = 1;
+            renderingInfo.colorAttachmentCount = 1;
+            renderingInfo.pColorAttachments = &colorAttachment;
+
+            dispatch.vkCmdBeginRenderingKHR(commandBuffer, &renderingInfo);
+        }
+
+        /*
+         * And the vkCmdEndRenderPass, which also does the render pass's
+         * finalLayout transition (ready to present, or to copy from or
+         * convert in batch mode)
+         */
+        void endDynamicRendering(VkCommandBuffer commandBuffer, const Output& output, size_t imageIndex) {
+
+            dispatch.vkCmdEndRenderingKHR(commandBuffer);
+
+            if (headless && capture) {
+                barriers.image(output.images[imageIndex],
+                               VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                               Usage::ColorAttachmentWrite, Usage::ComputeSampledRead);
+            } else if (headless) {
+                barriers.image(output.images[imageIndex],
+                               VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               Usage::ColorAttachmentWrite, Usage::CopySource);
+            } else {
+                // Presenting is ordered by the render finished semaphore,
+                // nothing after us in the command buffer needs to wait
+                barriers.image(output.images[imageIndex],
+                               VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                               Usage::ColorAttachmentWrite, Usage::None);
+            }
+
+            // Left for whoever records next to flush, so in batch mode it
+            // goes out along with anything the readback needs
+        }
+
+        /*
+         * Copy the rendered image into its readback buffer, then make the
+         * result visible to the CPU. With split frame rendering each GPU
+         * only has its own strip, in deviceRenderAreas.
+         */
+        void recordReadback(VkCommandBuffer commandBuffer, const Output& output, size_t imageIndex,
+                            const std::vector<VkRect2D>& deviceRenderAreas) {
+
+            if (capture) {
+                recordYuvConversion(commandBuffer, output, imageIndex);
+                return;
+            }
+
+            VkBufferImageCopy region = {};
+            region.bufferOffset = 0;
+            region.bufferRowLength = 0;     // Tightly packed
+            region.bufferImageHeight = 0;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = 0;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {output.extent.width, output.extent.height, 1};
+
+            // Anything still waiting to transition the image goes first
+            barriers.flush(commandBuffer);
+
+            if (deviceRenderAreas.empty()) {
+                dispatch.vkCmdCopyImageToBuffer(commandBuffer, output.images[imageIndex],
+                                                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                readbackBuffers[imageIndex], 1, &region);
+            } else {
+
+                // The readback buffer lives in host memory which all the GPUs
+                // share, so each copies its strip into its own rows of it
+                for (uint32_t device = 0; device < deviceRenderAreas.size(); device++) {
+
+                    const VkRect2D& area = deviceRenderAreas[device];
+                    region.bufferOffset = (VkDeviceSize) area.offset.y * output.extent.width * 4;
+                    region.imageOffset = {0, area.offset.y, 0};
+                    region.imageExtent = {area.extent.width, area.extent.height, 1};
+
+                    dispatch.vkCmdSetDeviceMaskKHR(commandBuffer, 1u << device);
+                    dispatch.vkCmdCopyImageToBuffer(commandBuffer, output.images[imageIndex],
+                                                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                    readbackBuffers[imageIndex], 1, &region);
+                }
+
+                dispatch.vkCmdSetDeviceMaskKHR(commandBuffer, allDevicesMask((uint32_t) deviceRenderAreas.size()));
+            }
+
+            barriers.buffer(readbackBuffers[imageIndex], Usage::CopyDestination, Usage::HostRead);
+            barriers.flush(commandBuffer);
+        }
+
+        /*
+         * Capture mode's readback: the compute shader converts the image to
+         * YUV and writes it into the readback buffer, which lives in host
+         * memory, so there's nothing left to copy.
+         */
+        void recordYuvConversion(VkCommandBuffer commandBuffer, const Output& output, size_t imageIndex) {
+
+            barriers.flush(commandBuffer);
+
+            uint32_t size[2] = {output.extent.width, output.extent.height};
+
+            dispatch.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, yuvPipeline);
+            dispatch.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, yuvPipelineLayout,
+                                             0, 1, &yuvDescriptorSets[imageIndex], 0, nullptr);
+            dispatch.vkCmdPushConstants(commandBuffer, yuvPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                                        0, sizeof(size), size);
+
+            // 8x8 invocations a group, each doing 8x2 pixels
+            dispatch.vkCmdDispatch(commandBuffer, (size[0] / 8 + 7) / 8, (size[1] / 2 + 7) / 8, 1);
+
+            barriers.buffer(readbackBuffers[imageIndex], Usage::ComputeStorageWrite, Usage::HostRead);
+            barriers.flush(commandBuffer);
+        }
+
+        /*
+         * This function is responsible for creating semaphores
+         *
+         * The swap chain only understands plain (binary) semaphores so we
+         * still need these to talk to it, everything else is tracked on the
+         * queue's timeline.
+         */
+        void createSemaphores() {
+
+            // In the current version of the API there
+            // aren't any options for a semaphore needed
+            // to create it. However a struct is stil
+            // required
+            VkSemaphoreCreateInfo semaphoreInfo = {};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+            frameTimelineValues.resize(framesInFlight, 0);
+            frameResolutions.resize(framesInFlight);
+
+            // Each window needs its own, the swap chains signal and wait on
+            // them independently
+            for (auto& output : outputs) {
+
+                output->imageAvailableSemaphores.resize(framesInFlight,
+                                                        VDeleter<VkSemaphore>{device, vkDestroySemaphore, allocator});
+                output->renderFinishedSemaphores.resize(framesInFlight,
+                                                        VDeleter<VkSemaphore>{device, vkDestroySemaphore, allocator});
+
+                for (size_t i = 0; i < framesInFlight; i++) {
+                    if (vkCreateSemaphore(device, &semaphoreInfo, allocator, &output->imageAvailableSemaphores[i]) != VK_SUCCESS
+                     || vkCreateSemaphore(device, &semaphoreInfo, allocator, &output->renderFinishedSemaphores[i]) != VK_SUCCESS) {
+                        throw std::runtime_error("Unable to create the semaphores!!");
+                    }
+                    setDebugName(output->imageAvailableSemaphores[i], "image available semaphore", i);
+                    setDebugName(output->renderFinishedSemaphores[i], "render finished semaphore", i);
+                }
+            }
+
+            presentSwapChains.resize(outputs.size());
+            presentImageIndices.resize(outputs.size());
+            presentWaitSemaphores.resize(outputs.size());
+        }
+
+
+        // -----------------------------------------------------------------------
+
+        /*
+         * Dynamic resolution's controller, once the frame last drawn in
+         * this frame's place is done: its GPU time goes in, and the level
+         * the next frame is drawn at comes out. Until the first frames are
+         * done, and if the GPU can't time them, it stays where it is.
+         */
+        void updateResolution() {
+
+            if (framesDrawn < framesInFlight) {
+                return;
+            }
+
+            const FrameResolution& frame = frameResolutions[currentFrame];
+            if (!passTimer.collect(frame.timerSlot)) {
+                return;
+            }
+
+            double frameMs = passTimer.lastFrameMs();
+            resolutionLevel = holdResolution ? DynamicResolution::LEVELS - 1 : resolutionController.update(frameMs);
+
+            resolutionStats.frames++;
+            resolutionStats.frameMs += frameMs;
+            resolutionStats.scale += DynamicResolution::levelScale(frame.level);
+            if (frameMs > resolutionController.getTargetMs() * 1.1) {
+                resolutionStats.overTarget++;
+            }
+        }
+
+        /*
+         * This does everything required to get a frame on screen
+         */
+        void drawFrame() {
+
+            // Counts this frame's allocations, and in strict mode complains
+            // about them
+            AllocationTracker::Frame allocationFrame;
 
             /*
-             * So... we need a command buffer for each framebuffer
-             * in the swapchain... for reasons.
+             * Everything in Vulkan is done asynchronously, which means the
+             * order of execution isn't guaranteed. However in the case of
+             * say drawing a frame each step depends on the previous one.
+             *
+             * Vulkan provides two 'objects' for syncronisation, Fences and
+             * Semaphores. The state of a fence can be queried which makes them
+             * ideal for integrating your application with the render process
+             * in Vulkan.
+             *
+             * You can't however do this with Semaphores, which makes them
+             * more suited to coordinating events within the render process
+             * itself.
+             *
+             * Timeline semaphores give us the best of both, each submit
+             * bumps a counter on the graphics queue's timeline which the
+             * CPU can wait on just like a fence. Binary semaphores are
+             * still used to talk to the swap chain.
              */
-            commandBuffers.resize(swapChainFramebuffers.size());
+
+            // Step zero. Make sure the GPU has finished with the semaphores
+            // belonging to this frame the last time around
+            graphicsTimeline.wait(frameTimelineValues[currentFrame]);
+            retireQueue.collect();
+
+            // That frame's GPU time is in now, which decides the size of
+            // this one
+            if (dynamicResolution) {
+                updateResolution();
+            }
+
+            // Step one. Retrieve the next image from each window's swap chain,
+            // in batch mode we simply take turns with our own images.
+            if (headless) {
+                Output& output = *outputs[0];
+                output.imageIndex = nextOffscreenImage;
+                nextOffscreenImage = (nextOffscreenImage + 1) % output.images.size();
+            } else {
+
+                // Third argument states a timeout in nanoseconds, using the max
+                // value disables the timeout
+                for (auto& output : outputs) {
+                    dispatch.vkAcquireNextImageKHR(device, output->swapChain, std::numeric_limits<uint64_t>::max(),
+                                                   output->imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE,
+                                                   &output->imageIndex);
+                }
+            }
 
             /*
-             * For our case we will be using "Primary" command buffers.
-             * We can submit them directly to a queue, but we can't use them
-             * from other buffers.
+             * Step two. Now we know the images we can draw to, time to select
+             * the correct command buffers and hand them over to be submitted.
+             * They can't start writing colours until the images are actually
+             * available, and they signal the render finished semaphores when
+             * finished so the next stage knows it's ok to continue.
              *
-             * There are "Secondary" buffers, which we can't submit directly
-             * to a queue, but they can be called from a number of different
-             * queues.
+             * All the waits go in first, then all the command buffers, then
+             * all the signals, so every window ends up in the same batch.
              */
-            VkCommandBufferAllocateInfo allocInfo = {};
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.commandPool = commandPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+            if (!headless) {
+                for (auto& output : outputs) {
+                    graphicsSubmit.wait(output->imageAvailableSemaphores[currentFrame],
+                                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+                }
+            }
+
+            // With alternate frame rendering the next GPU in the group takes
+            // this frame
+            if (deviceGroupEnabled && options.multiGpu == MultiGpuMode::AlternateFrame) {
+                graphicsSubmit.setDeviceMask(alternateFrameMask(framesDrawn, (uint32_t) deviceGroup.size()));
+            }
+
+            // The shadows go first, the lighting reads them
+            if (shadowing) {
+                graphicsSubmit.add(recordShadowUpdates(outputs[0]->imageIndex));
+            }
+
+            // Upscaling temporally, the history images are cleared before
+            // the first frame reads one
+            if (temporalUpscaling && !historyCleared) {
+                graphicsSubmit.add(recordHistoryClear());
+                historyCleared = true;
+            }
+
+            // With dynamic resolution, the command buffer for this image
+            // at the level the controller picked, and with temporal
+            // upscaling for this frame's phase
+            uint32_t variant = dynamicResolution ? resolutionLevel
+                             : temporalUpscaling ? framesDrawn % TemporalUpscale::PHASES : 0;
+            for (auto& output : outputs) {
+                graphicsSubmit.add(output->commandBuffers[variant * output->images.size() + output->imageIndex]);
+            }
+            frameResolutions[currentFrame] = {outputs[0]->imageIndex, resolutionLevel};
+
+            if (!headless) {
+                for (auto& output : outputs) {
+                    graphicsSubmit.signal(output->renderFinishedSemaphores[currentFrame]);
+                }
+            }
+
+            // Submit everything collected for this frame to the queue to be
+            // executed. The submit function can actually take an array of
+            // batches so anything else queued up this frame goes along with
+            // it in one call. The point we get back on the graphics timeline
+            // tells us when this frame is done.
+            frameTimelineValues[currentFrame] = graphicsSubmit.flush().value;
+            graphicsSubmit.endFrame();
+
+            // In batch mode there's nothing to present, instead we make a note
+            // of the frame so it can be read back once it's done
+            if (headless) {
+                if (framesDrawn == 0) {
+                    firstFrameOut("first frame submitted");
+                }
+
+                pendingReadbacks.push_back({framesDrawn++, outputs[0]->imageIndex, frameTimelineValues[currentFrame],
+                                            std::chrono::steady_clock::now()});
+                currentFrame = (currentFrame + 1) % framesInFlight;
+                hostAllocator.endFrame();
+                return;
+            }
+
+            // Step 3. With the images rendered, we need them to be released to
+            // the swap chains so they can be presented to the screen. One call
+            // takes every window's swap chain, rather than one call each.
+            for (size_t i = 0; i < outputs.size(); i++) {
+                presentSwapChains[i] = outputs[i]->swapChain;
+                presentImageIndices[i] = outputs[i]->imageIndex;
+                presentWaitSemaphores[i] = outputs[i]->renderFinishedSemaphores[currentFrame];
+            }
+
+            VkPresentInfoKHR presentInfo = {};
+            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            presentInfo.waitSemaphoreCount = (uint32_t) presentWaitSemaphores.size();
+            presentInfo.pWaitSemaphores = presentWaitSemaphores.data(); // Wait for the render semaphores
+
+            // We need to which swapChains to present to, and which of their images
+            presentInfo.swapchainCount = (uint32_t) presentSwapChains.size();
+            presentInfo.pSwapchains = presentSwapChains.data();
+            presentInfo.pImageIndices = presentImageIndices.data();
+
+            // Finally present the rendered images to the screen
+            dispatch.vkQueuePresentKHR(presentQueue, &presentInfo);
+
+            if (framesDrawn == 0) {
+                firstFrameOut("first frame presented");
+            }
+
+            framesDrawn++;
+            currentFrame = (currentFrame + 1) % framesInFlight;
+
+            // Anything the driver needed for the calls above is done with
+            hostAllocator.endFrame();
+        }
+
+        /*
+         * That's the end of startup, if asked report where the time went
+         */
+        void firstFrameOut(const char* what) {
+
+            startupProfiler.mark(what);
+            startupAllocations = hostAllocator.getStats();
+
+            if (options.profileStartup) {
+                startupProfiler.print(std::cout);
+            }
+        }
+
+        /*
+         * Wait for the oldest frame still on the GPU to finish, then hand
+         * its pixels (straight out of the readback buffer) to onFrame.
+         */
+        template <typename FrameCallback>
+        void readbackOldestFrame(FrameCallback& onFrame) {
+
+            AllocationTracker::Scope allocationScope(AllocationTracker::Subsystem::Readback);
+
+            PendingReadback readback = pendingReadbacks.front();
+            pendingReadbacks.erase(pendingReadbacks.begin());
+
+            graphicsTimeline.wait(readback.timelineValue);
+
+            // Dynamic resolution collects the times itself, as soon as the
+            // frame is done
+            if (!dynamicResolution) {
+                passTimer.collect(readback.imageIndex);
+            }
+
+            readbackSubmitted = readback.submitted;
+            onFrame(readback.frameIndex, (const uint8_t*) readbackMappings[readback.imageIndex]);
+        }
+
+        /*
+         * Draw count frames headlessly, passing each finished frame to
+         * onFrame. The pixels are only valid until onFrame returns.
+         */
+        template <typename FrameCallback>
+        void renderFrames(uint32_t count, FrameCallback onFrame) {
+
+            for (uint32_t i = 0; i < count; i++) {
+
+                drawFrame();
+
+                // The next frame will draw into the image the oldest pending
+                // frame lives in, so that one has to be copied out first.
+                // Anything else that has already finished can go too.
+                while (!pendingReadbacks.empty() &&
+                       (pendingReadbacks.size() >= outputs[0]->images.size() ||
+                        graphicsTimeline.reached(pendingReadbacks.front().timelineValue))) {
+                    readbackOldestFrame(onFrame);
+                }
+            }
+
+            while (!pendingReadbacks.empty()) {
+                readbackOldestFrame(onFrame);
+            }
+        }
+
+        /*
+         * Batch mode's answer to mainLoop, render a fixed number of frames
+         * and write each one to disk.
+         *
+         * Three things overlap here: the GPU draws the newest frames, the
+         * CPU copies out the oldest finished one and the writer threads
+         * convert and save the ones before that.
+         */
+        void batchLoop() {
+
+            if (options.lightBench) {
+                lightBenchLoop();
+                return;
+            }
+
+            if (options.shadowBench) {
+                shadowBenchLoop();
+                return;
+            }
+
+            if (options.postBench) {
+                postBenchLoop();
+                return;
+            }
+
+            if (options.resolutionBench) {
+                resolutionBenchLoop();
+                return;
+            }
+
+            if (options.temporalBench) {
+                temporalBenchLoop();
+                return;
+            }
+
+            if (capture) {
+                captureLoop();
+                return;
+            }
+
+            if (!options.streamTo.empty()) {
+                streamLoop();
+                return;
+            }
+
+            unsigned int threads = options.writerThreads;
+            if (threads == 0) {
+                threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+            }
+
+            ImageWriter writer(options.outputDirectory, options.outputFormat, threads);
+
+            auto start = std::chrono::steady_clock::now();
+
+            const VkExtent2D& extent = outputs[0]->extent;
+            size_t frameSize = (size_t) extent.width * extent.height * 4;
+
+            // A render worker only draws every Nth frame of the batch
+            renderFrames(options.batchFrames, [&](uint32_t frameIndex, const uint8_t* pixels) {
+                std::vector<uint8_t> copy = writer.acquireBuffer(frameSize);
+                memcpy(copy.data(), pixels, frameSize);
+                writer.write(options.firstFrame + frameIndex * options.frameStride,
+                             extent.width, extent.height, std::move(copy));
+            });
+
+            writer.finish();
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::cout << "Rendered and wrote " << options.batchFrames << " frames ("
+                      << extent.width << "x" << extent.height << ") in "
+                      << elapsed.count() << "s: "
+                      << options.batchFrames / elapsed.count() << " fps, "
+                      << writer.getBytesWritten() / elapsed.count() / (1024 * 1024) << " MiB/s to disk"
+                      << std::endl;
+
+            dispatch.vkDeviceWaitIdle(device);
+            retireQueue.flush();
+
+            printSyncStats();
+        }
+
+        /*
+         * batchLoop for a capture, the frames come back already in YUV and
+         * go to the encoder thread in order.
+         */
+        void captureLoop() {
+
+            const VkExtent2D& extent = outputs[0]->extent;
+            VideoEncoder encoder(options.captureFile, extent.width, extent.height, options.captureRate);
+
+            auto start = std::chrono::steady_clock::now();
+
+            size_t frameSize = VideoEncoder::frameSize(extent.width, extent.height);
+
+            renderFrames(options.batchFrames, [&](uint32_t, const uint8_t* yuv) {
+                std::vector<uint8_t> copy = encoder.acquireBuffer();
+                memcpy(copy.data(), yuv, frameSize);
+                encoder.write(std::move(copy));
+            });
+
+            encoder.finish();
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::cout << "Captured " << options.batchFrames << " frames ("
+                      << extent.width << "x" << extent.height << ") to " << options.captureFile << " in "
+                      << elapsed.count() << "s: "
+                      << options.batchFrames / elapsed.count() << " fps, "
+                      << frameSize * options.batchFrames / elapsed.count() / (1024 * 1024)
+                      << " MiB/s read back (" << frameSize / 1024 << " KiB/frame rather than "
+                      << (size_t) extent.width * extent.height * 4 / 1024 << " KiB of BGRA)"
+                      << std::endl;
+
+            dispatch.vkDeviceWaitIdle(device);
+            retireQueue.flush();
+
+            printSyncStats();
+        }
+
+        /*
+         * batchLoop for streaming, each frame is published as soon as it's
+         * read back. In shared memory that never waits for the consumer.
+         */
+        void streamLoop() {
+
+            const VkExtent2D& extent = outputs[0]->extent;
+            size_t frameSize = (size_t) extent.width * extent.height * 4;
+
+            StreamEndpoint endpoint = StreamEndpoint::parse(options.streamTo);
+            FramePublisher publisher(endpoint, extent.width, extent.height, outputs[0]->imageFormat, frameSize);
+
+            auto start = std::chrono::steady_clock::now();
+
+            renderFrames(options.batchFrames, [&](uint32_t frameIndex, const uint8_t* pixels) {
+                publisher.publish(frameIndex, streamClockNs(readbackSubmitted), pixels);
+            });
+
+            publisher.close();
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::cout << "Streamed " << options.batchFrames << " frames ("
+                      << extent.width << "x" << extent.height << ") to " << endpoint.toString() << " in "
+                      << elapsed.count() << "s: "
+                      << options.batchFrames / elapsed.count() << " fps, "
+                      << publisher.getBytesPublished() / elapsed.count() / (1024 * 1024) << " MiB/s"
+                      << std::endl;
+
+            dispatch.vkDeviceWaitIdle(device);
+            retireQueue.flush();
+
+            printSyncStats();
+        }
+
+        /*
+         * Compute mode's loop, runs each kernel over the same random data a
+         * few times and reports the best. The GB/s are the bytes the
+         * algorithm has to read and write at the least, so they compare
+         * directly with the GPU's memory bandwidth. Every result is checked
+         * against the CPU's.
+         */
+        void computeBenchLoop() {
+
+            static const int RUNS = 10;
+
+            ComputeEngine& engine = *computeEngine;
+            ComputeKernels& kernels = *computeKernels;
+
+            const uint32_t n = options.computeElements;
+
+            // Radix sort only takes whole workgroups of keys, the padding
+            // sorts to the end
+            const uint32_t sortCount = (n + ComputeEngine::WORKGROUP_SIZE - 1) / ComputeEngine::WORKGROUP_SIZE
+                                     * ComputeEngine::WORKGROUP_SIZE;
+
+            // The same data every run, so the numbers can be compared
+            std::mt19937 random(1234);
+            std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+            std::vector<uint32_t> values(n);
+            std::vector<uint32_t> keys(sortCount, UINT32_MAX);
+            std::vector<float> x(n);
+            std::vector<float> y(n);
+            for (uint32_t i = 0; i < n; i++) {
+                values[i] = random() & 0xffff;
+                keys[i] = random();
+                x[i] = unit(random);
+                y[i] = unit(random);
+            }
+            const float a = 2.5f;
+
+            VkDeviceSize size = (VkDeviceSize) n * sizeof(uint32_t);
+
+            std::unique_ptr<ComputeBuffer> valueBuffer = engine.createBuffer(size, false, "compute values");
+            std::unique_ptr<ComputeBuffer> scanBuffer = engine.createBuffer(size, false, "compute scan");
+            std::unique_ptr<ComputeBuffer> sumBuffer = engine.createBuffer(sizeof(uint32_t), true, "compute sum");
+            std::unique_ptr<ComputeBuffer> keyBuffer = engine.createBuffer((VkDeviceSize) sortCount * sizeof(uint32_t),
+                                                                           false, "compute keys");
+            std::unique_ptr<ComputeBuffer> xBuffer = engine.createBuffer(size, false, "compute x");
+            std::unique_ptr<ComputeBuffer> yBuffer = engine.createBuffer(size, false, "compute y");
+
+            engine.upload(*valueBuffer, values.data(), size);
+            engine.upload(*xBuffer, x.data(), size);
+
+            std::cout << "Compute benchmark on " << capabilities->get(physicalDevice).properties.deviceName
+                      << ", " << n << " elements, best of " << RUNS << " runs timed on the "
+                      << (engine.timesOnGpu() ? "GPU" : "CPU (the queue has no timestamps)") << std::endl;
+
+            bool allCorrect = true;
+
+            // Record once, then run it RUNS times. reset puts the inputs back
+            // between runs for the kernels which work in place.
+            auto benchmark = [&](const char* name, double bytes, const std::function<void()>& record,
+                                 const std::function<void()>& reset, const std::function<bool()>& check) {
+
+                engine.begin();
+                record();
+                engine.end();
+
+                double best = std::numeric_limits<double>::max();
+                for (int run = 0; run < RUNS; run++) {
+                    reset();
+                    best = std::min(best, engine.run());
+                }
+
+                bool correct = check();
+                allCorrect = allCorrect && correct;
+
+                std::cout << "  " << name << ": " << best * 1000.0 << " ms, "
+                          << bytes / best / 1e9 << " GB/s, "
+                          << n / best / 1e9 << " Gelements/s"
+                          << (correct ? "" : " (WRONG)") << std::endl;
+            };
+
+            benchmark("reduce", 4.0 * n,
+                [&] { kernels.reduce(*valueBuffer, n, *sumBuffer); },
+                [] {},
+                [&] {
+                    uint32_t expected = std::accumulate(values.begin(), values.end(), 0u);
+                    uint32_t sum;
+                    engine.download(*sumBuffer, &sum, sizeof(sum));
+                    return sum == expected;
+                });
+
+            benchmark("exclusive scan", 8.0 * n,
+                [&] { kernels.exclusiveScan(*valueBuffer, *scanBuffer, n); },
+                [] {},
+                [&] {
+                    std::vector<uint32_t> expected(n);
+                    std::exclusive_scan(values.begin(), values.end(), expected.begin(), 0u);
+                    std::vector<uint32_t> result(n);
+                    engine.download(*scanBuffer, result.data(), size);
+                    return result == expected;
+                });
+
+            // Eight passes, each reading and writing every key
+            benchmark("radix sort", 8 * 8.0 * sortCount,
+                [&] { kernels.radixSort(*keyBuffer, sortCount); },
+                [&] { engine.upload(*keyBuffer, keys.data(), (VkDeviceSize) sortCount * sizeof(uint32_t)); },
+                [&] {
+                    std::vector<uint32_t> expected = keys;
+                    std::sort(expected.begin(), expected.end());
+                    std::vector<uint32_t> result(sortCount);
+                    engine.download(*keyBuffer, result.data(), (VkDeviceSize) sortCount * sizeof(uint32_t));
+                    return result == expected;
+                });
+
+            benchmark("saxpy", 12.0 * n,
+                [&] { kernels.saxpy(a, *xBuffer, *yBuffer, n); },
+                [&] { engine.upload(*yBuffer, y.data(), size); },
+                [&] {
+                    std::vector<float> result(n);
+                    engine.download(*yBuffer, result.data(), size);
+                    for (uint32_t i = 0; i < n; i++) {
+                        float expected = a * x[i] + y[i];
+                        if (std::abs(result[i] - expected) > 1e-5f * (1.0f + std::abs(expected))) {
+                            return false;
+                        }
+                    }
+                    return true;
+                });
+
+            if (!allCorrect) {
+                throw std::runtime_error("The compute results don't match the CPU's!!");
+            }
+        }
 
-            if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data())
-                    != VK_SUCCESS) {
-                throw std::runtime_error("Unable to allocate command buffers!!");
+        /*
+         * What the GPU benchmarks share. Each runs its sweep inside
+         * runBench(), which needs the pass timer and leaves nothing in
+         * flight afterwards, and measures each step of the sweep with
+         * runTimedFrames(): once the GPU is done with everything, setup
+         * changes whatever the step changes (lights, shadows, command
+         * buffers), then the frames are drawn, warmup first and then the
+         * ones the times are averaged over.
+         */
+        static const uint32_t BENCH_WARMUP_FRAMES = 10;
+        static const uint32_t BENCH_FRAMES = 100;
+
+        template <typename Sweep>
+        void runBench(Sweep sweep) {
+
+            if (!passTimer.enabled()) {
+                throw std::runtime_error("The graphics queue has no timestamps to time the passes with!!");
             }
 
-            /*
-             * With the command buffers allocated, we can start "recording"
-             * commands to then, after of course giving some info about
-             * how they will be used
-             */
-            for (size_t i = 0; i < commandBuffers.size(); i++) {
-                VkCommandBufferBeginInfo beginInfo = {};
-                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+            sweep();
 
-                vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+            dispatch.vkDeviceWaitIdle(device);
+            retireQueue.flush();
+        }
 
-                // Now that the buffer is "open", ready to receive commands
-                // in this case 'execute the render pass we defined earlier'
-                VkRenderPassBeginInfo renderPassInfo = {};
-                renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-                renderPassInfo.renderPass = renderPass;
-                renderPassInfo.framebuffer = swapChainFramebuffers[i];
-                renderPassInfo.renderArea.offset = {0, 0};
-                renderPassInfo.renderArea.extent = swapChainExtent;
+        template <typename Setup>
+        void runTimedFrames(uint32_t warmupFrames, uint32_t frames, Setup setup) {
 
-                VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
-                renderPassInfo.clearValueCount = 1;
-                renderPassInfo.pClearValues = &clearColor;
+            dispatch.vkDeviceWaitIdle(device);
+            setup();
 
-                // Submit the command (Do the render)
-                vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            renderFrames(warmupFrames, [](uint32_t, const uint8_t*) {});
 
-                // Now we need to tell the command buffer which pipeline it should use
-                vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+            // Everything the benchmarks count starts again from here
+            passTimer.clear();
+            shadowTilesDrawn = 0;
+            resolutionStats = {};
 
-                /*
-                 * What are we drawing?
-                 *
-                 * 3 vertices, starting from index 0 of the vertex buffer.
-                 * (This will set the value of gl_VertexIndex in the vertex shader)
-                 *
-                 * The one and the second zero in the arguments are used when we do
-                 * instance rendering. Which we aren't using in our case so just leave
-                 * them as is
-                 */
-                vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
+            renderFrames(frames, [](uint32_t, const uint8_t*) {});
+        }
 
-                // Tell vulkan to end the render pass
-                vkCmdEndRenderPass(commandBuffers[i]);
+        /*
+         * The light benchmark's batchLoop, how long binning and shading take
+         * on the GPU as the number of lights goes up. Shading is the whole
+         * render pass, so its cost per pixel is spread over the frame.
+         */
+        void lightBenchLoop() {
 
-                // End recording to the buffer and check for errors
-                if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-                    throw std::runtime_error("Unable to record the command buffer!!");
+            static const uint32_t LIGHT_COUNTS[] = {10, 100, 1000, 10000, 100000};
+
+            runBench([&] {
+
+                const VkExtent2D& extent = outputs[0]->extent;
+                double pixels = (double) extent.width * extent.height;
+
+                std::cout << "Clustered lighting at " << extent.width << "x" << extent.height << " with "
+                          << ClusteredLighting::CLUSTER_COUNT << " clusters, GPU times averaged over "
+                          << BENCH_FRAMES << " frames" << std::endl;
+
+                for (uint32_t count : LIGHT_COUNTS) {
+
+                    runTimedFrames(BENCH_WARMUP_FRAMES, BENCH_FRAMES, [&] { writeLights(count); });
+
+                    double binningMs = passTimer.averageMs(BINNING_REGION);
+                    double shadingMs = passTimer.averageMs(SHADING_REGION);
+
+                    std::cout << "  " << count << " lights: binning " << binningMs << " ms, shading "
+                              << shadingMs << " ms, " << shadingMs * 1e6 / pixels << " ns/pixel" << std::endl;
                 }
+            });
+        }
 
-            }
+        /*
+         * The shadow benchmark's batchLoop: how long the atlas updates take
+         * on the GPU, and how many tiles they draw a frame, as the number
+         * of shadowed lights and moving casters goes up. Each is run with
+         * the cache and then without it, drawing every tile from scratch
+         * every frame.
+         */
+        void shadowBenchLoop() {
+
+            static const uint32_t SHADOW_COUNTS[] = {16, 64, 256};
+            static const uint32_t CASTER_COUNTS[] = {0, 4, 16, 64};
+
+            runBench([&] {
 
+                std::cout << "Shadow atlas updates with " << options.lights << " lights and "
+                          << ShadowAtlas::STATIC_CASTERS << " static casters, GPU times averaged over "
+                          << BENCH_FRAMES << " frames" << std::endl;
+
+                for (uint32_t shadows : SHADOW_COUNTS) {
+                    for (uint32_t casters : CASTER_COUNTS) {
+
+                        double ms[2] = {};
+                        double tiles[2] = {};
+
+                        for (int cached = 1; cached >= 0; cached--) {
+
+                            runTimedFrames(BENCH_WARMUP_FRAMES, BENCH_FRAMES, [&] {
+                                cacheShadows = cached != 0;
+                                shadowCasters = casters;
+                                allocateShadows(shadows);
+                            });
+
+                            ms[cached] = passTimer.averageMs(SHADOW_REGION);
+                            tiles[cached] = (double) shadowTilesDrawn / BENCH_FRAMES;
+                        }
+
+                        std::cout << "  " << shadowTiles.size() << " shadows, " << casters << " moving casters: "
+                                  << "cached " << ms[1] << " ms (" << tiles[1] << " tiles/frame), "
+                                  << "uncached " << ms[0] << " ms (" << tiles[0] << " tiles/frame)" << std::endl;
+                    }
+                }
+            });
         }
 
         /*
-         * This function is responsible for creating semaphores
+         * The post processing benchmark's batchLoop: how long each pass
+         * takes on the GPU, done as separate passes and then fused, and
+         * what the whole chain costs both ways
          */
-        void createSemaphores() {
+        void postBenchLoop() {
 
-            // In the current version of the API there
-            // aren't any options for a semaphore needed
-            // to create it. However a struct is stil
-            // required
-            VkSemaphoreCreateInfo semaphoreInfo = {};
-            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            runBench([&] {
 
-            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS
-             || vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
-                throw std::runtime_error("Unable to create the semaphores!!");
-            }
+                const VkExtent2D& extent = outputs[0]->extent;
+
+                std::cout << "Post processing at " << extent.width << "x" << extent.height
+                          << ", GPU times averaged over " << BENCH_FRAMES << " frames" << std::endl;
+
+                double totalMs[2] = {};
+
+                for (int fused = 0; fused <= 1; fused++) {
+
+                    runTimedFrames(BENCH_WARMUP_FRAMES, BENCH_FRAMES, [&] {
+                        fusePost = fused != 0;
+                        rerecordCommandBuffers();
+                    });
+
+                    std::cout << (fusePost ? "  fused:" : "  separate passes:") << std::endl;
+
+                    for (uint32_t i = 0; i < PostProcess::PASS_COUNT; i++) {
+                        if (PostProcess::PASSES[i].fused == fusePost) {
+                            double ms = passTimer.averageMs(FIRST_POST_REGION + i);
+                            totalMs[fused] += ms;
+                            std::cout << "    " << PostProcess::PASSES[i].name << ": " << ms << " ms" << std::endl;
+                        }
+                    }
+
+                    std::cout << "    total " << totalMs[fused] << " ms (the scene took "
+                              << passTimer.averageMs(SHADING_REGION) << " ms, presenting "
+                              << passTimer.averageMs(PRESENT_REGION) << " ms)" << std::endl;
+                }
+
+                std::cout << "  fusing saves " << totalMs[0] - totalMs[1] << " ms a frame" << std::endl;
+            });
         }
 
+        /*
+         * --resolution-bench: the load goes up and back down again (more
+         * lights, then fewer), first at full resolution and then with the
+         * controller free to pick the resolution. For each step, the GPU's
+         * average frame time, the average scale it was drawn at, and how
+         * many frames went more than 10% over the target.
+         */
+        void resolutionBenchLoop() {
+
+            static const uint32_t LIGHT_COUNTS[] = {1000, 10000, 100000, 10000, 1000};
+            static const uint32_t STEPS = sizeof(LIGHT_COUNTS) / sizeof(LIGHT_COUNTS[0]);
+            static const uint32_t FRAMES = 200;
 
-        // -----------------------------------------------------------------------
+            runBench([&] {
+
+                const VkExtent2D& extent = outputs[0]->extent;
+
+                std::cout << "Dynamic resolution at " << extent.width << "x" << extent.height << ", holding "
+                          << resolutionController.getTargetMs() << " ms a frame, " << FRAMES << " frames a step"
+                          << std::endl;
+
+                ResolutionStats results[2][STEPS] = {};
+
+                // The controller carries on from one step to the next, so
+                // what it's measured on is how quickly it catches up with
+                // the change, and there's no warming up
+                for (int dynamic = 0; dynamic <= 1; dynamic++) {
+
+                    holdResolution = dynamic == 0;
+
+                    for (uint32_t step = 0; step < STEPS; step++) {
+                        runTimedFrames(0, FRAMES, [&] { writeLights(LIGHT_COUNTS[step]); });
+                        results[dynamic][step] = resolutionStats;
+                    }
+                }
+
+                for (uint32_t step = 0; step < STEPS; step++) {
+
+                    std::cout << "  " << LIGHT_COUNTS[step] << " lights:";
+
+                    for (int dynamic = 0; dynamic <= 1; dynamic++) {
+
+                        const ResolutionStats& stats = results[dynamic][step];
+                        double frames = (double) std::max<uint64_t>(stats.frames, 1);
+
+                        std::cout << (dynamic ? ", dynamic " : " full resolution ") << stats.frameMs / frames
+                                  << " ms at " << stats.scale / frames << " scale, "
+                                  << 100.0 * stats.overTarget / frames << "% of frames over";
+                    }
+
+                    std::cout << std::endl;
+                }
+            });
+        }
 
         /*
-         * This does everything required to get a frame on screen
+         * --temporal-bench: drawing at full resolution, then at each of the
+         * benchmark's scales with the temporal resolve building the full
+         * size image. For each, the GPU's time drawing the scene, resolving
+         * and presenting, and how much of the full resolution frame that
+         * saves.
          */
-        void drawFrame() {
+        void temporalBenchLoop() {
 
-            /*
-             * Everything in Vulkan is done asynchronously, which means the
-             * order of execution isn't guaranteed. However in the case of
-             * say drawing a frame each step depends on the previous one.
-             *
-             * Vulkan provides two 'objects' for syncronisation, Fences and
-             * Semaphores. The state of a fence can be queried which makes them
-             * ideal for integrating your application with the render process
-             * in Vulkan.
-             *
-             * You can't however do this with Semaphores, which makes them
-             * more suited to coordinating events within the render process
-             * itself.
-             *
-             * We will be using semaphores here.
-             */
+            static const uint32_t SCALES = sizeof(TemporalUpscale::BENCH_SCALES) /
+                                           sizeof(TemporalUpscale::BENCH_SCALES[0]);
 
-            uint32_t imageIndex;
+            runBench([&] {
 
-            // Step one. Retrieve the next image from the swap chain
-
-            // Third argument states a timeout in nanoseconds, using the max
-            // value disables the timeout
-            vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(),
-                                  imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
-
-            // Step two. Now we know the image we can draw to, time to select the
-            // correct command buffer and submit it to the queue
-            VkSubmitInfo submitInfo = {};
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-            VkSemaphore waitSemaphores[] = {imageAvailableSemaphore};
-            VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-            submitInfo.waitSemaphoreCount = 1;
-            submitInfo.pWaitSemaphores = waitSemaphores;
-            submitInfo.pWaitDstStageMask = waitStages;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-
-            // Signal the render finished Semaphore when finished so the next
-            // stage knows it's ok to continue
-            VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
-            submitInfo.signalSemaphoreCount = 1;
-            submitInfo.pSignalSemaphores = signalSemaphores;
-
-            // Submit the render command to the queue to be executed.
-            // The submit function can actually take an array of commands
-            // so we can do things in batches when we need to.
-            if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-                throw std::runtime_error("Unable to submit the draw command!!");
-            }
-
-            // Step 3. With the image rendered, we need it to be released to the
-            // swap chain so it can be presented to the screen.
-            VkPresentInfoKHR presentInfo = {};
-            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-            presentInfo.waitSemaphoreCount = 1;
-            presentInfo.pWaitSemaphores = signalSemaphores; // Wait for the render semaphore
+                const VkExtent2D& extent = outputs[0]->extent;
+
+                std::cout << "Temporal upscaling to " << extent.width << "x" << extent.height
+                          << ", GPU times averaged over " << BENCH_FRAMES << " frames" << std::endl;
+
+                double fullMs = 0.0;
+
+                // The first run is the one to compare with: full size, no
+                // jitter and no resolve
+                for (uint32_t run = 0; run <= SCALES; run++) {
+
+                    runTimedFrames(BENCH_WARMUP_FRAMES, BENCH_FRAMES, [&] {
+                        temporalResolve = run > 0;
+                        temporalScale = run > 0 ? TemporalUpscale::BENCH_SCALES[run - 1] : 1.0f;
+                        rerecordCommandBuffers();
+                    });
 
-            // We need to which swapChain to present to
-            VkSwapchainKHR swapChains[] = {swapChain};
-            presentInfo.swapchainCount = 1;
-            presentInfo.pSwapchains = swapChains;
-            presentInfo.pImageIndices = &imageIndex;
+                    double totalMs = 0.0;
+                    for (size_t region = 0; region < passTimer.getRegions().size(); region++) {
+                        totalMs += passTimer.averageMs(region);
+                    }
+
+                    if (run == 0) {
+                        fullMs = totalMs;
+                        std::cout << "  full resolution:";
+                    } else {
+                        std::cout << "  " << temporalScale << " scale, resolved:";
+                    }
+                    std::cout << " scene " << passTimer.averageMs(SHADING_REGION) << " ms, resolve "
+                              << passTimer.averageMs(TEMPORAL_REGION) << " ms, present "
+                              << passTimer.averageMs(PRESENT_REGION) << " ms, total " << totalMs << " ms";
+                    if (run > 0) {
+                        std::cout << " (saves " << fullMs - totalMs << " ms a frame)";
+                    }
+                    std::cout << std::endl;
+                }
+            });
+        }
+
+        /*
+         * Print how much time the CPU spent submitting and waiting on the
+         * GPU, so the timeline and fence backends can be compared.
+         */
+        void printSyncStats() {
+
+            const SyncStats& stats = graphicsTimeline.getStats();
+
+            auto average = [](std::chrono::nanoseconds total, uint64_t count) {
+                return count == 0 ? 0.0 : total.count() / 1000.0 / count;
+            };
+
+            std::cout << "Sync backend: "
+                      << (graphicsTimeline.usesTimelineSemaphore() ? "timeline semaphore" : "fences")
+                      << "\n  submits: " << stats.submits
+                      << ", avg submit: " << average(stats.submitTime, stats.submits) << "us"
+                      << "\n  waits: " << stats.waits
+                      << ", avg wait: " << average(stats.waitTime, stats.waits) << "us"
+                      << "\n  avg fence reset: " << average(stats.resetTime, stats.submits) << "us"
+                      << std::endl;
+
+            const SubmitBatcher::Stats& submitStats = graphicsSubmit.getStats();
+
+            auto perFrame = [&](uint64_t count) {
+                return submitStats.frames == 0 ? 0.0 : (double) count / submitStats.frames;
+            };
+
+            std::cout << "Graphics queue: "
+                      << perFrame(submitStats.submitCalls) << " submits/frame, "
+                      << perFrame(submitStats.batches) << " batches/frame, "
+                      << perFrame(submitStats.commandBuffers) << " command buffers/frame, "
+                      << average(submitStats.submitTime, submitStats.frames) << "us submitting/frame"
+                      << std::endl;
+
+            // Only the frame loop, startup allocates plenty and that's fine
+            if (allocator != nullptr) {
+                HostAllocator::printStats(std::cout,
+                                          HostAllocator::difference(hostAllocator.getStats(), startupAllocations),
+                                          framesDrawn);
+            }
 
-            // Finally present the rendered image to the screen
-            vkQueuePresentKHR(presentQueue, &presentInfo);
+            AllocationTracker::print(std::cout);
+        }
 
+        /*
+         * Closing any one of the windows closes the lot
+         */
+        bool windowShouldClose() const {
+            for (const auto& output : outputs) {
+                if (glfwWindowShouldClose(output->window)) {
+                    return true;
+                }
+            }
+            return false;
         }
 
         void mainLoop() {
 
-            // Keep the main window open till it's asked to close
-            while (!glfwWindowShouldClose(window)) {
+            // Keep the windows open till one is asked to close
+            while (!windowShouldClose()) {
                 glfwPollEvents();
                 drawFrame();
             }
 
             // Wait for the device to finish before closing
-            vkDeviceWaitIdle(device);
+            dispatch.vkDeviceWaitIdle(device);
+            retireQueue.flush();
+
+            printSyncStats();
         }
 };
 
-int main() {
-    App app;
+/*
+ * Multi-GPU without a device group: give each GPU its own App (instance,
+ * device and all) on its own thread, and deal the batch's frames out
+ * between them like cards. Returns once every worker has finished.
+ */
+int runRenderWorkers(const AppOptions& baseOptions, uint32_t deviceCount) {
+
+    if (baseOptions.batchFrames == 0) {
+        throw std::runtime_error("Render workers only work in batch mode (--batch)!!");
+    }
+
+    uint32_t workerCount = std::min(deviceCount, baseOptions.batchFrames);
+    if (baseOptions.gpus > 0) {
+        workerCount = std::min(workerCount, baseOptions.gpus);
+    }
+
+    if (workerCount == 0) {
+        throw std::runtime_error("Unable to find any devices to render on!!");
+    }
+
+    std::cout << "Rendering on " << workerCount << " independent devices" << std::endl;
+
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(workerCount);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < workerCount; i++) {
+
+        AppOptions options = baseOptions;
+        options.multiGpu = MultiGpuMode::Off;
+        options.deviceIndex = (int) i;
+        options.firstFrame = i;
+        options.frameStride = workerCount;
+        options.batchFrames = (baseOptions.batchFrames - i + workerCount - 1) / workerCount;
+
+        // They would all be writing the same file at once
+        if (i > 0) {
+            options.capabilityCachePath.clear();
+        }
+
+        workers.emplace_back([options, &errors, i] {
+            try {
+                App(options).run();
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "All workers: " << baseOptions.batchFrames << " frames in " << elapsed.count() << "s: "
+              << baseOptions.batchFrames / elapsed.count() << " fps" << std::endl;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * The other end of --stream, standing in for the compositor. Reads frames
+ * until the renderer is done, touching every cache line of each as a
+ * compositor would, and reports how long they took to get here: from the
+ * renderer submitting them (end to end) and from them being published
+ * (the transport alone).
+ */
+int runStreamConsumer(const AppOptions& options) {
+
+    StreamEndpoint endpoint = StreamEndpoint::parse(options.consumeFrom);
+    FrameConsumer consumer(endpoint);
+
+    std::vector<double> endToEndMs;
+    std::vector<double> transportMs;
+    uint64_t received = 0;
+    uint64_t skipped = 0;
+    uint64_t lastFrame = 0;
+    uint64_t checksum = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (consumer.next([&](const StreamedFrame& frame) {
+
+        for (size_t i = 0; i < frame.size; i += 64) {
+            checksum += frame.pixels[i];
+        }
+
+        int64_t now = streamClockNs();
+        endToEndMs.push_back((now - frame.submitTimeNs) / 1e6);
+        transportMs.push_back((now - frame.publishTimeNs) / 1e6);
+
+        if (received > 0 && frame.frameIndex > lastFrame + 1) {
+            skipped += frame.frameIndex - lastFrame - 1;
+        }
+        lastFrame = frame.frameIndex;
+        received++;
+        width = frame.width;
+        height = frame.height;
+    })) {}
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (received == 0) {
+        throw std::runtime_error("The stream on " + endpoint.toString() + " ended without any frames!!");
+    }
+
+    auto report = [](const char* what, std::vector<double>& latencies) {
+        std::sort(latencies.begin(), latencies.end());
+        double total = 0.0;
+        for (double latency : latencies) {
+            total += latency;
+        }
+        auto percentile = [&](double p) { return latencies[(size_t) (p * (latencies.size() - 1))]; };
+
+        std::cout << "  " << what << ": avg " << total / latencies.size() << "ms, p50 " << percentile(0.5)
+                  << "ms, p99 " << percentile(0.99) << "ms, max " << latencies.back() << "ms\n";
+    };
+
+    std::cout << "Consumed " << received << " frames (" << width << "x" << height << ") from "
+              << endpoint.toString() << " in " << elapsed.count() << "s: "
+              << received / elapsed.count() << " fps, " << skipped << " skipped, "
+              << consumer.getTornFrames() << " overwritten while reading (checksum " << checksum << ")\n";
+    report("submit to consumer", endToEndMs);
+    report("publish to consumer", transportMs);
+    std::cout << std::flush;
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * The regression harness. Renders each reference scene, checks the image
+ * against its golden copy and the time per frame against its baseline.
+ * Returns EXIT_FAILURE if anything diverged or got too slow.
+ */
+int runRegressionSuite(const AppOptions& baseOptions) {
+
+    const std::string& golden = baseOptions.goldenDirectory;
+    std::filesystem::create_directories(golden);
+
+    // A frame that allocates is a regression too
+    AllocationTracker::setStrict(true);
+
+    int failures = 0;
+
+    for (const RegressionScene& scene : regressionScenes) {
+
+        AppOptions options = baseOptions;
+        options.width = scene.width;
+        options.height = scene.height;
+        options.instances = scene.instances;
+
+        App::SceneResult result = App(options).renderScene(scene.frames);
+
+        std::string imagePath = golden + "/" + scene.name + ".ppm";
+        std::string perfPath = golden + "/" + scene.name + ".perf";
+
+        bool passed = true;
+        std::cout << scene.name << " (" << scene.width << "x" << scene.height
+                  << ", " << scene.instances << " instances):\n";
+
+        // First the image
+        RgbImage expected;
+        if (options.updateGolden) {
+            writePpm(imagePath, result.image);
+            std::cout << "  image: recorded " << imagePath << "\n";
+        } else if (!readPpm(imagePath, expected)) {
+            std::cout << "  image: FAIL, no golden at " << imagePath << " (record one with --update-golden)\n";
+            passed = false;
+        } else {
+            ImageDifference difference = compareImages(expected, result.image, options.imageTolerance);
+
+            if (difference.sizeMismatch) {
+                std::cout << "  image: FAIL, golden is " << expected.width << "x" << expected.height << "\n";
+                passed = false;
+            } else {
+                bool imagePassed = difference.differentFraction() <= options.maxDifferentPixels;
+                std::cout << "  image: " << (imagePassed ? "ok" : "FAIL")
+                          << ", max channel difference " << difference.maxChannelDifference
+                          << ", " << difference.differentFraction() * 100 << "% of pixels differ\n";
+                passed = passed && imagePassed;
+            }
+
+            // Leave what we actually got next to the golden for inspection
+            if (!passed) {
+                writePpm(golden + "/" + scene.name + ".actual.ppm", result.image);
+            }
+        }
+
+        // Then the time per frame
+        double baselineMs;
+        if (options.updateGolden) {
+            writeBaseline(perfPath, result.frameMs);
+            std::cout << "  perf: recorded " << result.frameMs << " ms/frame\n";
+        } else if (!readBaseline(perfPath, baselineMs)) {
+            std::cout << "  perf: FAIL, no baseline at " << perfPath << " (record one with --update-golden)\n";
+            passed = false;
+        } else {
+            double change = result.frameMs / baselineMs - 1.0;
+            bool perfPassed = change <= options.perfThreshold;
+            std::cout << "  perf: " << (perfPassed ? "ok" : "FAIL") << ", "
+                      << result.frameMs << " ms/frame against a baseline of " << baselineMs
+                      << " (" << (change >= 0 ? "+" : "") << change * 100 << "%)\n";
+            passed = passed && perfPassed;
+        }
+
+        // And finally the steady state frame loop has to be allocation free
+        bool allocationsPassed = result.frameAllocations == 0;
+        std::cout << "  allocations: " << (allocationsPassed ? "ok" : "FAIL") << ", "
+                  << result.frameAllocations << " in drawFrame() after warming up\n";
+        passed = passed && allocationsPassed;
+
+        if (!passed) {
+            failures++;
+        }
+    }
+
+    std::cout << (failures == 0 ? "All scenes passed" : std::to_string(failures) + " scene(s) failed")
+              << std::endl;
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// bench.cpp builds this file into the benchmark binary with its own main
+#ifndef APP_NO_MAIN
+int main(int argc, char* argv[]) {
 
     try {
+        AppOptions options = parseOptions(argc, argv);
+        AllocationTracker::setStrict(options.strictAllocations);
+
+        if (options.regress) {
+            return runRegressionSuite(options);
+        }
+
+        if (!options.consumeFrom.empty()) {
+            return runStreamConsumer(options);
+        }
+
+        // Streaming and capturing are both batches whose frames go
+        // somewhere other than the output directory, and only from one GPU
+        if (!options.streamTo.empty()) {
+            if (options.batchFrames == 0) {
+                throw std::runtime_error("Streaming needs a number of frames (--batch)!!");
+            }
+            if (options.multiGpu != MultiGpuMode::Off || !options.captureFile.empty()) {
+                throw std::runtime_error("Streaming only works on one GPU, without --capture!!");
+            }
+        }
+
+        if (options.lightBench && (options.multiGpu != MultiGpuMode::Off || options.batchFrames > 0)) {
+            throw std::runtime_error("The light benchmark runs on its own, without --batch or --multi-gpu!!");
+        }
+
+        if (options.shadows > 0 && options.lights == 0) {
+            throw std::runtime_error("Shadows need some lights to cast them (--lights)!!");
+        }
+
+        if (options.shadowBench && (options.multiGpu != MultiGpuMode::Off || options.batchFrames > 0 ||
+                                    options.lightBench)) {
+            throw std::runtime_error("The shadow benchmark runs on its own, without --batch, --multi-gpu or "
+                                     "--light-bench!!");
+        }
+
+        // There's one set of post processing images, for one output
+        if (options.post && (options.multiGpu != MultiGpuMode::Off || options.windows > 1)) {
+            throw std::runtime_error("Post processing only works on one GPU, in one window!!");
+        }
+
+        if (options.postBench && (options.batchFrames > 0 || options.lightBench || options.shadowBench)) {
+            throw std::runtime_error("The post processing benchmark runs on its own, without --batch, "
+                                     "--light-bench or --shadow-bench!!");
+        }
+
+        // Like post processing there's one scene image, and the post
+        // processing passes would have to learn to work on part of it
+        if (options.targetFrameMs > 0.0 && (options.post || options.multiGpu != MultiGpuMode::Off ||
+                                            options.windows > 1)) {
+            throw std::runtime_error("Dynamic resolution only works on one GPU, in one window, without --post!!");
+        }
+
+        if (options.resolutionBench && (options.batchFrames > 0 || options.lightBench || options.shadowBench)) {
+            throw std::runtime_error("The resolution benchmark runs on its own, without --batch, "
+                                     "--light-bench or --shadow-bench!!");
+        }
+
+        // Temporal upscaling has its own set of recorded command buffers
+        // for each phase, as dynamic resolution does for each level, and
+        // one scene image and history like post processing
+        if (options.temporalScale > 0.0f && (options.post || options.targetFrameMs > 0.0 ||
+                                              options.multiGpu != MultiGpuMode::Off || options.windows > 1)) {
+            throw std::runtime_error("Temporal upscaling only works on one GPU, in one window, without --post "
+                                     "or --dynamic-resolution!!");
+        }
+
+        if (options.temporalBench && (options.batchFrames > 0 || options.lightBench || options.shadowBench)) {
+            throw std::runtime_error("The temporal upscaling benchmark runs on its own, without --batch, "
+                                     "--light-bench or --shadow-bench!!");
+        }
+
+        if (!options.captureFile.empty()) {
+            if (options.batchFrames == 0) {
+                throw std::runtime_error("Capturing needs a number of frames (--batch)!!");
+            }
+            if (options.multiGpu != MultiGpuMode::Off) {
+                throw std::runtime_error("Capturing only works on one GPU!!");
+            }
+        }
+
+        /*
+         * Device groups need a group with more than one GPU in it to be any
+         * use. If there isn't one but there are several separate GPUs, run
+         * those as independent workers instead, and with only the one GPU
+         * just render the batch on it as usual.
+         */
+        if (options.multiGpu != MultiGpuMode::Off) {
+
+            if (options.batchFrames == 0) {
+                throw std::runtime_error("Multi-GPU rendering only works in batch mode (--batch)!!");
+            }
+
+            MultiGpuTopology topology = probeMultiGpu();
+
+            if (options.multiGpu != MultiGpuMode::Workers && topology.largestGroup < 2) {
+                if (topology.physicalDevices >= 2) {
+                    std::cout << "No device group with more than one GPU, falling back to render workers"
+                              << std::endl;
+                    options.multiGpu = MultiGpuMode::Workers;
+                } else {
+                    std::cout << "Only one GPU, rendering without multi-GPU" << std::endl;
+                    options.multiGpu = MultiGpuMode::Off;
+                }
+            }
+
+            if (options.multiGpu == MultiGpuMode::Workers) {
+                return runRenderWorkers(options, topology.physicalDevices);
+            }
+        }
+
+        App app(options);
         app.run();
-    } catch (const std::runtime_error& e) {
+    } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
 }
+#endif
@@ -0,0 +1,135 @@
+#ifndef MULTI_GPU_H
+#define MULTI_GPU_H
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+ * Ways of spreading batch rendering over more than one GPU.
+ *
+ * A device group (VK_KHR_device_group) is a set of GPUs the driver has
+ * linked together, e.g. over NVLink or CrossFire, which we drive through a
+ * single VkDevice. Command buffers are recorded once and a device mask on
+ * each submit (or inside the command buffer) says which of the GPUs run
+ * them. Memory allocated from a device local heap gets a copy on every
+ * GPU, so each one renders into its own instance of our images.
+ *
+ * GPUs that aren't linked show up as groups of one, all we can do with
+ * those is give each its own VkDevice and its own share of the frames.
+ */
+enum class MultiGpuMode {
+    Off,                // One GPU, as ever
+    AlternateFrame,     // Device group, each frame drawn whole by the next GPU in turn
+    SplitFrame,         // Device group, every frame split into strips, a strip per GPU
+    Workers             // Independent devices, each running its own App on every Nth frame
+};
+
+/*
+ * What the driver has to offer: how many GPUs there are in all, and how
+ * many of them are in the largest device group.
+ */
+struct MultiGpuTopology {
+    uint32_t physicalDevices = 0;
+    uint32_t largestGroup = 0;
+};
+
+/*
+ * Ask a throwaway instance, so we can decide between a device group and
+ * render workers before any App exists. Instances are cheap next to
+ * everything else startup does.
+ */
+inline MultiGpuTopology probeMultiGpu() {
+
+    MultiGpuTopology topology;
+
+    // Can we ask about groups at all?
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+
+    bool groupsSupported = std::any_of(extensions.begin(), extensions.end(), [](const VkExtensionProperties& e) {
+        return strcmp(e.extensionName, VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME) == 0;
+    });
+
+    const char* groupExtension = VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME;
+
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.apiVersion = VK_API_VERSION_1_0;
+
+    VkInstanceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
+    createInfo.enabledExtensionCount = groupsSupported ? 1 : 0;
+    createInfo.ppEnabledExtensionNames = &groupExtension;
+
+    VkInstance instance;
+    if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+        return topology;
+    }
+
+    vkEnumeratePhysicalDevices(instance, &topology.physicalDevices, nullptr);
+
+    // Without the extension every GPU is on its own
+    topology.largestGroup = std::min(topology.physicalDevices, 1u);
+
+    auto enumerateGroups = (PFN_vkEnumeratePhysicalDeviceGroupsKHR)
+        vkGetInstanceProcAddr(instance, "vkEnumeratePhysicalDeviceGroupsKHR");
+
+    if (groupsSupported && enumerateGroups != nullptr) {
+
+        uint32_t groupCount = 0;
+        enumerateGroups(instance, &groupCount, nullptr);
+
+        std::vector<VkPhysicalDeviceGroupPropertiesKHR> groups(groupCount);
+        for (auto& group : groups) {
+            group.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES_KHR;
+        }
+        enumerateGroups(instance, &groupCount, groups.data());
+
+        for (const auto& group : groups) {
+            topology.largestGroup = std::max(topology.largestGroup, group.physicalDeviceCount);
+        }
+    }
+
+    vkDestroyInstance(instance, nullptr);
+    return topology;
+}
+
+/*
+ * A bit for each of the first count GPUs in a group
+ */
+inline uint32_t allDevicesMask(uint32_t count) {
+    return count >= 32 ? ~0u : (1u << count) - 1;
+}
+
+/*
+ * Alternate frame rendering: the GPUs take it in turns
+ */
+inline uint32_t alternateFrameMask(uint64_t frame, uint32_t count) {
+    return 1u << (frame % count);
+}
+
+/*
+ * Split frame rendering: cut the image into horizontal strips, one for
+ * each GPU. The last strip takes whatever rows are left over.
+ */
+inline std::vector<VkRect2D> splitFrameAreas(VkExtent2D extent, uint32_t count) {
+
+    std::vector<VkRect2D> areas(count);
+    uint32_t rows = extent.height / count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        areas[i].offset = {0, (int32_t) (i * rows)};
+        areas[i].extent = {extent.width, i + 1 == count ? extent.height - i * rows : rows};
+    }
+
+    return areas;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include <cstdint>
+
+/*
+ * The post processing chain (--post): bloom, tonemapping, colour grading
+ * and FXAA, as compute passes between the HDR image the scene is drawn
+ * into and the output. The kernels are in shaders/post_*.comp, with what
+ * they share in shaders/post_common.glsl and shaders/post_fxaa.glsl.
+ *
+ * It comes in two versions, which give the same picture. Done as separate
+ * passes, each one reads its input from memory and writes its whole
+ * output back:
+ *
+ *   bright pass   scene -> bloom A (half size, just the brightest parts)
+ *   blur x        bloom A -> bloom B
+ *   blur y        bloom B -> bloom A
+ *   tonemap       scene + bloom A -> LDR A
+ *   colour grade  LDR A -> LDR B
+ *   FXAA          LDR B -> LDR A
+ *
+ * Fused, neighbouring passes become one dispatch. Each workgroup loads the
+ * tile it needs (plus a border for the filters to reach into) into shared
+ * memory once, runs the passes there and only writes out the end result:
+ *
+ *   bloom         scene -> bloom A
+ *   resolve       scene + bloom A -> LDR A
+ *
+ * Either way a full screen triangle copies LDR A to the output.
+ *
+ * The numbers here are repeated in the shaders, change them together.
+ */
+namespace PostProcess {
+
+    // The kernels work on TILE by TILE blocks of pixels
+    const uint32_t TILE = 16;
+
+    // How far the bloom blur reaches either side, and how far FXAA walks
+    // along an edge. These are the borders the fused tiles load.
+    const uint32_t BLOOM_RADIUS = 4;
+    const uint32_t FXAA_SEARCH_STEPS = 4;
+
+    // The images between the passes. The scene is drawn into, the rest
+    // are written by the kernels as storage images.
+    enum Image {
+        SCENE,
+        BLOOM_A,
+        BLOOM_B,
+        LDR_A,
+        LDR_B,
+        IMAGE_COUNT,
+        NO_IMAGE = IMAGE_COUNT
+    };
+
+    /*
+     * One dispatch: its shader, what it reads (through bindings 0 and 1)
+     * and writes (binding 2), and for the blur, which way
+     */
+    struct Pass {
+        const char* name;
+        const char* shader;
+        bool fused;
+        Image input;
+        Image secondInput;
+        Image output;
+        int32_t direction[2];
+    };
+
+    // In the order they run. The timer gives each its own region, so
+    // both versions are listed one after the other and a frame only
+    // dispatches the version it's using.
+    const Pass PASSES[] = {
+        {"bloom bright pass", "post_bright.spv", false, SCENE, NO_IMAGE, BLOOM_A, {0, 0}},
+        {"bloom blur x", "post_blur.spv", false, BLOOM_A, NO_IMAGE, BLOOM_B, {1, 0}},
+        {"bloom blur y", "post_blur.spv", false, BLOOM_B, NO_IMAGE, BLOOM_A, {0, 1}},
+        {"tonemap", "post_tonemap.spv", false, SCENE, BLOOM_A, LDR_A, {0, 0}},
+        {"colour grade", "post_grade.spv", false, LDR_A, NO_IMAGE, LDR_B, {0, 0}},
+        {"fxaa", "post_fxaa.spv", false, LDR_B, NO_IMAGE, LDR_A, {0, 0}},
+        {"fused bloom", "post_bloom.spv", true, SCENE, NO_IMAGE, BLOOM_A, {0, 0}},
+        {"fused resolve", "post_resolve.spv", true, SCENE, BLOOM_A, LDR_A, {0, 0}},
+    };
+
+    const uint32_t PASS_COUNT = sizeof(PASSES) / sizeof(PASSES[0]);
+
+    // The bloom images are half the size of the rest
+    inline bool halfSize(Image image) {
+        return image == BLOOM_A || image == BLOOM_B;
+    }
+
+    /*
+     * The push constants every kernel takes: the size of the image it
+     * writes, and the blur's direction
+     */
+    struct PushConstants {
+        int32_t size[2];
+        int32_t direction[2];
+    };
+}
+
+#endif
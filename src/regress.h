@@ -0,0 +1,180 @@
+#ifndef REGRESS_H
+#define REGRESS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * The pieces of the regression harness that don't need Vulkan: the scenes
+ * we render, reading and writing golden images and comparing them.
+ *
+ * Each scene is rendered headlessly, the last frame is compared against
+ * <golden>/<scene>.ppm and the time per frame against the baseline in
+ * <golden>/<scene>.perf. They're only recorded when --update-golden is
+ * passed (make golden), from an optimized build without validation, and a
+ * scene with no golden fails rather than passing by recording one.
+ */
+struct RegressionScene {
+    const char* name;
+    uint32_t width;
+    uint32_t height;
+
+    // How many copies of the triangle to draw on top of each other, they
+    // all land in the same place so the image shouldn't change
+    uint32_t instances;
+
+    // How many frames to time (after warming up)
+    uint32_t frames;
+};
+
+const RegressionScene regressionScenes[] = {
+    {"triangle", 800,  600,  1,    300},
+    {"overdraw", 800,  600,  2000, 50},
+    {"large",    3840, 2160, 1,    30},
+};
+
+/*
+ * An 8 bit RGB image, the same layout as a binary PPM
+ */
+struct RgbImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+inline RgbImage rgbFromBgra(uint32_t width, uint32_t height, const uint8_t* bgra) {
+
+    RgbImage image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize((size_t) width * height * 3);
+
+    uint8_t* dst = image.pixels.data();
+    for (size_t i = 0; i < (size_t) width * height; i++, bgra += 4, dst += 3) {
+        dst[0] = bgra[2];
+        dst[1] = bgra[1];
+        dst[2] = bgra[0];
+    }
+
+    return image;
+}
+
+inline void writePpm(const std::string& path, const RgbImage& image) {
+
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open " + path + " for writing!!");
+    }
+
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+    file.write((const char*) image.pixels.data(), image.pixels.size());
+}
+
+/*
+ * Reads back the binary PPMs we write, returns false if the file doesn't
+ * exist.
+ */
+inline bool readPpm(const std::string& path, RgbImage& image) {
+
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::string magic;
+    unsigned int maxValue;
+    file >> magic >> image.width >> image.height >> maxValue;
+    file.get();     // The single whitespace character after the header
+
+    if (!file || magic != "P6" || maxValue != 255) {
+        throw std::runtime_error(path + " is not a binary 8 bit PPM!!");
+    }
+
+    image.pixels.resize((size_t) image.width * image.height * 3);
+    file.read((char*) image.pixels.data(), image.pixels.size());
+
+    if (!file) {
+        throw std::runtime_error(path + " is truncated!!");
+    }
+
+    return true;
+}
+
+struct ImageDifference {
+    bool sizeMismatch = false;
+    uint32_t maxChannelDifference = 0;
+
+    // Pixels where any channel differs by more than the tolerance
+    uint64_t differentPixels = 0;
+    uint64_t totalPixels = 0;
+
+    double differentFraction() const {
+        return totalPixels == 0 ? 0.0 : (double) differentPixels / totalPixels;
+    }
+};
+
+inline ImageDifference compareImages(const RgbImage& expected, const RgbImage& actual,
+                                     uint32_t tolerance) {
+
+    ImageDifference difference;
+
+    if (expected.width != actual.width || expected.height != actual.height) {
+        difference.sizeMismatch = true;
+        return difference;
+    }
+
+    difference.totalPixels = (uint64_t) expected.width * expected.height;
+
+    for (size_t i = 0; i < expected.pixels.size(); i += 3) {
+
+        uint32_t pixelDifference = 0;
+        for (size_t c = 0; c < 3; c++) {
+            uint32_t channel = std::abs((int) expected.pixels[i + c] - (int) actual.pixels[i + c]);
+            pixelDifference = std::max(pixelDifference, channel);
+        }
+
+        difference.maxChannelDifference = std::max(difference.maxChannelDifference, pixelDifference);
+        if (pixelDifference > tolerance) {
+            difference.differentPixels++;
+        }
+    }
+
+    return difference;
+}
+
+/*
+ * Performance baselines are a single number, milliseconds per frame, kept
+ * in a text file so they're easy to inspect or tweak by hand.
+ */
+inline bool readBaseline(const std::string& path, double& frameMs) {
+
+    std::ifstream file(path);
+    std::string key;
+
+    if (!(file >> key >> frameMs) || key != "frame_ms") {
+        return false;
+    }
+
+    return true;
+}
+
+inline void writeBaseline(const std::string& path, double frameMs) {
+
+    std::ofstream file(path);
+
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open " + path + " for writing!!");
+    }
+
+    file << "frame_ms " << frameMs << "\n";
+}
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "clustered_lighting.h"
+
+/*
+ * The CPU's half of shadowed spot lights (--shadows), the GPU's is in
+ * shaders/shadow.vert and the SHADOWS parts of shaders/lit.frag.
+ *
+ * Every shadowed light gets a square tile of one big depth texture, the
+ * atlas. The most important lights (the brightest and biggest on screen)
+ * get the biggest tiles, the rest get smaller ones until the atlas is full.
+ *
+ * There are two copies of the atlas. The cache holds each tile's static
+ * casters, which are drawn once, when the tile is handed out. The live one
+ * is what lit.frag samples. A live tile is only redrawn when a dynamic
+ * caster comes near its light (or has just left it): the cached tile is
+ * copied over it and the dynamic casters are drawn on top. So a frame's
+ * shadow work follows how much moved, not how many lights there are.
+ *
+ * Only spot lights cast shadows, one perspective tile each. A point light
+ * would need six.
+ *
+ * Everything is in the view space of clustered_lighting.h.
+ */
+namespace ShadowAtlas {
+
+    const uint32_t ATLAS_SIZE = 4096;
+
+    // Tile sizes go down by half from the biggest, a quarter of the
+    // atlas's width, to the smallest
+    const uint32_t MAX_TILE = 1024;
+    const uint32_t MIN_TILE = 128;
+
+    // How many lights --shadows can ask for. The atlas has room for a few
+    // more than this at the tile sizes handed out.
+    const uint32_t MAX_SHADOWS = 256;
+
+    // The casters: a fixed set of static triangles, and however many
+    // dynamic ones (up to MAX_DYNAMIC_CASTERS) orbiting through them
+    const uint32_t STATIC_CASTERS = 256;
+    const uint32_t MAX_DYNAMIC_CASTERS = 64;
+
+    // The shadow benchmark's lights, enough that there are MAX_SHADOWS
+    // spot lights to shadow
+    const uint32_t BENCH_LIGHTS = 4000;
+
+    // The near plane of a light's projection, its far plane is its radius
+    const float NEAR_Z = 0.05f;
+
+    /*
+     * One caster, as three vec4s for shadow.vert
+     */
+    struct Caster {
+        float corners[3][4];
+    };
+
+    /*
+     * What lit.frag needs for a tile, as std430 lays it out: the light's
+     * view projection matrix (column major) and where the tile is in the
+     * atlas, as a UV offset and scale
+     */
+    struct ShadowRecord {
+        float viewProjection[16];
+        float atlasRect[4];
+    };
+
+    struct Sphere {
+        float center[3];
+        float radius;
+    };
+
+    /*
+     * A light's place in the atlas
+     */
+    struct Tile {
+        uint32_t light;         // Index into the light buffer
+        uint32_t x, y, size;    // In texels
+        ShadowRecord record;
+
+        bool cached = false;    // Its static casters are in the cache atlas
+        bool dynamic = false;   // A dynamic caster was in it last frame
+    };
+
+    /*
+     * How much a light's shadow matters, roughly how big and bright the
+     * light looks from the camera
+     */
+    inline float importance(const ClusteredLighting::Light& light) {
+
+        float brightness = std::max({light.color[0], light.color[1], light.color[2]});
+        float distance = std::sqrt(light.position[0] * light.position[0] + light.position[1] * light.position[1]
+                                   + light.position[2] * light.position[2]);
+        float size = light.radius / std::max(distance, light.radius);
+
+        return brightness * size * size;
+    }
+
+    /*
+     * The light's view and projection in one: x and y across the cone, w
+     * the distance along it and z/w running from 0 at NEAR_Z to 1 at the
+     * light's radius
+     */
+    inline void viewProjection(const ClusteredLighting::Light& light, float matrix[16]) {
+
+        const float* forward = light.direction;
+        float up[3] = {0.0f, 1.0f, 0.0f};
+        if (std::abs(forward[1]) > 0.99f) {
+            up[0] = 1.0f;
+            up[1] = 0.0f;
+        }
+
+        // right = up x forward, then up again = forward x right
+        float right[3] = {up[1] * forward[2] - up[2] * forward[1],
+                          up[2] * forward[0] - up[0] * forward[2],
+                          up[0] * forward[1] - up[1] * forward[0]};
+        float length = std::sqrt(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+        for (float& component : right) {
+            component /= length;
+        }
+        float down[3] = {forward[1] * right[2] - forward[2] * right[1],
+                         forward[2] * right[0] - forward[0] * right[2],
+                         forward[0] * right[1] - forward[1] * right[0]};
+
+        float scale = 1.0f / std::tan(std::acos(light.cosOuterAngle));
+        float depthScale = light.radius / (light.radius - NEAR_Z);
+
+        const float* axes[3] = {right, down, forward};
+        float rows[4][4];
+        for (int row = 0; row < 3; row++) {
+            rows[row][3] = 0.0f;
+            for (int i = 0; i < 3; i++) {
+                rows[row][i] = axes[row][i];
+                rows[row][3] -= axes[row][i] * light.position[i];
+            }
+        }
+
+        // Row 2 is the distance along the cone, which becomes w, and z is
+        // that rescaled so the divide maps [NEAR_Z, radius] to [0, 1]
+        for (int i = 0; i < 4; i++) {
+            rows[3][i] = rows[2][i];
+            rows[2][i] *= depthScale;
+            rows[0][i] *= scale;
+            rows[1][i] *= scale;
+        }
+        rows[2][3] -= depthScale * NEAR_Z;
+
+        for (int row = 0; row < 4; row++) {
+            for (int column = 0; column < 4; column++) {
+                matrix[column * 4 + row] = rows[row][column];
+            }
+        }
+    }
+
+    /*
+     * Hand out tiles to the (at most maxShadows) most important spot
+     * lights. Sizes go by rank: one light gets MAX_TILE, the next four
+     * half that, the next sixteen half again and so on down to MIN_TILE.
+     *
+     * Because the tiles come in biggest first and every size is a power
+     * of two, laying them out along a Z-order curve packs them without
+     * gaps: each one starts where the last finished, and that's always a
+     * multiple of its own size.
+     */
+    inline std::vector<Tile> allocateTiles(const std::vector<ClusteredLighting::Light>& lights,
+                                           uint32_t maxShadows) {
+
+        std::vector<uint32_t> spots;
+        for (uint32_t i = 0; i < lights.size(); i++) {
+            if (lights[i].spot > 0.5f) {
+                spots.push_back(i);
+            }
+        }
+
+        std::stable_sort(spots.begin(), spots.end(), [&lights](uint32_t a, uint32_t b) {
+            return importance(lights[a]) > importance(lights[b]);
+        });
+
+        const uint32_t cellsAcross = ATLAS_SIZE / MIN_TILE;
+        const uint32_t cells = cellsAcross * cellsAcross;
+
+        std::vector<Tile> tiles;
+        uint32_t cursor = 0;
+        uint32_t size = MAX_TILE;
+        uint32_t tierLeft = 1;
+        uint32_t tierSize = 1;
+
+        for (uint32_t light : spots) {
+
+            if (tiles.size() == maxShadows) {
+                break;
+            }
+
+            if (tierLeft == 0) {
+                size = std::max(size / 2, MIN_TILE);
+                tierSize *= 4;
+                tierLeft = tierSize;
+            }
+            tierLeft--;
+
+            uint32_t tileCells = (size / MIN_TILE) * (size / MIN_TILE);
+            if (cursor + tileCells > cells) {
+                break;
+            }
+
+            // The cursor's even bits are x, the odd ones y
+            uint32_t x = 0;
+            uint32_t y = 0;
+            for (uint32_t bit = 0; (1u << (2 * bit)) < cells; bit++) {
+                x |= ((cursor >> (2 * bit)) & 1) << bit;
+                y |= ((cursor >> (2 * bit + 1)) & 1) << bit;
+            }
+            cursor += tileCells;
+
+            Tile tile;
+            tile.light = light;
+            tile.x = x * MIN_TILE;
+            tile.y = y * MIN_TILE;
+            tile.size = size;
+
+            viewProjection(lights[light], tile.record.viewProjection);
+            tile.record.atlasRect[0] = (float) tile.x / ATLAS_SIZE;
+            tile.record.atlasRect[1] = (float) tile.y / ATLAS_SIZE;
+            tile.record.atlasRect[2] = (float) size / ATLAS_SIZE;
+            tile.record.atlasRect[3] = (float) size / ATLAS_SIZE;
+
+            tiles.push_back(tile);
+        }
+
+        return tiles;
+    }
+
+    /*
+     * A triangle of the given size around a point, turned by angle about
+     * the view axis
+     */
+    inline Caster makeCaster(float x, float y, float z, float size, float angle) {
+
+        Caster caster;
+        for (int corner = 0; corner < 3; corner++) {
+            float a = angle + corner * 2.0943951f;
+            caster.corners[corner][0] = x + size * std::cos(a);
+            caster.corners[corner][1] = y + size * std::sin(a);
+            caster.corners[corner][2] = z + 0.2f * size * (corner - 1);
+            caster.corners[corner][3] = 1.0f;
+        }
+        return caster;
+    }
+
+    /*
+     * The static casters, scattered between the nearest lights and the
+     * triangle, the same every time
+     */
+    inline std::vector<Caster> generateStaticCasters() {
+
+        std::mt19937 random(STATIC_CASTERS);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        std::vector<Caster> casters(STATIC_CASTERS);
+        for (Caster& caster : casters) {
+            caster = makeCaster(-1.5f + 3.0f * unit(random), -1.2f + 2.4f * unit(random),
+                                1.2f + 1.4f * unit(random), 0.08f + 0.12f * unit(random),
+                                6.2831853f * unit(random));
+        }
+
+        return casters;
+    }
+
+    /*
+     * Where the dynamic casters are on a given frame, and a sphere around
+     * each. They go round in a ring, bobbing towards and away from the
+     * camera.
+     */
+    inline void dynamicCasters(uint64_t frame, uint32_t count, Caster* casters, Sphere* bounds) {
+
+        static const float SIZE = 0.15f;
+
+        for (uint32_t i = 0; i < count; i++) {
+
+            float angle = (float) (frame % 100000) * 0.02f + i * 6.2831853f / count;
+            float x = 1.2f * std::cos(angle);
+            float y = 0.8f * std::sin(angle);
+            float z = 1.9f + 0.5f * std::sin(2.0f * angle);
+
+            casters[i] = makeCaster(x, y, z, SIZE, 3.0f * angle);
+            bounds[i] = {{x, y, z}, SIZE * 1.02f};
+        }
+    }
+
+    /*
+     * Could the sphere be anywhere in the light's shadow? Anything outside
+     * the light's own sphere can't cast into its tile.
+     */
+    inline bool touches(const Sphere& sphere, const ClusteredLighting::Light& light) {
+
+        float reach = sphere.radius + light.radius;
+        float distanceSquared = 0.0f;
+        for (int i = 0; i < 3; i++) {
+            float d = sphere.center[i] - light.position[i];
+            distanceSquared += d * d;
+        }
+        return distanceSquared < reach * reach;
+    }
+}
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Near enough the moment the process started, static initialisation runs
+ * before main() so this is our best guess without asking the OS.
+ */
+inline const std::chrono::steady_clock::time_point processStartTime = std::chrono::steady_clock::now();
+
+/*
+ * Records when each startup step ran (and on which thread) so we can see
+ * where the time between launching and the first frame goes.
+ */
+class StartupProfiler {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /*
+         * Record a step that ran from start to end, safe to call from any
+         * thread.
+         */
+        void record(const std::string& name, Clock::time_point start, Clock::time_point end) {
+
+            std::lock_guard<std::mutex> lock(mutex);
+            steps.push_back({name, start, end, threadNumber(std::this_thread::get_id())});
+        }
+
+        /*
+         * Record a moment rather than a step, e.g. the first frame going out
+         */
+        void mark(const std::string& name) {
+            auto now = Clock::now();
+            record(name, now, now);
+        }
+
+        /*
+         * Print each step with its start and end relative to the process
+         * starting, then the time spent in steps against the wall clock.
+         */
+        void print(std::ostream& out) {
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            std::sort(steps.begin(), steps.end(), [](const Step& a, const Step& b) {
+                return a.start < b.start;
+            });
+
+            auto ms = [](Clock::duration duration) {
+                return std::chrono::duration<double, std::milli>(duration).count();
+            };
+
+            out << "Startup (ms since process start):\n";
+
+            double busy = 0.0;
+            Clock::time_point last = processStartTime;
+
+            for (const auto& step : steps) {
+
+                char line[128];
+                if (step.start == step.end) {
+                    snprintf(line, sizeof(line), "  %8.2f            %-24s\n",
+                             ms(step.start - processStartTime), step.name.c_str());
+                } else {
+                    snprintf(line, sizeof(line), "  %8.2f - %8.2f %-24s %8.2f  thread %u\n",
+                             ms(step.start - processStartTime), ms(step.end - processStartTime),
+                             step.name.c_str(), ms(step.end - step.start), step.thread);
+                    busy += ms(step.end - step.start);
+                }
+                out << line;
+
+                last = std::max(last, step.end);
+            }
+
+            out << "  " << busy << " ms of steps in " << ms(last - processStartTime)
+                << " ms of wall clock" << std::endl;
+        }
+
+    private:
+        struct Step {
+            std::string name;
+            Clock::time_point start;
+            Clock::time_point end;
+            unsigned int thread;
+        };
+
+        std::mutex mutex;
+        std::vector<Step> steps;
+        std::vector<std::thread::id> threads;
+
+        // Small numbers are easier to read than thread ids, the first thread
+        // to record anything (the main thread) is 0
+        unsigned int threadNumber(std::thread::id id) {
+
+            auto found = std::find(threads.begin(), threads.end(), id);
+            if (found != threads.end()) {
+                return (unsigned int) (found - threads.begin());
+            }
+
+            threads.push_back(id);
+            return (unsigned int) threads.size() - 1;
+        }
+};
+
+/*
+ * The startup steps along with what each one needs finished before it can
+ * start. Run in parallel, each step starts as soon as its dependencies are
+ * done, so independent work (like loading shaders) overlaps the long
+ * driver calls (like creating the device).
+ *
+ * Steps have to be added after the steps they depend on, which means the
+ * order they are added in is always a valid order to run them one at a
+ * time.
+ */
+class InitGraph {
+    public:
+
+        // Some things (anything touching a GLFW window) have to happen on the
+        // main thread
+        enum class Thread { Main, Any };
+
+        /*
+         * Run at the start of each worker thread, before its step
+         */
+        void setThreadInit(std::function<void()> init) {
+            threadInit = std::move(init);
+        }
+
+        void add(const std::string& name, const std::vector<std::string>& dependsOn,
+                 Thread thread, std::function<void()> run) {
+
+            Task task;
+            task.name = name;
+            task.thread = thread;
+            task.run = std::move(run);
+
+            for (const auto& dependency : dependsOn) {
+
+                auto found = std::find_if(tasks.begin(), tasks.end(), [&](const Task& other) {
+                    return other.name == dependency;
+                });
+
+                if (found == tasks.end()) {
+                    throw std::runtime_error("Startup step " + name + " depends on unknown step "
+                                             + dependency + "!!");
+                }
+
+                task.dependsOn.push_back(found - tasks.begin());
+            }
+
+            tasks.push_back(std::move(task));
+        }
+
+        /*
+         * Run every step, timing each with profiler. If a step throws no
+         * more are started and the first exception is rethrown once the
+         * running ones have finished.
+         */
+        void run(StartupProfiler& profiler, bool parallel) {
+
+            if (!parallel) {
+                for (auto& task : tasks) {
+                    timed(profiler, task);
+                }
+                return;
+            }
+
+            std::vector<std::thread> workers;
+            std::unique_lock<std::mutex> lock(mutex);
+
+            size_t finished = 0;
+            size_t started = 0;
+
+            while (finished < tasks.size()) {
+
+                if (error && started == finished) {
+                    break;
+                }
+
+                // Kick off everything that's ready to go, keeping back one
+                // main thread step to run ourselves
+                Task* mainTask = nullptr;
+
+                for (auto& task : tasks) {
+                    if (task.started || error || !ready(task)) {
+                        continue;
+                    }
+
+                    if (task.thread == Thread::Main) {
+                        if (mainTask == nullptr) {
+                            mainTask = &task;
+                            task.started = true;
+                            started++;
+                        }
+                        continue;
+                    }
+
+                    task.started = true;
+                    started++;
+                    workers.emplace_back([this, &profiler, &task] {
+                        if (threadInit) {
+                            threadInit();
+                        }
+                        runAndFinish(profiler, task);
+                    });
+                }
+
+                if (mainTask != nullptr) {
+                    lock.unlock();
+                    runAndFinish(profiler, *mainTask);
+                    lock.lock();
+                } else {
+                    // Nothing for us to do until a worker finishes
+                    size_t before = completed;
+                    taskFinished.wait(lock, [&] { return completed != before; });
+                }
+
+                finished = completed;
+            }
+
+            lock.unlock();
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        struct Task {
+            std::string name;
+            std::vector<size_t> dependsOn;
+            Thread thread;
+            std::function<void()> run;
+            bool started = false;
+            bool done = false;
+        };
+
+        std::vector<Task> tasks;
+        std::function<void()> threadInit;
+
+        std::mutex mutex;
+        std::condition_variable taskFinished;
+        size_t completed = 0;
+        std::exception_ptr error;
+
+        bool ready(const Task& task) const {
+            for (size_t dependency : task.dependsOn) {
+                if (!tasks[dependency].done) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static void timed(StartupProfiler& profiler, Task& task) {
+            auto start = StartupProfiler::Clock::now();
+            task.run();
+            profiler.record(task.name, start, StartupProfiler::Clock::now());
+        }
+
+        void runAndFinish(StartupProfiler& profiler, Task& task) {
+
+            std::exception_ptr taskError;
+            try {
+                timed(profiler, task);
+            } catch (...) {
+                taskError = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (taskError && !error) {
+                    error = taskError;
+                }
+                task.done = !taskError;
+                completed++;
+            }
+            taskFinished.notify_all();
+        }
+};
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef SUBMIT_H
+#define SUBMIT_H
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "timeline.h"
+
+/*
+ * Every vkQueueSubmit call costs us a trip into the driver, so rather than
+ * each part of the renderer submitting its own work we collect everything
+ * destined for a queue over the course of a frame and hand it over in one
+ * go.
+ *
+ * Work is grouped into batches (a VkSubmitInfo each). A batch is a list of
+ * semaphore waits, then a list of command buffers, then a list of
+ * semaphore signals. As long as things are added in that order they all
+ * land in the same batch, a wait added after some command buffers (or a
+ * command buffer added after a signal) starts a new batch. All the batches
+ * then go to the driver in a single vkQueueSubmit on flush().
+ *
+ * On a device group each command buffer also carries a device mask, which
+ * says which of the group's GPUs run it.
+ */
+class SubmitBatcher {
+    public:
+
+        /*
+         * Counters so we can see how many submits we make per frame and how
+         * long the CPU spends making them.
+         */
+        struct Stats {
+            uint64_t frames = 0;
+            uint64_t submitCalls = 0;
+            uint64_t batches = 0;
+            uint64_t commandBuffers = 0;
+            std::chrono::nanoseconds submitTime{0};
+        };
+
+        explicit SubmitBatcher(QueueTimeline& timeline) : timeline(timeline) {}
+
+        /*
+         * Wait on a binary semaphore (e.g. one from the swap chain)
+         */
+        void wait(VkSemaphore semaphore, VkPipelineStageFlags stage) {
+            addWait(semaphore, stage, 0);
+        }
+
+        /*
+         * Wait for another queue's timeline to reach a value before this
+         * work starts.
+         */
+        void wait(TimelinePoint point, VkPipelineStageFlags stage) {
+
+            // Work on the same queue is ordered by pipeline barriers, not
+            // by us
+            if (point.timeline == &timeline || point.value == 0) {
+                return;
+            }
+
+            if (point.timeline->usesTimelineSemaphore()) {
+                addWait(point.timeline->semaphore(), stage, point.value);
+            } else {
+                // Without timeline semaphores there is nothing the GPU can
+                // wait on, so the CPU will have to.
+                point.timeline->wait(point.value);
+            }
+        }
+
+        void add(VkCommandBuffer commandBuffer) {
+
+            if (current().signalCount > 0) {
+                startBatch();
+            }
+
+            commandBuffers.push_back(commandBuffer);
+            commandBufferMasks.push_back(deviceMask);
+            current().commandBufferCount++;
+        }
+
+        /*
+         * Submit to a device group, allDevices has a bit for each of its
+         * GPUs. Until this is called submits go to the device as normal.
+         */
+        void useDeviceGroup(uint32_t allDevices) {
+            this->allDevices = allDevices;
+            deviceMask = allDevices;
+        }
+
+        /*
+         * Which of the group's GPUs run the command buffers added from now
+         * until the next flush(), the default is all of them
+         */
+        void setDeviceMask(uint32_t mask) {
+            deviceMask = mask;
+        }
+
+        /*
+         * Signal a binary semaphore once the work added so far is done
+         */
+        void signal(VkSemaphore semaphore) {
+            signalSemaphores.push_back(semaphore);
+            signalValues.push_back(0);
+            current().signalCount++;
+        }
+
+        bool empty() const {
+            return batches.size() == 1 && batches[0].waitCount == 0 &&
+                   batches[0].commandBufferCount == 0 && batches[0].signalCount == 0;
+        }
+
+        /*
+         * Hand everything collected so far to the driver with a single call.
+         * Returns the point on the queue's timeline which will be reached
+         * once all of it has finished.
+         */
+        TimelinePoint flush() {
+
+            if (empty()) {
+                return timeline.lastPoint();
+            }
+
+            // The last batch also moves the queue's timeline on
+            uint64_t value = timeline.nextValue();
+
+            if (timeline.usesTimelineSemaphore()) {
+                signalSemaphores.push_back(timeline.semaphore());
+                signalValues.push_back(value);
+                current().signalCount++;
+            }
+
+            // Now nothing else is going to be added we can point the submit
+            // infos into our arrays without worrying about them moving
+            submitInfos.resize(batches.size());
+            timelineInfos.resize(batches.size());
+            groupInfos.resize(batches.size());
+
+            // Semaphores are waited on and signalled by the group's first GPU
+            semaphoreDeviceIndices.resize(std::max({semaphoreDeviceIndices.size(), waitSemaphores.size(),
+                                                    signalSemaphores.size()}), 0);
+
+            size_t wait = 0, commandBuffer = 0, signal = 0;
+
+            for (size_t i = 0; i < batches.size(); i++) {
+
+                const Batch& batch = batches[i];
+
+                VkSubmitInfo& submitInfo = submitInfos[i];
+                submitInfo = {};
+                submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+                submitInfo.waitSemaphoreCount = batch.waitCount;
+                submitInfo.pWaitSemaphores = waitSemaphores.data() + wait;
+                submitInfo.pWaitDstStageMask = waitStages.data() + wait;
+                submitInfo.commandBufferCount = batch.commandBufferCount;
+                submitInfo.pCommandBuffers = commandBuffers.data() + commandBuffer;
+                submitInfo.signalSemaphoreCount = batch.signalCount;
+                submitInfo.pSignalSemaphores = signalSemaphores.data() + signal;
+
+                if (timeline.usesTimelineSemaphore()) {
+                    VkTimelineSemaphoreSubmitInfoKHR& timelineInfo = timelineInfos[i];
+                    timelineInfo = {};
+                    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+                    timelineInfo.waitSemaphoreValueCount = batch.waitCount;
+                    timelineInfo.pWaitSemaphoreValues = waitValues.data() + wait;
+                    timelineInfo.signalSemaphoreValueCount = batch.signalCount;
+                    timelineInfo.pSignalSemaphoreValues = signalValues.data() + signal;
+
+                    submitInfo.pNext = &timelineInfo;
+                }
+
+                if (allDevices != 0) {
+                    VkDeviceGroupSubmitInfoKHR& groupInfo = groupInfos[i];
+                    groupInfo = {};
+                    groupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO_KHR;
+                    groupInfo.pNext = submitInfo.pNext;
+                    groupInfo.waitSemaphoreCount = batch.waitCount;
+                    groupInfo.pWaitSemaphoreDeviceIndices = semaphoreDeviceIndices.data();
+                    groupInfo.commandBufferCount = batch.commandBufferCount;
+                    groupInfo.pCommandBufferDeviceMasks = commandBufferMasks.data() + commandBuffer;
+                    groupInfo.signalSemaphoreCount = batch.signalCount;
+                    groupInfo.pSignalSemaphoreDeviceIndices = semaphoreDeviceIndices.data();
+
+                    submitInfo.pNext = &groupInfo;
+                }
+
+                wait += batch.waitCount;
+                commandBuffer += batch.commandBufferCount;
+                signal += batch.signalCount;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            if (timeline.getDispatch().vkQueueSubmit(timeline.getQueue(), (uint32_t) submitInfos.size(), submitInfos.data(),
+                              timeline.fenceFor(value)) != VK_SUCCESS) {
+                throw std::runtime_error("Unable to submit the batched work!!");
+            }
+
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            timeline.recordSubmit(value, elapsed);
+
+            stats.submitCalls++;
+            stats.batches += batches.size();
+            stats.commandBuffers += commandBuffers.size();
+            stats.submitTime += elapsed;
+
+            reset();
+            return timeline.point(value);
+        }
+
+        /*
+         * Mark the end of a frame, only used for the per frame statistics
+         */
+        void endFrame() {
+            stats.frames++;
+        }
+
+        const Stats& getStats() const {
+            return stats;
+        }
+
+    private:
+        struct Batch {
+            uint32_t waitCount = 0;
+            uint32_t commandBufferCount = 0;
+            uint32_t signalCount = 0;
+        };
+
+        QueueTimeline& timeline;
+
+        // Everything is stored in flat arrays which are cleared rather than
+        // freed between frames, so once we've warmed up a frame's worth of
+        // submits doesn't allocate.
+        std::vector<Batch> batches{1};
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<VkPipelineStageFlags> waitStages;
+        std::vector<uint64_t> waitValues;
+        std::vector<VkCommandBuffer> commandBuffers;
+        std::vector<uint32_t> commandBufferMasks;
+        std::vector<VkSemaphore> signalSemaphores;
+        std::vector<uint64_t> signalValues;
+
+        std::vector<VkSubmitInfo> submitInfos;
+        std::vector<VkTimelineSemaphoreSubmitInfoKHR> timelineInfos;
+        std::vector<VkDeviceGroupSubmitInfoKHR> groupInfos;
+        std::vector<uint32_t> semaphoreDeviceIndices;
+
+        // Zero when not on a device group
+        uint32_t allDevices = 0;
+        uint32_t deviceMask = 0;
+
+        Stats stats;
+
+        Batch& current() {
+            return batches.back();
+        }
+
+        void startBatch() {
+            batches.emplace_back();
+        }
+
+        void addWait(VkSemaphore semaphore, VkPipelineStageFlags stage, uint64_t value) {
+
+            if (current().commandBufferCount > 0 || current().signalCount > 0) {
+                startBatch();
+            }
+
+            waitSemaphores.push_back(semaphore);
+            waitStages.push_back(stage);
+            waitValues.push_back(value);
+            current().waitCount++;
+        }
+
+        void reset() {
+            batches.resize(1);
+            batches[0] = Batch();
+            waitSemaphores.clear();
+            waitStages.clear();
+            waitValues.clear();
+            commandBuffers.clear();
+            commandBufferMasks.clear();
+            signalSemaphores.clear();
+            signalValues.clear();
+            deviceMask = allDevices;
+        }
+};
+
+#endif
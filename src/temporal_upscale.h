@@ -0,0 +1,104 @@
+#ifndef TEMPORAL_UPSCALE_H
+#define TEMPORAL_UPSCALE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/*
+ * Temporal upscaling (--temporal-upscale SCALE): the scene is drawn at
+ * SCALE of the output's size, and every frame the drawing is nudged by a
+ * different fraction of a pixel (the jitter). shaders/temporal_resolve.comp
+ * builds a full size image from this frame's pixels and a history of the
+ * frames before, so over a few frames every output pixel gets a sample of
+ * its own. That's the history buffer, one of two images written in turns.
+ *
+ * Things move, so alongside its colour the scene writes how far each pixel
+ * moved since the last frame (the motion vectors). The resolve follows them
+ * back to where the pixel was in the history. Anything the history has
+ * that isn't near this frame's neighbourhood of colours is out of date
+ * (something new came into view, say), and is clamped to it.
+ *
+ * The command buffers are recorded once and reused, so as with dynamic
+ * resolution there's a set of them for each frame of a sequence of PHASES:
+ * the jitter follows a Halton sequence of that length, and the triangle
+ * goes round a small circle once in the same number of frames so there's
+ * something to reproject. The scene image is full size and smaller scales
+ * only draw into its top left corner, so the benchmark can change the scale
+ * by recording the command buffers again.
+ *
+ * The numbers here are repeated in the shaders, change them together.
+ */
+namespace TemporalUpscale {
+
+    const uint32_t PHASES = 32;
+
+    // The resolve works on TILE by TILE blocks of output pixels
+    const uint32_t TILE = 8;
+
+    // How far the triangle is from where it would be without the motion, in
+    // normalized device coordinates
+    const float MOTION_RADIUS = 0.05f;
+
+    // The scales the benchmark compares with drawing at full size
+    const float BENCH_SCALES[] = {1.0f, 0.75f, 0.5f};
+
+    // How many pixels of the output a scaled side comes to, never less
+    // than one
+    inline uint32_t scaledSize(uint32_t size, float scale) {
+        return std::max(1u, (uint32_t) std::lround(size * scale));
+    }
+
+    // The index'th number of the Halton sequence in base, between 0 and 1
+    inline float halton(uint32_t index, uint32_t base) {
+        float result = 0.0f;
+        float fraction = 1.0f / base;
+        while (index > 0) {
+            result += fraction * (index % base);
+            index /= base;
+            fraction /= base;
+        }
+        return result;
+    }
+
+    /*
+     * The phase's jitter, in pixels of the scene image, within half a pixel
+     * of none. The sequence starts at 1, its 0 is a corner.
+     */
+    inline void jitter(uint32_t phase, float pixels[2]) {
+        pixels[0] = halton(phase % PHASES + 1, 2) - 0.5f;
+        pixels[1] = halton(phase % PHASES + 1, 3) - 0.5f;
+    }
+
+    // And how far the triangle has gone round its circle
+    inline void triangleOffset(uint32_t phase, float offset[2]) {
+        float angle = 2.0f * 3.14159265f * (phase % PHASES) / PHASES;
+        offset[0] = MOTION_RADIUS * std::cos(angle);
+        offset[1] = MOTION_RADIUS * std::sin(angle);
+    }
+
+    /*
+     * What shader.vert takes as push constants, clear of lit.frag's screen
+     * size at the start: the jitter and the triangle's offset this frame
+     * and last, all in normalized device coordinates
+     */
+    const uint32_t VERTEX_CONSTANTS_OFFSET = 16;
+
+    struct VertexConstants {
+        float jitter[2];
+        float offset[2];
+        float previousOffset[2];
+    };
+
+    /*
+     * And what temporal_resolve.comp takes: how much of the scene image
+     * was drawn, the output's size, and the jitter in scene pixels
+     */
+    struct ResolveConstants {
+        float sceneSize[2];
+        float outputSize[2];
+        float jitter[2];
+    };
+}
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "dispatch.h"
+
+/*
+ * Everything we submit to a queue gets a number. The first submit is 1, the
+ * next is 2 and so on. A (timeline, value) pair then tells us everything we
+ * need to know: the CPU can wait for it, another queue can wait for it and
+ * we can hold on to resources until it has been reached.
+ *
+ * Where VK_KHR_timeline_semaphore is available the number lives in a single
+ * timeline semaphore per queue. Where it isn't we fall back to a small ring
+ * of fences, one per value still in flight, which is also what we compare
+ * against when measuring submission overhead.
+ */
+class QueueTimeline;
+
+struct TimelinePoint {
+    QueueTimeline* timeline = nullptr;
+    uint64_t value = 0;
+};
+
+/*
+ * Counters for the time the CPU spends talking to the driver around a
+ * submit, so the two backends can be compared.
+ */
+struct SyncStats {
+    uint64_t submits = 0;
+    uint64_t waits = 0;
+    std::chrono::nanoseconds submitTime{0};
+    std::chrono::nanoseconds waitTime{0};
+    std::chrono::nanoseconds resetTime{0};
+};
+
+class QueueTimeline {
+    public:
+
+        // How many values we allow to be in flight with the fence backend
+        static const uint32_t FENCE_RING_SIZE = 8;
+
+        QueueTimeline() = default;
+        QueueTimeline(const QueueTimeline&) = delete;
+        QueueTimeline& operator=(const QueueTimeline&) = delete;
+
+        ~QueueTimeline() {
+            destroy();
+        }
+
+        /*
+         * Create the timeline for a queue, useTimelineSemaphore should only be
+         * set if the extension and the timelineSemaphore feature were enabled
+         * on the device. Everything goes through the device's dispatch
+         * table, which has to outlive the timeline.
+         */
+        void init(const DeviceDispatch& dispatch, VkDevice device, VkQueue queue, bool useTimelineSemaphore,
+                  const VkAllocationCallbacks* allocator = nullptr) {
+
+            this->dispatch = &dispatch;
+            this->device = device;
+            this->queue = queue;
+            this->useSemaphore = useTimelineSemaphore;
+            this->allocator = allocator;
+
+            if (useSemaphore) {
+
+                // The extension functions aren't exported by the loader, the
+                // dispatch table only has them if the extension is enabled
+                if (dispatch.vkWaitSemaphoresKHR == nullptr || dispatch.vkGetSemaphoreCounterValueKHR == nullptr) {
+                    throw std::runtime_error("Unable to load the timeline semaphore functions!!");
+                }
+
+                VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+                typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+                typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+                typeInfo.initialValue = 0;
+
+                VkSemaphoreCreateInfo semaphoreInfo = {};
+                semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                semaphoreInfo.pNext = &typeInfo;
+
+                if (dispatch.vkCreateSemaphore(device, &semaphoreInfo, allocator, &timelineSemaphore)
+                        != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to create the timeline semaphore!!");
+                }
+
+            } else {
+
+                // Fences start off signalled, that way we don't need to
+                // special case the first trip around the ring
+                VkFenceCreateInfo fenceInfo = {};
+                fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+                fences.resize(FENCE_RING_SIZE, VK_NULL_HANDLE);
+                for (auto& fence : fences) {
+                    if (dispatch.vkCreateFence(device, &fenceInfo, allocator, &fence) != VK_SUCCESS) {
+                        throw std::runtime_error("Unable to create the timeline fences!!");
+                    }
+                }
+            }
+        }
+
+        void destroy() {
+
+            if (timelineSemaphore != VK_NULL_HANDLE) {
+                dispatch->vkDestroySemaphore(device, timelineSemaphore, allocator);
+                timelineSemaphore = VK_NULL_HANDLE;
+            }
+
+            for (auto fence : fences) {
+                dispatch->vkDestroyFence(device, fence, allocator);
+            }
+            fences.clear();
+        }
+
+        bool usesTimelineSemaphore() const {
+            return useSemaphore;
+        }
+
+        VkQueue getQueue() const {
+            return queue;
+        }
+
+        const DeviceDispatch& getDispatch() const {
+            return *dispatch;
+        }
+
+        /*
+         * The semaphore to signal (with value) from a submit, this will be
+         * VK_NULL_HANDLE when we are running on fences.
+         */
+        VkSemaphore semaphore() const {
+            return timelineSemaphore;
+        }
+
+        /*
+         * The value the next submit to this queue will signal, either
+         * through semaphore() or the fence returned by fenceFor(). It only
+         * counts as submitted once recordSubmit() is told about it, so if
+         * the submit fails nobody waits on a fence that will never be
+         * signalled and the next submit gets the same value again.
+         */
+        uint64_t nextValue() {
+
+            uint64_t value = lastSubmitted + 1;
+
+            if (!useSemaphore) {
+
+                // The fence we are about to reuse belonged to the value one
+                // trip around the ring ago, make sure it has finished first.
+                if (value > FENCE_RING_SIZE) {
+                    wait(value - FENCE_RING_SIZE);
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                dispatch->vkResetFences(device, 1, &fences[value % FENCE_RING_SIZE]);
+                stats.resetTime += std::chrono::steady_clock::now() - start;
+            }
+
+            return value;
+        }
+
+        VkFence fenceFor(uint64_t value) const {
+            return useSemaphore ? VK_NULL_HANDLE : fences[value % FENCE_RING_SIZE];
+        }
+
+        TimelinePoint point(uint64_t value) {
+            return {this, value};
+        }
+
+        TimelinePoint lastPoint() {
+            return {this, lastSubmitted};
+        }
+
+        /*
+         * Has the GPU got as far as value yet? Doesn't block. Like wait(),
+         * this throws if the device is lost rather than going on with what
+         * it knew before.
+         */
+        bool reached(uint64_t value) const {
+
+            if (value <= lastCompleted) {
+                return true;
+            }
+
+            if (useSemaphore) {
+
+                uint64_t counter = 0;
+                if (dispatch->vkGetSemaphoreCounterValueKHR(device, timelineSemaphore, &counter) != VK_SUCCESS) {
+                    throw std::runtime_error("Unable to read the timeline semaphore's value!!");
+                }
+                lastCompleted = counter;
+            } else {
+
+                // Fences complete in submission order so we can walk forward
+                // from the last one we know about
+                while (lastCompleted < lastSubmitted) {
+                    VkResult status = dispatch->vkGetFenceStatus(device, fenceFor(lastCompleted + 1));
+                    if (status == VK_NOT_READY) {
+                        break;
+                    }
+                    if (status != VK_SUCCESS) {
+                        throw std::runtime_error("Unable to read a timeline fence's status!!");
+                    }
+                    lastCompleted++;
+                }
+            }
+
+            return value <= lastCompleted;
+        }
+
+        /*
+         * Block the CPU until the GPU has got as far as value.
+         */
+        void wait(uint64_t value) {
+
+            if (value == 0 || value <= lastCompleted) {
+                return;
+            }
+
+            if (value > lastSubmitted) {
+                throw std::runtime_error("Waiting on a timeline value that was never submitted!!");
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            const uint64_t timeout = std::numeric_limits<uint64_t>::max();
+
+            VkResult result;
+            if (useSemaphore) {
+                VkSemaphoreWaitInfoKHR waitInfo = {};
+                waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+                waitInfo.semaphoreCount = 1;
+                waitInfo.pSemaphores = &timelineSemaphore;
+                waitInfo.pValues = &value;
+
+                result = dispatch->vkWaitSemaphoresKHR(device, &waitInfo, timeout);
+            } else {
+                VkFence fence = fenceFor(value);
+                result = dispatch->vkWaitForFences(device, 1, &fence, VK_TRUE, timeout);
+            }
+
+            // A timeout or a lost device means the GPU may still be using
+            // whatever the caller is about to reuse
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Unable to wait for the GPU to reach a timeline value!!");
+            }
+
+            lastCompleted = value;
+
+            stats.waits++;
+            stats.waitTime += std::chrono::steady_clock::now() - start;
+        }
+
+        /*
+         * Used by whoever submits, once the submit signalling value has
+         * succeeded, to record it and how long it took
+         */
+        void recordSubmit(uint64_t value, std::chrono::nanoseconds time) {
+            lastSubmitted = value;
+            stats.submits++;
+            stats.submitTime += time;
+        }
+
+        const SyncStats& getStats() const {
+            return stats;
+        }
+
+    private:
+        const DeviceDispatch* dispatch = nullptr;
+        VkDevice device = VK_NULL_HANDLE;
+        VkQueue queue = VK_NULL_HANDLE;
+        bool useSemaphore = false;
+        const VkAllocationCallbacks* allocator = nullptr;
+
+        // Timeline backend
+        VkSemaphore timelineSemaphore = VK_NULL_HANDLE;
+
+        // Fence backend
+        std::vector<VkFence> fences;
+
+        uint64_t lastSubmitted = 0;
+        mutable uint64_t lastCompleted = 0;
+
+        SyncStats stats;
+};
+
+/*
+ * Holds on to things the GPU may still be using until the timeline has moved
+ * past the point where it last used them, then runs the callback to release
+ * them.
+ */
+class RetireQueue {
+    public:
+        void retire(TimelinePoint point, std::function<void()> release) {
+            pending.push_back({point, std::move(release)});
+        }
+
+        /*
+         * Release everything whose point has been reached, call this once a
+         * frame.
+         */
+        void collect() {
+
+            size_t kept = 0;
+            for (size_t i = 0; i < pending.size(); i++) {
+                if (pending[i].point.timeline->reached(pending[i].point.value)) {
+                    pending[i].release();
+                } else if (kept++ != i) {
+                    pending[kept - 1] = std::move(pending[i]);
+                }
+            }
+
+            pending.resize(kept);
+        }
+
+        /*
+         * Release everything regardless, only safe once the device is idle.
+         */
+        void flush() {
+            for (auto& entry : pending) {
+                entry.release();
+            }
+            pending.clear();
+        }
+
+    private:
+        struct Entry {
+            TimelinePoint point;
+            std::function<void()> release;
+        };
+
+        std::vector<Entry> pending;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef VIDEO_ENCODER_H
+#define VIDEO_ENCODER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc_tracker.h"
+
+/*
+ * Turns the frames of a capture into a video on a background thread, so
+ * the render loop only has to copy each one out of its readback buffer.
+ *
+ * Frames come in as planar YUV 4:2:0 (I420: the Y plane, then the quarter
+ * size U and V planes), which the GPU has already converted them to. They
+ * go out as a YUV4MPEG2 stream, which is just a header and the raw planes
+ * of each frame, so there's nothing left for the CPU to do but write them.
+ *
+ *   - A .y4m file gets the stream as it is, any player can open it
+ *   - Anything else is handed to ffmpeg through a pipe, which compresses
+ *     it into whatever the file extension says
+ *
+ * A video's frames have to go out in order, so unlike the ImageWriter
+ * there is only ever one thread writing.
+ */
+class VideoEncoder {
+    public:
+
+        // How many bytes a width x height I420 frame takes up
+        static size_t frameSize(uint32_t width, uint32_t height) {
+            return (size_t) width * height + 2 * ((size_t) width / 2) * (height / 2);
+        }
+
+        VideoEncoder(const std::string& path, uint32_t width, uint32_t height, uint32_t frameRate)
+            : width(width), height(height) {
+
+            if (width % 2 != 0 || height % 2 != 0) {
+                throw std::runtime_error("Video frames need an even width and height!!");
+            }
+
+            std::string extension = path.substr(path.find_last_of('.') + 1);
+            piped = extension != "y4m";
+
+            if (piped) {
+                // Quote the name for the shell, ' becomes '\''
+                std::string quoted = "'";
+                for (char c : path) {
+                    quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+                }
+                quoted += "'";
+
+                std::string command = "ffmpeg -loglevel error -y -f yuv4mpegpipe -i - " + quoted;
+                file = popen(command.c_str(), "w");
+            } else {
+                file = fopen(path.c_str(), "wb");
+            }
+
+            if (file == nullptr) {
+                throw std::runtime_error("Unable to open " + path + " for writing!!");
+            }
+
+            // C420jpeg is plain 4:2:0 with the chroma sited between the
+            // luma samples, which is what averaging 2x2 squares gives us
+            char header[128];
+            int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n",
+                                  width, height, frameRate);
+            if (fwrite(header, 1, length, file) != (size_t) length) {
+                close();
+                throw std::runtime_error("Unable to write the header of " + path + "!!");
+            }
+            bytesWritten += length;
+
+            worker = std::thread(&VideoEncoder::work, this);
+        }
+
+        VideoEncoder(const VideoEncoder&) = delete;
+        VideoEncoder& operator=(const VideoEncoder&) = delete;
+
+        ~VideoEncoder() {
+            stop();
+            close();
+        }
+
+        /*
+         * Get a buffer to copy a frame into, recycled once the frame it last
+         * held has been written.
+         */
+        std::vector<uint8_t> acquireBuffer() {
+
+            std::vector<uint8_t> buffer;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!freeBuffers.empty()) {
+                    buffer = std::move(freeBuffers.back());
+                    freeBuffers.pop_back();
+                }
+            }
+
+            buffer.resize(frameSize(width, height));
+            return buffer;
+        }
+
+        /*
+         * Queue the next frame, this blocks if the encoder has fallen too far
+         * behind.
+         */
+        void write(std::vector<uint8_t> frame) {
+
+            std::unique_lock<std::mutex> lock(mutex);
+            spaceAvailable.wait(lock, [this] { return frames.size() < MAX_QUEUED || error; });
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+
+            frames.push_back(std::move(frame));
+            workAvailable.notify_one();
+        }
+
+        /*
+         * Wait for every queued frame to be written, then close the file (or
+         * wait for ffmpeg to finish).
+         */
+        void finish() {
+
+            stop();
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+
+            if (close() != 0) {
+                throw std::runtime_error(piped ? "ffmpeg failed to encode the capture!!"
+                                               : "Unable to finish writing the capture!!");
+            }
+        }
+
+        uint64_t getBytesWritten() const {
+            return bytesWritten;
+        }
+
+    private:
+
+        // Each queued frame is a full copy of one, a few is plenty to smooth
+        // over the odd slow write
+        static const size_t MAX_QUEUED = 4;
+
+        uint32_t width;
+        uint32_t height;
+        bool piped = false;
+        FILE* file = nullptr;
+
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable spaceAvailable;
+
+        std::deque<std::vector<uint8_t>> frames;
+        std::vector<std::vector<uint8_t>> freeBuffers;
+        std::thread worker;
+        bool stopping = false;
+        std::exception_ptr error;
+        uint64_t bytesWritten = 0;
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+
+            workAvailable.notify_all();
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+
+        int close() {
+
+            if (file == nullptr) {
+                return 0;
+            }
+
+            int status = piped ? pclose(file) : fclose(file);
+            file = nullptr;
+            return status;
+        }
+
+        void work() {
+
+            AllocationTracker::setThreadSubsystem(AllocationTracker::Subsystem::Writer);
+
+            while (true) {
+
+                std::vector<uint8_t> frame;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    workAvailable.wait(lock, [this] { return !frames.empty() || stopping; });
+
+                    // Once stopping, drain whatever is left before going
+                    if (frames.empty()) {
+                        return;
+                    }
+
+                    frame = std::move(frames.front());
+                    frames.pop_front();
+                }
+                spaceAvailable.notify_one();
+
+                static const char FRAME_HEADER[] = "FRAME\n";
+                bool ok = fwrite(FRAME_HEADER, 1, sizeof(FRAME_HEADER) - 1, file) == sizeof(FRAME_HEADER) - 1 &&
+                          fwrite(frame.data(), 1, frame.size(), file) == frame.size();
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!ok && !error) {
+                        error = std::make_exception_ptr(std::runtime_error("Unable to write a video frame!!"));
+                    }
+                    bytesWritten += sizeof(FRAME_HEADER) - 1 + frame.size();
+                    freeBuffers.push_back(std::move(frame));
+                }
+                spaceAvailable.notify_all();
+
+                if (!ok) {
+                    return;
+                }
+            }
+        }
+};
+
+#endif